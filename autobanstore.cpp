@@ -0,0 +1,529 @@
+/*
+** autobanstore.cpp
+**
+** Copyright © Quazaa Development Team, 2014.
+** This file is part of the Quazaa Security Library (quazaa.sourceforge.net)
+**
+** The Quazaa Security Library is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** The Quazaa Security Library is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with the Quazaa Security Library; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include <algorithm>
+
+#include "autobanstore.h"
+#include "securerule.h"
+
+#include "debug_new.h"
+
+using namespace Security;
+
+namespace Security
+{
+static bool banLastHitGreater( const AutoBan& oA, const AutoBan& oB )
+{
+	return oA.tLastHit > oB.tLastHit;
+}
+}
+
+AutoBanStore::AutoBanStore() :
+	m_pSlots( NULL ),
+	m_nInsertions( 0 ),
+	m_nRefreshs( 0 ),
+	m_nEvictions( 0 ),
+	m_nExpirations( 0 ),
+	m_nHits( 0 )
+{
+	allocate( SECURITY_AUTOBAN_MEMORY );
+}
+
+AutoBanStore::~AutoBanStore()
+{
+	delete[] m_pSlots;
+}
+
+quint32 AutoBanStore::setMemory( quint32 nBytes )
+{
+	QWriteLocker oLock( &m_oRWLock );
+
+	AutoBanVector vBans;
+	vBans.reserve( m_nSize.load() );
+
+	for ( quint32 i = 0; i <= m_nMask; ++i )
+	{
+		const Slot& oSlot = m_pSlots[i];
+
+		if ( oSlot.nProtocol )
+		{
+			AutoBan oBan;
+			oBan.oAddress = address( oSlot );
+			oBan.tExpire  = common::intToUint( oSlot.tExpire.load() );
+			oBan.tLastHit = common::intToUint( oSlot.tLastHit.load() );
+			oBan.nTotal   = common::intToUint( oSlot.nTotal.load() );
+			vBans.push_back( oBan );
+		}
+	}
+
+	// keep the most recently hit bans if not all of them fit into the new table
+	std::stable_sort( vBans.begin(), vBans.end(), banLastHitGreater );
+
+	allocate( nBytes );
+
+	quint32 nEvicted = 0;
+	for ( size_t i = 0; i < vBans.size(); ++i )
+	{
+		if ( ( quint32 )m_nSize.load() < m_nMaxSize )
+		{
+			quint64 pAddress[2];
+			const quint8 nProtocol = key( vBans[i].oAddress, pAddress );
+			place( pAddress, nProtocol, vBans[i].tExpire, vBans[i].tLastHit, vBans[i].nTotal );
+		}
+		else
+		{
+			++nEvicted;
+		}
+	}
+
+	m_nEvictions += nEvicted;
+
+	return nEvicted;
+}
+
+quint32 AutoBanStore::memory() const
+{
+	QReadLocker oLock( &m_oRWLock );
+	return m_nMemory;
+}
+
+quint32 AutoBanStore::size() const
+{
+	return ( quint32 )m_nSize.load();
+}
+
+bool AutoBanStore::insert( const AutoBan& oBan, quint32 tNow, QHostAddress& oEvicted )
+{
+	quint64 pAddress[2];
+	const quint8 nProtocol = key( oBan.oAddress, pAddress );
+
+	if ( !nProtocol )
+	{
+		return false;
+	}
+
+	QWriteLocker oLock( &m_oRWLock );
+
+	const quint32 nPos = find( pAddress, nProtocol );
+
+	if ( nPos <= m_nMask )
+	{
+		Slot& oSlot = m_pSlots[nPos];
+		const quint32 tExpire = common::intToUint( oSlot.tExpire.load() );
+
+		// don't overwrite indefinite expiry times
+		if ( tExpire != RuleTime::Forever &&
+			 ( oBan.tExpire == RuleTime::Forever || oBan.tExpire > tExpire ) )
+		{
+			oSlot.tExpire.store( common::uintToInt( oBan.tExpire ) );
+		}
+
+		if ( oBan.tLastHit > common::intToUint( oSlot.tLastHit.load() ) )
+		{
+			oSlot.tLastHit.store( common::uintToInt( oBan.tLastHit ) );
+		}
+
+		oSlot.nTotal.fetchAndAddRelaxed( common::uintToInt( oBan.nTotal ) );
+		oSlot.bReferenced.store( 1 );
+
+		++m_nRefreshs;
+		return false;
+	}
+
+	if ( ( quint32 )m_nSize.load() >= m_nMaxSize )
+	{
+		evict( tNow, oEvicted );
+	}
+
+	place( pAddress, nProtocol, oBan.tExpire, oBan.tLastHit, oBan.nTotal );
+	++m_nInsertions;
+
+	return true;
+}
+
+bool AutoBanStore::isBanned( const QHostAddress& oAddress, quint32 tNow )
+{
+	if ( !m_nSize.load() )
+	{
+		return false;
+	}
+
+	quint64 pAddress[2];
+	const quint8 nProtocol = key( oAddress, pAddress );
+
+	QReadLocker oLock( &m_oRWLock );
+
+	const quint32 nPos = find( pAddress, nProtocol );
+
+	if ( nPos > m_nMask )
+	{
+		return false;
+	}
+
+	Slot& oSlot = m_pSlots[nPos];
+	const quint32 tExpire = common::intToUint( oSlot.tExpire.load() );
+
+	if ( isExpired( tExpire, tNow ) )
+	{
+		return false;
+	}
+
+	if ( tExpire != RuleTime::Forever && tExpire != RuleTime::Session )
+	{
+		// Add 30 seconds to the ban time for every hit.
+		oSlot.tExpire.fetchAndAddRelaxed( 30 );
+	}
+
+	oSlot.tLastHit.store( common::uintToInt( tNow ) );
+	oSlot.nTotal.ref();
+	oSlot.bReferenced.store( 1 );
+
+	m_nHits.ref();
+
+	return true;
+}
+
+bool AutoBanStore::contains( const QHostAddress& oAddress, quint32 tNow ) const
+{
+	quint64 pAddress[2];
+	const quint8 nProtocol = key( oAddress, pAddress );
+
+	QReadLocker oLock( &m_oRWLock );
+
+	const quint32 nPos = find( pAddress, nProtocol );
+
+	return nPos <= m_nMask &&
+		   !isExpired( common::intToUint( m_pSlots[nPos].tExpire.load() ), tNow );
+}
+
+bool AutoBanStore::remove( const QHostAddress& oAddress )
+{
+	quint64 pAddress[2];
+	const quint8 nProtocol = key( oAddress, pAddress );
+
+	QWriteLocker oLock( &m_oRWLock );
+
+	const quint32 nPos = find( pAddress, nProtocol );
+
+	if ( nPos > m_nMask )
+	{
+		return false;
+	}
+
+	erase( nPos );
+
+	return true;
+}
+
+quint32 AutoBanStore::expire( quint32 tNow )
+{
+	QWriteLocker oLock( &m_oRWLock );
+
+	quint32 nCount = 0;
+
+	for ( quint32 i = 0; i <= m_nMask; )
+	{
+		const Slot& oSlot = m_pSlots[i];
+
+		if ( oSlot.nProtocol && isExpired( common::intToUint( oSlot.tExpire.load() ), tNow ) )
+		{
+			// The slot is refilled by the following entries of the cluster, so check it again.
+			erase( i );
+			++nCount;
+		}
+		else
+		{
+			++i;
+		}
+	}
+
+	m_nExpirations += nCount;
+
+	return nCount;
+}
+
+void AutoBanStore::clear()
+{
+	QWriteLocker oLock( &m_oRWLock );
+
+	for ( quint32 i = 0; i <= m_nMask; ++i )
+	{
+		m_pSlots[i].nProtocol = 0;
+	}
+
+	m_nSize.store( 0 );
+	m_nHand = 0;
+}
+
+void AutoBanStore::bans( AutoBanVector& vBans ) const
+{
+	QReadLocker oLock( &m_oRWLock );
+
+	vBans.reserve( vBans.size() + m_nSize.load() );
+
+	for ( quint32 i = 0; i <= m_nMask; ++i )
+	{
+		const Slot& oSlot = m_pSlots[i];
+
+		if ( oSlot.nProtocol )
+		{
+			AutoBan oBan;
+			oBan.oAddress = address( oSlot );
+			oBan.tExpire  = common::intToUint( oSlot.tExpire.load() );
+			oBan.tLastHit = common::intToUint( oSlot.tLastHit.load() );
+			oBan.nTotal   = common::intToUint( oSlot.nTotal.load() );
+			vBans.push_back( oBan );
+		}
+	}
+}
+
+AutoBanStatistics AutoBanStore::statistics() const
+{
+	QReadLocker oLock( &m_oRWLock );
+
+	AutoBanStatistics oStatistics;
+	oStatistics.nSize        = ( quint32 )m_nSize.load();
+	oStatistics.nCapacity    = m_nMaxSize;
+	oStatistics.nMemory      = ( m_nMask + 1 ) * ( quint32 )sizeof( Slot );
+	oStatistics.nInsertions  = m_nInsertions;
+	oStatistics.nRefreshs    = m_nRefreshs;
+	oStatistics.nEvictions   = m_nEvictions;
+	oStatistics.nExpirations = m_nExpirations;
+	oStatistics.nHits        = ( quint32 )m_nHits.load();
+
+	return oStatistics;
+}
+
+void AutoBanStore::allocate( quint32 nBytes )
+{
+	quint32 nSlots = 16;
+	while ( ( quint64 )nSlots * 2 * sizeof( Slot ) <= nBytes )
+	{
+		nSlots *= 2;
+	}
+
+	delete[] m_pSlots;
+	m_pSlots = new Slot[nSlots];
+
+	for ( quint32 i = 0; i < nSlots; ++i )
+	{
+		m_pSlots[i].nProtocol = 0;
+	}
+
+	m_nMask    = nSlots - 1;
+	m_nMaxSize = ( quint32 )( ( quint64 )nSlots * SECURITY_AUTOBAN_MAX_LOAD / 100 );
+	m_nHand    = 0;
+	m_nMemory  = nBytes;
+	m_nSize.store( 0 );
+
+	// at least one slot must stay free to terminate the probe sequences
+	Q_ASSERT( m_nMaxSize < nSlots );
+}
+
+quint32 AutoBanStore::find( const quint64* const pAddress, quint8 nProtocol ) const
+{
+	quint32 nPos = hash( pAddress, nProtocol ) & m_nMask;
+
+	forever
+	{
+		const Slot& oSlot = m_pSlots[nPos];
+
+		if ( !oSlot.nProtocol )
+		{
+			return m_nMask + 1;
+		}
+
+		if ( oSlot.nProtocol == nProtocol &&
+			 oSlot.pAddress[0] == pAddress[0] && oSlot.pAddress[1] == pAddress[1] )
+		{
+			return nPos;
+		}
+
+		nPos = ( nPos + 1 ) & m_nMask;
+	}
+}
+
+void AutoBanStore::place( const quint64* const pAddress, quint8 nProtocol, quint32 tExpire,
+						  quint32 tLastHit, quint32 nTotal )
+{
+	quint32 nPos = hash( pAddress, nProtocol ) & m_nMask;
+
+	while ( m_pSlots[nPos].nProtocol )
+	{
+		nPos = ( nPos + 1 ) & m_nMask;
+	}
+
+	Slot& oSlot = m_pSlots[nPos];
+	oSlot.pAddress[0] = pAddress[0];
+	oSlot.pAddress[1] = pAddress[1];
+	oSlot.nProtocol   = nProtocol;
+	oSlot.tExpire.store( common::uintToInt( tExpire ) );
+	oSlot.tLastHit.store( common::uintToInt( tLastHit ) );
+	oSlot.nTotal.store( common::uintToInt( nTotal ) );
+
+	// new bans survive the next pass of the hand
+	oSlot.bReferenced.store( 1 );
+
+	m_nSize.ref();
+}
+
+void AutoBanStore::erase( quint32 nPos )
+{
+	quint32 nHole = nPos;
+	quint32 nNext = ( nPos + 1 ) & m_nMask;
+
+	while ( m_pSlots[nNext].nProtocol )
+	{
+		const Slot& oNext = m_pSlots[nNext];
+		const quint32 nHome = hash( oNext.pAddress, oNext.nProtocol ) & m_nMask;
+
+		// The entry may only be moved if the hole is not located before its home slot.
+		if ( ( ( nNext - nHome ) & m_nMask ) >= ( ( nNext - nHole ) & m_nMask ) )
+		{
+			Slot& oHole = m_pSlots[nHole];
+			oHole.pAddress[0] = oNext.pAddress[0];
+			oHole.pAddress[1] = oNext.pAddress[1];
+			oHole.nProtocol   = oNext.nProtocol;
+			oHole.tExpire.store( oNext.tExpire.load() );
+			oHole.tLastHit.store( oNext.tLastHit.load() );
+			oHole.nTotal.store( oNext.nTotal.load() );
+			oHole.bReferenced.store( oNext.bReferenced.load() );
+
+			nHole = nNext;
+		}
+
+		nNext = ( nNext + 1 ) & m_nMask;
+	}
+
+	m_pSlots[nHole].nProtocol = 0;
+	m_nSize.deref();
+}
+
+void AutoBanStore::evict( quint32 tNow, QHostAddress& oEvicted )
+{
+	// All reference bits are cleared after one pass, so this ends within the second one.
+	forever
+	{
+		Slot& oSlot = m_pSlots[m_nHand];
+
+		if ( oSlot.nProtocol )
+		{
+			if ( isExpired( common::intToUint( oSlot.tExpire.load() ), tNow ) )
+			{
+				erase( m_nHand );
+				++m_nExpirations;
+				return;
+			}
+
+			if ( !oSlot.bReferenced.load() )
+			{
+				oEvicted = address( oSlot );
+				erase( m_nHand );
+				++m_nEvictions;
+				return;
+			}
+
+			oSlot.bReferenced.store( 0 );
+		}
+
+		m_nHand = ( m_nHand + 1 ) & m_nMask;
+	}
+}
+
+quint8 AutoBanStore::key( const QHostAddress& oAddress, quint64* pAddress )
+{
+	switch ( oAddress.protocol() )
+	{
+	case QAbstractSocket::IPv4Protocol:
+		pAddress[0] = 0;
+		pAddress[1] = oAddress.toIPv4Address();
+		return 4;
+
+	case QAbstractSocket::IPv6Protocol:
+	{
+		const Q_IPV6ADDR oIP6 = oAddress.toIPv6Address();
+
+		pAddress[0] = 0;
+		pAddress[1] = 0;
+
+		for ( int i = 0; i < 8; ++i )
+		{
+			pAddress[0] = ( pAddress[0] << 8 ) | oIP6[i];
+			pAddress[1] = ( pAddress[1] << 8 ) | oIP6[i + 8];
+		}
+		return 6;
+	}
+
+	default:
+		pAddress[0] = 0;
+		pAddress[1] = 0;
+		return 0;
+	}
+}
+
+QHostAddress AutoBanStore::address( const Slot& oSlot )
+{
+	if ( oSlot.nProtocol == 4 )
+	{
+		return QHostAddress( ( quint32 )oSlot.pAddress[1] );
+	}
+
+	Q_IPV6ADDR oIP6;
+
+	for ( int i = 0; i < 8; ++i )
+	{
+		oIP6[i]     = ( quint8 )( oSlot.pAddress[0] >> ( 56 - 8 * i ) );
+		oIP6[i + 8] = ( quint8 )( oSlot.pAddress[1] >> ( 56 - 8 * i ) );
+	}
+
+	return QHostAddress( oIP6 );
+}
+
+quint32 AutoBanStore::hash( const quint64* const pAddress, quint8 nProtocol )
+{
+	// 64 bit finalizer of MurmurHash3
+	quint64 nHash = pAddress[0] * Q_UINT64_C( 0x9E3779B97F4A7C15 ) ^ pAddress[1] ^ nProtocol;
+
+	nHash ^= nHash >> 33;
+	nHash *= Q_UINT64_C( 0xFF51AFD7ED558CCD );
+	nHash ^= nHash >> 33;
+	nHash *= Q_UINT64_C( 0xC4CEB9FE1A85EC53 );
+	nHash ^= nHash >> 33;
+
+	return ( quint32 )nHash;
+}
+
+bool AutoBanStore::isExpired( quint32 tExpire, quint32 tNow )
+{
+	switch ( tExpire )
+	{
+	case RuleTime::Forever:
+	case RuleTime::Session:
+		return false;
+
+	default:
+		return tExpire < tNow;
+	}
+}
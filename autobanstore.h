@@ -0,0 +1,282 @@
+/*
+** autobanstore.h
+**
+** Copyright © Quazaa Development Team, 2014.
+** This file is part of the Quazaa Security Library (quazaa.sourceforge.net)
+**
+** The Quazaa Security Library is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** The Quazaa Security Library is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with the Quazaa Security Library; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#ifndef AUTOBANSTORE_H
+#define AUTOBANSTORE_H
+
+#include <vector>
+
+#include <QAtomicInt>
+#include <QHostAddress>
+#include <QReadWriteLock>
+
+#include "externals.h"
+
+// default memory available to the automatic bans in bytes
+#define SECURITY_AUTOBAN_MEMORY ( 1024 * 1024 )
+
+// maximum share of occupied slots in percent; the oldest bans are evicted beyond that
+#define SECURITY_AUTOBAN_MAX_LOAD 75
+
+namespace Security
+{
+
+/**
+ * @brief The AutoBan struct describes a single automatic IP ban.
+ */
+struct AutoBan
+{
+	QHostAddress    oAddress;
+	quint32         tExpire;    // absolute time, RuleTime::Forever or RuleTime::Session
+	quint32         tLastHit;
+	quint32         nTotal;
+};
+
+/**
+ * @brief AutoBanVector represents a set of automatic IP bans.
+ */
+typedef std::vector< AutoBan > AutoBanVector;
+
+/**
+ * @brief The AutoBanStatistics struct holds the size and the eviction metrics of an AutoBanStore.
+ */
+struct AutoBanStatistics
+{
+	quint32         nSize;          // bans currently stored
+	quint32         nCapacity;      // bans that can be stored before evicting
+	quint32         nMemory;        // bytes allocated for the table
+	quint32         nInsertions;    // new bans since start
+	quint32         nRefreshs;      // bans of addresses that had already been banned
+	quint32         nEvictions;     // bans removed before their expiry to make room for new ones
+	quint32         nExpirations;   // bans removed after their expiry
+	quint32         nHits;          // checks that found an active ban
+};
+
+/**
+ * @brief The AutoBanStore class holds the automatic IP bans of a Manager within a fixed amount of
+ * memory, so floods of automatic bans (e.g. from a Sybil attack) cannot grow the rule set without
+ * bounds. The bans are stored in an open addressing table with linear probing. Once the table is
+ * full, the slot of the next expired ban or of the next ban that has not been hit since the last
+ * pass of a CLOCK hand is reused, which approximates evicting the least recently hit ban.
+ *
+ * Checks take a shared lock and update the hit data of a ban with atomic operations, so they do
+ * not block each other.
+ */
+class AutoBanStore
+{
+#ifndef QUAZAA_SETUP_UNIT_TESTS
+private:
+#else
+public:
+#endif
+	struct Slot
+	{
+		quint64     pAddress[2];    // IPv6 address or IPv4 address in the lower 32 bits
+		QAtomicInt  tExpire;
+		QAtomicInt  tLastHit;
+		QAtomicInt  nTotal;
+		QAtomicInt  bReferenced;    // set on every hit, cleared by the CLOCK hand
+		quint8      nProtocol;      // 4, 6 or 0 if the slot is free
+	};
+
+	mutable QReadWriteLock m_oRWLock;
+
+	Slot*           m_pSlots;
+	quint32         m_nMask;        // number of slots - 1
+	quint32         m_nMaxSize;
+	quint32         m_nHand;
+	quint32         m_nMemory;
+
+	// allows to skip the lock for checks while there are no bans
+	QAtomicInt      m_nSize;
+
+	// statistics, protected by m_oRWLock
+	quint32         m_nInsertions;
+	quint32         m_nRefreshs;
+	quint32         m_nEvictions;
+	quint32         m_nExpirations;
+	QAtomicInt      m_nHits;
+
+public:
+	/**
+	 * @brief AutoBanStore constructs an empty store using SECURITY_AUTOBAN_MEMORY bytes.
+	 */
+	AutoBanStore();
+	~AutoBanStore();
+
+	/**
+	 * @brief setMemory resizes the table to use at most nBytes. If the new table is too small for
+	 * the current bans, the least recently hit ones are evicted.
+	 * <br><b>Locking: /</b> (write locks m_oRWLock internally)
+	 *
+	 * @param nBytes  The memory available to the table.
+	 * @return the number of evicted bans
+	 */
+	quint32         setMemory( quint32 nBytes );
+
+	/**
+	 * @brief memory allows to access the memory limit of the table.
+	 * <br><b>Locking: /</b> (read locks m_oRWLock internally)
+	 *
+	 * @return the limit in bytes
+	 */
+	quint32         memory() const;
+
+	/**
+	 * @brief size allows to access the number of stored bans, expired ones included.
+	 * <br><b>Locking: /</b>
+	 */
+	quint32         size() const;
+
+	/**
+	 * @brief insert bans an address. If the address is already banned, the bans are merged the
+	 * way Rule::mergeInto() merges rules.
+	 * <br><b>Locking: /</b> (write locks m_oRWLock internally)
+	 *
+	 * @param oBan      The ban.
+	 * @param tNow      The current time.
+	 * @param oEvicted  Set to the address of the ban that has been evicted to make room, if any.
+	 * @return <code>true</code> if the address has not been banned before;
+	 * <br><code>false</code> otherwise
+	 */
+	bool            insert( const AutoBan& oBan, quint32 tNow, QHostAddress& oEvicted );
+
+	/**
+	 * @brief isBanned checks whether there is an active ban for an address and counts the hit.
+	 * Like automatic IP rules, bans with an expiry time are extended by 30 seconds on every hit.
+	 * <br><b>Locking: /</b> (read locks m_oRWLock internally)
+	 *
+	 * @param oAddress  The address.
+	 * @param tNow      The current time.
+	 * @return <code>true</code> if the address is banned; <br><code>false</code> otherwise
+	 */
+	bool            isBanned( const QHostAddress& oAddress, quint32 tNow );
+
+	/**
+	 * @brief contains checks whether there is an active ban for an address without counting a hit.
+	 * <br><b>Locking: /</b> (read locks m_oRWLock internally)
+	 */
+	bool            contains( const QHostAddress& oAddress, quint32 tNow ) const;
+
+	/**
+	 * @brief remove lifts the ban of a single address.
+	 * <br><b>Locking: /</b> (write locks m_oRWLock internally)
+	 *
+	 * @param oAddress  The address.
+	 * @return <code>true</code> if the address had been banned; <br><code>false</code> otherwise
+	 */
+	bool            remove( const QHostAddress& oAddress );
+
+	/**
+	 * @brief expire removes all expired bans.
+	 * <br><b>Locking: /</b> (write locks m_oRWLock internally)
+	 *
+	 * @param tNow  The current time.
+	 * @return the number of removed bans
+	 */
+	quint32         expire( quint32 tNow );
+
+	/**
+	 * @brief clear removes all bans. The statistics are not reset.
+	 * <br><b>Locking: /</b> (write locks m_oRWLock internally)
+	 */
+	void            clear();
+
+	/**
+	 * @brief bans allows to access a copy of all stored bans, e.g. for saving or displaying them.
+	 * Expired bans that have not been removed by expire() yet are included.
+	 * <br><b>Locking: /</b> (read locks m_oRWLock internally)
+	 *
+	 * @param vBans  The bans are appended to this vector.
+	 */
+	void            bans( AutoBanVector& vBans ) const;
+
+	/**
+	 * @brief statistics allows to access the size and the eviction metrics of the store.
+	 * <br><b>Locking: /</b> (read locks m_oRWLock internally)
+	 */
+	AutoBanStatistics statistics() const;
+
+#ifndef QUAZAA_SETUP_UNIT_TESTS
+private:
+#else
+public:
+#endif
+	/**
+	 * @brief allocate replaces the table by an empty one using at most nBytes.
+	 * <br><b>Locking: REQUIRES RW</b>
+	 */
+	void            allocate( quint32 nBytes );
+
+	/**
+	 * @brief find looks up the slot of an address.
+	 * <br><b>Locking: REQUIRES R</b>
+	 *
+	 * @return the slot position; <code>m_nMask + 1</code> if the address is not stored
+	 */
+	quint32         find( const quint64* const pAddress, quint8 nProtocol ) const;
+
+	/**
+	 * @brief place stores a ban in the first free slot of its probe sequence. The address must not
+	 * be stored yet and the table must not be full.
+	 * <br><b>Locking: REQUIRES RW</b>
+	 */
+	void            place( const quint64* const pAddress, quint8 nProtocol, quint32 tExpire,
+						   quint32 tLastHit, quint32 nTotal );
+
+	/**
+	 * @brief erase frees a slot and moves the following entries of its cluster back, so no
+	 * tombstones are needed.
+	 * <br><b>Locking: REQUIRES RW</b>
+	 */
+	void            erase( quint32 nPos );
+
+	/**
+	 * @brief evict advances the CLOCK hand to the next expired ban or the next ban that has not
+	 * been hit since the last pass and removes it.
+	 * <br><b>Locking: REQUIRES RW</b>
+	 *
+	 * @param tNow      The current time.
+	 * @param oEvicted  Set to the address of the removed ban if it had not expired yet.
+	 */
+	void            evict( quint32 tNow, QHostAddress& oEvicted );
+
+	/**
+	 * @brief key converts an address to the representation used within the table.
+	 *
+	 * @return the protocol (4 or 6); <code>0</code> if the address is neither IPv4 nor IPv6
+	 */
+	static quint8   key( const QHostAddress& oAddress, quint64* pAddress );
+
+	static QHostAddress address( const Slot& oSlot );
+
+	static quint32  hash( const quint64* const pAddress, quint8 nProtocol );
+
+	static bool     isExpired( quint32 tExpire, quint32 tNow );
+};
+
+}
+
+#endif // AUTOBANSTORE_H
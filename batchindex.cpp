@@ -0,0 +1,290 @@
+/*
+** batchindex.cpp
+**
+** Copyright © Quazaa Development Team, 2014.
+** This file is part of the Quazaa Security Library (quazaa.sourceforge.net)
+**
+** The Quazaa Security Library is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** The Quazaa Security Library is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with the Quazaa Security Library; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include <algorithm>
+
+#include "batchindex.h"
+#include "contentrule.h"
+#include "hashrule.h"
+#include "iprangerule.h"
+#include "iprule.h"
+
+#include "debug_new.h"
+
+using namespace Security;
+
+BatchIndex::BatchIndex() :
+	m_oContents( Qt::CaseSensitive )
+{
+}
+
+void BatchIndex::build( const std::vector< Rule* >& vRules )
+{
+	clear();
+
+	for ( quint32 nPos = 0, nSize = ( quint32 )vRules.size(); nPos < nSize; ++nPos )
+	{
+		const Rule* const pRule = vRules[nPos];
+
+		switch ( pRule->type() )
+		{
+		case RuleType::IPAddress:
+		{
+			const QHostAddress& oIP = ( ( IPRule* )pRule )->IP();
+
+			Range oRange;
+			oRange.oStart = toKey( oIP );
+			oRange.oEnd   = oRange.oStart;
+			oRange.nPos   = nPos;
+
+			addRange( oIP.protocol(), oRange );
+			break;
+		}
+
+		case RuleType::IPAddressRange:
+		{
+			const IPRangeRule* const pRange = ( IPRangeRule* )pRule;
+
+			Range oRange;
+			oRange.oStart = toKey( pRange->startIP() );
+			oRange.oEnd   = toKey( pRange->endIP() );
+			oRange.nPos   = nPos;
+
+			addRange( pRange->startIP().protocol(), oRange );
+			break;
+		}
+
+#if SECURITY_ENABLE_GEOIP
+		case RuleType::Country:
+			m_lhCountries.insert( pRule->contentString(), nPos );
+			break;
+#endif // SECURITY_ENABLE_GEOIP
+
+		case RuleType::Hash:
+		{
+			const HashSet& vHashes = ( ( HashRule* )pRule )->getHashes();
+
+			for ( quint8 i = 0, nHashes = vHashes.size(); i < nHashes; ++i )
+			{
+				if ( vHashes[i] )
+				{
+					if ( i >= m_vHashes.size() )
+					{
+						m_vHashes.resize( nHashes );
+					}
+
+					m_vHashes[i].insert( vHashes[i]->rawValue(), nPos );
+				}
+			}
+			break;
+		}
+
+		case RuleType::Content:
+		{
+			const ContentRule* const pContent = ( ContentRule* )pRule;
+			const QStringList& lKeywords = pContent->getKeywords();
+
+			// Size rules are matched against a generated string, so they cannot be looked up by
+			// the file name.
+			if ( pContent->isSizeRule() || lKeywords.isEmpty() )
+			{
+				m_vOtherHitRules.push_back( nPos );
+			}
+			else
+			{
+				for ( int i = 0; i < lKeywords.size(); ++i )
+				{
+					m_oContents.add( lKeywords.at( i ), nPos );
+				}
+			}
+			break;
+		}
+
+		case RuleType::RegularExpression:
+			m_vOtherHitRules.push_back( nPos );
+			break;
+
+		default:
+			// user agent rules are not part of the sanity check
+			break;
+		}
+	}
+
+	prepareRanges( m_vIPv4Ranges, m_vIPv4MaxEnds );
+	prepareRanges( m_vIPv6Ranges, m_vIPv6MaxEnds );
+
+	m_oContents.build();
+}
+
+void BatchIndex::clear()
+{
+	m_vIPv4Ranges.clear();
+	m_vIPv4MaxEnds.clear();
+	m_vIPv6Ranges.clear();
+	m_vIPv6MaxEnds.clear();
+
+#if SECURITY_ENABLE_GEOIP
+	m_lhCountries.clear();
+#endif // SECURITY_ENABLE_GEOIP
+
+	m_vHashes.clear();
+	m_oContents.clear();
+	m_vOtherHitRules.clear();
+}
+
+void BatchIndex::candidates( const EndPoint& oAddress, PositionVector& vPositions ) const
+{
+	vPositions.clear();
+
+	if ( oAddress.protocol() == QAbstractSocket::IPv4Protocol )
+	{
+		stab( m_vIPv4Ranges, m_vIPv4MaxEnds, toKey( oAddress ), vPositions );
+	}
+	else
+	{
+		stab( m_vIPv6Ranges, m_vIPv6MaxEnds, toKey( oAddress ), vPositions );
+	}
+
+#if SECURITY_ENABLE_GEOIP
+	if ( !m_lhCountries.isEmpty() )
+	{
+		const QString sCountry = oAddress.country();
+
+		QMultiHash< QString, quint32 >::const_iterator itC = m_lhCountries.constFind( sCountry );
+		while ( itC != m_lhCountries.constEnd() && itC.key() == sCountry )
+		{
+			vPositions.push_back( itC.value() );
+			++itC;
+		}
+	}
+#endif // SECURITY_ENABLE_GEOIP
+
+	std::sort( vPositions.begin(), vPositions.end() );
+}
+
+void BatchIndex::candidates( const QueryHit* const pHit, PositionVector& vPositions ) const
+{
+	m_oContents.match( pHit->m_sDescriptiveName, vPositions );
+
+	const HashSet& vHashes = pHit->m_vHashes;
+	const quint8 nSlots = ( quint8 )qMin( ( size_t )vHashes.size(), m_vHashes.size() );
+
+	for ( quint8 i = 0; i < nSlots; ++i )
+	{
+		if ( vHashes[i] )
+		{
+			const QByteArray baDigest = vHashes[i]->rawValue();
+
+			DigestMap::const_iterator it = m_vHashes[i].constFind( baDigest );
+			while ( it != m_vHashes[i].constEnd() && it.key() == baDigest )
+			{
+				vPositions.push_back( it.value() );
+				++it;
+			}
+		}
+	}
+
+	vPositions.insert( vPositions.end(), m_vOtherHitRules.begin(), m_vOtherHitRules.end() );
+
+	std::sort( vPositions.begin(), vPositions.end() );
+
+	// a hash rule might be found by multiple hashes
+	vPositions.erase( std::unique( vPositions.begin(), vPositions.end() ), vPositions.end() );
+}
+
+BatchIndex::IPKey BatchIndex::toKey( const QHostAddress& oAddress )
+{
+	IPKey oKey;
+
+	if ( oAddress.protocol() == QAbstractSocket::IPv4Protocol )
+	{
+		oKey.nHigh = 0;
+		oKey.nLow  = oAddress.toIPv4Address();
+	}
+	else
+	{
+		const Q_IPV6ADDR ip6 = oAddress.toIPv6Address();
+
+		oKey.nHigh = 0;
+		oKey.nLow  = 0;
+
+		// big endian byte order, so numerical order equals address order
+		for ( int i = 0; i < 8; ++i )
+		{
+			oKey.nHigh = ( oKey.nHigh << 8 ) | ip6[i];
+			oKey.nLow  = ( oKey.nLow  << 8 ) | ip6[i + 8];
+		}
+	}
+
+	return oKey;
+}
+
+void BatchIndex::addRange( QAbstractSocket::NetworkLayerProtocol eProtocol, const Range& oRange )
+{
+	if ( eProtocol == QAbstractSocket::IPv4Protocol )
+	{
+		m_vIPv4Ranges.push_back( oRange );
+	}
+	else
+	{
+		m_vIPv6Ranges.push_back( oRange );
+	}
+}
+
+void BatchIndex::prepareRanges( RangeVector& vRanges, IPKeyVector& vMaxEnds )
+{
+	std::sort( vRanges.begin(), vRanges.end() );
+
+	vMaxEnds.resize( vRanges.size() );
+
+	for ( RangeVector::size_type i = 0; i < vRanges.size(); ++i )
+	{
+		vMaxEnds[i] = ( i && vRanges[i].oEnd < vMaxEnds[i - 1] ) ? vMaxEnds[i - 1] :
+																	 vRanges[i].oEnd;
+	}
+}
+
+void BatchIndex::stab( const RangeVector& vRanges, const IPKeyVector& vMaxEnds,
+					   const IPKey& oKey, PositionVector& vPositions )
+{
+	Range oProbe;
+	oProbe.oStart = oKey;
+
+	// first range starting after oKey
+	RangeVector::size_type n = std::upper_bound( vRanges.begin(), vRanges.end(), oProbe ) -
+							   vRanges.begin();
+
+	// All ranges before n start at or before oKey. Walk backwards as long as a range ending at or
+	// after oKey might still exist.
+	while ( n && !( vMaxEnds[n - 1] < oKey ) )
+	{
+		--n;
+
+		if ( !( vRanges[n].oEnd < oKey ) )
+		{
+			vPositions.push_back( vRanges[n].nPos );
+		}
+	}
+}
@@ -0,0 +1,166 @@
+/*
+** batchindex.h
+**
+** Copyright © Quazaa Development Team, 2014.
+** This file is part of the Quazaa Security Library (quazaa.sourceforge.net)
+**
+** The Quazaa Security Library is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** The Quazaa Security Library is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with the Quazaa Security Library; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#ifndef BATCHINDEX_H
+#define BATCHINDEX_H
+
+#include <vector>
+
+#include <QHash>
+
+#include "externals.h"
+#include "patternmatcher.h"
+#include "securerule.h"
+
+namespace Security
+{
+
+/**
+ * @brief The BatchIndex class indexes a batch of new rules for the sanity check, so a peer or
+ * QueryHit can be checked against the batch without testing every rule. Lookups return the batch
+ * positions of all candidate rules in ascending order; these still need to be confirmed by calling
+ * the match() methods of the rules.
+ */
+class BatchIndex
+{
+public:
+	typedef std::vector< quint32 > PositionVector;
+
+#ifndef QUAZAA_SETUP_UNIT_TESTS
+private:
+#else
+public:
+#endif
+	/**
+	 * @brief IPKey is a numerical representation of an IPv4 or IPv6 address.
+	 */
+	struct IPKey
+	{
+		quint64 nHigh;
+		quint64 nLow;
+
+		bool operator<( const IPKey& other ) const
+		{
+			return nHigh == other.nHigh ? nLow < other.nLow : nHigh < other.nHigh;
+		}
+	};
+
+	struct Range
+	{
+		IPKey   oStart;
+		IPKey   oEnd;
+		quint32 nPos;
+
+		bool operator<( const Range& other ) const
+		{
+			return oStart < other.oStart;
+		}
+	};
+
+	typedef std::vector< Range > RangeVector;
+	typedef std::vector< IPKey > IPKeyVector;
+	typedef QMultiHash< QByteArray, quint32 > DigestMap;
+
+	// IP ranges and single IPs (as ranges of size 1) sorted by start address, separated by
+	// protocol, and the maximum end address of all ranges up to the respective position
+	RangeVector     m_vIPv4Ranges;
+	IPKeyVector     m_vIPv4MaxEnds;
+	RangeVector     m_vIPv6Ranges;
+	IPKeyVector     m_vIPv6MaxEnds;
+
+#if SECURITY_ENABLE_GEOIP
+	// country rules by country code
+	QMultiHash< QString, quint32 > m_lhCountries;
+#endif // SECURITY_ENABLE_GEOIP
+
+	// hash rules by raw digest, one map per HashSet slot
+	std::vector< DigestMap > m_vHashes;
+
+	// keywords of content rules
+	PatternMatcher  m_oContents;
+
+	// rules that need to be tested against every QueryHit
+	PositionVector  m_vOtherHitRules;
+
+public:
+	/**
+	 * @brief BatchIndex constructs an empty index.
+	 */
+	BatchIndex();
+
+	/**
+	 * @brief build indexes a batch of rules.
+	 *
+	 * @param vRules  The batch. Positions returned by lookups refer to this vector.
+	 */
+	void            build( const std::vector< Rule* >& vRules );
+
+	/**
+	 * @brief clear removes all rules from the index.
+	 */
+	void            clear();
+
+	/**
+	 * @brief candidates looks up the rules of the batch that might match an address.
+	 *
+	 * @param oAddress     The address.
+	 * @param vPositions   Is filled with the sorted batch positions of the candidates.
+	 */
+	void            candidates( const EndPoint& oAddress, PositionVector& vPositions ) const;
+
+	/**
+	 * @brief candidates looks up the rules of the batch that might match a QueryHit.
+	 *
+	 * @param pHit        The QueryHit.
+	 * @param vPositions  Is filled with the sorted batch positions of the candidates.
+	 */
+	void            candidates( const QueryHit* const pHit, PositionVector& vPositions ) const;
+
+private:
+	/**
+	 * @brief toKey converts an address into its numerical representation.
+	 */
+	static IPKey    toKey( const QHostAddress& oAddress );
+
+	/**
+	 * @brief addRange adds a range to the range table of its protocol.
+	 */
+	void            addRange( QAbstractSocket::NetworkLayerProtocol eProtocol, const Range& oRange );
+
+	/**
+	 * @brief prepareRanges sorts a range vector and calculates its maximum end addresses.
+	 */
+	static void     prepareRanges( RangeVector& vRanges, IPKeyVector& vMaxEnds );
+
+	/**
+	 * @brief stab adds the positions of all ranges containing oKey to vPositions.
+	 */
+	static void     stab( const RangeVector& vRanges, const IPKeyVector& vMaxEnds,
+						  const IPKey& oKey, PositionVector& vPositions );
+};
+
+}
+
+#endif // BATCHINDEX_H
@@ -0,0 +1,54 @@
+#
+# benchmarks.pro
+#
+# Copyright © Quazaaa Development Team, 2014.
+# This file is part of QUAZAA (quazaa.sourceforge.net)
+#
+# Quazaa is free software; this file may be used under the terms of the GNU
+# General Public License version 3.0 or later or later as published by the Free Software
+# Foundation and appearing in the file LICENSE.GPL included in the
+# packaging of this file.
+#
+# Quazaa is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+#
+# Please review the following information to ensure the GNU General Public
+# License version 3.0 requirements will be met:
+# http://www.gnu.org/copyleft/gpl.html.
+#
+# You should have received a copy of the GNU General Public License version
+# 3.0 along with Quazaa; if not, write to the Free Software Foundation,
+# Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+#
+
+# Microbenchmarks of the security manager, see README.md for how to run them.
+#
+# The library depends on parts of the Quazaa source tree, which is expected in the parent
+# directory of the library by default. Use "qmake QUAZAA_SRC=<path>" to override.
+
+QT       += core network xml testlib
+QT       -= gui
+
+CONFIG   += console
+CONFIG   -= app_bundle
+
+TARGET    = securitybenchmarks
+TEMPLATE  = app
+
+DEFINES  += QUAZAA_SETUP_UNIT_TESTS
+
+isEmpty(QUAZAA_SRC): QUAZAA_SRC = $$PWD/../..
+
+include(quazaa.pri)
+include(../security.pri)
+
+# Headers
+HEADERS += \
+		$$PWD/rulegenerator.h \
+		$$PWD/securitybenchmark.h
+
+# Sources
+SOURCES += \
+		$$PWD/rulegenerator.cpp \
+		$$PWD/securitybenchmark.cpp
@@ -0,0 +1,289 @@
+/*
+** main.cpp
+**
+** Copyright © Quazaa Development Team, 2014.
+** This file is part of the Quazaa Security Library (quazaa.sourceforge.net)
+**
+** The Quazaa Security Library is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** The Quazaa Security Library is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with the Quazaa Security Library; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QTextStream>
+
+#include "workers.h"
+
+#include "debug_new.h"
+
+using namespace Security;
+
+// number of distinct peer addresses looked up by the readers
+#define CONTENTION_ADDRESSES 65536
+
+struct Options
+{
+	int     nRules;
+	int     nMaxReaders;
+	int     nWriters;
+	int     nInterval;
+	int     nDuration;
+	int     nReplicas;
+	bool    bCSV;
+};
+
+struct Result
+{
+	int                 nReaders;
+	double              dSeconds;
+	quint64             nDenied;
+	LatencyHistogram    oLookups;
+	LatencyHistogram    pWrites[WriterThread::NoOfOperations];
+	LatencyHistogram    oAllWrites;
+};
+
+static bool parseOptions( const QCoreApplication& oApp, Options& oOptions )
+{
+	QCommandLineParser oParser;
+	oParser.setApplicationDescription( "Measures the throughput and latency of concurrent address "
+									   "checks while the rule set is being modified." );
+	oParser.addHelpOption();
+
+	QCommandLineOption oRules( "rules", "Size of the synthetic rule set.", "n", "10000" );
+	QCommandLineOption oReaders( "readers", "Maximum number of reader threads; the reader "
+								 "count is doubled from 1 up to this.", "n", "64" );
+	QCommandLineOption oWriters( "writers", "Number of writer threads (0-63).", "n", "2" );
+	QCommandLineOption oInterval( "interval", "Pause between two writes of a writer in us.",
+								  "us", "1000" );
+	QCommandLineOption oDuration( "duration", "Duration of each run in ms.", "ms", "2000" );
+	QCommandLineOption oReplicas( "replicas", "Number of replicas of the IP lookup indexes "
+								  "(0 disables them).", "n", "0" );
+	QCommandLineOption oCSV( "csv", "Write the results as CSV." );
+
+	oParser.addOption( oRules );
+	oParser.addOption( oReaders );
+	oParser.addOption( oWriters );
+	oParser.addOption( oInterval );
+	oParser.addOption( oDuration );
+	oParser.addOption( oReplicas );
+	oParser.addOption( oCSV );
+	oParser.process( oApp );
+
+	oOptions.nRules      = oParser.value( oRules ).toInt();
+	oOptions.nMaxReaders = oParser.value( oReaders ).toInt();
+	oOptions.nWriters    = oParser.value( oWriters ).toInt();
+	oOptions.nInterval   = oParser.value( oInterval ).toInt();
+	oOptions.nDuration   = oParser.value( oDuration ).toInt();
+	oOptions.nReplicas   = oParser.value( oReplicas ).toInt();
+	oOptions.bCSV        = oParser.isSet( oCSV );
+
+	return oOptions.nRules >= 0 && oOptions.nMaxReaders > 0 &&
+		   oOptions.nWriters >= 0 && oOptions.nWriters < 64 &&
+		   oOptions.nInterval >= 0 && oOptions.nDuration > 0 && oOptions.nReplicas >= 0;
+}
+
+static void run( const Options& oOptions, const AddressPool& oPool, Result& oResult )
+{
+	RuleGenerator oGenerator( 1 );
+	oGenerator.populate( securityManager, oOptions.nRules );
+
+	QAtomicInt bStop( 0 );
+	std::vector<ReaderThread*> vReaders;
+	std::vector<WriterThread*> vWriters;
+
+	for ( int i = 0; i < oResult.nReaders; ++i )
+	{
+		vReaders.push_back( new ReaderThread( oPool, bStop, 100 + i ) );
+	}
+	for ( int i = 0; i < oOptions.nWriters; ++i )
+	{
+		vWriters.push_back( new WriterThread( oPool, bStop, i, oOptions.nInterval ) );
+	}
+
+	QElapsedTimer oTimer;
+	oTimer.start();
+
+	for ( size_t i = 0; i < vWriters.size(); ++i )
+	{
+		vWriters[i]->start();
+	}
+	for ( size_t i = 0; i < vReaders.size(); ++i )
+	{
+		vReaders[i]->start();
+	}
+
+	// The main thread performs the commits (sanity checks) scheduled by the writers, just like the
+	// GUI thread of the application does.
+	while ( oTimer.elapsed() < oOptions.nDuration )
+	{
+		QCoreApplication::processEvents();
+		QThread::msleep( 5 );
+	}
+
+	bStop.store( 1 );
+
+	for ( size_t i = 0; i < vReaders.size(); ++i )
+	{
+		vReaders[i]->wait();
+	}
+	oResult.dSeconds = oTimer.nsecsElapsed() / 1e9;
+
+	for ( size_t i = 0; i < vWriters.size(); ++i )
+	{
+		vWriters[i]->wait();
+	}
+
+	oResult.nDenied = 0;
+	for ( size_t i = 0; i < vReaders.size(); ++i )
+	{
+		oResult.oLookups.merge( vReaders[i]->m_oLatency );
+		oResult.nDenied += vReaders[i]->m_nDenied;
+		delete vReaders[i];
+	}
+
+	for ( size_t i = 0; i < vWriters.size(); ++i )
+	{
+		for ( int j = 0; j < WriterThread::NoOfOperations; ++j )
+		{
+			oResult.pWrites[j].merge( vWriters[i]->m_pLatency[j] );
+			oResult.oAllWrites.merge( vWriters[i]->m_pLatency[j] );
+		}
+		delete vWriters[i];
+	}
+
+	QCoreApplication::processEvents();
+	securityManager.m_oSanity.sanityCheck();
+	securityManager.clear();
+}
+
+static void printHeader( QTextStream& oOut, const Options& oOptions )
+{
+	if ( oOptions.bCSV )
+	{
+		oOut << "readers,writers,replicas,rules,seconds,lookups,lookups_per_s,denied,"
+			 << "lookup_p50_ns,lookup_p99_ns,lookup_p999_ns,lookup_max_ns,"
+			 << "writes,writes_per_s,write_p50_ns,write_p99_ns,write_p999_ns,write_max_ns";
+
+		for ( int i = 0; i < WriterThread::NoOfOperations; ++i )
+		{
+			const QString sName = WriterThread::operationName( i );
+			oOut << "," << sName << "_count," << sName << "_p50_ns," << sName << "_p99_ns";
+		}
+
+		oOut << "\n";
+	}
+	else
+	{
+		oOut << "Rules: " << oOptions.nRules << ", writers: " << oOptions.nWriters
+			 << ", write interval: " << oOptions.nInterval << " us, replicas: "
+			 << oOptions.nReplicas << ", hardware threads: " << QThread::idealThreadCount()
+			 << "\n\n";
+		oOut << qSetFieldWidth( 8 ) << "readers" << qSetFieldWidth( 14 ) << "lookups/s"
+			 << qSetFieldWidth( 10 ) << "p50 ns" << "p99 ns" << "p999 ns"
+			 << qSetFieldWidth( 12 ) << "writes/s" << "w p50 ns" << "w p99 ns" << "w p999 ns"
+			 << qSetFieldWidth( 0 ) << "\n";
+	}
+	oOut.flush();
+}
+
+static void printResult( QTextStream& oOut, const Options& oOptions, const Result& oResult )
+{
+	const quint64 nLookups = oResult.oLookups.count();
+	const quint64 nWrites  = oResult.oAllWrites.count();
+
+	if ( oOptions.bCSV )
+	{
+		oOut << oResult.nReaders << "," << oOptions.nWriters << "," << oOptions.nReplicas << ","
+			 << oOptions.nRules << ","
+			 << oResult.dSeconds << "," << nLookups << "," << nLookups / oResult.dSeconds << ","
+			 << oResult.nDenied << "," << oResult.oLookups.percentile( 50 ) << ","
+			 << oResult.oLookups.percentile( 99 ) << "," << oResult.oLookups.percentile( 99.9 ) << ","
+			 << oResult.oLookups.max() << "," << nWrites << "," << nWrites / oResult.dSeconds << ","
+			 << oResult.oAllWrites.percentile( 50 ) << "," << oResult.oAllWrites.percentile( 99 )
+			 << "," << oResult.oAllWrites.percentile( 99.9 ) << "," << oResult.oAllWrites.max();
+
+		for ( int i = 0; i < WriterThread::NoOfOperations; ++i )
+		{
+			oOut << "," << oResult.pWrites[i].count() << "," << oResult.pWrites[i].percentile( 50 )
+				 << "," << oResult.pWrites[i].percentile( 99 );
+		}
+
+		oOut << "\n";
+	}
+	else
+	{
+		oOut << qSetFieldWidth( 8 ) << oResult.nReaders
+			 << qSetFieldWidth( 14 ) << ( quint64 )( nLookups / oResult.dSeconds )
+			 << qSetFieldWidth( 10 ) << oResult.oLookups.percentile( 50 )
+			 << oResult.oLookups.percentile( 99 ) << oResult.oLookups.percentile( 99.9 )
+			 << qSetFieldWidth( 12 ) << ( quint64 )( nWrites / oResult.dSeconds )
+			 << oResult.oAllWrites.percentile( 50 ) << oResult.oAllWrites.percentile( 99 )
+			 << oResult.oAllWrites.percentile( 99.9 ) << qSetFieldWidth( 0 ) << "\n";
+
+		// p50/p99 write latency in ns by operation
+		oOut << qSetFieldWidth( 22 ) << "";
+		for ( int i = 0; i < WriterThread::NoOfOperations; ++i )
+		{
+			oOut << qSetFieldWidth( 0 ) << "  " << WriterThread::operationName( i ) << ": "
+				 << oResult.pWrites[i].percentile( 50 ) << "/" << oResult.pWrites[i].percentile( 99 );
+		}
+		oOut << "\n";
+	}
+	oOut.flush();
+}
+
+int main( int argc, char* argv[] )
+{
+	QCoreApplication oApp( argc, argv );
+
+	Options oOptions;
+	if ( !parseOptions( oApp, oOptions ) )
+	{
+		QTextStream( stderr ) << "Invalid options, see --help.\n";
+		return 1;
+	}
+
+	securityManager.start( oOptions.nReplicas );
+
+	const AddressPool oPool( CONTENTION_ADDRESSES, 2 );
+
+	QTextStream oOut( stdout );
+	printHeader( oOut, oOptions );
+
+	for ( int nReaders = 1; ; nReaders *= 2 )
+	{
+		nReaders = qMin( nReaders, oOptions.nMaxReaders );
+
+		Result* pResult = new Result();
+		pResult->nReaders = nReaders;
+
+		run( oOptions, oPool, *pResult );
+		printResult( oOut, oOptions, *pResult );
+
+		delete pResult;
+
+		if ( nReaders == oOptions.nMaxReaders )
+		{
+			break;
+		}
+	}
+
+	securityManager.stop();
+	return 0;
+}
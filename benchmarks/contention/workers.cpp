@@ -0,0 +1,196 @@
+/*
+** workers.cpp
+**
+** Copyright © Quazaa Development Team, 2014.
+** This file is part of the Quazaa Security Library (quazaa.sourceforge.net)
+**
+** The Quazaa Security Library is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** The Quazaa Security Library is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with the Quazaa Security Library; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include <QElapsedTimer>
+
+#include "workers.h"
+
+#include "debug_new.h"
+
+using namespace Security;
+
+// Writers add their rules within 100.64.0.0/10, 64k addresses per writer. The reader pool excludes
+// this network, so bans never collide with (and replace) the rules a writer is going to remove.
+#define WRITER_NETWORK      0x64400000u
+#define WRITER_NETWORK_MASK 0xFFC00000u
+
+// maximum number of rules a writer keeps added at any time
+#define WRITER_MAX_ADDED    4096
+
+AddressPool::AddressPool( quint32 nSize, quint64 nSeed )
+{
+	RuleGenerator oGenerator( nSeed );
+
+	m_vAddresses.reserve( nSize );
+	while ( m_vAddresses.size() < nSize )
+	{
+		// Two thirds of the peers are located within the networks the clustered rules cover.
+		const QHostAddress oAddress = oGenerator.ipv4( oGenerator.bounded( 3 ) );
+
+		if ( ( oAddress.toIPv4Address() & WRITER_NETWORK_MASK ) != WRITER_NETWORK )
+		{
+			m_vAddresses.push_back( oAddress );
+		}
+	}
+}
+
+const QHostAddress& AddressPool::draw( RuleGenerator& oGenerator ) const
+{
+	// Drawing a bound first results in P(i) ~ ln( n / i ), which favours the low indexes about as
+	// strongly as the peer distributions we see in the wild.
+	const quint32 nBound = 1 + oGenerator.bounded( ( quint32 )m_vAddresses.size() );
+	return m_vAddresses[oGenerator.bounded( nBound )];
+}
+
+ReaderThread::ReaderThread( const AddressPool& oPool, const QAtomicInt& bStop, quint64 nSeed ) :
+	m_oPool( oPool ),
+	m_bStop( bStop ),
+	m_oGenerator( nSeed ),
+	m_nDenied( 0 )
+{
+}
+
+void ReaderThread::run()
+{
+	QElapsedTimer oTimer;
+	oTimer.start();
+
+	while ( !m_bStop.load() )
+	{
+		const EndPoint oAddress( m_oPool.draw( m_oGenerator ) );
+		const qint64 tStart = oTimer.nsecsElapsed();
+
+		if ( securityManager.isDenied( oAddress ) )
+		{
+			++m_nDenied;
+		}
+
+		m_oLatency.record( ( quint64 )( oTimer.nsecsElapsed() - tStart ) );
+	}
+}
+
+WriterThread::WriterThread( const AddressPool& oPool, const QAtomicInt& bStop, quint32 nWriter,
+							quint32 nInterval ) :
+	m_oPool( oPool ),
+	m_bStop( bStop ),
+	m_oGenerator( 1000 + nWriter ),
+	m_nWriter( nWriter ),
+	m_nInterval( nInterval ),
+	m_nNextAddress( 0 )
+{
+	Q_ASSERT( nWriter < 64 );
+}
+
+const char* WriterThread::operationName( int eOperation )
+{
+	static const char* const pNames[NoOfOperations] = { "ban", "add", "remove", "expire" };
+	return pNames[eOperation];
+}
+
+void WriterThread::run()
+{
+	QElapsedTimer oTimer;
+	oTimer.start();
+
+	while ( !m_bStop.load() )
+	{
+		// 35% bans, 30% additions, 30% removals, 5% expiry runs
+		const quint32 nRoll = m_oGenerator.bounded( 100 );
+		Operation eOperation;
+
+		if ( nRoll < 35 )
+		{
+			eOperation = Ban;
+		}
+		else if ( nRoll < 65 )
+		{
+			eOperation = m_vAdded.size() < WRITER_MAX_ADDED ? Add : Remove;
+		}
+		else if ( nRoll < 95 )
+		{
+			eOperation = m_vAdded.empty() ? Add : Remove;
+		}
+		else
+		{
+			eOperation = Expire;
+		}
+
+		const qint64 tStart = oTimer.nsecsElapsed();
+
+		switch ( eOperation )
+		{
+		case Ban:
+			securityManager.ban( m_oPool.draw( m_oGenerator ), RuleTime::FiveMinutes, false );
+			break;
+
+		case Add:
+			addRule();
+			break;
+
+		case Remove:
+			removeRule();
+			break;
+
+		default:
+			securityManager.expire();
+		}
+
+		m_pLatency[eOperation].record( ( quint64 )( oTimer.nsecsElapsed() - tStart ) );
+
+		if ( m_nInterval )
+		{
+			QThread::usleep( m_nInterval );
+		}
+	}
+
+	// leave the rule set as it has been found
+	while ( !m_vAdded.empty() )
+	{
+		removeRule();
+	}
+}
+
+void WriterThread::addRule()
+{
+	const quint32 nAddress = WRITER_NETWORK + ( m_nWriter << 16 ) + ( m_nNextAddress++ & 0xFFFF );
+
+	IPRule* pRule = new IPRule();
+	pRule->parseContent( QHostAddress( nAddress ).toString() );
+	pRule->m_nAction    = RuleAction::Deny;
+	pRule->setExpiryTime( RuleTime::Forever );
+	pRule->m_bAutomatic = false;
+
+	// The address is unique within the Manager, so the rule is never merged into another one.
+	if ( securityManager.add( pRule ) )
+	{
+		m_vAdded.push_back( pRule );
+	}
+}
+
+void WriterThread::removeRule()
+{
+	securityManager.remove( m_vAdded.front() );
+	m_vAdded.pop_front();
+}
@@ -0,0 +1,145 @@
+/*
+** workers.h
+**
+** Copyright © Quazaa Development Team, 2014.
+** This file is part of the Quazaa Security Library (quazaa.sourceforge.net)
+**
+** The Quazaa Security Library is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** The Quazaa Security Library is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with the Quazaa Security Library; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#ifndef WORKERS_H
+#define WORKERS_H
+
+#include <deque>
+#include <vector>
+
+#include <QAtomicInt>
+#include <QHostAddress>
+#include <QThread>
+
+#include "latencyhistogram.h"
+#include "rulegenerator.h"
+
+namespace Security
+{
+
+/**
+ * @brief AddressPool holds the addresses readers look up. Real traffic is skewed: few peers
+ * (neighbours, hubs) are checked over and over again while most addresses are only seen a couple
+ * of times. This is modelled by drawing from the pool with a heavily skewed distribution.
+ */
+class AddressPool
+{
+private:
+	std::vector<QHostAddress> m_vAddresses;
+
+public:
+	/**
+	 * @brief AddressPool generates the pool.
+	 *
+	 * @param nSize  The number of distinct addresses.
+	 * @param nSeed  The seed.
+	 */
+	AddressPool( quint32 nSize, quint64 nSeed );
+
+	/**
+	 * @brief draw selects an address; low indexes are drawn far more often than high ones.
+	 *
+	 * @param oGenerator  The random number generator of the calling thread.
+	 * @return the address
+	 */
+	const QHostAddress& draw( RuleGenerator& oGenerator ) const;
+};
+
+/**
+ * @brief The ReaderThread class checks addresses against the Manager as fast as possible and
+ * records the latency of every lookup.
+ */
+class ReaderThread : public QThread
+{
+private:
+	const AddressPool&  m_oPool;
+	const QAtomicInt&   m_bStop;
+	RuleGenerator       m_oGenerator;
+
+public:
+	LatencyHistogram    m_oLatency;
+	quint64             m_nDenied;
+
+public:
+	ReaderThread( const AddressPool& oPool, const QAtomicInt& bStop, quint64 nSeed );
+
+protected:
+	void run();
+};
+
+/**
+ * @brief The WriterThread class modifies the rule set at a fixed rate, mixing ban(), add(),
+ * remove() and expire() calls, and records the latency of every operation by type.
+ */
+class WriterThread : public QThread
+{
+public:
+	enum Operation
+	{
+		Ban = 0, Add = 1, Remove = 2, Expire = 3, NoOfOperations = 4
+	};
+
+private:
+	const AddressPool&  m_oPool;
+	const QAtomicInt&   m_bStop;
+	RuleGenerator       m_oGenerator;
+	quint32             m_nWriter;
+	quint32             m_nInterval;
+
+	// rules added by this thread that have not been removed yet, oldest first
+	std::deque<Rule*>   m_vAdded;
+	quint32             m_nNextAddress;
+
+public:
+	LatencyHistogram    m_pLatency[NoOfOperations];
+
+public:
+	/**
+	 * @brief WriterThread constructs a writer.
+	 *
+	 * @param oPool      The addresses to ban.
+	 * @param bStop      Set to 1 to stop the thread.
+	 * @param nWriter    The number of this writer; used to give each writer its own address space.
+	 * @param nInterval  The pause between two operations in us.
+	 */
+	WriterThread( const AddressPool& oPool, const QAtomicInt& bStop, quint32 nWriter,
+				  quint32 nInterval );
+
+	/**
+	 * @brief operationName returns a human readable name for an Operation.
+	 */
+	static const char* operationName( int eOperation );
+
+protected:
+	void run();
+
+private:
+	void addRule();
+	void removeRule();
+};
+
+}
+
+#endif // WORKERS_H
@@ -0,0 +1,56 @@
+#
+# quazaa.pri
+#
+# Copyright © Quazaaa Development Team, 2014.
+# This file is part of QUAZAA (quazaa.sourceforge.net)
+#
+# Quazaa is free software; this file may be used under the terms of the GNU
+# General Public License version 3.0 or later or later as published by the Free Software
+# Foundation and appearing in the file LICENSE.GPL included in the
+# packaging of this file.
+#
+# Quazaa is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+#
+# Please review the following information to ensure the GNU General Public
+# License version 3.0 requirements will be met:
+# http://www.gnu.org/copyleft/gpl.html.
+#
+# You should have received a copy of the GNU General Public License version
+# 3.0 along with Quazaa; if not, write to the Free Software Foundation,
+# Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+#
+
+# Parts of the Quazaa source tree required to link the security library outside of Quazaa.
+# Extend this if the library starts to depend on further Quazaa modules.
+
+INCLUDEPATH += \
+		$$QUAZAA_SRC \
+		$$QUAZAA_SRC/3rdparty
+
+# Headers
+HEADERS += \
+		$$QUAZAA_SRC/commonfunctions.h \
+		$$QUAZAA_SRC/geoiplist.h \
+		$$QUAZAA_SRC/quazaaglobals.h \
+		$$QUAZAA_SRC/quazaasettings.h \
+		$$QUAZAA_SRC/systemlog.h \
+		$$QUAZAA_SRC/Misc/timedsignalqueue.h \
+		$$QUAZAA_SRC/NetworkCore/endpoint.h \
+		$$QUAZAA_SRC/NetworkCore/queryhit.h \
+		$$QUAZAA_SRC/NetworkCore/Hashes/hash.h \
+		$$QUAZAA_SRC/NetworkCore/Hashes/hashset.h
+
+# Sources
+SOURCES += \
+		$$QUAZAA_SRC/commonfunctions.cpp \
+		$$QUAZAA_SRC/geoiplist.cpp \
+		$$QUAZAA_SRC/quazaaglobals.cpp \
+		$$QUAZAA_SRC/quazaasettings.cpp \
+		$$QUAZAA_SRC/systemlog.cpp \
+		$$QUAZAA_SRC/Misc/timedsignalqueue.cpp \
+		$$QUAZAA_SRC/NetworkCore/endpoint.cpp \
+		$$QUAZAA_SRC/NetworkCore/queryhit.cpp \
+		$$QUAZAA_SRC/NetworkCore/Hashes/hash.cpp \
+		$$QUAZAA_SRC/NetworkCore/Hashes/hashset.cpp
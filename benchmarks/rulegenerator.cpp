@@ -0,0 +1,310 @@
+/*
+** rulegenerator.cpp
+**
+** Copyright © Quazaa Development Team, 2014.
+** This file is part of the Quazaa Security Library (quazaa.sourceforge.net)
+**
+** The Quazaa Security Library is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** The Quazaa Security Library is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with the Quazaa Security Library; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include "rulegenerator.h"
+
+#include "debug_new.h"
+
+using namespace Security;
+
+static const char* const pVocabulary[] =
+{
+	"linux", "ubuntu", "iso", "dvd", "rip", "live", "concert", "album", "remix", "mix",
+	"documentary", "nature", "season", "episode", "final", "edition", "collection", "best",
+	"of", "the", "sample", "free", "demo", "game", "setup", "install", "crack", "keygen",
+	"manual", "ebook", "lecture", "course", "tutorial", "podcast", "radio", "show"
+};
+
+static const char* const pExtensions[] =
+{
+	"mp3", "ogg", "flac", "avi", "mkv", "mp4", "iso", "zip", "rar", "exe", "pdf", "txt"
+};
+
+static const char* const pAgents[] =
+{
+	"Quazaa", "Shareaza", "gtk-gnutella", "LimeWire", "FrostWire", "BearShare", "Phex",
+	"WireShare", "eMule", "Foxy", "RazaB", "Morpheus", "Cabos", "Acqlite"
+};
+
+static const int nVocabulary = sizeof( pVocabulary ) / sizeof( pVocabulary[0] );
+static const int nExtensions = sizeof( pExtensions ) / sizeof( pExtensions[0] );
+static const int nAgents     = sizeof( pAgents ) / sizeof( pAgents[0] );
+
+RuleGenerator::RuleGenerator( quint64 nSeed ) :
+	m_nState( nSeed ? nSeed : Q_UINT64_C( 0x9E3779B97F4A7C15 ) )
+{
+}
+
+quint32 RuleGenerator::next()
+{
+	m_nState ^= m_nState >> 12;
+	m_nState ^= m_nState << 25;
+	m_nState ^= m_nState >> 27;
+
+	return ( quint32 )( ( m_nState * Q_UINT64_C( 2685821657736338717 ) ) >> 32 );
+}
+
+quint32 RuleGenerator::bounded( quint32 nBound )
+{
+	return nBound ? ( quint32 )( ( ( quint64 )next() * nBound ) >> 32 ) : 0;
+}
+
+QHostAddress RuleGenerator::ipv4( bool bClustered )
+{
+	if ( bClustered )
+	{
+		// 64 networks starting at 24.0.0.0, spaced 3 /16 networks apart
+		const quint32 nNetwork = ( 24u << 24 ) + bounded( 64 ) * 3 * 65536;
+		return QHostAddress( nNetwork + bounded( 65536 ) );
+	}
+
+	// avoid the 0.0.0.0/8 network
+	return QHostAddress( ( 1u << 24 ) + bounded( 0xFF000000u ) );
+}
+
+IPRule* RuleGenerator::ipRule( bool bClustered, RuleAction::Action eAction )
+{
+	IPRule* pRule = new IPRule();
+	pRule->parseContent( ipv4( bClustered ).toString() );
+	pRule->m_nAction = eAction;
+	pRule->setExpiryTime( RuleTime::Forever );
+	pRule->m_bAutomatic = false;
+
+	return pRule;
+}
+
+IPRangeRule* RuleGenerator::rangeRule( bool bClustered, RuleAction::Action eAction )
+{
+	const quint32 nStart = ipv4( bClustered ).toIPv4Address();
+	const quint32 nSize  = 16u << bounded( 9 );
+	const quint32 nEnd   = nStart > 0xFFFFFFFFu - nSize ? 0xFFFFFFFFu : nStart + nSize - 1;
+
+	IPRangeRule* pRule = new IPRangeRule();
+	pRule->parseContent( QHostAddress( nStart ).toString() + "-" +
+						 QHostAddress( nEnd ).toString() );
+	pRule->m_nAction = eAction;
+	pRule->setExpiryTime( RuleTime::Forever );
+	pRule->m_bAutomatic = false;
+
+	return pRule;
+}
+
+IPRangeRule* RuleGenerator::denseRangeRule()
+{
+	static const RuleAction::Action pActions[] =
+	{
+		RuleAction::None, RuleAction::Accept, RuleAction::Deny
+	};
+
+	const quint32 nStart = 0x0A000000u + bounded( 2048 );
+	const quint32 nEnd   = nStart + bounded( 256 );
+
+	IPRangeRule* pRule = new IPRangeRule();
+	pRule->parseContent( QHostAddress( nStart ).toString() + "-" +
+						 QHostAddress( nEnd ).toString() );
+	pRule->m_nAction = pActions[bounded( 3 )];
+	pRule->setExpiryTime( bounded( 2 ) ? ( quint32 )RuleTime::Forever :
+										 common::getTNowUTC() + RuleTime::Day );
+	pRule->loadTotalCount( bounded( 100 ) );
+	pRule->m_bAutomatic = false;
+
+	return pRule;
+}
+
+QString RuleGenerator::sha1Urn()
+{
+	static const char pBase32[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ234567";
+
+	QString sUrn( "urn:sha1:" );
+	sUrn.reserve( 9 + 32 );
+
+	for ( int i = 0; i < 32; ++i )
+	{
+		sUrn.append( QLatin1Char( pBase32[bounded( 32 )] ) );
+	}
+
+	return sUrn;
+}
+
+HashRule* RuleGenerator::hashRule()
+{
+	HashRule* pRule = new HashRule();
+	pRule->parseContent( sha1Urn() );
+	pRule->m_nAction = RuleAction::Deny;
+	pRule->setExpiryTime( RuleTime::Forever );
+	pRule->m_bAutomatic = false;
+
+	return pRule;
+}
+
+ContentRule* RuleGenerator::contentRule()
+{
+	ContentRule* pRule = new ContentRule();
+	pRule->parseContent( word() + " " + word() );
+	pRule->setAll( bounded( 2 ) );
+	pRule->m_nAction = RuleAction::Deny;
+	pRule->setExpiryTime( RuleTime::Forever );
+	pRule->m_bAutomatic = false;
+
+	return pRule;
+}
+
+RegularExpressionRule* RuleGenerator::regExpRule()
+{
+	RegularExpressionRule* pRule = new RegularExpressionRule();
+
+	// every other rule uses the special elements referring to the search keywords
+	if ( bounded( 2 ) )
+	{
+		pRule->parseContent( QString( ".*<1>.*%1.*" ).arg( word() ) );
+	}
+	else
+	{
+		pRule->parseContent( QString( ".*%1.*%2.*" ).arg( word(), word() ) );
+	}
+
+	pRule->m_nAction = RuleAction::Deny;
+	pRule->setExpiryTime( RuleTime::Forever );
+	pRule->m_bAutomatic = false;
+
+	return pRule;
+}
+
+UserAgentRule* RuleGenerator::userAgentRule()
+{
+	UserAgentRule* pRule = new UserAgentRule();
+
+	// one in eight rules is a regular expression
+	if ( !bounded( 8 ) )
+	{
+		pRule->parseContent( QString( "%1 [0-9]+\\.%2.*" ).arg( pAgents[bounded( nAgents )],
+																QString::number( bounded( 10 ) ) ) );
+		pRule->setRegExp( true );
+	}
+	else
+	{
+		pRule->parseContent( QString( "%1 %2" ).arg( pAgents[bounded( nAgents )],
+													 QString::number( bounded( 10 ) ) ) );
+		pRule->setRegExp( false );
+	}
+
+	pRule->m_nAction = RuleAction::Deny;
+	pRule->setExpiryTime( RuleTime::Forever );
+	pRule->m_bAutomatic = false;
+
+	return pRule;
+}
+
+QString RuleGenerator::word()
+{
+	return QString( pVocabulary[bounded( nVocabulary )] );
+}
+
+QString RuleGenerator::fileName()
+{
+	QString sName = word();
+
+	for ( quint32 i = 0, nWords = 1 + bounded( 5 ); i < nWords; ++i )
+	{
+		sName += " " + word();
+	}
+
+	return sName + "." + pExtensions[bounded( nExtensions )];
+}
+
+QList<QString> RuleGenerator::query()
+{
+	QList<QString> lQuery;
+
+	for ( quint32 i = 0, nWords = 1 + bounded( 3 ); i < nWords; ++i )
+	{
+		lQuery.append( word() );
+	}
+
+	return lQuery;
+}
+
+QString RuleGenerator::userAgent()
+{
+	return QString( "%1 %2.%3.%4" ).arg( pAgents[bounded( nAgents )],
+										QString::number( bounded( 10 ) ),
+										QString::number( bounded( 10 ) ),
+										QString::number( bounded( 100 ) ) );
+}
+
+void RuleGenerator::populate( Manager& oManager, int nRules )
+{
+	oManager.clear();
+
+	Rule* pRule;
+
+	for ( int i = 0; i < nRules; ++i )
+	{
+		const int nType = i % 100;
+
+		if ( nType < 40 )
+		{
+			pRule = ipRule( i & 1 );
+		}
+		else if ( nType < 70 )
+		{
+			pRule = rangeRule( i & 1 );
+		}
+		else if ( nType < 85 )
+		{
+			pRule = hashRule();
+		}
+		else if ( nType < 91 )
+		{
+			pRule = contentRule();
+		}
+		else if ( nType < 94 )
+		{
+			pRule = regExpRule();
+		}
+		else
+		{
+			pRule = userAgentRule();
+		}
+
+		oManager.add( pRule, false );
+	}
+}
+
+QueryHit* RuleGenerator::queryHit()
+{
+	QueryHit* pHit = new QueryHit();
+
+	pHit->m_sDescriptiveName = fileName();
+	pHit->m_nObjectSize      = 1024 + bounded( 1u << 30 );
+
+	Hash* pHash = Hash::fromURN( sha1Urn() );
+	if ( pHash )
+	{
+		pHit->m_vHashes.insert( pHash );
+	}
+
+	return pHit;
+}
@@ -0,0 +1,128 @@
+/*
+** rulegenerator.h
+**
+** Copyright © Quazaa Development Team, 2014.
+** This file is part of the Quazaa Security Library (quazaa.sourceforge.net)
+**
+** The Quazaa Security Library is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** The Quazaa Security Library is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with the Quazaa Security Library; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#ifndef RULEGENERATOR_H
+#define RULEGENERATOR_H
+
+#include <QHostAddress>
+#include <QList>
+#include <QString>
+
+#include "securitymanager.h"
+
+namespace Security
+{
+
+/**
+ * @brief The RuleGenerator class creates synthetic rules, addresses, user agents and QueryHits for
+ * benchmarking. It uses its own pseudo random number generator, so a given seed produces the same
+ * data on every platform and Qt version.
+ */
+class RuleGenerator
+{
+private:
+	quint64 m_nState;
+
+public:
+	/**
+	 * @brief RuleGenerator constructs a generator.
+	 *
+	 * @param nSeed  The seed. Generators with the same seed produce the same sequence of data.
+	 */
+	RuleGenerator( quint64 nSeed );
+
+	/**
+	 * @brief next returns the next 32 bit pseudo random number (xorshift64*).
+	 */
+	quint32         next();
+
+	/**
+	 * @brief bounded returns a pseudo random number in the range [0, nBound).
+	 */
+	quint32         bounded( quint32 nBound );
+
+	/**
+	 * @brief ipv4 generates an IPv4 address.
+	 *
+	 * @param bClustered  If set, the addresses are concentrated within a small number of /16
+	 * networks, as is typical for the peers of a filesharing client and for ban lists. Otherwise
+	 * they are distributed uniformly over the entire address space.
+	 */
+	QHostAddress    ipv4( bool bClustered );
+
+	IPRule*         ipRule( bool bClustered, RuleAction::Action eAction = RuleAction::Deny );
+
+	/**
+	 * @brief rangeRule generates an IP range rule covering between 16 and 4096 addresses.
+	 */
+	IPRangeRule*    rangeRule( bool bClustered, RuleAction::Action eAction = RuleAction::Deny );
+
+	/**
+	 * @brief denseRangeRule generates an IP range rule of up to 256 addresses within 10.0.0.0/21
+	 * with a random action, expiry time and hit count, so that generated ranges overlap, touch and
+	 * contain each other frequently.
+	 */
+	IPRangeRule*    denseRangeRule();
+
+	/**
+	 * @brief sha1Urn generates the URN of a random SHA1 hash.
+	 */
+	QString         sha1Urn();
+
+	HashRule*       hashRule();
+	ContentRule*    contentRule();
+	RegularExpressionRule* regExpRule();
+	UserAgentRule*  userAgentRule();
+
+	/**
+	 * @brief word returns a word of a small vocabulary, so generated content rules, queries and
+	 * file names overlap like real ones do.
+	 */
+	QString         word();
+
+	QString         fileName();
+	QList<QString>  query();
+	QString         userAgent();
+
+	/**
+	 * @brief populate clears a Manager and fills it with a synthetic rule set. Per 100 rules, it
+	 * contains 40 IP, 30 IP range, 15 hash, 6 keyword, 3 regular expression and 6 user agent rules,
+	 * which roughly resembles the blocklists users import.
+	 *
+	 * @param oManager  The Manager.
+	 * @param nRules    The number of rules to generate.
+	 */
+	void            populate( Manager& oManager, int nRules );
+
+	/**
+	 * @brief queryHit generates a QueryHit with a SHA1 hash, a file name and a size. The caller
+	 * takes ownership.
+	 */
+	QueryHit*       queryHit();
+};
+
+}
+
+#endif // RULEGENERATOR_H
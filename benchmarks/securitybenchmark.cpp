@@ -0,0 +1,403 @@
+/*
+** securitybenchmark.cpp
+**
+** Copyright © Quazaa Development Team, 2014.
+** This file is part of the Quazaa Security Library (quazaa.sourceforge.net)
+**
+** The Quazaa Security Library is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** The Quazaa Security Library is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with the Quazaa Security Library; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include <QTemporaryFile>
+#include <QTextStream>
+
+#include "securitybenchmark.h"
+
+#include "debug_new.h"
+
+using namespace Security;
+
+// number of lookups performed per benchmark iteration
+#define BENCHMARK_LOOKUPS    4096
+
+// number of rules added, removed or expired per benchmark
+#define BENCHMARK_CHANGES    1000
+
+void SecurityBenchmark::populate( int nRules, quint64 nSeed )
+{
+	RuleGenerator oGenerator( nSeed );
+	oGenerator.populate( securityManager, nRules );
+}
+
+void SecurityBenchmark::addRulesData()
+{
+	QTest::addColumn<int>( "nRules" );
+
+	QTest::newRow( "1k" )   << 1000;
+	QTest::newRow( "10k" )  << 10000;
+	QTest::newRow( "100k" ) << 100000;
+}
+
+void SecurityBenchmark::initTestCase()
+{
+	securityManager.start();
+
+	// Lookup inputs are generated from a different seed than the rules, half of the addresses
+	// fall into the networks the clustered rules are located in.
+	RuleGenerator oGenerator( 2 );
+
+	m_vAddresses.reserve( BENCHMARK_LOOKUPS );
+	for ( int i = 0; i < BENCHMARK_LOOKUPS; ++i )
+	{
+		m_vAddresses.push_back( oGenerator.ipv4( i & 1 ) );
+	}
+
+	m_vHits.reserve( BENCHMARK_LOOKUPS );
+	for ( int i = 0; i < BENCHMARK_LOOKUPS; ++i )
+	{
+		m_vHits.push_back( oGenerator.queryHit() );
+	}
+
+	m_lQuery = oGenerator.query();
+
+	for ( int i = 0; i < BENCHMARK_LOOKUPS; ++i )
+	{
+		m_lAgents.append( oGenerator.userAgent() );
+	}
+}
+
+void SecurityBenchmark::cleanupTestCase()
+{
+	securityManager.clear();
+	securityManager.stop();
+
+	for ( std::vector<QueryHit*>::iterator it = m_vHits.begin(); it != m_vHits.end(); ++it )
+	{
+		delete *it;
+	}
+	m_vHits.clear();
+}
+
+void SecurityBenchmark::cleanup()
+{
+	// process pending commits to prevent them from running during the next benchmark
+	QCoreApplication::processEvents();
+	securityManager.m_oSanity.sanityCheck();
+	securityManager.clear();
+}
+
+void SecurityBenchmark::isDeniedAddressCold_data()
+{
+	addRulesData();
+}
+
+void SecurityBenchmark::isDeniedAddressCold()
+{
+	QFETCH( int, nRules );
+	populate( nRules );
+
+	QBENCHMARK
+	{
+		securityManager.m_oMissCache.clear();
+
+		for ( int i = 0; i < BENCHMARK_LOOKUPS; ++i )
+		{
+			securityManager.isDenied( EndPoint( m_vAddresses[i] ) );
+		}
+	}
+}
+
+void SecurityBenchmark::isDeniedAddressWarm_data()
+{
+	addRulesData();
+}
+
+void SecurityBenchmark::isDeniedAddressWarm()
+{
+	QFETCH( int, nRules );
+	populate( nRules );
+
+	for ( int i = 0; i < BENCHMARK_LOOKUPS; ++i )
+	{
+		securityManager.isDenied( EndPoint( m_vAddresses[i] ) );
+	}
+
+	QBENCHMARK
+	{
+		for ( int i = 0; i < BENCHMARK_LOOKUPS; ++i )
+		{
+			securityManager.isDenied( EndPoint( m_vAddresses[i] ) );
+		}
+	}
+}
+
+void SecurityBenchmark::isDeniedHit_data()
+{
+	addRulesData();
+}
+
+void SecurityBenchmark::isDeniedHit()
+{
+	QFETCH( int, nRules );
+	populate( nRules );
+
+	QBENCHMARK
+	{
+		for ( int i = 0; i < BENCHMARK_LOOKUPS; ++i )
+		{
+			securityManager.isDenied( m_vHits[i], m_lQuery );
+		}
+	}
+}
+
+void SecurityBenchmark::isClientBad()
+{
+	QBENCHMARK
+	{
+		for ( int i = 0; i < BENCHMARK_LOOKUPS; ++i )
+		{
+			securityManager.isClientBad( m_lAgents[i] );
+		}
+	}
+}
+
+void SecurityBenchmark::isAgentDenied_data()
+{
+	addRulesData();
+}
+
+void SecurityBenchmark::isAgentDenied()
+{
+	QFETCH( int, nRules );
+	populate( nRules );
+
+	QBENCHMARK
+	{
+		for ( int i = 0; i < BENCHMARK_LOOKUPS; ++i )
+		{
+			securityManager.isAgentDenied( m_lAgents[i] );
+		}
+	}
+}
+
+void SecurityBenchmark::add_data()
+{
+	addRulesData();
+}
+
+void SecurityBenchmark::add()
+{
+	QFETCH( int, nRules );
+	populate( nRules );
+
+	// a different seed avoids adding rules that already exist
+	RuleGenerator oGenerator( 3 );
+	std::vector<Rule*> vRules;
+	vRules.reserve( BENCHMARK_CHANGES );
+
+	for ( int i = 0; i < BENCHMARK_CHANGES; ++i )
+	{
+		switch ( i % 3 )
+		{
+		case 0:
+			vRules.push_back( oGenerator.ipRule( i & 1 ) );
+			break;
+
+		case 1:
+			vRules.push_back( oGenerator.rangeRule( i & 1 ) );
+			break;
+
+		default:
+			vRules.push_back( oGenerator.hashRule() );
+		}
+	}
+
+	// The Manager takes ownership of the rules, so they can only be added once.
+	QBENCHMARK_ONCE
+	{
+		for ( int i = 0; i < BENCHMARK_CHANGES; ++i )
+		{
+			securityManager.add( vRules[i] );
+		}
+	}
+}
+
+void SecurityBenchmark::remove_data()
+{
+	addRulesData();
+}
+
+void SecurityBenchmark::remove()
+{
+	QFETCH( int, nRules );
+	populate( nRules );
+
+	securityManager.m_oRWLock.lockForRead();
+	const std::vector<Rule*> vAll = securityManager.m_vRules;
+	securityManager.m_oRWLock.unlock();
+
+	// remove rules spread over the entire rule set
+	std::vector<Rule*> vRules;
+	const size_t nStep = qMax<size_t>( 1, vAll.size() / BENCHMARK_CHANGES );
+	for ( size_t i = 0; i < vAll.size() && vRules.size() < BENCHMARK_CHANGES; i += nStep )
+	{
+		vRules.push_back( vAll[i] );
+	}
+
+	QBENCHMARK_ONCE
+	{
+		for ( size_t i = 0; i < vRules.size(); ++i )
+		{
+			securityManager.remove( vRules[i] );
+		}
+	}
+}
+
+void SecurityBenchmark::expire_data()
+{
+	addRulesData();
+}
+
+void SecurityBenchmark::expire()
+{
+	QFETCH( int, nRules );
+	populate( nRules );
+
+	const quint32 tPast = common::getTNowUTC() - 60;
+	RuleGenerator oGenerator( 3 );
+
+	for ( int i = 0; i < BENCHMARK_CHANGES; ++i )
+	{
+		Rule* pRule = ( i & 1 ) ? ( Rule* )oGenerator.ipRule( true ) : oGenerator.hashRule();
+		pRule->setExpiryTime( tPast );
+		securityManager.add( pRule, false );
+	}
+
+	QBENCHMARK_ONCE
+	{
+		securityManager.expire();
+	}
+}
+
+void SecurityBenchmark::save_data()
+{
+	addRulesData();
+}
+
+void SecurityBenchmark::save()
+{
+	QFETCH( int, nRules );
+	populate( nRules );
+
+	QTemporaryFile oFile;
+	QVERIFY( oFile.open() );
+
+	QBENCHMARK
+	{
+		oFile.resize( 0 );
+		oFile.seek( 0 );
+
+		securityManager.m_oRWLock.lockForRead();
+		Manager::writeToFile( &securityManager, oFile );
+		securityManager.m_oRWLock.unlock();
+
+		oFile.flush();
+	}
+}
+
+void SecurityBenchmark::load_data()
+{
+	addRulesData();
+}
+
+void SecurityBenchmark::load()
+{
+	QFETCH( int, nRules );
+	populate( nRules );
+
+	QTemporaryFile oFile;
+	QVERIFY( oFile.open() );
+
+	securityManager.m_oRWLock.lockForRead();
+	Manager::writeToFile( &securityManager, oFile );
+	securityManager.m_oRWLock.unlock();
+	oFile.close();
+
+	// load() clears the Manager before reading the file.
+	QBENCHMARK
+	{
+		QVERIFY( securityManager.load( oFile.fileName() ) );
+	}
+}
+
+void SecurityBenchmark::fromP2P_data()
+{
+	addRulesData();
+}
+
+void SecurityBenchmark::fromP2P()
+{
+	QFETCH( int, nRules );
+
+	QTemporaryFile oFile;
+	QVERIFY( oFile.open() );
+
+	{
+		RuleGenerator oGenerator( 4 );
+		QTextStream oStream( &oFile );
+
+		for ( int i = 0; i < nRules; ++i )
+		{
+			IPRangeRule* pRule = oGenerator.rangeRule( i & 1 );
+			oStream << "Synthetic range " << i << ":" << pRule->startIP().toString() << "-"
+					<< pRule->endIP().toString() << "\n";
+			delete pRule;
+		}
+	}
+	oFile.close();
+
+	QBENCHMARK
+	{
+		securityManager.clear();
+		QVERIFY( securityManager.fromP2P( oFile.fileName() ) );
+	}
+}
+
+void SecurityBenchmark::fromXML_data()
+{
+	addRulesData();
+}
+
+void SecurityBenchmark::fromXML()
+{
+	QFETCH( int, nRules );
+	populate( nRules );
+
+	QTemporaryFile oFile;
+	QVERIFY( oFile.open() );
+	oFile.close();
+	QVERIFY( securityManager.toXML( oFile.fileName() ) );
+
+	QBENCHMARK
+	{
+		securityManager.clear();
+		QVERIFY( securityManager.fromXML( oFile.fileName() ) );
+	}
+}
+
+QTEST_GUILESS_MAIN( Security::SecurityBenchmark )
@@ -0,0 +1,102 @@
+/*
+** securitybenchmark.h
+**
+** Copyright © Quazaa Development Team, 2014.
+** This file is part of the Quazaa Security Library (quazaa.sourceforge.net)
+**
+** The Quazaa Security Library is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** The Quazaa Security Library is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with the Quazaa Security Library; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#ifndef SECURITYBENCHMARK_H
+#define SECURITYBENCHMARK_H
+
+#include <vector>
+
+#include <QObject>
+#include <QtTest>
+
+#include "rulegenerator.h"
+
+namespace Security
+{
+
+/**
+ * @brief The SecurityBenchmark class contains the microbenchmarks of the security manager. Every
+ * case operates on the global securityManager populated with a synthetic rule set generated from a
+ * fixed seed, so runs on different builds can be compared with each other.
+ */
+class SecurityBenchmark : public QObject
+{
+	Q_OBJECT
+
+private:
+	std::vector<QHostAddress> m_vAddresses;
+	std::vector<QueryHit*>    m_vHits;
+	QList<QString>            m_lQuery;
+	QList<QString>            m_lAgents;
+
+private:
+	/**
+	 * @brief populate clears the Manager and fills it with a synthetic rule set.
+	 *
+	 * @param nRules  The number of rules to generate.
+	 * @param nSeed   The seed to use for generating the rules.
+	 */
+	void populate( int nRules, quint64 nSeed = 1 );
+
+	/**
+	 * @brief addRulesData adds the rule set sizes to be benchmarked as a data column.
+	 */
+	void addRulesData();
+
+private slots:
+	void initTestCase();
+	void cleanupTestCase();
+	void cleanup();
+
+	void isDeniedAddressCold_data();
+	void isDeniedAddressCold();
+	void isDeniedAddressWarm_data();
+	void isDeniedAddressWarm();
+	void isDeniedHit_data();
+	void isDeniedHit();
+	void isClientBad();
+	void isAgentDenied_data();
+	void isAgentDenied();
+
+	void add_data();
+	void add();
+	void remove_data();
+	void remove();
+	void expire_data();
+	void expire();
+
+	void save_data();
+	void save();
+	void load_data();
+	void load();
+	void fromP2P_data();
+	void fromP2P();
+	void fromXML_data();
+	void fromXML();
+};
+
+}
+
+#endif // SECURITYBENCHMARK_H
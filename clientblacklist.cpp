@@ -0,0 +1,345 @@
+/*
+** clientblacklist.cpp
+**
+** Copyright © Quazaa Development Team, 2014.
+** This file is part of the Quazaa Security Library (quazaa.sourceforge.net)
+**
+** The Quazaa Security Library is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** The Quazaa Security Library is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with the Quazaa Security Library; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include <algorithm>
+
+#include <QFile>
+#include <QTextStream>
+
+#include "clientblacklist.h"
+#include "externals.h"
+#include "useragent.h"
+
+#include "debug_new.h"
+
+using namespace Security;
+
+// built-in entries, see ClientBlacklist for the format
+static const char* const pDefaultEntries[] =
+{
+	// old and bad versions
+	"bad-version <= 2.5.2.0 Shareaza",
+	// fake versions
+	"bad-version >= 3.0.0.0 Shareaza",
+	"bad Shareaza Pro",
+
+#if SECURITY_EXTENDED_CLIENT_BLACKLIST
+	// Dianlei: Shareaza rip-off
+	// add only based on alpha code, need verification for others
+	"bad Dianlei 1.",
+	"bad Dianlei 0.",
+
+	// BearShare
+	"bad BearShare Lite",
+	"bad BearShare Pro",
+	"bad BearShare MP3",        // GPL breaker
+	"bad BearShare Music",      // GPL breaker
+	"bad BearShare 6.",         // iMesh
+
+	"bad Fastload.TV",
+	"bad Fildelarprogram",
+	// Gnutella Turbo (Look into this client some more)
+	"bad Gnutella Turbo",
+	// Identified Shareaza Leecher Mod
+	"bad eMule mod (4)",
+	"bad iMesh",
+	"bad Mastermax File Sharing",
+	"bad Trilix",
+	// Wru (bad GuncDNA based client)
+	"bad Wru",
+
+	// GPL breakers- Clients violating the GPL
+	// See http://www.gnu.org/copyleft/gpl.html
+	// Some other breakers outside the list
+	"bad C -3.0.1",
+	// outdated rip-off
+	"bad eTomi",
+	// Shareaza rip-off / GPL violator
+	"bad FreeTorrentViewer",
+	// Is it bad?
+	"bad K-Lite",
+	// Leechers, do not allow to connect
+	"bad mxie",
+	// ShareZilla (bad Shareaza clone)
+	"bad ShareZilla",
+	// Shareaza rip-off / GPL violator
+	"bad P2P Rocket",
+	// Rip-off with bad tweaks
+	"bad SlingerX",
+	// Not clear why it's bad
+	"bad vagaa",
+	"bad WinMX",
+#endif // SECURITY_EXTENDED_CLIENT_BLACKLIST
+
+	// foxy - leecher client. (Tested, does not upload)
+	// having something like Authentication which is not defined on specification
+	"deny foxy",
+	// i2hub - leecher client. (Tested, does not upload)
+	"deny i2hub 2.0",
+
+	"vendor foxy"
+};
+
+ClientBlacklist::ClientBlacklist()
+{
+	clear();
+
+	for ( size_t i = 0; i < sizeof( pDefaultEntries ) / sizeof( pDefaultEntries[0] ); ++i )
+	{
+		const bool bSuccess = addEntry( QString::fromLatin1( pDefaultEntries[i] ) );
+		Q_ASSERT( bSuccess );
+		Q_UNUSED( bSuccess );
+	}
+}
+
+bool ClientBlacklist::load( const QString& sPath, Environment* pEnvironment )
+{
+	if ( !pEnvironment )
+	{
+		pEnvironment = Environment::global();
+	}
+
+	QFile oFile( sPath );
+
+	if ( !oFile.open( QIODevice::ReadOnly | QIODevice::Text ) )
+	{
+		return false;
+	}
+
+	clear();
+
+	QTextStream fsFile( &oFile );
+	while ( !fsFile.atEnd() )
+	{
+		const QString sLine = fsFile.readLine();
+
+		if ( sLine.trimmed().isEmpty() || sLine.startsWith( '#' ) )
+		{
+			continue;
+		}
+
+		if ( !addEntry( sLine ) )
+		{
+			pEnvironment->log( LogSeverity::Warning,
+							   QObject::tr( "Ignoring invalid client blacklist entry: %1" ).arg( sLine ) );
+		}
+	}
+
+	return true;
+}
+
+bool ClientBlacklist::addEntry( const QString& sLine )
+{
+	const int nSeparator = sLine.indexOf( ' ' );
+
+	if ( nSeparator < 1 || nSeparator + 1 >= sLine.size() )
+	{
+		return false;
+	}
+
+	const QString sType  = sLine.left( nSeparator );
+	const QString sValue = sLine.mid( nSeparator + 1 );
+
+	if ( sType == "bad" )
+	{
+		insert( m_vBadClients, sValue ).bPrefix = true;
+	}
+	else if ( sType == "deny" )
+	{
+		insert( m_vDeniedAgents, sValue ).bPrefix = true;
+	}
+	else if ( sType == "vendor" )
+	{
+		m_lsVendors.insert( packVendor( sValue.trimmed() ) );
+	}
+	else if ( sType == "bad-version" )
+	{
+		// <=|>= <version> <name>
+		const QStringList lArguments = sValue.split( ' ', QString::SkipEmptyParts );
+
+		if ( lArguments.size() < 3 || ( lArguments[0] != "<=" && lArguments[0] != ">=" ) )
+		{
+			return false;
+		}
+
+		ClientVersion oVersion( lArguments[1], ClientVersion::Style::QuazaaDefault );
+
+		if ( oVersion.versionString().isEmpty() )
+		{
+			oVersion = ClientVersion( lArguments[1], ClientVersion::Style::Simple );
+
+			if ( oVersion.versionString().isEmpty() )
+			{
+				return false;
+			}
+		}
+
+		VersionPredicate oPredicate;
+		oPredicate.bLessEqual = lArguments[0] == "<=";
+		oPredicate.nVersion   = oVersion.version();
+
+		const QString sName = QStringList( lArguments.mid( 2 ) ).join( ' ' );
+		insert( m_vBadClients, sName ).vPredicates.push_back( oPredicate );
+	}
+	else
+	{
+		return false;
+	}
+
+	return true;
+}
+
+bool ClientBlacklist::isClientBad( const QString& sUserAgent ) const
+{
+	return match( m_vBadClients, sUserAgent );
+}
+
+bool ClientBlacklist::isAgentDenied( const QString& sUserAgent ) const
+{
+	return match( m_vDeniedAgents, sUserAgent );
+}
+
+bool ClientBlacklist::isVendorBlocked( const QString& sVendor ) const
+{
+	return !m_lsVendors.empty() && m_lsVendors.count( packVendor( sVendor ) );
+}
+
+quint32 ClientBlacklist::packVendor( const QString& sVendor )
+{
+	quint32 nCode = 0;
+
+	for ( int i = 0; i < 4; ++i )
+	{
+		nCode <<= 8;
+
+		if ( i < sVendor.size() )
+		{
+			nCode |= ( quint8 )sVendor.at( i ).toUpper().toLatin1();
+		}
+	}
+
+	return nCode;
+}
+
+void ClientBlacklist::clear()
+{
+	m_vBadClients.assign( 1, Node() );
+	m_vDeniedAgents.assign( 1, Node() );
+	m_lsVendors.clear();
+}
+
+ClientBlacklist::Node& ClientBlacklist::insert( Trie& vTrie, const QString& sString )
+{
+	quint32 nNode = 0;
+
+	for ( int i = 0; i < sString.size(); ++i )
+	{
+		const Node::Edge oEdge( sString.at( i ).toCaseFolded().unicode(), 0 );
+
+		std::vector< Node::Edge >& vEdges = vTrie[nNode].vEdges;
+		std::vector< Node::Edge >::iterator it = std::lower_bound( vEdges.begin(), vEdges.end(),
+																   oEdge );
+
+		if ( it != vEdges.end() && ( *it ).first == oEdge.first )
+		{
+			nNode = ( *it ).second;
+		}
+		else
+		{
+			const quint32 nChild = ( quint32 )vTrie.size();
+			vEdges.insert( it, Node::Edge( oEdge.first, nChild ) );
+
+			// Note: this invalidates vEdges
+			vTrie.push_back( Node() );
+			nNode = nChild;
+		}
+	}
+
+	return vTrie[nNode];
+}
+
+bool ClientBlacklist::match( const Trie& vTrie, const QString& sUserAgent )
+{
+	const int nSize = sUserAgent.size();
+	quint32 nNode = 0;
+
+	for ( int i = 0; ; ++i )
+	{
+		const Node& oNode = vTrie[nNode];
+
+		if ( oNode.bPrefix )
+		{
+			return true;
+		}
+
+		// client names end at the end of the string or in front of a whitespace
+		if ( !oNode.vPredicates.empty() && ( i == nSize || sUserAgent.at( i ).isSpace() ) &&
+			 matchVersion( oNode, sUserAgent, i ) )
+		{
+			return true;
+		}
+
+		if ( i == nSize || oNode.vEdges.empty() )
+		{
+			return false;
+		}
+
+		const Node::Edge oEdge( sUserAgent.at( i ).toCaseFolded().unicode(), 0 );
+		std::vector< Node::Edge >::const_iterator it = std::lower_bound( oNode.vEdges.begin(),
+																		 oNode.vEdges.end(), oEdge );
+
+		if ( it == oNode.vEdges.end() || ( *it ).first != oEdge.first )
+		{
+			return false;
+		}
+
+		nNode = ( *it ).second;
+	}
+}
+
+bool ClientBlacklist::matchVersion( const Node& oNode, const QString& sUserAgent, int nNameSize )
+{
+	// Parsing is only required for the rare agents actually starting with a listed client name.
+	const UserAgent oUserAgent( sUserAgent );
+
+	if ( oUserAgent.clientName().compare( sUserAgent.left( nNameSize ).trimmed(),
+										  Qt::CaseInsensitive ) )
+	{
+		return false;
+	}
+
+	const quint32 nVersion = oUserAgent.clientVersion().version();
+
+	for ( std::vector< VersionPredicate >::const_iterator it = oNode.vPredicates.begin();
+		  it != oNode.vPredicates.end(); ++it )
+	{
+		if ( ( *it ).bLessEqual ? nVersion <= ( *it ).nVersion : nVersion >= ( *it ).nVersion )
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
@@ -0,0 +1,181 @@
+/*
+** clientblacklist.h
+**
+** Copyright © Quazaa Development Team, 2014.
+** This file is part of the Quazaa Security Library (quazaa.sourceforge.net)
+**
+** The Quazaa Security Library is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** The Quazaa Security Library is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with the Quazaa Security Library; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#ifndef CLIENTBLACKLIST_H
+#define CLIENTBLACKLIST_H
+
+#include <unordered_set>
+#include <vector>
+
+#include <QString>
+
+namespace Security
+{
+
+class Environment;
+
+/**
+ * @brief The ClientBlacklist class holds the built-in lists of bad clients, denied user agents and
+ * blocked vendor codes. User agents are matched against a case folded prefix trie, so all entries
+ * of a list are decided within a single pass over the agent string. Vendor codes are packed into
+ * 32 bit integers and looked up in a set.
+ *
+ * The lists can be replaced at runtime by loading a data file. Each line contains one entry:
+ * <br><code>bad &lt;prefix&gt;</code> - isClientBad() for agents starting with prefix
+ * <br><code>bad-version &lt;=|&gt;= &lt;version&gt; &lt;name&gt;</code> - isClientBad() for
+ * agents with the client name name and a version matching the predicate
+ * <br><code>deny &lt;prefix&gt;</code> - isAgentDenied() for agents starting with prefix
+ * <br><code>vendor &lt;code&gt;</code> - isVendorBlocked() for vendor codes starting with code
+ * <br>Empty lines and lines starting with '#' are ignored. Matching is case insensitive.
+ */
+class ClientBlacklist
+{
+#ifndef QUAZAA_SETUP_UNIT_TESTS
+private:
+#else
+public:
+#endif
+	struct VersionPredicate
+	{
+		bool    bLessEqual;     // true: version <= nVersion; false: version >= nVersion
+		quint32 nVersion;
+	};
+
+	struct Node
+	{
+		typedef std::pair< ushort, quint32 > Edge; // case folded character, child node
+
+		std::vector< Edge >             vEdges;         // sorted by character
+		std::vector< VersionPredicate > vPredicates;    // for client names ending at this node
+		bool                            bPrefix;        // a prefix entry ends at this node
+
+		Node() :
+			bPrefix( false )
+		{
+		}
+	};
+
+	typedef std::vector< Node > Trie;
+
+	Trie                        m_vBadClients;
+	Trie                        m_vDeniedAgents;
+	std::unordered_set<quint32> m_lsVendors;
+
+public:
+	/**
+	 * @brief ClientBlacklist constructs a blacklist containing the built-in entries.
+	 */
+	ClientBlacklist();
+
+	/**
+	 * @brief load replaces all entries with the entries of a data file.
+	 *
+	 * @param sPath         The location of the data file.
+	 * @param pEnvironment  The environment invalid entries are reported to; NULL for the default
+	 * environment.
+	 * @return <code>true</code> if the file could be read; <br><code>false</code> otherwise
+	 */
+	bool            load( const QString& sPath, Environment* pEnvironment = NULL );
+
+	/**
+	 * @brief addEntry parses a single entry in data file format and adds it to the blacklist.
+	 *
+	 * @param sLine  The entry.
+	 * @return <code>true</code> if the entry could be parsed; <br><code>false</code> otherwise
+	 */
+	bool            addEntry( const QString& sLine );
+
+	/**
+	 * @brief isClientBad checks a user agent against the list of bad clients.
+	 *
+	 * @param sUserAgent  The user agent string.
+	 * @return <code>true</code> if the client is bad; <br><code>false</code> otherwise
+	 */
+	bool            isClientBad( const QString& sUserAgent ) const;
+
+	/**
+	 * @brief isAgentDenied checks a user agent against the list of denied agents.
+	 *
+	 * @param sUserAgent  The user agent string.
+	 * @return <code>true</code> if the agent is denied; <br><code>false</code> otherwise
+	 */
+	bool            isAgentDenied( const QString& sUserAgent ) const;
+
+	/**
+	 * @brief isVendorBlocked checks a vendor code against the list of blocked vendors.
+	 *
+	 * @param sVendor  The vendor code.
+	 * @return <code>true</code> if the vendor is blocked; <br><code>false</code> otherwise
+	 */
+	bool            isVendorBlocked( const QString& sVendor ) const;
+
+	/**
+	 * @brief packVendor packs the first 4 characters of a vendor code case insensitively into a
+	 * 32 bit integer.
+	 *
+	 * @param sVendor  The vendor code.
+	 * @return the packed code
+	 */
+	static quint32  packVendor( const QString& sVendor );
+
+private:
+	/**
+	 * @brief clear removes all entries.
+	 */
+	void            clear();
+
+	/**
+	 * @brief insert adds a string to a trie.
+	 *
+	 * @param vTrie    The trie.
+	 * @param sString  The string.
+	 * @return the node the string ends at
+	 */
+	static Node&    insert( Trie& vTrie, const QString& sString );
+
+	/**
+	 * @brief match walks a trie along sUserAgent.
+	 *
+	 * @param vTrie       The trie.
+	 * @param sUserAgent  The user agent string.
+	 * @return <code>true</code> if an entry matches; <br><code>false</code> otherwise
+	 */
+	static bool     match( const Trie& vTrie, const QString& sUserAgent );
+
+	/**
+	 * @brief matchVersion evaluates the version predicates of a node against sUserAgent.
+	 *
+	 * @param oNode       The node.
+	 * @param sUserAgent  The user agent string.
+	 * @param nNameSize   The length of the client name represented by oNode.
+	 * @return <code>true</code> if the client name of sUserAgent equals the name represented by
+	 * oNode and a predicate matches; <br><code>false</code> otherwise
+	 */
+	static bool     matchVersion( const Node& oNode, const QString& sUserAgent, int nNameSize );
+};
+
+}
+
+#endif // CLIENTBLACKLIST_H
@@ -22,9 +22,6 @@
 ** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 */
 
-#include <QDebug>
-#include <QRegularExpression>
-
 #include "clientversion.h"
 
 ClientVersion::ClientVersion() :
@@ -35,104 +32,23 @@ ClientVersion::ClientVersion() :
 }
 
 ClientVersion::ClientVersion( const QString& sVersion , Style eStyle ) :
-	m_eStyle( eStyle )
+	m_eStyle( eStyle ),
+	m_nVersion( 0 )
 {
-	qDebug() << "Parsing ClientVersion String: " << sVersion.toLocal8Bit().data();
-
-	quint8 bytes[4];
-
-	bytes[0] = 0;
-	bytes[1] = 0;
-	bytes[2] = 0;
-	bytes[3] = 0;
+	const QString sTmp = sVersion.trimmed();
+	const int nEnd = scan( sTmp, 0, eStyle, m_nVersion );
 
-	QString sTmp = sVersion.trimmed();
-	int nVersionLength = 0;
-
-	switch ( eStyle )
+	if ( nEnd != -1 )
 	{
-	case Style::QuazaaDefault:
-	{
-		int n, nPos;
-		for ( quint8 i = 3; i > 0; --i )
-		{
-			nPos = sTmp.indexOf( '.' );
-			bytes[i] = sTmp.left( nPos ).toUInt();
-			sTmp = sTmp.mid( nPos + 1 );
-		}
-
-		if ( sTmp.indexOf( QRegularExpression( "(1[0-9][0-9]|2[0-4][0-9]|25[0-5])" ) ) == 0 )
-		{
-			n = 3;
-		}
-		else if ( sTmp.indexOf( QRegularExpression( "[1-9][0-9]" ) ) == 0 )
-		{
-			n = 2;
-		}
-		else
-		{
-#ifdef _DEBUG
-			Q_ASSERT( sTmp.indexOf( QRegularExpression( "[0-9]" ) ) == 0 );
-#endif // _DEBUG
-			n = 1;
-		}
-
-		bytes[0] = sTmp.left( n ).toUInt();
-
-		nVersionLength = sVersion.size() - sTmp.size() + n;
-
-		break;
+		m_sVersion = sTmp.left( nEnd );
 	}
-	case Style::eMule:
-	case Style::Simple:
-	{
-		int nPos = sTmp.indexOf( '.' );
-		bytes[3] = sTmp.left( nPos ).toUInt();
-		sTmp     = sTmp.mid( nPos + 1 );
-
-		int n;
-		if ( sTmp.indexOf( QRegularExpression( "(1[0-9][0-9]|2[0-4][0-9]|25[0-5])" ) ) == 0 )
-		{
-			n = 3;
-		}
-		else if ( sTmp.indexOf( QRegularExpression( "[0-9][0-9]" ) ) == 0 )
-		{
-			n = 2;
-		}
-		else
-		{
-#ifdef _DEBUG
-			Q_ASSERT( sTmp.indexOf( QRegularExpression( "[0-9]" ) ) == 0 );
-#endif // _DEBUG
-			n = 1;
-		}
-
-		bytes[2] = sTmp.left( n ).toUInt();
-		nVersionLength = sVersion.size() - sTmp.size() + n;
-
-		if ( eStyle == Style::eMule )
-		{
-			Q_ASSERT( n == 2 );
-			QChar cVersion = sTmp[2];
-			Q_ASSERT( cVersion.isLower() );
-			ushort nVal = cVersion.unicode() - QChar( 'a' ).unicode();
-			Q_ASSERT( nVal >= 0 && nVal <= 26 );
-			bytes[1] = ( quint8 )nVal;
-
-			++nVersionLength;
-		}
-
-		break;
-	}
-	default:
-		// do nothing
-		break;
-	}
-
-	m_nVersion = *( quint32* )( &bytes );
-	m_sVersion = sVersion.left( nVersionLength );
+}
 
-	qDebug() << "Extracted version number: " << m_nVersion;
+ClientVersion::ClientVersion( Style eStyle, quint32 nVersion, const QString& sVersion ) :
+	m_eStyle( eStyle ),
+	m_nVersion( nVersion ),
+	m_sVersion( sVersion )
+{
 }
 
 ClientVersion& ClientVersion::operator=( const ClientVersion& other )
@@ -178,3 +94,100 @@ QString ClientVersion::versionString() const
 {
 	return m_sVersion;
 }
+
+int ClientVersion::scan( const QString& sString, int nPos, Style eStyle, quint32& nVersion )
+{
+	quint8 bytes[4] = { 0, 0, 0, 0 };
+
+	// number of dot separated numbers
+	const quint8 nNumbers = ( eStyle == Style::QuazaaDefault ) ? 4 : 2;
+
+	switch ( eStyle )
+	{
+	case Style::QuazaaDefault:
+	case Style::eMule:
+	case Style::Simple:
+	{
+		for ( quint8 i = 0; i < nNumbers; ++i )
+		{
+			if ( i )
+			{
+				if ( nPos >= sString.size() || sString.at( nPos ) != '.' )
+				{
+					return -1;
+				}
+				++nPos;
+			}
+
+			nPos = scanNumber( sString, nPos, bytes[3 - i] );
+
+			if ( nPos == -1 )
+			{
+				return -1;
+			}
+		}
+
+		if ( eStyle == Style::eMule )
+		{
+			// the minor version is directly followed by a lower case letter
+			if ( nPos >= sString.size() )
+			{
+				return -1;
+			}
+
+			const ushort c = sString.at( nPos ).unicode();
+
+			if ( c < 'a' || c > 'z' )
+			{
+				return -1;
+			}
+
+			bytes[1] = ( quint8 )( c - 'a' );
+			++nPos;
+		}
+
+		break;
+	}
+	default:
+		return -1;
+	}
+
+	nVersion = ( ( quint32 )bytes[3] << 24 ) | ( ( quint32 )bytes[2] << 16 ) |
+			   ( ( quint32 )bytes[1] <<  8 ) |   ( quint32 )bytes[0];
+
+	return nPos;
+}
+
+int ClientVersion::scanNumber( const QString& sString, int nPos, quint8& nValue )
+{
+	const int nSize = sString.size();
+
+	if ( nPos >= nSize || sString.at( nPos ).unicode() < '0' || sString.at( nPos ).unicode() > '9' )
+	{
+		return -1;
+	}
+
+	quint16 nNumber = sString.at( nPos ).unicode() - '0';
+	++nPos;
+
+	// no leading zeros
+	if ( nNumber )
+	{
+		// at most 3 digits, value may not exceed 255
+		for ( quint8 i = 1; i < 3 && nPos < nSize; ++i )
+		{
+			const ushort c = sString.at( nPos ).unicode();
+
+			if ( c < '0' || c > '9' || nNumber * 10 + ( c - '0' ) > 255 )
+			{
+				break;
+			}
+
+			nNumber = nNumber * 10 + ( c - '0' );
+			++nPos;
+		}
+	}
+
+	nValue = ( quint8 )nNumber;
+	return nPos;
+}
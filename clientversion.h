@@ -44,6 +44,7 @@ private:
 public:
 	ClientVersion();
 	ClientVersion( const QString& sVersion, Style eStyle );
+	ClientVersion( Style eStyle, quint32 nVersion, const QString& sVersion );
 
 	ClientVersion& operator=( const ClientVersion& other );
 
@@ -56,6 +57,30 @@ public:
 	Style   style() const;
 	quint32 version() const;
 	QString versionString() const;
+
+	/**
+	 * @brief scan parses a version of the given style starting at nPos without making use of
+	 * regular expressions.
+	 *
+	 * @param sString   The string to parse.
+	 * @param nPos      The position of the first character of the version.
+	 * @param eStyle    The expected version style.
+	 * @param nVersion  Set to the numerical representation of the version on success.
+	 * @return the position after the last character of the version; <br>-1 if no version of the
+	 * requested style starts at nPos
+	 */
+	static int scan( const QString& sString, int nPos, Style eStyle, quint32& nVersion );
+
+private:
+	/**
+	 * @brief scanNumber parses a number in the range 0-255 without leading zeros.
+	 *
+	 * @param sString  The string to parse.
+	 * @param nPos     The position of the first digit.
+	 * @param nValue   Set to the number on success.
+	 * @return the position after the last digit; <br>-1 if there is no digit at nPos
+	 */
+	static int scanNumber( const QString& sString, int nPos, quint8& nValue );
 };
 
 #endif // CLIENTVERSION_H
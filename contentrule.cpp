@@ -104,6 +104,16 @@ bool ContentRule::getAll() const
 	return m_bAll;
 }
 
+const QStringList& ContentRule::getKeywords() const
+{
+	return m_lContent;
+}
+
+bool ContentRule::isSizeRule() const
+{
+	return m_bSize;
+}
+
 bool ContentRule::match( const QString& sFileName ) const
 {
 	for ( ListIterator i = m_lContent.begin() ; i != m_lContent.end() ; ++i )
@@ -52,6 +52,9 @@ public:
 	void    setAll( bool all = true );
 	bool    getAll() const;
 
+	const QStringList& getKeywords() const;
+	bool    isSizeRule() const;
+
 	bool    match( const QString& sFileName ) const;
 	bool    match( const QueryHit* const pHit ) const;
 
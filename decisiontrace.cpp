@@ -0,0 +1,267 @@
+/*
+** decisiontrace.cpp
+**
+** Copyright © Quazaa Development Team, 2014.
+** This file is part of the Quazaa Security Library (quazaa.sourceforge.net)
+**
+** The Quazaa Security Library is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** The Quazaa Security Library is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with the Quazaa Security Library; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include <QDateTime>
+
+#include "decisiontrace.h"
+
+#include "debug_new.h"
+
+using namespace Security;
+
+// Fixed stream version, so traces can be exchanged between builds using different Qt versions.
+#define SECURITY_TRACE_STREAM_VERSION QDataStream::Qt_4_8
+
+DecisionTrace::DecisionTrace() :
+	m_bRecording( 0 ),
+	m_nRecords( 0 )
+{
+}
+
+DecisionTrace::~DecisionTrace()
+{
+	stop();
+}
+
+bool DecisionTrace::start( const QString& sPath )
+{
+	QMutexLocker oLock( &m_oSection );
+
+	stopInternal();
+
+	m_oFile.setFileName( sPath );
+	if ( !m_oFile.open( QIODevice::WriteOnly | QIODevice::Truncate ) )
+	{
+		return false;
+	}
+
+	m_oStream.setDevice( &m_oFile );
+	m_oStream.setVersion( SECURITY_TRACE_STREAM_VERSION );
+
+	m_oStream << ( quint32 )SECURITY_TRACE_MAGIC << ( quint16 )SECURITY_TRACE_VERSION
+			  << ( qint64 )QDateTime::currentMSecsSinceEpoch();
+
+	m_nRecords = 0;
+	m_oTimer.start();
+	m_bRecording.store( 1 );
+
+	return true;
+}
+
+void DecisionTrace::stop()
+{
+	QMutexLocker oLock( &m_oSection );
+	stopInternal();
+}
+
+quint32 DecisionTrace::records()
+{
+	QMutexLocker oLock( &m_oSection );
+	return m_nRecords;
+}
+
+void DecisionTrace::recordAddress( const EndPoint& oAddress, bool bDenied )
+{
+	QMutexLocker oLock( &m_oSection );
+
+	// the recording might have been stopped since isRecording() has been checked
+	if ( !m_bRecording.load() )
+	{
+		return;
+	}
+
+	writeHeader( TraceEvent::Address, bDenied );
+	m_oStream << ( const QHostAddress& )oAddress;
+}
+
+void DecisionTrace::recordHit( const QueryHit* const pHit, const QList<QString>& lQuery,
+							   bool bDenied )
+{
+	QMutexLocker oLock( &m_oSection );
+
+	if ( !m_bRecording.load() )
+	{
+		return;
+	}
+
+	writeHeader( TraceEvent::Hit, bDenied );
+
+	m_oStream << pHit->m_sDescriptiveName.toUtf8() << ( quint64 )pHit->m_nObjectSize;
+
+	const HashSet& vHashes = pHit->m_vHashes;
+	quint8 nHashes = 0;
+
+	for ( quint8 i = 0, nSize = vHashes.size(); i < nSize; ++i )
+	{
+		if ( vHashes[i] )
+		{
+			++nHashes;
+		}
+	}
+
+	m_oStream << nHashes;
+	for ( quint8 i = 0, nSize = vHashes.size(); i < nSize; ++i )
+	{
+		if ( vHashes[i] )
+		{
+			m_oStream << vHashes[i]->toURN().toUtf8();
+		}
+	}
+
+	m_oStream << ( quint8 )qMin( lQuery.size(), 255 );
+	for ( int i = 0, nSize = qMin( lQuery.size(), 255 ); i < nSize; ++i )
+	{
+		m_oStream << lQuery.at( i ).toUtf8();
+	}
+}
+
+void DecisionTrace::recordAgent( const QString& sUserAgent, bool bDenied )
+{
+	QMutexLocker oLock( &m_oSection );
+
+	if ( !m_bRecording.load() )
+	{
+		return;
+	}
+
+	writeHeader( TraceEvent::Agent, bDenied );
+	m_oStream << sUserAgent.toUtf8();
+}
+
+void DecisionTrace::writeHeader( TraceEvent::Type eType, bool bDenied )
+{
+	++m_nRecords;
+	m_oStream << ( quint8 )eType << ( quint32 )m_oTimer.elapsed() << ( quint8 )bDenied;
+}
+
+void DecisionTrace::stopInternal()
+{
+	if ( m_oFile.isOpen() )
+	{
+		m_bRecording.store( 0 );
+		m_oStream.setDevice( NULL );
+		m_oFile.close();
+	}
+}
+
+DecisionTraceReader::DecisionTraceReader() :
+	m_tStart( 0 )
+{
+}
+
+bool DecisionTraceReader::open( const QString& sPath )
+{
+	m_oFile.setFileName( sPath );
+	if ( !m_oFile.open( QIODevice::ReadOnly ) )
+	{
+		return false;
+	}
+
+	m_oStream.setDevice( &m_oFile );
+	m_oStream.setVersion( SECURITY_TRACE_STREAM_VERSION );
+
+	quint32 nMagic;
+	quint16 nVersion;
+	m_oStream >> nMagic >> nVersion >> m_tStart;
+
+	return m_oStream.status() == QDataStream::Ok &&
+		   nMagic == SECURITY_TRACE_MAGIC && nVersion == SECURITY_TRACE_VERSION;
+}
+
+qint64 DecisionTraceReader::startTime() const
+{
+	return m_tStart;
+}
+
+bool DecisionTraceReader::next( TraceRecord& oRecord )
+{
+	if ( m_oStream.atEnd() )
+	{
+		return false;
+	}
+
+	quint8 nType, nDenied;
+	m_oStream >> nType >> oRecord.m_tOffset >> nDenied;
+
+	if ( nType >= TraceEvent::NoOfTypes )
+	{
+		return false;
+	}
+
+	oRecord.m_eType   = ( TraceEvent::Type )nType;
+	oRecord.m_bDenied = nDenied;
+
+	QByteArray baValue;
+
+	switch ( oRecord.m_eType )
+	{
+	case TraceEvent::Address:
+	{
+		QHostAddress oAddress;
+		m_oStream >> oAddress;
+		oRecord.m_oAddress = EndPoint( oAddress );
+		break;
+	}
+
+	case TraceEvent::Hit:
+	{
+		QueryHit* pHit = new QueryHit();
+		oRecord.m_pHit = QSharedPointer<QueryHit>( pHit );
+
+		quint64 nSize;
+		m_oStream >> baValue >> nSize;
+		pHit->m_sDescriptiveName = QString::fromUtf8( baValue );
+		pHit->m_nObjectSize      = nSize;
+
+		quint8 nCount;
+		m_oStream >> nCount;
+		for ( quint8 i = 0; i < nCount; ++i )
+		{
+			m_oStream >> baValue;
+
+			Hash* pHash = Hash::fromURN( QString::fromUtf8( baValue ) );
+			if ( pHash )
+			{
+				pHit->m_vHashes.insert( pHash );
+			}
+		}
+
+		oRecord.m_lQuery.clear();
+		m_oStream >> nCount;
+		for ( quint8 i = 0; i < nCount; ++i )
+		{
+			m_oStream >> baValue;
+			oRecord.m_lQuery.append( QString::fromUtf8( baValue ) );
+		}
+		break;
+	}
+
+	default:
+		m_oStream >> baValue;
+		oRecord.m_sAgent = QString::fromUtf8( baValue );
+	}
+
+	return m_oStream.status() == QDataStream::Ok;
+}
@@ -0,0 +1,227 @@
+/*
+** decisiontrace.h
+**
+** Copyright © Quazaa Development Team, 2014.
+** This file is part of the Quazaa Security Library (quazaa.sourceforge.net)
+**
+** The Quazaa Security Library is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** The Quazaa Security Library is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with the Quazaa Security Library; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#ifndef DECISIONTRACE_H
+#define DECISIONTRACE_H
+
+#include <QAtomicInt>
+#include <QDataStream>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QMutex>
+#include <QSharedPointer>
+
+#include "externals.h"
+
+// trace file identifier ("QSDT") and format version
+#define SECURITY_TRACE_MAGIC   0x51534454
+#define SECURITY_TRACE_VERSION 1
+
+namespace Security
+{
+
+namespace TraceEvent
+{
+/**
+ * @brief The Type enum describes the different kinds of checks recorded in a decision trace.
+ */
+enum Type
+{
+	Address = 0, Hit = 1, Agent = 2, NoOfTypes = 3
+};
+}
+
+/**
+ * @brief The TraceRecord struct holds a single check read from a decision trace.
+ */
+struct TraceRecord
+{
+	TraceEvent::Type        m_eType;
+
+	// time of the check in ms since the recording has been started
+	quint32                 m_tOffset;
+
+	// the verdict returned at recording time
+	bool                    m_bDenied;
+
+	EndPoint                m_oAddress; // TraceEvent::Address only
+	QString                 m_sAgent;   // TraceEvent::Agent only
+	QSharedPointer<QueryHit> m_pHit;    // TraceEvent::Hit only
+	QList<QString>          m_lQuery;   // TraceEvent::Hit only
+};
+
+/**
+ * @brief The DecisionTrace class records the checks performed by the Manager, including their
+ * verdicts, into a compact binary file. Traces can be replayed against other rule sets or
+ * engine configurations using DecisionTraceReader.
+ *
+ * Format: magic (quint32), version (quint16), start time (qint64, ms since epoch), followed by
+ * records made of type (quint8), time offset (quint32, ms), verdict (quint8) and the type specific
+ * payload. Strings are stored as UTF-8, hashes as URNs.
+ */
+class DecisionTrace
+{
+#ifndef QUAZAA_SETUP_UNIT_TESTS
+private:
+#else
+public:
+#endif
+	QMutex          m_oSection;
+	QAtomicInt      m_bRecording;
+
+	QFile           m_oFile;
+	QDataStream     m_oStream;
+	QElapsedTimer   m_oTimer;
+
+	quint32         m_nRecords;
+
+public:
+	DecisionTrace();
+	~DecisionTrace();
+
+	/**
+	 * @brief start starts recording to the specified file. A running recording is stopped first.
+	 * <br><b>Locking: /</b> (locks m_oSection internally)
+	 *
+	 * @param sPath  The file to record to. It is overwritten if it exists.
+	 * @return <code>true</code> if the file could be opened; <br><code>false</code> otherwise
+	 */
+	bool            start( const QString& sPath );
+
+	/**
+	 * @brief stop finishes the recording and closes the trace file.
+	 * <br><b>Locking: /</b> (locks m_oSection internally)
+	 */
+	void            stop();
+
+	/**
+	 * @brief isRecording allows to check whether checks need to be recorded at all.
+	 * <br><b>Locking: /</b>
+	 */
+	inline bool     isRecording() const
+	{
+		return m_bRecording.load();
+	}
+
+	/**
+	 * @brief records allows to access the number of records written since the recording has been
+	 * started.
+	 * <br><b>Locking: /</b> (locks m_oSection internally)
+	 */
+	quint32         records();
+
+	/**
+	 * @brief recordAddress records an address check.
+	 * <br><b>Locking: /</b> (locks m_oSection internally)
+	 */
+	void            recordAddress( const EndPoint& oAddress, bool bDenied );
+
+	/**
+	 * @brief recordHit records a QueryHit check.
+	 * <br><b>Locking: /</b> (locks m_oSection internally)
+	 *
+	 * @param pHit     The QueryHit.
+	 * @param lQuery   The keywords of the search the hit belongs to.
+	 * @param bDenied  The verdict.
+	 */
+	void            recordHit( const QueryHit* const pHit, const QList<QString>& lQuery,
+							   bool bDenied );
+
+	/**
+	 * @brief recordAgent records a user agent check.
+	 * <br><b>Locking: /</b> (locks m_oSection internally)
+	 */
+	void            recordAgent( const QString& sUserAgent, bool bDenied );
+
+private:
+	/**
+	 * @brief writeHeader writes the common part of a record. Caller must hold m_oSection.
+	 */
+	void            writeHeader( TraceEvent::Type eType, bool bDenied );
+
+	/**
+	 * @brief stopInternal closes the file. Caller must hold m_oSection.
+	 */
+	void            stopInternal();
+};
+
+/**
+ * @brief The DecisionTraceReader class reads the records of a trace written by DecisionTrace.
+ */
+class DecisionTraceReader
+{
+private:
+	QFile           m_oFile;
+	QDataStream     m_oStream;
+	qint64          m_tStart;
+
+public:
+	DecisionTraceReader();
+
+	/**
+	 * @brief open opens a trace file and verifies its header.
+	 *
+	 * @param sPath  The trace file.
+	 * @return <code>true</code> if the file is a trace of a supported version;
+	 * <br><code>false</code> otherwise
+	 */
+	bool            open( const QString& sPath );
+
+	/**
+	 * @brief startTime allows to access the time the recording has been started at.
+	 *
+	 * @return the time in ms since epoch
+	 */
+	qint64          startTime() const;
+
+	/**
+	 * @brief next reads the next record.
+	 *
+	 * @param oRecord  Receives the record.
+	 * @return <code>true</code> if a record has been read; <br><code>false</code> at the end of the
+	 * trace or if the trace is corrupt
+	 */
+	bool            next( TraceRecord& oRecord );
+};
+
+}
+
+#if SECURITY_ENABLE_DECISION_TRACE
+#define SECURITY_TRACE_ADDRESS( oTrace, oAddress, bDenied ) \
+	do { if ( ( oTrace ).isRecording() ) \
+		( oTrace ).recordAddress( oAddress, bDenied ); } while ( 0 )
+#define SECURITY_TRACE_HIT( oTrace, pHit, lQuery, bDenied ) \
+	do { if ( ( oTrace ).isRecording() ) \
+		( oTrace ).recordHit( pHit, lQuery, bDenied ); } while ( 0 )
+#define SECURITY_TRACE_AGENT( oTrace, sUserAgent, bDenied ) \
+	do { if ( ( oTrace ).isRecording() ) \
+		( oTrace ).recordAgent( sUserAgent, bDenied ); } while ( 0 )
+#else
+#define SECURITY_TRACE_ADDRESS( oTrace, oAddress, bDenied )
+#define SECURITY_TRACE_HIT( oTrace, pHit, lQuery, bDenied )
+#define SECURITY_TRACE_AGENT( oTrace, sUserAgent, bDenied )
+#endif // SECURITY_ENABLE_DECISION_TRACE
+
+#endif // DECISIONTRACE_H
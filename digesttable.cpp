@@ -0,0 +1,181 @@
+/*
+** digesttable.cpp
+**
+** Copyright © Quazaa Development Team, 2014.
+** This file is part of the Quazaa Security Library (quazaa.sourceforge.net)
+**
+** The Quazaa Security Library is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** The Quazaa Security Library is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with the Quazaa Security Library; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include "digesttable.h"
+#include "hashrule.h"
+
+#include "debug_new.h"
+
+using namespace Security;
+
+// initial number of buckets, must be a power of 2
+#define DIGEST_TABLE_MIN_SIZE 16
+
+DigestTable::DigestTable() :
+	m_nCount( 0 )
+{
+}
+
+quint32 DigestTable::count() const
+{
+	return m_nCount;
+}
+
+void DigestTable::clear()
+{
+	m_vBuckets.clear();
+	m_nCount = 0;
+}
+
+void DigestTable::insert( const QByteArray& baDigest, HashRule* pRule )
+{
+	Q_ASSERT( pRule );
+
+	// keep the load factor at or below 1/2 to keep probe sequences short
+	if ( 2 * ( m_nCount + 1 ) > m_vBuckets.size() )
+	{
+		grow();
+	}
+
+	insertInternal( qHash( baDigest ), baDigest, pRule );
+	++m_nCount;
+}
+
+bool DigestTable::remove( const QByteArray& baDigest, const HashRule* const pRule )
+{
+	if ( !m_nCount )
+	{
+		return false;
+	}
+
+	const quint32 nMask = ( quint32 )m_vBuckets.size() - 1;
+	const uint    nHash = qHash( baDigest );
+
+	quint32 nPos = nHash & nMask;
+
+	while ( m_vBuckets[nPos].pRule )
+	{
+		if ( m_vBuckets[nPos].pRule == pRule && m_vBuckets[nPos].nHash == nHash &&
+			 m_vBuckets[nPos].baDigest == baDigest )
+		{
+			break;
+		}
+
+		nPos = ( nPos + 1 ) & nMask;
+	}
+
+	if ( !m_vBuckets[nPos].pRule )
+	{
+		return false;
+	}
+
+	// Backward shift deletion: move following entries of the probe sequence into the gap so no
+	// tombstones are required.
+	quint32 nGap  = nPos;
+	quint32 nNext = ( nPos + 1 ) & nMask;
+
+	while ( m_vBuckets[nNext].pRule )
+	{
+		const quint32 nHome = m_vBuckets[nNext].nHash & nMask;
+
+		// distance of nGap and nNext from the home bucket of the entry at nNext
+		const quint32 nDistGap  = ( nGap  - nHome ) & nMask;
+		const quint32 nDistNext = ( nNext - nHome ) & nMask;
+
+		if ( nDistGap < nDistNext )
+		{
+			m_vBuckets[nGap] = m_vBuckets[nNext];
+			nGap = nNext;
+		}
+
+		nNext = ( nNext + 1 ) & nMask;
+	}
+
+	m_vBuckets[nGap] = Bucket();
+	--m_nCount;
+
+	return true;
+}
+
+HashRule* DigestTable::match( const QByteArray& baDigest, const HashSet& vHashes ) const
+{
+	if ( !m_nCount )
+	{
+		return NULL;
+	}
+
+	const quint32 nMask = ( quint32 )m_vBuckets.size() - 1;
+	const uint    nHash = qHash( baDigest );
+
+	const Bucket* const pBuckets = &m_vBuckets[0];
+
+	for ( quint32 nPos = nHash & nMask; pBuckets[nPos].pRule; nPos = ( nPos + 1 ) & nMask )
+	{
+		if ( pBuckets[nPos].nHash == nHash && pBuckets[nPos].baDigest == baDigest )
+		{
+			// There might be multiple rules containing this digest, so make sure the other hashes
+			// of the rule do not contradict vHashes.
+			if ( pBuckets[nPos].pRule->match( vHashes ) )
+			{
+				return pBuckets[nPos].pRule;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+void DigestTable::grow()
+{
+	BucketVector vOld;
+	vOld.swap( m_vBuckets );
+
+	m_vBuckets.resize( vOld.empty() ? DIGEST_TABLE_MIN_SIZE : 2 * vOld.size() );
+
+	for ( BucketVector::const_iterator it = vOld.begin(); it != vOld.end(); ++it )
+	{
+		if ( ( *it ).pRule )
+		{
+			insertInternal( ( *it ).nHash, ( *it ).baDigest, ( *it ).pRule );
+		}
+	}
+}
+
+void DigestTable::insertInternal( uint nHash, const QByteArray& baDigest, HashRule* pRule )
+{
+	const quint32 nMask = ( quint32 )m_vBuckets.size() - 1;
+
+	quint32 nPos = nHash & nMask;
+
+	while ( m_vBuckets[nPos].pRule )
+	{
+		nPos = ( nPos + 1 ) & nMask;
+	}
+
+	Bucket& oBucket  = m_vBuckets[nPos];
+	oBucket.nHash    = nHash;
+	oBucket.baDigest = baDigest;
+	oBucket.pRule    = pRule;
+}
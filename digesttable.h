@@ -0,0 +1,130 @@
+/*
+** digesttable.h
+**
+** Copyright © Quazaa Development Team, 2014.
+** This file is part of the Quazaa Security Library (quazaa.sourceforge.net)
+**
+** The Quazaa Security Library is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** The Quazaa Security Library is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with the Quazaa Security Library; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#ifndef DIGESTTABLE_H
+#define DIGESTTABLE_H
+
+#include <vector>
+
+#include <QByteArray>
+
+#include "externals.h"
+
+namespace Security
+{
+
+class HashRule;
+
+/**
+ * @brief The DigestTable class maps the raw digests of a single hash algorithm to the HashRules
+ * containing them. It uses open addressing with linear probing, so a lookup usually requires a
+ * single probe into a flat array. Multiple rules may share the same digest.
+ */
+class DigestTable
+{
+#ifndef QUAZAA_SETUP_UNIT_TESTS
+private:
+#else
+public:
+#endif
+	struct Bucket
+	{
+		uint        nHash;      // qHash() of baDigest, compared before the digest itself
+		QByteArray  baDigest;
+		HashRule*   pRule;      // NULL for empty buckets
+
+		Bucket() :
+			nHash( 0 ),
+			pRule( NULL )
+		{
+		}
+	};
+
+	typedef std::vector< Bucket > BucketVector;
+
+	BucketVector    m_vBuckets;     // size is always 0 or a power of 2
+	quint32         m_nCount;
+
+public:
+	/**
+	 * @brief DigestTable constructs an empty table.
+	 */
+	DigestTable();
+
+	/**
+	 * @brief count allows to access the number of entries within the table.
+	 *
+	 * @return the number of entries
+	 */
+	quint32     count() const;
+
+	/**
+	 * @brief clear removes all entries from the table.
+	 */
+	void        clear();
+
+	/**
+	 * @brief insert adds an entry to the table. Entries with the same digest for different rules
+	 * are allowed.
+	 *
+	 * @param baDigest  The raw digest.
+	 * @param pRule     The rule containing the digest. May not be NULL.
+	 */
+	void        insert( const QByteArray& baDigest, HashRule* pRule );
+
+	/**
+	 * @brief remove removes the entry of a rule for a given digest.
+	 *
+	 * @param baDigest  The raw digest.
+	 * @param pRule     The rule.
+	 * @return <code>true</code> if an entry has been removed; <br><code>false</code> otherwise
+	 */
+	bool        remove( const QByteArray& baDigest, const HashRule* const pRule );
+
+	/**
+	 * @brief match looks up the rules containing baDigest and returns the first one matching
+	 * vHashes.
+	 *
+	 * @param baDigest  The raw digest to look up.
+	 * @param vHashes   The HashSet baDigest has been taken from.
+	 * @return the matching HashRule; <br><code>NULL</code> if there is none
+	 */
+	HashRule*   match( const QByteArray& baDigest, const HashSet& vHashes ) const;
+
+private:
+	/**
+	 * @brief grow doubles the capacity of the table and re-inserts all entries.
+	 */
+	void        grow();
+
+	/**
+	 * @brief insertInternal inserts an entry without checking the load factor.
+	 */
+	void        insertInternal( uint nHash, const QByteArray& baDigest, HashRule* pRule );
+};
+
+}
+
+#endif // DIGESTTABLE_H
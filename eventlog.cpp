@@ -0,0 +1,439 @@
+/*
+** eventlog.cpp
+**
+** Copyright © Quazaa Development Team, 2014.
+** This file is part of the Quazaa Security Library (quazaa.sourceforge.net)
+**
+** The Quazaa Security Library is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** The Quazaa Security Library is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with the Quazaa Security Library; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include <cstring>
+
+#include <QLocale>
+#include <QThread>
+
+#include "eventlog.h"
+
+#include "debug_new.h"
+
+namespace Security
+{
+/**
+ * @brief The EventLogConsumer class runs EventLog::consume() in the background.
+ */
+class EventLogConsumer : public QThread
+{
+private:
+	EventLog&   m_rLog;
+
+public:
+	EventLogConsumer( EventLog& rLog ) :
+		m_rLog( rLog )
+	{
+	}
+
+protected:
+	void run()
+	{
+		m_rLog.consume();
+	}
+};
+}
+
+using namespace Security;
+
+EventLog::EventLog( Environment* pEnvironment ) :
+	m_pCells( new Cell[SECURITY_LOG_QUEUE_SIZE] ),
+	m_nEnqueuePos( 0 ),
+	m_nDequeuePos( 0 ),
+	m_nDropped( 0 ),
+	m_pConsumer( NULL ),
+	m_bStop( 0 ),
+	m_pEnvironment( pEnvironment ? pEnvironment : Environment::global() ),
+	m_tWindowStart( 0 )
+{
+	Q_ASSERT( !( SECURITY_LOG_QUEUE_SIZE & ( SECURITY_LOG_QUEUE_SIZE - 1 ) ) );
+
+	for ( int i = 0; i < SECURITY_LOG_QUEUE_SIZE; ++i )
+	{
+		m_pCells[i].m_nSequence.store( i );
+	}
+
+	for ( int i = 0; i < LogEvent::NoOfEvents; ++i )
+	{
+		m_pEvents[i] = 0;
+		m_pLogged[i] = 0;
+	}
+}
+
+EventLog::~EventLog()
+{
+	stop();
+	delete[] m_pCells;
+}
+
+void EventLog::start()
+{
+	if ( m_pConsumer )
+	{
+		return;
+	}
+
+	m_tWindowStart = m_pEnvironment->now();
+	m_bStop.store( 0 );
+
+	m_pConsumer = new EventLogConsumer( *this );
+	m_pConsumer->start( QThread::LowPriority );
+}
+
+void EventLog::stop()
+{
+	if ( !m_pConsumer )
+	{
+		return;
+	}
+
+	m_oWaitLock.lock();
+	m_bStop.store( 1 );
+	m_oWakeUp.wakeAll();
+	m_oWaitLock.unlock();
+
+	m_pConsumer->wait();
+	delete m_pConsumer;
+	m_pConsumer = NULL;
+
+	flush( true );
+}
+
+void EventLog::post( LogEvent::Type eType, quint32 nValue )
+{
+	LogRecord oRecord;
+	oRecord.m_eType     = eType;
+	oRecord.m_nProtocol = 0;
+	oRecord.m_nValue    = nValue;
+
+	if ( !push( oRecord ) )
+	{
+		m_nDropped.ref();
+	}
+}
+
+void EventLog::post( LogEvent::Type eType, const QHostAddress& oAddress, quint32 nValue )
+{
+	LogRecord oRecord;
+	oRecord.m_eType  = eType;
+	oRecord.m_nValue = nValue;
+	store( oAddress, oRecord.m_oAddress, oRecord.m_nProtocol );
+
+	if ( !push( oRecord ) )
+	{
+		m_nDropped.ref();
+	}
+}
+
+void EventLog::post( LogEvent::Type eType, const QHostAddress& oStart, const QHostAddress& oEnd )
+{
+	LogRecord oRecord;
+	oRecord.m_eType  = eType;
+	oRecord.m_nValue = 0;
+	store( oStart, oRecord.m_oAddress, oRecord.m_nProtocol );
+	store( oEnd, oRecord.m_oEndAddress, oRecord.m_nProtocol );
+
+	if ( !push( oRecord ) )
+	{
+		m_nDropped.ref();
+	}
+}
+
+void EventLog::flush( bool bFinal )
+{
+	LogRecord oRecord;
+
+	while ( pop( oRecord ) )
+	{
+		process( oRecord );
+	}
+
+	if ( bFinal || m_pEnvironment->now() >= m_tWindowStart + SECURITY_LOG_SUMMARY_INTERVAL )
+	{
+		summarize();
+	}
+}
+
+quint32 EventLog::dropped() const
+{
+	return ( quint32 )m_nDropped.load();
+}
+
+bool EventLog::push( const LogRecord& oRecord )
+{
+	Cell* pCell;
+	int nPos = m_nEnqueuePos.load();
+
+	forever
+	{
+		pCell = &m_pCells[( quint32 )nPos & ( SECURITY_LOG_QUEUE_SIZE - 1 )];
+		const int nDiff = sequenceDiff( pCell->m_nSequence.loadAcquire(), nPos );
+
+		if ( !nDiff )
+		{
+			// the cell is free, try to claim it
+			if ( m_nEnqueuePos.testAndSetRelaxed( nPos, sequenceAdd( nPos, 1 ) ) )
+			{
+				break;
+			}
+			nPos = m_nEnqueuePos.load();
+		}
+		else if ( nDiff < 0 )
+		{
+			// The cell still holds the record of the previous round: the queue is full.
+			return false;
+		}
+		else
+		{
+			// another producer has claimed the cell in the meantime
+			nPos = m_nEnqueuePos.load();
+		}
+	}
+
+	pCell->m_oRecord = oRecord;
+	pCell->m_nSequence.storeRelease( sequenceAdd( nPos, 1 ) );
+
+	return true;
+}
+
+bool EventLog::pop( LogRecord& oRecord )
+{
+	Cell* pCell;
+	int nPos = m_nDequeuePos.load();
+
+	forever
+	{
+		pCell = &m_pCells[( quint32 )nPos & ( SECURITY_LOG_QUEUE_SIZE - 1 )];
+		const int nDiff = sequenceDiff( pCell->m_nSequence.loadAcquire(), sequenceAdd( nPos, 1 ) );
+
+		if ( !nDiff )
+		{
+			if ( m_nDequeuePos.testAndSetRelaxed( nPos, sequenceAdd( nPos, 1 ) ) )
+			{
+				break;
+			}
+			nPos = m_nDequeuePos.load();
+		}
+		else if ( nDiff < 0 )
+		{
+			// the cell has not been written yet: the queue is empty
+			return false;
+		}
+		else
+		{
+			nPos = m_nDequeuePos.load();
+		}
+	}
+
+	oRecord = pCell->m_oRecord;
+
+	// make the cell available to the producers of the next round
+	pCell->m_nSequence.storeRelease( sequenceAdd( nPos, SECURITY_LOG_QUEUE_SIZE ) );
+
+	return true;
+}
+
+void EventLog::consume()
+{
+	m_oWaitLock.lock();
+
+	while ( !m_bStop.load() )
+	{
+		m_oWakeUp.wait( &m_oWaitLock, SECURITY_LOG_FLUSH_INTERVAL );
+
+		m_oWaitLock.unlock();
+		flush();
+		m_oWaitLock.lock();
+	}
+
+	m_oWaitLock.unlock();
+}
+
+void EventLog::process( const LogRecord& oRecord )
+{
+	const LogEvent::Type eType = ( LogEvent::Type )oRecord.m_eType;
+
+	++m_pEvents[eType];
+
+	if ( m_pLogged[eType] < SECURITY_LOG_EVENTS_PER_INTERVAL )
+	{
+		++m_pLogged[eType];
+		m_pEnvironment->log( severity( eType ), format( oRecord ) );
+	}
+}
+
+void EventLog::summarize()
+{
+	for ( int i = 0; i < LogEvent::NoOfEvents; ++i )
+	{
+		// Summaries are only needed if events have been suppressed.
+		if ( m_pEvents[i] > m_pLogged[i] )
+		{
+			m_pEnvironment->log( severity( ( LogEvent::Type )i ),
+								 summary( ( LogEvent::Type )i, m_pEvents[i] ) );
+		}
+
+		m_pEvents[i] = 0;
+		m_pLogged[i] = 0;
+	}
+
+	const quint32 nDropped = ( quint32 )m_nDropped.fetchAndStoreRelaxed( 0 );
+	if ( nDropped )
+	{
+		m_pEnvironment->log( LogSeverity::Warning,
+							 QObject::tr( "%1 security events could not be logged (queue full)."
+										).arg( QLocale().toString( nDropped ) ) );
+	}
+
+	m_tWindowStart = m_pEnvironment->now();
+}
+
+QString EventLog::format( const LogRecord& oRecord )
+{
+	const QString sAddress = restore( oRecord.m_oAddress, oRecord.m_nProtocol ).toString();
+
+	switch ( oRecord.m_eType )
+	{
+	case LogEvent::RepeatIPCheck:
+		return QObject::tr( "Skipped repeat IP security check for %1 (%2 IPs cached)."
+						  ).arg( sAddress, QString::number( oRecord.m_nValue ) );
+
+	case LogEvent::FirstIPCheck:
+		return QObject::tr( "Called first-time IP security check for %1." ).arg( sAddress );
+
+	case LogEvent::PrivateIPDenied:
+		return QObject::tr( "Local/Private IP denied: %1" ).arg( sAddress );
+
+	case LogEvent::RuleMerged:
+		return QObject::tr( "A new security rule has been merged into an existing one." );
+
+	case LogEvent::OverlappedRangeRemoved:
+		return QObject::tr( "Merging IP range rules. Removing overlapped IP range %1-%2."
+						  ).arg( sAddress, restore( oRecord.m_oEndAddress,
+													oRecord.m_nProtocol ).toString() );
+
+	case LogEvent::AutoBanEvicted:
+		return QObject::tr( "Automatic ban store full. Evicted the ban of %1." ).arg( sAddress );
+
+	case LogEvent::FloodBan:
+		if ( oRecord.m_nValue )
+		{
+			return QObject::tr( "Flood detected. Automatically banned network %1/%2."
+							  ).arg( sAddress, QString::number( oRecord.m_nValue ) );
+		}
+		return QObject::tr( "Flood detected. Automatically banned %1." ).arg( sAddress );
+
+	default:
+		Q_ASSERT( false );
+		return QString();
+	}
+}
+
+QString EventLog::summary( LogEvent::Type eType, quint32 nCount )
+{
+	const QString sCount = QLocale().toString( nCount );
+	const QString sSeconds = QString::number( SECURITY_LOG_SUMMARY_INTERVAL );
+
+	switch ( eType )
+	{
+	case LogEvent::RepeatIPCheck:
+		return QObject::tr( "%1 repeat IP security checks skipped in the last %2 s."
+						  ).arg( sCount, sSeconds );
+
+	case LogEvent::FirstIPCheck:
+		return QObject::tr( "%1 first-time IP security checks in the last %2 s."
+						  ).arg( sCount, sSeconds );
+
+	case LogEvent::PrivateIPDenied:
+		return QObject::tr( "%1 private IPs denied in the last %2 s." ).arg( sCount, sSeconds );
+
+	case LogEvent::RuleMerged:
+		return QObject::tr( "%1 new security rules merged into existing ones in the last %2 s."
+						  ).arg( sCount, sSeconds );
+
+	case LogEvent::OverlappedRangeRemoved:
+		return QObject::tr( "%1 overlapped IP ranges removed while merging in the last %2 s."
+						  ).arg( sCount, sSeconds );
+
+	case LogEvent::AutoBanEvicted:
+		return QObject::tr( "%1 automatic bans evicted from the full ban store in the last %2 s."
+						  ).arg( sCount, sSeconds );
+
+	case LogEvent::FloodBan:
+		return QObject::tr( "%1 addresses or networks banned for flooding in the last %2 s."
+						  ).arg( sCount, sSeconds );
+
+	default:
+		Q_ASSERT( false );
+		return QString();
+	}
+}
+
+LogSeverity EventLog::severity( LogEvent::Type /*eType*/ )
+{
+	// all current events are security notifications
+	return LogSeverity::Security;
+}
+
+void EventLog::store( const QHostAddress& oAddress, Q_IPV6ADDR& oRaw, quint8& nProtocol )
+{
+	switch ( oAddress.protocol() )
+	{
+	case QAbstractSocket::IPv4Protocol:
+	{
+		const quint32 nIPv4 = oAddress.toIPv4Address();
+		memcpy( &oRaw, &nIPv4, sizeof( nIPv4 ) );
+		nProtocol = 4;
+		break;
+	}
+
+	case QAbstractSocket::IPv6Protocol:
+		oRaw = oAddress.toIPv6Address();
+		nProtocol = 6;
+		break;
+
+	default:
+		nProtocol = 0;
+	}
+}
+
+QHostAddress EventLog::restore( const Q_IPV6ADDR& oRaw, quint8 nProtocol )
+{
+	switch ( nProtocol )
+	{
+	case 4:
+	{
+		quint32 nIPv4;
+		memcpy( &nIPv4, &oRaw, sizeof( nIPv4 ) );
+		return QHostAddress( nIPv4 );
+	}
+
+	case 6:
+		return QHostAddress( oRaw );
+
+	default:
+		return QHostAddress();
+	}
+}
@@ -0,0 +1,220 @@
+/*
+** eventlog.h
+**
+** Copyright © Quazaa Development Team, 2014.
+** This file is part of the Quazaa Security Library (quazaa.sourceforge.net)
+**
+** The Quazaa Security Library is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** The Quazaa Security Library is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with the Quazaa Security Library; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#ifndef EVENTLOG_H
+#define EVENTLOG_H
+
+#include <QAtomicInt>
+#include <QHostAddress>
+#include <QMutex>
+#include <QWaitCondition>
+
+#include "externals.h"
+
+class QThread;
+
+namespace Security
+{
+
+namespace LogEvent
+{
+/**
+ * @brief The Type enum describes the events that can be posted to the EventLog.
+ */
+enum Type
+{
+	RepeatIPCheck = 0, FirstIPCheck = 1, PrivateIPDenied = 2, RuleMerged = 3,
+	OverlappedRangeRemoved = 4, AutoBanEvicted = 5, FloodBan = 6, NoOfEvents = 7
+};
+}
+
+/**
+ * @brief The LogRecord struct holds the raw data of an event. It is formatted by the consumer.
+ */
+struct LogRecord
+{
+	quint8      m_eType;
+	quint8      m_nProtocol;    // 4, 6 or 0 if the record does not contain addresses
+	quint32     m_nValue;       // event specific value (e.g. a number of cached IPs)
+	Q_IPV6ADDR  m_oAddress;     // IPv4 addresses are stored in the first 4 bytes
+	Q_IPV6ADDR  m_oEndAddress;  // end of a range; same protocol as m_oAddress
+};
+
+/**
+ * @brief The EventLog class decouples the checks from formatting and posting log messages.
+ * Producers store a LogRecord in a bounded lock-free queue (Vyukov's MPMC ring), which a
+ * background thread drains every SECURITY_LOG_FLUSH_INTERVAL ms. Only the first
+ * SECURITY_LOG_EVENTS_PER_INTERVAL events of each type within a SECURITY_LOG_SUMMARY_INTERVAL
+ * window are logged individually; the others are summarized at the end of the window.
+ */
+class EventLog
+{
+	friend class EventLogConsumer;
+
+#ifndef QUAZAA_SETUP_UNIT_TESTS
+private:
+#else
+public:
+#endif
+	struct Cell
+	{
+		QAtomicInt  m_nSequence;
+		LogRecord   m_oRecord;
+	};
+
+	Cell*           m_pCells;
+
+	// positions are counted modulo 2^32, use sequenceDiff() to compare them
+	QAtomicInt      m_nEnqueuePos;
+	QAtomicInt      m_nDequeuePos;
+	QAtomicInt      m_nDropped;
+
+	// consumer state
+	QThread*        m_pConsumer;
+	QMutex          m_oWaitLock;
+	QWaitCondition  m_oWakeUp;
+	QAtomicInt      m_bStop;
+
+	// clock and log the events are reported with
+	Environment*    m_pEnvironment;
+
+	quint32         m_tWindowStart;
+	quint32         m_pEvents[LogEvent::NoOfEvents];    // events in the current window
+	quint32         m_pLogged[LogEvent::NoOfEvents];    // events logged individually in it
+
+public:
+	/**
+	 * @brief EventLog constructs an event log.
+	 *
+	 * @param pEnvironment  The environment providing the clock and the system log. If
+	 * <code>NULL</code>, the default environment is used.
+	 */
+	EventLog( Environment* pEnvironment = NULL );
+	~EventLog();
+
+	/**
+	 * @brief start starts the consumer thread.
+	 * <br><b>Locking: /</b>
+	 */
+	void            start();
+
+	/**
+	 * @brief stop stops the consumer thread and logs all remaining events and summaries.
+	 * <br><b>Locking: /</b>
+	 */
+	void            stop();
+
+	/**
+	 * @brief post queues an event. This never blocks; if the queue is full, the event is dropped.
+	 * <br><b>Locking: /</b>
+	 *
+	 * @param eType     The event type.
+	 * @param nValue    An event specific value.
+	 */
+	void            post( LogEvent::Type eType, quint32 nValue = 0 );
+
+	/**
+	 * @brief post queues an event concerning an address.
+	 * <br><b>Locking: /</b>
+	 */
+	void            post( LogEvent::Type eType, const QHostAddress& oAddress, quint32 nValue = 0 );
+
+	/**
+	 * @brief post queues an event concerning an address range.
+	 * <br><b>Locking: /</b>
+	 */
+	void            post( LogEvent::Type eType, const QHostAddress& oStart,
+						  const QHostAddress& oEnd );
+
+	/**
+	 * @brief flush formats and posts all queued events. Summaries are only written if the current
+	 * window has ended or bFinal is set.
+	 * <br><b>Locking: /</b> (must only be called by one thread at a time)
+	 *
+	 * @param bFinal  Set to <code>true</code> to end the current window regardless of its age.
+	 */
+	void            flush( bool bFinal = false );
+
+	/**
+	 * @brief dropped allows to access the number of events dropped since the last summary.
+	 * <br><b>Locking: /</b>
+	 */
+	quint32         dropped() const;
+
+#ifndef QUAZAA_SETUP_UNIT_TESTS
+private:
+#else
+public:
+#endif
+	/**
+	 * @brief push stores a record in the queue.
+	 *
+	 * @return <code>false</code> if the queue was full; <br><code>true</code> otherwise
+	 */
+	bool            push( const LogRecord& oRecord );
+
+	/**
+	 * @brief pop removes the oldest record from the queue.
+	 *
+	 * @return <code>false</code> if the queue was empty; <br><code>true</code> otherwise
+	 */
+	bool            pop( LogRecord& oRecord );
+
+	/**
+	 * @brief consume is the main loop of the consumer thread.
+	 */
+	void            consume();
+
+	/**
+	 * @brief process rate limits and logs a single record.
+	 */
+	void            process( const LogRecord& oRecord );
+
+	/**
+	 * @brief summarize logs the summaries of the current window and starts a new one.
+	 */
+	void            summarize();
+
+	static QString  format( const LogRecord& oRecord );
+	static QString  summary( LogEvent::Type eType, quint32 nCount );
+	static LogSeverity severity( LogEvent::Type eType );
+
+	static void     store( const QHostAddress& oAddress, Q_IPV6ADDR& oRaw, quint8& nProtocol );
+	static QHostAddress restore( const Q_IPV6ADDR& oRaw, quint8 nProtocol );
+
+	static inline int sequenceDiff( int nFirst, int nSecond )
+	{
+		return ( int )( ( quint32 )nFirst - ( quint32 )nSecond );
+	}
+
+	static inline int sequenceAdd( int nPos, int nDelta )
+	{
+		return ( int )( ( quint32 )nPos + ( quint32 )nDelta );
+	}
+};
+
+}
+
+#endif // EVENTLOG_H
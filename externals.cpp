@@ -69,15 +69,25 @@ QString Security::dataPath()
 
 Security::SecuritySettings securitySettings;
 
+Security::SecuritySettings::SecuritySettings() :
+	m_bLogIPCheckHits( false ),
+	m_bIgnorePrivateIPs( false ),
+	m_tRuleExpiryInterval( 0 )
+{
+}
+
 void Security::SecuritySettings::start()
 {
-	connect( &quazaaSettings, &QuazaaSettings::securitySettingsChanged, &securitySettings,
+	connect( &quazaaSettings, &QuazaaSettings::securitySettingsChanged, this,
 			 &Security::SecuritySettings::settingsChanged, Qt::QueuedConnection );
 
 #ifndef QUAZAA_SETUP_UNIT_TESTS
-	// Make sure securityManager is informed about application shutdown.
-	connect( mainWindow, &CWinMain::shutDown, &securityManager, &Security::Manager::shutDown,
-			 Qt::UniqueConnection );
+	if ( this == &securitySettings )
+	{
+		// Make sure securityManager is informed about application shutdown.
+		connect( mainWindow, &CWinMain::shutDown, &securityManager, &Security::Manager::shutDown,
+				 Qt::UniqueConnection );
+	}
 #endif
 
 	settingsChanged();
@@ -86,7 +96,7 @@ void Security::SecuritySettings::start()
 void Security::SecuritySettings::stop()
 {
 	disconnect( &quazaaSettings, &QuazaaSettings::securitySettingsChanged,
-				&securitySettings, &Security::SecuritySettings::settingsChanged );
+				this, &Security::SecuritySettings::settingsChanged );
 }
 
 bool SecuritySettings::logIPCheckHits()
@@ -107,6 +117,20 @@ quint64 SecuritySettings::ruleExpiryInterval()
 	return m_tRuleExpiryInterval;
 }
 
+void SecuritySettings::setValues( bool bLogIPCheckHits, bool bIgnorePrivateIPs,
+								  quint64 tRuleExpiryInterval )
+{
+	m_oLock.lock();
+
+	m_bLogIPCheckHits     = bLogIPCheckHits;
+	m_bIgnorePrivateIPs   = bIgnorePrivateIPs;
+	m_tRuleExpiryInterval = tRuleExpiryInterval;
+
+	m_oLock.unlock();
+
+	emit settingsUpdate();
+}
+
 void Security::SecuritySettings::settingsChanged()
 {
 	m_oLock.lock();
@@ -119,3 +143,56 @@ void Security::SecuritySettings::settingsChanged()
 
 	emit settingsUpdate();
 }
+
+Environment::Environment( SecuritySettings* pSettings, const QString& sDataPath ) :
+	m_pSettings( pSettings ? pSettings : &securitySettings ),
+	m_sDataPath( sDataPath ),
+	m_bApplicationSettings( !pSettings )
+{
+}
+
+Environment::~Environment()
+{
+}
+
+Environment* Environment::global()
+{
+	static Environment oGlobal;
+	return &oGlobal;
+}
+
+void Environment::start()
+{
+	if ( m_bApplicationSettings )
+	{
+		m_pSettings->start();
+	}
+}
+
+void Environment::stop()
+{
+	if ( m_bApplicationSettings )
+	{
+		m_pSettings->stop();
+	}
+}
+
+SecuritySettings& Environment::settings() const
+{
+	return *m_pSettings;
+}
+
+quint32 Environment::now() const
+{
+	return common::getTNowUTC();
+}
+
+void Environment::log( LogSeverity eSeverity, const QString& sMessage, bool bDebug ) const
+{
+	postLogMessage( eSeverity, sMessage, bDebug );
+}
+
+QString Environment::dataPath() const
+{
+	return m_sDataPath.isEmpty() ? Security::dataPath() : m_sDataPath;
+}
@@ -28,6 +28,50 @@
 // the minimal amount of IP related rules before enabling the miss cache
 #define SECURITY_MIN_RULES_TO_ENABLE_CACHE 30
 
+// the maximal number of user agent strings isClientBad() remembers its verdict for
+#define SECURITY_MAX_CACHED_AGENTS 1024
+
+// the default time in ms rule changes are collected before performing a sanity check and saving
+#define SECURITY_COMMIT_DELAY 1000
+
+// the minimal number of items a sanity check worker thread is handed at once by the bulk checks
+#define SECURITY_SANITY_CHECK_CHUNK_SIZE 256
+
+// number of records the security event log queue can hold (must be a power of 2); events posted
+// while it is full are dropped and reported in the next summary
+#define SECURITY_LOG_QUEUE_SIZE 4096
+
+// time in ms between two runs of the event log consumer
+#define SECURITY_LOG_FLUSH_INTERVAL 250
+
+// length of the event log rate limiting window in s and the number of events per type that are
+// logged individually within each window; the remaining ones are summarized at its end
+#define SECURITY_LOG_SUMMARY_INTERVAL 60
+#define SECURITY_LOG_EVENTS_PER_INTERVAL 10
+
+// number of per thread group replicas of the IP lookup indexes isDenied( EndPoint ) uses instead of
+// locking the Manager (see Manager::start()); 0 disables the replicas
+#define SECURITY_IP_REPLICAS 0
+
+// number of hit counter lanes per replica; the threads of a replica count their hits in different
+// lanes to avoid writing to the same cache lines
+#define SECURITY_IP_HIT_LANES 4
+
+// time in ms between two replica updates; replicas are also updated after every commit
+#define SECURITY_REPLICA_UPDATE_INTERVAL 1000
+
+// Enable the built-in client blacklist entries that have been unreachable in isClientBad() for a
+// long time. Enabling them changes which clients are accepted as leaves.
+#define SECURITY_EXTENDED_CLIENT_BLACKLIST 0
+
+// Enable/disable the hot path instrumentation (stage counters, latency histograms and lock wait
+// times). If disabled, the instrumentation macros compile to nothing.
+#define SECURITY_ENABLE_INSTRUMENTATION 0
+
+// Enable/disable support for recording decision traces (see Manager::startTrace()). If disabled,
+// the trace hooks compile to nothing.
+#define SECURITY_ENABLE_DECISION_TRACE 0
+
 #define SECURITY_LOG_BAN_SOURCES 0
 #define SECURITY_DISABLE_IS_PRIVATE_OLD 0
 
@@ -103,6 +147,11 @@ private:
 	quint64 m_tRuleExpiryInterval;
 
 public:
+	/**
+	 * @brief SecuritySettings constructs a settings object with all settings disabled.
+	 */
+	SecuritySettings();
+
 	/**
 	 * @brief start must be called on application startup. Inintalizes the necessary signal/slot
 	 * connections and makes sure the resective settings are loaded from the settings manager.
@@ -140,6 +189,17 @@ public:
 	 */
 	quint64 ruleExpiryInterval();
 
+	/**
+	 * @brief setValues allows to configure settings that are not bound to the settings manager,
+	 * e.g. for Manager instances other than securityManager. Notifies the Manager afterwards.
+	 * <br><b>Locking: YES</b>
+	 *
+	 * @param bLogIPCheckHits      Report IP rule hits to the system log.
+	 * @param bIgnorePrivateIPs    Deny private IPs on principle.
+	 * @param tRuleExpiryInterval  The time in ms between two rule expiry cleanups.
+	 */
+	void setValues( bool bLogIPCheckHits, bool bIgnorePrivateIPs, quint64 tRuleExpiryInterval );
+
 public slots:
 	/**
 	 * @brief settingsChanged pulls all relevant settings from the settings manager and notifies the
@@ -157,6 +217,84 @@ signals:
 	 */
 	void settingsUpdate();
 };
+
+/**
+ * @brief The Environment class bundles the dependencies of a Manager on the host application: its
+ * settings, the system log, the clock and the data path. securityManager uses the application wide
+ * default environment; other Manager instances (e.g. for sharding, replicas or benchmarks) may be
+ * handed their own environment on construction.
+ */
+class Environment
+{
+private:
+	SecuritySettings* m_pSettings;
+	QString           m_sDataPath;
+
+	// true if m_pSettings are to be pulled from the settings manager
+	bool              m_bApplicationSettings;
+
+public:
+	/**
+	 * @brief Environment constructs an environment.
+	 *
+	 * @param pSettings  The settings to use. If <code>NULL</code>, the global securitySettings are
+	 * used and bound to the settings manager. Otherwise the settings are used as they are and may be
+	 * configured by the caller using SecuritySettings::setValues(). They must outlive the
+	 * environment.
+	 * @param sDataPath  The location to store rules in. If empty, dataPath() is used.
+	 */
+	Environment( SecuritySettings* pSettings = NULL, const QString& sDataPath = QString() );
+	virtual ~Environment();
+
+	/**
+	 * @brief global allows to access the application wide default environment.
+	 * <br><b>Locking: /</b>
+	 *
+	 * @return the default environment
+	 */
+	static Environment* global();
+
+	/**
+	 * @brief start is called by Manager::start(). Binds the settings to the settings manager if
+	 * required.
+	 */
+	virtual void start();
+
+	/**
+	 * @brief stop is called by Manager::stop().
+	 */
+	virtual void stop();
+
+	/**
+	 * @brief settings allows to access the settings of the environment.
+	 * <br><b>Locking: /</b>
+	 *
+	 * @return the settings
+	 */
+	SecuritySettings& settings() const;
+
+	/**
+	 * @brief now allows to access the clock of the environment. Override for simulated time.
+	 * <br><b>Locking: /</b>
+	 *
+	 * @return the current time in seconds since 1.1.1970 UTC
+	 */
+	virtual quint32 now() const;
+
+	/**
+	 * @brief log writes a message to the log of the environment. See postLogMessage().
+	 * <br><b>Locking: /</b>
+	 */
+	virtual void log( LogSeverity eSeverity, const QString& sMessage, bool bDebug = false ) const;
+
+	/**
+	 * @brief dataPath allows to access the data path of the environment.
+	 * <br><b>Locking: /</b>
+	 *
+	 * @return The location where the Manager is supposed to store its data between sessions.
+	 */
+	virtual QString dataPath() const;
+};
 }
 
 extern Security::SecuritySettings securitySettings;
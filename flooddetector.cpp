@@ -0,0 +1,399 @@
+/*
+** flooddetector.cpp
+**
+** Copyright © Quazaa Development Team, 2014.
+** This file is part of the Quazaa Security Library (quazaa.sourceforge.net)
+**
+** The Quazaa Security Library is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** The Quazaa Security Library is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with the Quazaa Security Library; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include <algorithm>
+
+#include "flooddetector.h"
+
+#include "debug_new.h"
+
+using namespace Security;
+
+namespace Security
+{
+static inline quint32 counterIndex( quint32 nSketch, quint32 nRow, quint32 nColumn )
+{
+	return ( nSketch * SECURITY_FLOOD_SKETCH_DEPTH + nRow ) * SECURITY_FLOOD_SKETCH_WIDTH + nColumn;
+}
+
+// 64 bit finalizer of MurmurHash3
+static inline quint64 mix( quint64 nHash )
+{
+	nHash ^= nHash >> 33;
+	nHash *= Q_UINT64_C( 0xFF51AFD7ED558CCD );
+	nHash ^= nHash >> 33;
+	nHash *= Q_UINT64_C( 0xC4CEB9FE1A85EC53 );
+	nHash ^= nHash >> 33;
+
+	return nHash;
+}
+}
+
+FloodDetector::FloodDetector() :
+	m_pCounters( new QAtomicInt[3 * SECURITY_FLOOD_SKETCH_DEPTH * SECURITY_FLOOD_SKETCH_WIDTH] ),
+	m_nPeriod( 0 ),
+	m_nWindow( SECURITY_FLOOD_WINDOW ),
+	m_nTriggered( 0 )
+{
+	for ( int i = 0; i < FloodEvent::NoOfEvents; ++i )
+	{
+		for ( int j = 0; j < FloodScope::NoOfScopes; ++j )
+		{
+			m_pThresholds[i][j].nEvents.store( 0 );
+			m_pThresholds[i][j].nBanLength.store( RuleTime::FiveMinutes );
+		}
+	}
+
+	clear();
+}
+
+FloodDetector::~FloodDetector()
+{
+	delete[] m_pCounters;
+}
+
+void FloodDetector::setThreshold( FloodEvent::Type eType, FloodScope::Scope eScope,
+								  quint32 nEvents, RuleTime::Time nBanLength )
+{
+	Q_ASSERT( eType >= 0 && eType < FloodEvent::NoOfEvents );
+	Q_ASSERT( eScope >= 0 && eScope < FloodScope::NoOfScopes );
+
+	m_pThresholds[eType][eScope].nBanLength.store( ( int )nBanLength );
+	m_pThresholds[eType][eScope].nEvents.store( common::uintToInt( nEvents ) );
+}
+
+quint32 FloodDetector::threshold( FloodEvent::Type eType, FloodScope::Scope eScope ) const
+{
+	return common::intToUint( m_pThresholds[eType][eScope].nEvents.load() );
+}
+
+RuleTime::Time FloodDetector::banLength( FloodEvent::Type eType, FloodScope::Scope eScope ) const
+{
+	return ( RuleTime::Time )m_pThresholds[eType][eScope].nBanLength.load();
+}
+
+void FloodDetector::setWindow( quint32 nSeconds )
+{
+	m_nWindow.store( common::uintToInt( qMax( nSeconds, 1u ) ) );
+	clear();
+}
+
+quint32 FloodDetector::window() const
+{
+	return common::intToUint( m_nWindow.load() );
+}
+
+FloodScope::Scope FloodDetector::record( const QHostAddress& oAddress, FloodEvent::Type eType,
+										 quint32 tNow )
+{
+	Q_ASSERT( eType >= 0 && eType < FloodEvent::NoOfEvents );
+
+	const quint32 nWindow = window();
+	const quint32 nPeriod = tNow / nWindow;
+
+	advance( nPeriod );
+
+	const quint32 nCurrent  = nPeriod % 3;
+	const quint32 nPrevious = ( nPeriod + 2 ) % 3;
+
+	// share of the previous period still covered by the window, in 1/nWindow
+	const qint64 nWeight = nWindow - tNow % nWindow;
+
+	FloodScope::Scope eResult = FloodScope::NoOfScopes;
+	bool bReached = false;
+
+	for ( int i = 0; i < FloodScope::NoOfScopes; ++i )
+	{
+		const FloodScope::Scope eScope = ( FloodScope::Scope )i;
+		const qint64 nThreshold = threshold( eType, eScope );
+
+		quint32 pColumns[SECURITY_FLOOD_SKETCH_DEPTH];
+
+		if ( !nThreshold || !columns( oAddress, eType, eScope, pColumns ) )
+		{
+			continue;
+		}
+
+		// All counts are scaled by the window length to weight the previous period exactly.
+		const qint64 nCurrentTotal = ( qint64 )m_pTotals[nCurrent].fetchAndAddRelaxed( 1 ) + 1;
+		const qint64 nTotal = nCurrentTotal * nWindow +
+							  ( qint64 )m_pTotals[nPrevious].load() * nWeight;
+
+		qint64 pBefore[SECURITY_FLOOD_SKETCH_DEPTH];
+		qint64 pAfter[SECURITY_FLOOD_SKETCH_DEPTH];
+
+		for ( quint32 nRow = 0; nRow < SECURITY_FLOOD_SKETCH_DEPTH; ++nRow )
+		{
+			QAtomicInt& nCount = m_pCounters[counterIndex( nCurrent, nRow, pColumns[nRow] )];
+			const qint64 nPrevCount = m_pCounters[counterIndex( nPrevious, nRow,
+			                                                    pColumns[nRow] )].load();
+
+			pBefore[nRow] = ( qint64 )nCount.fetchAndAddRelaxed( 1 ) * nWindow +
+							nPrevCount * nWeight;
+			pAfter[nRow]  = pBefore[nRow] + nWindow;
+		}
+
+		// Report every event at or above the threshold, so sources that keep flooding after their
+		// ban has ended are banned again. Only the event reaching the threshold is counted.
+		const qint64 nLimit = nThreshold * nWindow;
+
+		if ( estimate( pAfter, nTotal ) >= nLimit )
+		{
+			eResult = eScope;
+			bReached |= estimate( pBefore, nTotal - nWindow ) < nLimit;
+		}
+	}
+
+	if ( bReached )
+	{
+		m_nTriggered.ref();
+	}
+
+	return eResult;
+}
+
+quint32 FloodDetector::estimate( const QHostAddress& oAddress, FloodEvent::Type eType,
+								 FloodScope::Scope eScope, quint32 tNow ) const
+{
+	const quint32 nWindow = window();
+	const quint32 nPeriod = tNow / nWindow;
+
+	quint32 pColumns[SECURITY_FLOOD_SKETCH_DEPTH];
+
+	// The counters are outdated if no event has been recorded during the last two periods.
+	if ( nPeriod - common::intToUint( m_nPeriod.load() ) > 1 ||
+		 !columns( oAddress, eType, eScope, pColumns ) )
+	{
+		return 0;
+	}
+
+	const quint32 nCurrent  = nPeriod % 3;
+	const quint32 nPrevious = ( nPeriod + 2 ) % 3;
+	const qint64  nWeight   = nWindow - tNow % nWindow;
+
+	const qint64 nTotal = ( qint64 )m_pTotals[nCurrent].load() * nWindow +
+						  ( qint64 )m_pTotals[nPrevious].load() * nWeight;
+
+	qint64 pCounts[SECURITY_FLOOD_SKETCH_DEPTH];
+
+	for ( quint32 nRow = 0; nRow < SECURITY_FLOOD_SKETCH_DEPTH; ++nRow )
+	{
+		pCounts[nRow] =
+		    ( qint64 )m_pCounters[counterIndex( nCurrent, nRow, pColumns[nRow] )].load() * nWindow +
+		    ( qint64 )m_pCounters[counterIndex( nPrevious, nRow, pColumns[nRow] )].load() * nWeight;
+	}
+
+	return ( quint32 )( estimate( pCounts, nTotal ) / nWindow );
+}
+
+quint32 FloodDetector::triggered() const
+{
+	return common::intToUint( m_nTriggered.load() );
+}
+
+void FloodDetector::clear()
+{
+	for ( quint32 i = 0; i < 3; ++i )
+	{
+		clearSketch( i );
+	}
+
+	m_nPeriod.store( 0 );
+}
+
+QHostAddress FloodDetector::network( const QHostAddress& oAddress )
+{
+	quint64 nHigh, nLow;
+
+	switch ( key( oAddress, true, nHigh, nLow ) )
+	{
+	case 4:
+		return QHostAddress( ( quint32 )nLow );
+
+	case 6:
+	{
+		Q_IPV6ADDR oIP6;
+
+		for ( int i = 0; i < 8; ++i )
+		{
+			oIP6[i]     = ( quint8 )( nHigh >> ( 56 - 8 * i ) );
+			oIP6[i + 8] = ( quint8 )( nLow  >> ( 56 - 8 * i ) );
+		}
+
+		return QHostAddress( oIP6 );
+	}
+
+	default:
+		return QHostAddress();
+	}
+}
+
+QString FloodDetector::prefix( const QHostAddress& oAddress )
+{
+	const QHostAddress oNetwork = network( oAddress );
+
+	switch ( oNetwork.protocol() )
+	{
+	case QAbstractSocket::IPv4Protocol:
+		return oNetwork.toString() + "/" + QString::number( SECURITY_FLOOD_IPV4_PREFIX );
+
+	case QAbstractSocket::IPv6Protocol:
+		return oNetwork.toString() + "/" + QString::number( SECURITY_FLOOD_IPV6_PREFIX );
+
+	default:
+		return QString();
+	}
+}
+
+void FloodDetector::advance( quint32 nPeriod )
+{
+	const int nCurrent = m_nPeriod.load();
+	const quint32 nLast = common::intToUint( nCurrent );
+
+	// Threads reporting a slightly older time do not move the window back.
+	if ( nPeriod <= nLast )
+	{
+		return;
+	}
+
+	if ( m_nPeriod.testAndSetOrdered( nCurrent, common::uintToInt( nPeriod ) ) )
+	{
+		// The sketch of the next period still holds the counts of the period before the previous
+		// one. If the last event is older than that, the other sketches are outdated as well.
+		clearSketch( ( nPeriod + 1 ) % 3 );
+
+		if ( nPeriod - nLast > 1 )
+		{
+			clearSketch( nPeriod % 3 );
+			clearSketch( ( nPeriod + 2 ) % 3 );
+		}
+	}
+}
+
+void FloodDetector::clearSketch( quint32 nSketch )
+{
+	QAtomicInt* pCounters = &m_pCounters[counterIndex( nSketch, 0, 0 )];
+
+	for ( quint32 i = 0; i < SECURITY_FLOOD_SKETCH_DEPTH * SECURITY_FLOOD_SKETCH_WIDTH; ++i )
+	{
+		pCounters[i].store( 0 );
+	}
+
+	m_pTotals[nSketch].store( 0 );
+}
+
+bool FloodDetector::columns( const QHostAddress& oAddress, FloodEvent::Type eType,
+							 FloodScope::Scope eScope, quint32* pColumns )
+{
+	quint64 nHigh, nLow;
+	const quint8 nProtocol = key( oAddress, eScope == FloodScope::Prefix, nHigh, nLow );
+
+	if ( !nProtocol )
+	{
+		return false;
+	}
+
+	const quint64 nTag  = ( ( quint64 )eType << 16 ) | ( ( quint64 )eScope << 8 ) | nProtocol;
+	const quint64 nHash = mix( mix( mix( nTag ) ^ nHigh ) ^ nLow );
+
+	// The rows are indexed by double hashing (Kirsch, Mitzenmacher).
+	const quint32 nHash1 = ( quint32 )nHash;
+	const quint32 nHash2 = ( quint32 )( nHash >> 32 ) | 1;
+
+	for ( quint32 nRow = 0; nRow < SECURITY_FLOOD_SKETCH_DEPTH; ++nRow )
+	{
+		pColumns[nRow] = ( nHash1 + nRow * nHash2 ) & ( SECURITY_FLOOD_SKETCH_WIDTH - 1 );
+	}
+
+	return true;
+}
+
+quint8 FloodDetector::key( const QHostAddress& oAddress, bool bPrefix, quint64& nHigh,
+						   quint64& nLow )
+{
+	nHigh = 0;
+	nLow  = 0;
+
+	switch ( oAddress.protocol() )
+	{
+	case QAbstractSocket::IPv4Protocol:
+		nLow = oAddress.toIPv4Address();
+
+		if ( bPrefix )
+		{
+			nLow &= ~Q_UINT64_C( 0 ) << ( 32 - SECURITY_FLOOD_IPV4_PREFIX );
+		}
+		return 4;
+
+	case QAbstractSocket::IPv6Protocol:
+	{
+		const Q_IPV6ADDR oIP6 = oAddress.toIPv6Address();
+
+		for ( int i = 0; i < 8; ++i )
+		{
+			nHigh = ( nHigh << 8 ) | oIP6[i];
+			nLow  = ( nLow  << 8 ) | oIP6[i + 8];
+		}
+
+		if ( bPrefix )
+		{
+#if SECURITY_FLOOD_IPV6_PREFIX > 64
+			nLow &= ~Q_UINT64_C( 0 ) << ( 128 - SECURITY_FLOOD_IPV6_PREFIX );
+#else
+			nHigh &= ~Q_UINT64_C( 0 ) << ( 64 - SECURITY_FLOOD_IPV6_PREFIX );
+			nLow   = 0;
+#endif
+		}
+		return 6;
+	}
+
+	default:
+		return 0;
+	}
+}
+
+qint64 FloodDetector::estimate( const qint64* const pCounts, qint64 nTotal )
+{
+	qint64 nMin = pCounts[0];
+	qint64 pResiduals[SECURITY_FLOOD_SKETCH_DEPTH];
+
+	for ( quint32 nRow = 0; nRow < SECURITY_FLOOD_SKETCH_DEPTH; ++nRow )
+	{
+		nMin = qMin( nMin, pCounts[nRow] );
+
+		// subtract the mean of the other counters of the row, which only hold foreign events
+		pResiduals[nRow] = pCounts[nRow] - ( nTotal - pCounts[nRow] ) /
+		                   ( SECURITY_FLOOD_SKETCH_WIDTH - 1 );
+	}
+
+	std::sort( pResiduals, pResiduals + SECURITY_FLOOD_SKETCH_DEPTH );
+
+	const qint64 nMedian = ( SECURITY_FLOOD_SKETCH_DEPTH & 1 ) ?
+							   pResiduals[SECURITY_FLOOD_SKETCH_DEPTH / 2] :
+							   ( pResiduals[SECURITY_FLOOD_SKETCH_DEPTH / 2 - 1] +
+								 pResiduals[SECURITY_FLOOD_SKETCH_DEPTH / 2] ) / 2;
+
+	return qMax( Q_INT64_C( 0 ), qMin( nMin, nMedian ) );
+}
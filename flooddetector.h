@@ -0,0 +1,264 @@
+/*
+** flooddetector.h
+**
+** Copyright © Quazaa Development Team, 2014.
+** This file is part of the Quazaa Security Library (quazaa.sourceforge.net)
+**
+** The Quazaa Security Library is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** The Quazaa Security Library is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with the Quazaa Security Library; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#ifndef FLOODDETECTOR_H
+#define FLOODDETECTOR_H
+
+#include <QAtomicInt>
+#include <QHostAddress>
+
+#include "externals.h"
+#include "securerule.h"
+
+// number of counters per sketch row; must be a power of 2
+#define SECURITY_FLOOD_SKETCH_WIDTH 4096
+
+// number of sketch rows, each using an independent hash function
+#define SECURITY_FLOOD_SKETCH_DEPTH 4
+
+// default length of the sliding window events are counted in, in seconds
+#define SECURITY_FLOOD_WINDOW 10
+
+// prefix lengths of the networks counted for prefix thresholds
+#define SECURITY_FLOOD_IPV4_PREFIX 24
+#define SECURITY_FLOOD_IPV6_PREFIX 48
+
+namespace Security
+{
+
+namespace FloodEvent
+{
+/**
+ * @brief The Type enum describes the events that can be reported to the FloodDetector.
+ */
+enum Type
+{
+	Connection = 0, // incoming connection attempt
+	Query      = 1, // search request
+	Packet     = 2, // any other packet
+	Violation  = 3, // protocol violation or other misbehaviour
+	NoOfEvents = 4
+};
+}
+
+namespace FloodScope
+{
+/**
+ * @brief The Scope enum describes whether events are counted per address or per network.
+ */
+enum Scope
+{
+	Address    = 0, // single address
+	Prefix     = 1, // SECURITY_FLOOD_IPV4_PREFIX or SECURITY_FLOOD_IPV6_PREFIX network
+	NoOfScopes = 2
+};
+}
+
+/**
+ * @brief The FloodDetector class counts events by address and by network within a sliding window
+ * and reports when one of them exceeds the threshold configured for the event type.
+ *
+ * The counts are estimated by a count-min sketch, so the memory used is constant no matter how many
+ * distinct addresses report events. The window consists of three sketches used in turn: the one of
+ * the current period, the one of the previous period, which is weighted by the share of the window
+ * still covering it, and one that is cleared for the next period. As floods of distinct addresses
+ * inflate all counters alike, the estimate subtracts the mean count of the other counters of a row
+ * (count-mean-min). Updates only use atomic operations and never block.
+ */
+class FloodDetector
+{
+#ifndef QUAZAA_SETUP_UNIT_TESTS
+private:
+#else
+public:
+#endif
+	struct Threshold
+	{
+		QAtomicInt  nEvents;    // 0 disables the threshold
+		QAtomicInt  nBanLength;
+	};
+
+	// counters by period, row and column
+	QAtomicInt*     m_pCounters;
+
+	// number of updates by period
+	QAtomicInt      m_pTotals[3];
+
+	QAtomicInt      m_nPeriod;
+	QAtomicInt      m_nWindow;
+
+	Threshold       m_pThresholds[FloodEvent::NoOfEvents][FloodScope::NoOfScopes];
+
+	// number of exceeded thresholds
+	QAtomicInt      m_nTriggered;
+
+public:
+	/**
+	 * @brief FloodDetector constructs a detector with all thresholds disabled.
+	 */
+	FloodDetector();
+	~FloodDetector();
+
+	/**
+	 * @brief setThreshold configures when an address or a network is reported for an event type.
+	 * <br><b>Locking: /</b>
+	 *
+	 * @param eType       The event type.
+	 * @param eScope      Whether the events are counted by address or by network.
+	 * @param nEvents     The number of events within the window to report at; <code>0</code>
+	 * disables the threshold.
+	 * @param nBanLength  The ban length to use once the threshold has been reached.
+	 */
+	void            setThreshold( FloodEvent::Type eType, FloodScope::Scope eScope, quint32 nEvents,
+								  RuleTime::Time nBanLength );
+
+	/**
+	 * @brief threshold allows to access the number of events a threshold is reached at.
+	 * <br><b>Locking: /</b>
+	 *
+	 * @return the number of events; <code>0</code> if the threshold is disabled
+	 */
+	quint32         threshold( FloodEvent::Type eType, FloodScope::Scope eScope ) const;
+
+	/**
+	 * @brief banLength allows to access the ban length configured for a threshold.
+	 * <br><b>Locking: /</b>
+	 */
+	RuleTime::Time  banLength( FloodEvent::Type eType, FloodScope::Scope eScope ) const;
+
+	/**
+	 * @brief setWindow sets the length of the sliding window events are counted in. The counts
+	 * are reset.
+	 * <br><b>Locking: /</b> (must not be called while events are recorded)
+	 *
+	 * @param nSeconds  The window length in seconds.
+	 */
+	void            setWindow( quint32 nSeconds );
+
+	/**
+	 * @brief window allows to access the length of the sliding window.
+	 * <br><b>Locking: /</b>
+	 *
+	 * @return the window length in seconds
+	 */
+	quint32         window() const;
+
+	/**
+	 * @brief record counts an event. Every event at or above a threshold is reported, not only the
+	 * one reaching it, so the caller has to skip sources that are banned already.
+	 * <br><b>Locking: /</b>
+	 *
+	 * @param oAddress  The address the event originated from.
+	 * @param eType     The event type.
+	 * @param tNow      The current time.
+	 * @return the scope whose threshold has been reached including this event, FloodScope::Prefix
+	 * if both have been reached; <br>FloodScope::NoOfScopes otherwise
+	 */
+	FloodScope::Scope record( const QHostAddress& oAddress, FloodEvent::Type eType, quint32 tNow );
+
+	/**
+	 * @brief estimate allows to access the estimated number of events within the window.
+	 * <br><b>Locking: /</b>
+	 *
+	 * @return the estimated count; only counted if a threshold is set for eType and eScope
+	 */
+	quint32         estimate( const QHostAddress& oAddress, FloodEvent::Type eType,
+							  FloodScope::Scope eScope, quint32 tNow ) const;
+
+	/**
+	 * @brief triggered allows to access the number of reached thresholds since start.
+	 * <br><b>Locking: /</b>
+	 */
+	quint32         triggered() const;
+
+	/**
+	 * @brief clear resets all counts. The thresholds are kept.
+	 * <br><b>Locking: /</b> (must not be called while events are recorded)
+	 */
+	void            clear();
+
+	/**
+	 * @brief network returns the first address of the network of an address counted for prefix
+	 * thresholds, which identifies the network.
+	 * <br><b>Locking: /</b>
+	 *
+	 * @return the network address; a null address for invalid addresses
+	 */
+	static QHostAddress network( const QHostAddress& oAddress );
+
+	/**
+	 * @brief prefix returns the network of an address counted for prefix thresholds.
+	 * <br><b>Locking: /</b>
+	 *
+	 * @return the network in CIDR notation; an empty string for invalid addresses
+	 */
+	static QString  prefix( const QHostAddress& oAddress );
+
+#ifndef QUAZAA_SETUP_UNIT_TESTS
+private:
+#else
+public:
+#endif
+	/**
+	 * @brief advance starts a new period if required and clears the sketch of the next one.
+	 */
+	void            advance( quint32 nPeriod );
+
+	/**
+	 * @brief clearSketch resets the counters of a period.
+	 *
+	 * @param nSketch  The sketch of the period (period modulo 3).
+	 */
+	void            clearSketch( quint32 nSketch );
+
+	/**
+	 * @brief key converts an address or its network to a numerical representation.
+	 *
+	 * @return the protocol (4 or 6); <code>0</code> if the address is neither IPv4 nor IPv6
+	 */
+	static quint8   key( const QHostAddress& oAddress, bool bPrefix,
+						 quint64& nHigh, quint64& nLow );
+
+	/**
+	 * @brief columns calculates the counter of every row for a key.
+	 *
+	 * @return <code>false</code> if the address is neither IPv4 nor IPv6
+	 */
+	static bool     columns( const QHostAddress& oAddress, FloodEvent::Type eType,
+							 FloodScope::Scope eScope, quint32* pColumns );
+
+	/**
+	 * @brief estimate calculates the count-mean-min estimate from the counters of a key.
+	 *
+	 * @param pCounts  The counters of the key in every row, scaled by the window length.
+	 * @param nTotal   The sum of all counters of a row, scaled by the window length.
+	 * @return the estimated count scaled by the window length
+	 */
+	static qint64   estimate( const qint64* const pCounts, qint64 nTotal );
+};
+
+}
+
+#endif // FLOODDETECTOR_H
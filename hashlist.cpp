@@ -0,0 +1,387 @@
+/*
+** hashlist.cpp
+**
+** Copyright © Quazaa Development Team, 2014.
+** This file is part of the Quazaa Security Library (quazaa.sourceforge.net)
+**
+** The Quazaa Security Library is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** The Quazaa Security Library is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with the Quazaa Security Library; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#include <QDataStream>
+#include <QTextStream>
+
+#include "hashlist.h"
+
+#include "debug_new.h"
+
+using namespace Security;
+
+// "QSHL"
+#define HASH_LIST_MAGIC 0x5153484C
+
+HashList::HashList() :
+	m_pData( NULL ),
+	m_nAction( RuleAction::Deny ),
+	m_nCount( 0 )
+{
+}
+
+HashList::~HashList()
+{
+	close();
+}
+
+bool HashList::open( const QString& sPath )
+{
+	close();
+
+	m_oFile.setFileName( sPath );
+
+	if ( !m_oFile.open( QIODevice::ReadOnly ) )
+	{
+		return false;
+	}
+
+	const qint64 nSize = m_oFile.size();
+
+	// the whole file must be addressable through the mapping
+	if ( nSize <= 0 || ( quint64 )nSize > ( quint64 )std::numeric_limits<size_t>::max() )
+	{
+		m_oFile.close();
+		return false;
+	}
+
+	m_pData = m_oFile.map( 0, nSize );
+
+	if ( !m_pData )
+	{
+		m_oFile.close();
+		return false;
+	}
+
+	// Read the header from the file itself: a QByteArray cannot span more than 2 GiB.
+	QDataStream oStream( &m_oFile );
+
+	quint32 nMagic, nCommentLength, nSections;
+	quint16 nVersion;
+	quint8  nAction, nReserved;
+
+	oStream >> nMagic >> nVersion >> nAction >> nReserved >> nCommentLength;
+
+	if ( oStream.status() != QDataStream::Ok || nMagic != HASH_LIST_MAGIC ||
+		 nVersion > SECURITY_HASH_LIST_VERSION ||
+		 ( nAction != RuleAction::Accept && nAction != RuleAction::Deny ) ||
+		 nCommentLength > nSize || nCommentLength > SECURITY_HASH_LIST_MAX_COMMENT )
+	{
+		close();
+		return false;
+	}
+
+	QByteArray baComment( ( int )nCommentLength, '\0' );
+	oStream.readRawData( baComment.data(), ( int )nCommentLength );
+	oStream >> nSections;
+
+	// each section header takes 16 bytes
+	if ( oStream.status() != QDataStream::Ok || ( quint64 )nSections * 16 > ( quint64 )nSize )
+	{
+		close();
+		return false;
+	}
+
+	m_nAction  = ( RuleAction::Action )nAction;
+	m_sComment = QString::fromUtf8( baComment );
+	m_vSections.reserve( nSections );
+
+	for ( quint32 i = 0; i < nSections && oStream.status() == QDataStream::Ok; ++i )
+	{
+		Section oSection;
+		quint16 nPadding;
+		quint64 nOffset;
+
+		oStream >> oSection.nSlot >> oSection.nLength >> nPadding >> oSection.nCount >> nOffset;
+
+		// make sure the section lies within the file
+		if ( !oSection.nLength || nOffset > ( quint64 )nSize ||
+			 ( quint64 )oSection.nLength * oSection.nCount > ( quint64 )nSize - nOffset )
+		{
+			close();
+			return false;
+		}
+
+		oSection.pDigests = m_pData + nOffset;
+
+		// lookups rely on binary search, so do not trust the file to be sorted
+		if ( !isSorted( oSection ) )
+		{
+			close();
+			return false;
+		}
+
+		m_nCount += oSection.nCount;
+		m_vSections.push_back( oSection );
+	}
+
+	if ( oStream.status() != QDataStream::Ok )
+	{
+		close();
+		return false;
+	}
+
+	return true;
+}
+
+void HashList::close()
+{
+	if ( m_pData )
+	{
+		m_oFile.unmap( m_pData );
+		m_pData = NULL;
+	}
+
+	m_oFile.close();
+
+	m_vSections.clear();
+	m_sComment.clear();
+	m_nCount = 0;
+}
+
+bool HashList::isOpen() const
+{
+	return m_pData;
+}
+
+QString HashList::path() const
+{
+	return m_oFile.fileName();
+}
+
+RuleAction::Action HashList::action() const
+{
+	return m_nAction;
+}
+
+const QString& HashList::comment() const
+{
+	return m_sComment;
+}
+
+quint32 HashList::count() const
+{
+	return m_nCount;
+}
+
+bool HashList::contains( const HashSet& vHashes ) const
+{
+	for ( SectionVector::const_iterator it = m_vSections.begin(); it != m_vSections.end(); ++it )
+	{
+		const Section& oSection = *it;
+
+		if ( oSection.nSlot < vHashes.size() && vHashes[oSection.nSlot] )
+		{
+			const QByteArray baDigest = vHashes[oSection.nSlot]->rawValue();
+
+			if ( baDigest.size() == oSection.nLength &&
+				 find( oSection, ( const uchar* )baDigest.constData() ) )
+			{
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+quint32 HashList::compile( const QString& sSource, const QString& sTarget,
+						   RuleAction::Action nAction, const QString& sComment,
+						   Environment* pEnvironment )
+{
+	Q_ASSERT( nAction == RuleAction::Accept || nAction == RuleAction::Deny );
+
+	if ( !pEnvironment )
+	{
+		pEnvironment = Environment::global();
+	}
+
+	QFile oSource( sSource );
+
+	if ( sComment.toUtf8().size() > SECURITY_HASH_LIST_MAX_COMMENT ||
+		 !oSource.open( QIODevice::ReadOnly | QIODevice::Text ) )
+	{
+		return 0;
+	}
+
+	// digests by HashSet slot
+	std::vector< std::vector< QByteArray > > vvDigests;
+
+	QTextStream fsSource( &oSource );
+	while ( !fsSource.atEnd() )
+	{
+		const QString sLine = fsSource.readLine().trimmed();
+
+		if ( sLine.isEmpty() || sLine.startsWith( '#' ) )
+		{
+			continue;
+		}
+
+		Hash* pHash = Hash::fromURN( sLine );
+
+		if ( !pHash )
+		{
+			pEnvironment->log( LogSeverity::Warning,
+							   QObject::tr( "Ignoring invalid entry in hash list: %1" ).arg( sLine ) );
+			continue;
+		}
+
+		// let the HashSet figure out the slot of the hash
+		HashSet vHashes;
+		vHashes.insert( pHash );
+
+		for ( quint8 i = 0, nSize = vHashes.size(); i < nSize; ++i )
+		{
+			if ( vHashes[i] )
+			{
+				if ( i >= vvDigests.size() )
+				{
+					vvDigests.resize( i + 1 );
+				}
+
+				vvDigests[i].push_back( vHashes[i]->rawValue() );
+			}
+		}
+	}
+
+	oSource.close();
+
+	const QByteArray baComment = sComment.toUtf8();
+	quint32 nSections = 0;
+
+	for ( quint8 i = 0; i < vvDigests.size(); ++i )
+	{
+		std::vector< QByteArray >& vDigests = vvDigests[i];
+
+		// QByteArray compares bytewise, which is the order required for the lookup
+		std::sort( vDigests.begin(), vDigests.end() );
+		vDigests.erase( std::unique( vDigests.begin(), vDigests.end() ), vDigests.end() );
+
+		if ( !vDigests.empty() )
+		{
+			++nSections;
+		}
+	}
+
+	QFile oTarget( sTarget );
+
+	if ( !nSections || !oTarget.open( QIODevice::WriteOnly | QIODevice::Truncate ) )
+	{
+		return 0;
+	}
+
+	QDataStream oStream( &oTarget );
+
+	oStream << ( quint32 )HASH_LIST_MAGIC << ( quint16 )SECURITY_HASH_LIST_VERSION
+			<< ( quint8 )nAction << ( quint8 )0 << ( quint32 )baComment.size();
+	oStream.writeRawData( baComment.constData(), baComment.size() );
+	oStream << nSections;
+
+	// magic, version, action, reserved, comment length, comment, number of sections, sections
+	quint64 nOffset = 4 + 2 + 1 + 1 + 4 + baComment.size() + 4 + 16 * nSections;
+	quint32 nCount  = 0;
+
+	for ( quint8 i = 0; i < vvDigests.size(); ++i )
+	{
+		const std::vector< QByteArray >& vDigests = vvDigests[i];
+
+		if ( !vDigests.empty() )
+		{
+			const quint8 nLength = ( quint8 )vDigests.front().size();
+
+			oStream << i << nLength << ( quint16 )0 << ( quint32 )vDigests.size() << nOffset;
+
+			nOffset += ( quint64 )nLength * vDigests.size();
+			nCount  += ( quint32 )vDigests.size();
+		}
+	}
+
+	for ( quint8 i = 0; i < vvDigests.size(); ++i )
+	{
+		const std::vector< QByteArray >& vDigests = vvDigests[i];
+
+		for ( std::vector< QByteArray >::const_iterator it = vDigests.begin();
+			  it != vDigests.end(); ++it )
+		{
+			oStream.writeRawData( ( *it ).constData(), ( *it ).size() );
+		}
+	}
+
+	if ( oStream.status() != QDataStream::Ok )
+	{
+		oTarget.close();
+		oTarget.remove();
+		return 0;
+	}
+
+	return nCount;
+}
+
+bool HashList::isSorted( const Section& oSection )
+{
+	for ( quint32 i = 1; i < oSection.nCount; ++i )
+	{
+		const uchar* pDigest = oSection.pDigests + ( quint64 )i * oSection.nLength;
+
+		if ( memcmp( pDigest - oSection.nLength, pDigest, oSection.nLength ) > 0 )
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool HashList::find( const Section& oSection, const uchar* pDigest )
+{
+	quint32 nBegin = 0;
+	quint32 nEnd   = oSection.nCount;
+
+	while ( nBegin < nEnd )
+	{
+		const quint32 nMiddle = nBegin + ( nEnd - nBegin ) / 2;
+		const int nCompare = memcmp( oSection.pDigests + ( quint64 )nMiddle * oSection.nLength,
+									 pDigest, oSection.nLength );
+
+		if ( !nCompare )
+		{
+			return true;
+		}
+		else if ( nCompare < 0 )
+		{
+			nBegin = nMiddle + 1;
+		}
+		else
+		{
+			nEnd = nMiddle;
+		}
+	}
+
+	return false;
+}
@@ -0,0 +1,202 @@
+/*
+** hashlist.h
+**
+** Copyright © Quazaa Development Team, 2014.
+** This file is part of the Quazaa Security Library (quazaa.sourceforge.net)
+**
+** The Quazaa Security Library is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** The Quazaa Security Library is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with the Quazaa Security Library; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#ifndef HASHLIST_H
+#define HASHLIST_H
+
+#include <vector>
+
+#include <QFile>
+
+#include "externals.h"
+#include "securerule.h"
+
+// file format version of compiled hash lists
+#define SECURITY_HASH_LIST_VERSION 1
+
+// maximum length of the comment stored in a compiled hash list
+#define SECURITY_HASH_LIST_MAX_COMMENT ( 64 * 1024 )
+
+namespace Security
+{
+
+/**
+ * @brief The HashList class provides read access to a compiled list of file hashes sharing the
+ * same action and comment, such as community maintained fake file lists.
+ *
+ * Compiled lists contain the raw digests of each hash algorithm in a sorted array. The file is
+ * memory mapped and searched in place, so an entry costs no more than the size of its digest.
+ *
+ * File layout (integers big endian):
+ * <br>quint32 magic ("QSHL"), quint16 version, quint8 action, quint8 reserved,
+ * <br>quint32 comment length, UTF-8 comment,
+ * <br>quint32 number of sections, per section: quint8 HashSet slot, quint8 digest length,
+ * quint16 reserved, quint32 number of digests, quint64 file offset of the first digest,
+ * <br>followed by the sorted digests of all sections.
+ */
+class HashList
+{
+#ifndef QUAZAA_SETUP_UNIT_TESTS
+private:
+#else
+public:
+#endif
+	struct Section
+	{
+		quint8          nSlot;      // HashSet slot, equals the hash algorithm
+		quint8          nLength;    // digest length in bytes
+		quint32         nCount;
+		const uchar*    pDigests;   // points into the mapped file
+	};
+
+	typedef std::vector< Section > SectionVector;
+
+	QFile               m_oFile;
+	uchar*              m_pData;
+
+	RuleAction::Action  m_nAction;
+	QString             m_sComment;
+	quint32             m_nCount;
+
+	SectionVector       m_vSections;
+
+public:
+	/**
+	 * @brief HashList constructs an empty (closed) HashList.
+	 */
+	HashList();
+
+	/**
+	 * @brief ~HashList unmaps the underlying file.
+	 */
+	~HashList();
+
+	/**
+	 * @brief open maps a compiled hash list file into memory and validates its header as well as
+	 * the sort order of all sections. Files that cannot be mapped as a whole are rejected.
+	 * <br><b>Locking: /</b>
+	 *
+	 * @param sPath  The location of the compiled list.
+	 * @return <code>true</code> if successful; <br><code>false</code> otherwise
+	 */
+	bool                open( const QString& sPath );
+
+	/**
+	 * @brief close unmaps the list.
+	 * <br><b>Locking: /</b>
+	 */
+	void                close();
+
+	/**
+	 * @brief isOpen allows to determine whether the list can be used for lookups.
+	 * <br><b>Locking: /</b>
+	 *
+	 * @return <code>true</code> if the list is mapped; <br><code>false</code> otherwise
+	 */
+	bool                isOpen() const;
+
+	/**
+	 * @brief path allows to access the location of the list.
+	 * <br><b>Locking: /</b>
+	 *
+	 * @return the file path
+	 */
+	QString             path() const;
+
+	/**
+	 * @brief action allows to access the action shared by all entries of the list.
+	 * <br><b>Locking: /</b>
+	 *
+	 * @return RuleAction::Accept or RuleAction::Deny
+	 */
+	RuleAction::Action  action() const;
+
+	/**
+	 * @brief comment allows to access the comment shared by all entries of the list.
+	 * <br><b>Locking: /</b>
+	 *
+	 * @return the comment; may be empty
+	 */
+	const QString&      comment() const;
+
+	/**
+	 * @brief count allows to access the number of digests within the list.
+	 * <br><b>Locking: /</b>
+	 *
+	 * @return the total number of digests of all hash algorithms
+	 */
+	quint32             count() const;
+
+	/**
+	 * @brief contains checks whether any of the hashes in vHashes is part of the list.
+	 * <br><b>Locking: /</b>
+	 *
+	 * @param vHashes  The HashSet to look up.
+	 * @return <code>true</code> if a hash has been found; <br><code>false</code> otherwise
+	 */
+	bool                contains( const HashSet& vHashes ) const;
+
+	/**
+	 * @brief compile converts a text file containing one hash URN per line into a compiled hash
+	 * list. Empty lines and lines starting with '#' are ignored.
+	 * <br><b>Locking: /</b>
+	 *
+	 * @param sSource       The text file.
+	 * @param sTarget       The location of the compiled list to be written.
+	 * @param nAction       The action to apply to all entries.
+	 * @param sComment      The comment to apply to all entries; at most
+	 * SECURITY_HASH_LIST_MAX_COMMENT bytes once UTF-8 encoded.
+	 * @param pEnvironment  The environment invalid entries are reported to; NULL for the default
+	 * environment.
+	 * @return the number of unique hashes written; <br>0 on failure
+	 */
+	static quint32      compile( const QString& sSource, const QString& sTarget,
+								 RuleAction::Action nAction = RuleAction::Deny,
+								 const QString& sComment = QString(),
+								 Environment* pEnvironment = NULL );
+
+private:
+	/**
+	 * @brief isSorted verifies that the digests of a section are in ascending bytewise order.
+	 *
+	 * @param oSection  The section.
+	 * @return <code>true</code> if the section can be binary searched; <br><code>false</code>
+	 * otherwise
+	 */
+	static bool         isSorted( const Section& oSection );
+
+	/**
+	 * @brief find performs a binary search for a digest within a section.
+	 *
+	 * @param oSection  The section.
+	 * @param pDigest   The digest; must be oSection.nLength bytes long.
+	 * @return <code>true</code> if the digest has been found; <br><code>false</code> otherwise
+	 */
+	static bool         find( const Section& oSection, const uchar* pDigest );
+};
+
+}
+
+#endif // HASHLIST_H
@@ -0,0 +1,260 @@
+/*
+** instrumentation.cpp
+**
+** Copyright © Quazaa Development Team, 2014.
+** This file is part of the Quazaa Security Library (quazaa.sourceforge.net)
+**
+** The Quazaa Security Library is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** The Quazaa Security Library is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with the Quazaa Security Library; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include <cstring>
+#include <vector>
+
+#include <QAtomicInt>
+#include <QThreadStorage>
+
+#include "instrumentation.h"
+
+#include "debug_new.h"
+
+using namespace Security;
+
+InstrumentationSnapshot::InstrumentationSnapshot()
+{
+	memset( m_pStages, 0, sizeof( m_pStages ) );
+}
+
+void InstrumentationSnapshot::merge( const InstrumentationSnapshot& oOther )
+{
+	for ( int i = 0; i < Stage::NoOfStages; ++i )
+	{
+		m_pStages[i] += oOther.m_pStages[i];
+	}
+
+	for ( int i = 0; i < Measurement::NoOfMeasurements; ++i )
+	{
+		m_pMeasurements[i].merge( oOther.m_pMeasurements[i] );
+	}
+}
+
+void InstrumentationSnapshot::clear()
+{
+	memset( m_pStages, 0, sizeof( m_pStages ) );
+
+	for ( int i = 0; i < Measurement::NoOfMeasurements; ++i )
+	{
+		m_pMeasurements[i].clear();
+	}
+}
+
+#if SECURITY_ENABLE_INSTRUMENTATION
+
+namespace Security
+{
+/**
+ * @brief The ThreadStatistics class is the block a single thread records into. It registers itself
+ * on creation and hands its values over to the registry once its thread finishes.
+ */
+class ThreadStatistics
+{
+public:
+	InstrumentationSnapshot m_oData;
+
+	// reset epoch m_oData belongs to; only written by the owning thread
+	QAtomicInt              m_nEpoch;
+
+	ThreadStatistics();
+	~ThreadStatistics();
+};
+
+/**
+ * @brief The InstrumentationRegistry struct keeps track of the blocks of all running threads.
+ */
+struct InstrumentationRegistry
+{
+	QMutex                          m_oSection;
+	std::vector< ThreadStatistics* > m_vThreads;
+
+	// values recorded by threads that have finished
+	InstrumentationSnapshot         m_oFinished;
+
+	// incremented by reset(); blocks of older epochs are cleared by their own threads
+	QAtomicInt                      m_nEpoch;
+};
+}
+
+static InstrumentationRegistry& registry()
+{
+	static InstrumentationRegistry oRegistry;
+	return oRegistry;
+}
+
+static InstrumentationSnapshot& threadData()
+{
+	// Make sure the registry outlives the thread storage.
+	registry();
+
+	static QThreadStorage< ThreadStatistics* > oStorage;
+
+	if ( !oStorage.hasLocalData() )
+	{
+		oStorage.setLocalData( new ThreadStatistics() );
+	}
+
+	ThreadStatistics* pThread = oStorage.localData();
+
+	// Only the owning thread writes to its block, so reset() leaves the clearing to it.
+	const int nEpoch = registry().m_nEpoch.loadAcquire();
+	if ( pThread->m_nEpoch.load() != nEpoch )
+	{
+		pThread->m_oData.clear();
+		pThread->m_nEpoch.storeRelease( nEpoch );
+	}
+
+	return pThread->m_oData;
+}
+
+ThreadStatistics::ThreadStatistics()
+{
+	InstrumentationRegistry& oRegistry = registry();
+
+	oRegistry.m_oSection.lock();
+	m_nEpoch.store( oRegistry.m_nEpoch.load() );
+	oRegistry.m_vThreads.push_back( this );
+	oRegistry.m_oSection.unlock();
+}
+
+ThreadStatistics::~ThreadStatistics()
+{
+	InstrumentationRegistry& oRegistry = registry();
+
+	oRegistry.m_oSection.lock();
+
+	if ( m_nEpoch.load() == oRegistry.m_nEpoch.load() )
+	{
+		oRegistry.m_oFinished.merge( m_oData );
+	}
+
+	for ( size_t i = 0; i < oRegistry.m_vThreads.size(); ++i )
+	{
+		if ( oRegistry.m_vThreads[i] == this )
+		{
+			oRegistry.m_vThreads[i] = oRegistry.m_vThreads.back();
+			oRegistry.m_vThreads.pop_back();
+			break;
+		}
+	}
+
+	oRegistry.m_oSection.unlock();
+}
+
+void Instrumentation::countStage( Stage::Type eStage )
+{
+	++threadData().m_pStages[eStage];
+}
+
+void Instrumentation::record( Measurement::Type eMeasurement, quint64 nNanoSeconds )
+{
+	threadData().m_pMeasurements[eMeasurement].record( nNanoSeconds );
+}
+
+void Instrumentation::lockForRead( QReadWriteLock& oLock, Measurement::Type eMeasurement )
+{
+	if ( oLock.tryLockForRead() )
+	{
+		record( eMeasurement, 0 );
+		return;
+	}
+
+	QElapsedTimer oTimer;
+	oTimer.start();
+
+	oLock.lockForRead();
+
+	record( eMeasurement, ( quint64 )oTimer.nsecsElapsed() );
+}
+
+void Instrumentation::lockForWrite( QReadWriteLock& oLock, Measurement::Type eMeasurement )
+{
+	if ( oLock.tryLockForWrite() )
+	{
+		record( eMeasurement, 0 );
+		return;
+	}
+
+	QElapsedTimer oTimer;
+	oTimer.start();
+
+	oLock.lockForWrite();
+
+	record( eMeasurement, ( quint64 )oTimer.nsecsElapsed() );
+}
+
+void Instrumentation::lock( QMutex& oMutex, Measurement::Type eMeasurement )
+{
+	if ( oMutex.tryLock() )
+	{
+		record( eMeasurement, 0 );
+		return;
+	}
+
+	QElapsedTimer oTimer;
+	oTimer.start();
+
+	oMutex.lock();
+
+	record( eMeasurement, ( quint64 )oTimer.nsecsElapsed() );
+}
+
+InstrumentationSnapshot Instrumentation::snapshot()
+{
+	InstrumentationRegistry& oRegistry = registry();
+
+	oRegistry.m_oSection.lock();
+
+	InstrumentationSnapshot oReturn = oRegistry.m_oFinished;
+	const int nEpoch = oRegistry.m_nEpoch.load();
+
+	for ( size_t i = 0; i < oRegistry.m_vThreads.size(); ++i )
+	{
+		// skip blocks that have been reset but not yet cleared by their threads
+		if ( oRegistry.m_vThreads[i]->m_nEpoch.loadAcquire() == nEpoch )
+		{
+			oReturn.merge( oRegistry.m_vThreads[i]->m_oData );
+		}
+	}
+
+	oRegistry.m_oSection.unlock();
+
+	return oReturn;
+}
+
+void Instrumentation::reset()
+{
+	InstrumentationRegistry& oRegistry = registry();
+
+	oRegistry.m_oSection.lock();
+
+	oRegistry.m_oFinished.clear();
+	oRegistry.m_nEpoch.ref();
+
+	oRegistry.m_oSection.unlock();
+}
+
+#endif // SECURITY_ENABLE_INSTRUMENTATION
@@ -0,0 +1,217 @@
+/*
+** instrumentation.h
+**
+** Copyright © Quazaa Development Team, 2014.
+** This file is part of the Quazaa Security Library (quazaa.sourceforge.net)
+**
+** The Quazaa Security Library is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** The Quazaa Security Library is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with the Quazaa Security Library; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#ifndef INSTRUMENTATION_H
+#define INSTRUMENTATION_H
+
+#include <QMutex>
+#include <QReadWriteLock>
+
+#include "externals.h"
+#include "latencyhistogram.h"
+
+#if SECURITY_ENABLE_INSTRUMENTATION
+#include <QElapsedTimer>
+#endif // SECURITY_ENABLE_INSTRUMENTATION
+
+namespace Security
+{
+
+namespace Stage
+{
+/**
+ * @brief The Type enum describes the stages of the Manager checks. A stage is counted each time one
+ * of its rules matches.
+ */
+enum Type
+{
+	MissCacheHit = 0, PrivateIP = 1, Country = 2, IPRange = 3, SingleIP = 4, Hash = 5,
+	HashList = 6, Content = 7, RegularExpression = 8, UserAgent = 9, Replica = 10, AutoBan = 11,
+	NoOfStages = 12
+};
+}
+
+namespace Measurement
+{
+/**
+ * @brief The Type enum describes the durations recorded by the instrumentation.
+ */
+enum Type
+{
+	IPCheck = 0, HitCheck = 1, AgentCheck = 2, ManagerLockWait = 3, MissCacheLockWait = 4,
+	NoOfMeasurements = 5
+};
+}
+
+/**
+ * @brief The InstrumentationSnapshot struct holds the statistics of all threads at the time the
+ * snapshot has been taken.
+ */
+struct InstrumentationSnapshot
+{
+	// number of matches per stage
+	quint64             m_pStages[Stage::NoOfStages];
+
+	// durations in ns
+	LatencyHistogram    m_pMeasurements[Measurement::NoOfMeasurements];
+
+	InstrumentationSnapshot();
+
+	/**
+	 * @brief merge adds the values of another snapshot to this one.
+	 */
+	void merge( const InstrumentationSnapshot& oOther );
+
+	/**
+	 * @brief clear resets all values.
+	 */
+	void clear();
+};
+
+#if SECURITY_ENABLE_INSTRUMENTATION
+
+/**
+ * @brief The Instrumentation class collects stage counters and latency histograms of the hot
+ * paths. Each thread records into its own block, so recording requires neither locks nor atomic
+ * operations. Blocks of finished threads are folded into a common block.
+ *
+ * Note: The per thread blocks are read without synchronization by snapshot(), so values of
+ * threads recording at that time may be slightly outdated (or, for 64 bit counters on 32 bit
+ * platforms, torn). reset() never writes to the blocks of other threads: it starts a new epoch
+ * and each thread clears its own block the next time it records something.
+ */
+class Instrumentation
+{
+public:
+	/**
+	 * @brief countStage counts a match within a stage.
+	 * <br><b>Locking: /</b>
+	 */
+	static void countStage( Stage::Type eStage );
+
+	/**
+	 * @brief record adds a duration to a histogram.
+	 * <br><b>Locking: /</b>
+	 *
+	 * @param eMeasurement  The histogram.
+	 * @param nNanoSeconds  The duration.
+	 */
+	static void record( Measurement::Type eMeasurement, quint64 nNanoSeconds );
+
+	/**
+	 * @brief lockForRead, lockForWrite and lock acquire a lock and record the time spent waiting
+	 * for it. Uncontended locks are recorded with a wait time of 0.
+	 * <br><b>Locking: /</b>
+	 */
+	static void lockForRead( QReadWriteLock& oLock, Measurement::Type eMeasurement );
+	static void lockForWrite( QReadWriteLock& oLock, Measurement::Type eMeasurement );
+	static void lock( QMutex& oMutex, Measurement::Type eMeasurement );
+
+	/**
+	 * @brief snapshot aggregates the statistics of all threads.
+	 * <br><b>Locking: /</b> (locks the thread registry internally)
+	 *
+	 * @return the snapshot
+	 */
+	static InstrumentationSnapshot snapshot();
+
+	/**
+	 * @brief reset clears the statistics of all threads. Blocks of running threads are excluded
+	 * from snapshots until their threads have cleared them.
+	 * <br><b>Locking: /</b> (locks the thread registry internally)
+	 */
+	static void reset();
+};
+
+/**
+ * @brief The LatencyProbe class records the time between its construction and destruction.
+ */
+class LatencyProbe
+{
+private:
+	QElapsedTimer       m_oTimer;
+	Measurement::Type   m_eMeasurement;
+
+public:
+	inline LatencyProbe( Measurement::Type eMeasurement ) :
+		m_eMeasurement( eMeasurement )
+	{
+		m_oTimer.start();
+	}
+
+	inline ~LatencyProbe()
+	{
+		Instrumentation::record( m_eMeasurement, ( quint64 )m_oTimer.nsecsElapsed() );
+	}
+};
+
+/**
+ * @brief The InstrumentedReadLocker class is a QReadLocker recording the time spent waiting for
+ * the lock.
+ */
+class InstrumentedReadLocker
+{
+private:
+	QReadWriteLock* m_pLock;
+
+public:
+	inline InstrumentedReadLocker( QReadWriteLock* pLock, Measurement::Type eMeasurement ) :
+		m_pLock( pLock )
+	{
+		Instrumentation::lockForRead( *m_pLock, eMeasurement );
+	}
+
+	inline ~InstrumentedReadLocker()
+	{
+		m_pLock->unlock();
+	}
+};
+
+#define SECURITY_COUNT_STAGE( eStage ) Security::Instrumentation::countStage( eStage )
+#define SECURITY_MEASURE_LATENCY( eMeasurement ) \
+	Security::LatencyProbe oLatencyProbe( eMeasurement )
+#define SECURITY_READ_LOCKER( oName, pLock, eMeasurement ) \
+	Security::InstrumentedReadLocker oName( pLock, eMeasurement )
+#define SECURITY_LOCK_FOR_READ( oLock, eMeasurement ) \
+	Security::Instrumentation::lockForRead( oLock, eMeasurement )
+#define SECURITY_LOCK_FOR_WRITE( oLock, eMeasurement ) \
+	Security::Instrumentation::lockForWrite( oLock, eMeasurement )
+#define SECURITY_LOCK_MUTEX( oMutex, eMeasurement ) \
+	Security::Instrumentation::lock( oMutex, eMeasurement )
+
+#else // SECURITY_ENABLE_INSTRUMENTATION
+
+#define SECURITY_COUNT_STAGE( eStage )
+#define SECURITY_MEASURE_LATENCY( eMeasurement )
+#define SECURITY_READ_LOCKER( oName, pLock, eMeasurement ) QReadLocker oName( pLock )
+#define SECURITY_LOCK_FOR_READ( oLock, eMeasurement ) ( oLock ).lockForRead()
+#define SECURITY_LOCK_FOR_WRITE( oLock, eMeasurement ) ( oLock ).lockForWrite()
+#define SECURITY_LOCK_MUTEX( oMutex, eMeasurement ) ( oMutex ).lock()
+
+#endif // SECURITY_ENABLE_INSTRUMENTATION
+
+}
+
+#endif // INSTRUMENTATION_H
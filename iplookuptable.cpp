@@ -0,0 +1,477 @@
+/*
+** iplookuptable.cpp
+**
+** Copyright © Quazaa Development Team, 2014.
+** This file is part of the Quazaa Security Library (quazaa.sourceforge.net)
+**
+** The Quazaa Security Library is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** The Quazaa Security Library is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with the Quazaa Security Library; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include <algorithm>
+
+#include <QThreadStorage>
+
+#include "iplookuptable.h"
+
+#include "countryrule.h"
+#include "iprangerule.h"
+#include "iprule.h"
+
+#include "debug_new.h"
+
+using namespace Security;
+
+IPLookupTable::IPLookupTable( int nGeneration, bool bDenyPolicy, bool bDenyPrivateIPs,
+							  bool bLogIPCheckHits ) :
+	m_nGeneration( nGeneration ),
+	m_bDenyPolicy( bDenyPolicy ),
+	m_bDenyPrivateIPs( bDenyPrivateIPs ),
+	m_bLogIPCheckHits( bLogIPCheckHits ),
+	m_pHits( NULL ),
+	m_nHitStride( 0 )
+{
+}
+
+IPLookupTable::IPLookupTable( const IPLookupTable& oOther ) :
+	m_nGeneration( oOther.m_nGeneration ),
+	m_bDenyPolicy( oOther.m_bDenyPolicy ),
+	m_bDenyPrivateIPs( oOther.m_bDenyPrivateIPs ),
+	m_bLogIPCheckHits( oOther.m_bLogIPCheckHits ),
+	m_vIPv4Ranges( oOther.m_vIPv4Ranges ),
+	m_vIPv6Ranges( oOther.m_vIPv6Ranges ),
+	m_vIPv4Addresses( oOther.m_vIPv4Addresses ),
+	m_vIPv6Addresses( oOther.m_vIPv6Addresses ),
+	m_vPrivateRanges( oOther.m_vPrivateRanges ),
+#if SECURITY_ENABLE_GEOIP
+	m_vCountries( oOther.m_vCountries ),
+#endif // SECURITY_ENABLE_GEOIP
+	m_vRuleIDs( oOther.m_vRuleIDs ),
+	m_pHits( NULL ),
+	m_nHitStride( 0 )
+{
+	finalize();
+}
+
+IPLookupTable::~IPLookupTable()
+{
+	delete[] m_pHits;
+}
+
+void IPLookupTable::addRange( const IPRangeRule* const pRule )
+{
+	const IPKey oStart = toKey( pRule->startIP() );
+	Entry oEntry = makeEntry( oStart, toKey( pRule->endIP() ), pRule->expiryTime() );
+
+	oEntry.nRule      = addRule( pRule );
+	oEntry.nAction    = pRule->m_nAction;
+	oEntry.bAutomatic = pRule->m_bAutomatic;
+
+	if ( pRule->startIP().protocol() == QAbstractSocket::IPv4Protocol )
+	{
+		m_vIPv4Ranges.push_back( oEntry );
+	}
+	else
+	{
+		m_vIPv6Ranges.push_back( oEntry );
+	}
+}
+
+void IPLookupTable::addAddress( const IPRule* const pRule )
+{
+	const IPKey oKey = toKey( pRule->IP() );
+	Entry oEntry = makeEntry( oKey, oKey, pRule->expiryTime() );
+
+	oEntry.nRule      = addRule( pRule );
+	oEntry.nAction    = pRule->m_nAction;
+	oEntry.bAutomatic = pRule->m_bAutomatic;
+
+	if ( pRule->IP().protocol() == QAbstractSocket::IPv4Protocol )
+	{
+		m_vIPv4Addresses.push_back( oEntry );
+	}
+	else
+	{
+		m_vIPv6Addresses.push_back( oEntry );
+	}
+}
+
+void IPLookupTable::addPrivateRange( const IPRangeRule* const pRule )
+{
+	// Private ranges are not counted and never expire.
+	m_vPrivateRanges.push_back( makeEntry( toKey( pRule->startIP() ), toKey( pRule->endIP() ),
+										   RuleTime::Forever ) );
+}
+
+#if SECURITY_ENABLE_GEOIP
+void IPLookupTable::addCountry( const CountryRule* const pRule )
+{
+	const QString& sCountry = pRule->contentString();
+
+	IPKey oKey;
+	oKey.nHigh = 0;
+	oKey.nLow  = sCountry.size() == 2 ?
+					 ( sCountry[0].unicode() << 16 ) | sCountry[1].unicode() : 0;
+
+	Entry oEntry = makeEntry( oKey, oKey, pRule->expiryTime() );
+
+	oEntry.nRule      = addRule( pRule );
+	oEntry.nAction    = pRule->m_nAction;
+	oEntry.bAutomatic = pRule->m_bAutomatic;
+
+	m_vCountries.push_back( oEntry );
+}
+#endif // SECURITY_ENABLE_GEOIP
+
+void IPLookupTable::finalize()
+{
+	std::sort( m_vIPv4Ranges.begin(),    m_vIPv4Ranges.end()    );
+	std::sort( m_vIPv6Ranges.begin(),    m_vIPv6Ranges.end()    );
+	std::sort( m_vIPv4Addresses.begin(), m_vIPv4Addresses.end() );
+	std::sort( m_vIPv6Addresses.begin(), m_vIPv6Addresses.end() );
+	std::sort( m_vPrivateRanges.begin(), m_vPrivateRanges.end() );
+#if SECURITY_ENABLE_GEOIP
+	std::sort( m_vCountries.begin(),     m_vCountries.end()     );
+#endif // SECURITY_ENABLE_GEOIP
+
+	// Round the lanes up to 64 bytes to keep them on separate cache lines.
+	const size_t nLineSize = 64 / sizeof( QAtomicInt );
+	m_nHitStride = ( m_vRuleIDs.size() + nLineSize - 1 ) / nLineSize * nLineSize;
+
+	delete[] m_pHits;
+	m_pHits = m_vRuleIDs.empty() ? NULL : new QAtomicInt[m_nHitStride * SECURITY_IP_HIT_LANES];
+}
+
+int IPLookupTable::generation() const
+{
+	return m_nGeneration;
+}
+
+bool IPLookupTable::denyPolicy() const
+{
+	return m_bDenyPolicy;
+}
+
+LookupResult::Result IPLookupTable::lookup( const EndPoint& oAddress, quint32 tNow,
+											uint nLane ) const
+{
+	// Logging requires the miss cache state, so leave that to the Manager.
+	if ( m_bLogIPCheckHits || oAddress.isNull() )
+	{
+		return LookupResult::Locked;
+	}
+
+	const bool  bIPv4 = oAddress.protocol() == QAbstractSocket::IPv4Protocol;
+	const IPKey oKey  = toKey( oAddress );
+
+	// The stages and their order are the same as in Manager::isDenied( EndPoint ).
+	if ( m_bDenyPrivateIPs && bIPv4 && find( m_vPrivateRanges, oKey ) )
+	{
+		return LookupResult::Private;
+	}
+
+	const Entry* pEntries[3] = { NULL, NULL, NULL };
+
+#if SECURITY_ENABLE_GEOIP
+	if ( !m_vCountries.empty() )
+	{
+		const QString sCountry = oAddress.country();
+		if ( sCountry.size() == 2 )
+		{
+			IPKey oCountry;
+			oCountry.nHigh = 0;
+			oCountry.nLow  = ( sCountry[0].unicode() << 16 ) | sCountry[1].unicode();
+
+			pEntries[0] = find( m_vCountries, oCountry );
+		}
+	}
+#endif // SECURITY_ENABLE_GEOIP
+
+	pEntries[1] = find( bIPv4 ? m_vIPv4Ranges    : m_vIPv6Ranges,    oKey );
+	pEntries[2] = find( bIPv4 ? m_vIPv4Addresses : m_vIPv6Addresses, oKey );
+
+	LookupResult::Result eResult = LookupResult::Default;
+	int nDecisive = 2;
+
+	for ( int i = 0; i < 3 && eResult == LookupResult::Default; ++i )
+	{
+		const Entry* pEntry = pEntries[i];
+
+		if ( !pEntry )
+		{
+			continue;
+		}
+
+		// Expired rules need to be removed and automatic IP bans are extended on every hit, which
+		// both requires write access to the rules.
+		if ( ( pEntry->tExpire > RuleTime::Session && pEntry->tExpire < tNow ) ||
+			 ( i == 2 && pEntry->bAutomatic ) )
+		{
+			return LookupResult::Locked;
+		}
+
+		if ( pEntry->nAction == RuleAction::Deny )
+		{
+			eResult   = LookupResult::Deny;
+			nDecisive = i;
+		}
+		else if ( pEntry->nAction == RuleAction::Accept )
+		{
+			eResult   = LookupResult::Accept;
+			nDecisive = i;
+		}
+	}
+
+	// Only count the hits once it is certain the Manager does not need to repeat the check.
+	for ( int i = 0; i <= nDecisive; ++i )
+	{
+		if ( pEntries[i] )
+		{
+			countHit( *pEntries[i], nLane );
+		}
+	}
+
+	return eResult;
+}
+
+void IPLookupTable::harvest( HitVector& vHits )
+{
+	for ( size_t i = 0; i < m_vRuleIDs.size(); ++i )
+	{
+		uint nCount = 0;
+
+		for ( size_t nLane = 0; nLane < SECURITY_IP_HIT_LANES; ++nLane )
+		{
+			QAtomicInt& nHits = m_pHits[nLane * m_nHitStride + i];
+
+			// Skip lanes without hits to avoid taking their cache lines away from the lookups.
+			if ( nHits.loadAcquire() )
+			{
+				nCount += ( uint )nHits.fetchAndStoreRelaxed( 0 );
+			}
+		}
+
+		if ( nCount )
+		{
+			vHits.push_back( std::make_pair( m_vRuleIDs[i], nCount ) );
+		}
+	}
+}
+
+quint32 IPLookupTable::addRule( const Rule* const pRule )
+{
+	m_vRuleIDs.push_back( pRule->m_idUUID );
+	return ( quint32 )( m_vRuleIDs.size() - 1 );
+}
+
+void IPLookupTable::countHit( const Entry& oEntry, uint nLane ) const
+{
+	m_pHits[( nLane % SECURITY_IP_HIT_LANES ) * m_nHitStride + oEntry.nRule].fetchAndAddRelaxed( 1 );
+}
+
+IPLookupTable::IPKey IPLookupTable::toKey( const QHostAddress& oAddress )
+{
+	IPKey oKey;
+
+	if ( oAddress.protocol() == QAbstractSocket::IPv4Protocol )
+	{
+		oKey.nHigh = 0;
+		oKey.nLow  = oAddress.toIPv4Address();
+	}
+	else
+	{
+		const Q_IPV6ADDR ip6 = oAddress.toIPv6Address();
+
+		oKey.nHigh = 0;
+		oKey.nLow  = 0;
+
+		// big endian byte order, so numerical order equals address order
+		for ( int i = 0; i < 8; ++i )
+		{
+			oKey.nHigh = ( oKey.nHigh << 8 ) | ip6[i];
+			oKey.nLow  = ( oKey.nLow  << 8 ) | ip6[i + 8];
+		}
+	}
+
+	return oKey;
+}
+
+IPLookupTable::Entry IPLookupTable::makeEntry( const IPKey& oStart, const IPKey& oEnd,
+											   quint32 tExpire )
+{
+	Entry oEntry;
+
+	oEntry.oStart     = oStart;
+	oEntry.oEnd       = oEnd;
+	oEntry.tExpire    = tExpire;
+	oEntry.nRule      = 0;
+	oEntry.nAction    = RuleAction::Deny;
+	oEntry.bAutomatic = false;
+
+	return oEntry;
+}
+
+const IPLookupTable::Entry* IPLookupTable::find( const EntryVector& vEntries, const IPKey& oKey )
+{
+	// The entries of one vector do not overlap, so the last entry starting at or before oKey is
+	// the only candidate.
+	size_t nBegin = 0;
+	size_t n      = vEntries.size();
+
+	while ( n > 0 )
+	{
+		const size_t nHalf   = n >> 1;
+		const size_t nMiddle = nBegin + nHalf;
+
+		if ( oKey < vEntries[nMiddle].oStart )
+		{
+			n = nHalf;
+		}
+		else
+		{
+			if ( !( vEntries[nMiddle].oEnd < oKey ) )
+			{
+				return &vEntries[nMiddle];
+			}
+
+			nBegin = nMiddle + 1;
+			n     -= nHalf + 1;
+		}
+	}
+
+	return NULL;
+}
+
+IPReplicaSet::IPReplicaSet() :
+	m_nGeneration( -1 )
+{
+}
+
+IPReplicaSet::~IPReplicaSet()
+{
+	HitVector vHits;
+	resize( 0, vHits );
+}
+
+void IPReplicaSet::resize( int nReplicas, HitVector& vHits )
+{
+	QMutexLocker oLock( &m_oPublishLock );
+
+	for ( size_t i = 0; i < m_vReplicas.size(); ++i )
+	{
+		if ( m_vReplicas[i]->m_pTable )
+		{
+			m_vReplicas[i]->m_pTable->harvest( vHits );
+			delete m_vReplicas[i]->m_pTable;
+		}
+		delete m_vReplicas[i];
+	}
+	m_vReplicas.clear();
+
+	for ( int i = 0; i < nReplicas; ++i )
+	{
+		Replica* pReplica  = new Replica();
+		pReplica->m_pTable = NULL;
+		m_vReplicas.push_back( pReplica );
+	}
+
+	m_nGeneration.store( -1 );
+}
+
+int IPReplicaSet::size() const
+{
+	return ( int )m_vReplicas.size();
+}
+
+int IPReplicaSet::generation() const
+{
+	return m_nGeneration.load();
+}
+
+void IPReplicaSet::publish( const IPLookupTable& oTable, HitVector& vHits )
+{
+	QMutexLocker oLock( &m_oPublishLock );
+
+	for ( size_t i = 0; i < m_vReplicas.size(); ++i )
+	{
+		// Copy outside of the replica lock, so the threads of the replica are only blocked for
+		// the exchange.
+		IPLookupTable* pTable = new IPLookupTable( oTable );
+
+		m_vReplicas[i]->m_oLock.lockForWrite();
+		std::swap( pTable, m_vReplicas[i]->m_pTable );
+		m_vReplicas[i]->m_oLock.unlock();
+
+		if ( pTable )
+		{
+			// No thread can access the old table anymore.
+			pTable->harvest( vHits );
+			delete pTable;
+		}
+	}
+
+	m_nGeneration.store( oTable.generation() );
+}
+
+void IPReplicaSet::harvest( HitVector& vHits )
+{
+	QMutexLocker oLock( &m_oPublishLock );
+
+	for ( size_t i = 0; i < m_vReplicas.size(); ++i )
+	{
+		// The table cannot be replaced while the publish lock is held and the counters are atomic,
+		// so no replica lock is required.
+		if ( m_vReplicas[i]->m_pTable )
+		{
+			m_vReplicas[i]->m_pTable->harvest( vHits );
+		}
+	}
+}
+
+LookupResult::Result IPReplicaSet::lookup( const EndPoint& oAddress, quint32 tNow,
+										   int nGeneration, bool& bDenyPolicy ) const
+{
+	const uint nThread = ( uint )threadIndex();
+	Replica* pReplica  = m_vReplicas[nThread % m_vReplicas.size()];
+
+	QReadLocker oLock( &pReplica->m_oLock );
+	const IPLookupTable* pTable = pReplica->m_pTable;
+
+	if ( !pTable || pTable->generation() != nGeneration )
+	{
+		return LookupResult::Locked;
+	}
+
+	bDenyPolicy = pTable->denyPolicy();
+	// Threads are assigned to the replicas round robin, so spread the threads of a replica over
+	// the hit counter lanes.
+	return pTable->lookup( oAddress, tNow, nThread / ( uint )m_vReplicas.size() );
+}
+
+int IPReplicaSet::threadIndex()
+{
+	static QAtomicInt nNextIndex( 0 );
+	static QThreadStorage< int > oStorage;
+
+	if ( !oStorage.hasLocalData() )
+	{
+		oStorage.setLocalData( nNextIndex.fetchAndAddRelaxed( 1 ) );
+	}
+
+	return oStorage.localData();
+}
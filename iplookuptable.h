@@ -0,0 +1,333 @@
+/*
+** iplookuptable.h
+**
+** Copyright © Quazaa Development Team, 2014.
+** This file is part of the Quazaa Security Library (quazaa.sourceforge.net)
+**
+** The Quazaa Security Library is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** The Quazaa Security Library is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with the Quazaa Security Library; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#ifndef IPLOOKUPTABLE_H
+#define IPLOOKUPTABLE_H
+
+#include <vector>
+
+#include <QAtomicInt>
+#include <QHostAddress>
+#include <QMutex>
+#include <QReadWriteLock>
+#include <QUuid>
+
+#include "externals.h"
+
+namespace Security
+{
+
+class Rule;
+class IPRule;
+class IPRangeRule;
+#if SECURITY_ENABLE_GEOIP
+class CountryRule;
+#endif // SECURITY_ENABLE_GEOIP
+
+namespace LookupResult
+{
+/**
+ * @brief The Result enum describes the outcome of an IPLookupTable lookup.
+ */
+enum Result
+{
+	Default = 0, // no rule matched, the deny policy applies
+	Deny    = 1,
+	Accept  = 2,
+	Private = 3, // denied as private address
+	Locked  = 4  // the table cannot decide, the check must be performed by the Manager
+};
+}
+
+/**
+ * @brief HitVector holds hit counts of rules by UUID.
+ */
+typedef std::vector< std::pair< QUuid, uint > > HitVector;
+
+/**
+ * @brief The IPLookupTable class is an immutable snapshot of the IP related indexes of a Manager
+ * (IP ranges, single IPs, countries and private ranges) and of the settings the IP checks depend
+ * on, compiled for one rule set generation. Once built, it can be queried without accessing the
+ * Manager or its rules. Hits are counted within the table until they are harvested.
+ *
+ * Cases the table cannot decide on its own (expired rules, automatic IP bans that are extended on
+ * every hit, hit logging) are reported as LookupResult::Locked.
+ */
+class IPLookupTable
+{
+#ifndef QUAZAA_SETUP_UNIT_TESTS
+private:
+#else
+public:
+#endif
+	/**
+	 * @brief IPKey is a numerical representation of an IPv4 or IPv6 address or a country code.
+	 */
+	struct IPKey
+	{
+		quint64 nHigh;
+		quint64 nLow;
+
+		bool operator<( const IPKey& other ) const
+		{
+			return nHigh == other.nHigh ? nLow < other.nLow : nHigh < other.nHigh;
+		}
+	};
+
+	struct Entry
+	{
+		IPKey   oStart;
+		IPKey   oEnd;
+		quint32 tExpire;
+		quint32 nRule;      // position in m_vRuleIDs
+		quint8  nAction;
+		bool    bAutomatic;
+
+		bool operator<( const Entry& other ) const
+		{
+			return oStart < other.oStart;
+		}
+	};
+
+	typedef std::vector< Entry > EntryVector;
+
+	int             m_nGeneration;
+	bool            m_bDenyPolicy;
+	bool            m_bDenyPrivateIPs;
+	bool            m_bLogIPCheckHits;
+
+	// sorted by start address, separated by protocol; single IPs are stored as ranges of size 1
+	EntryVector     m_vIPv4Ranges;
+	EntryVector     m_vIPv6Ranges;
+	EntryVector     m_vIPv4Addresses;
+	EntryVector     m_vIPv6Addresses;
+	EntryVector     m_vPrivateRanges;
+#if SECURITY_ENABLE_GEOIP
+	EntryVector     m_vCountries;       // by country code
+#endif // SECURITY_ENABLE_GEOIP
+
+	// UUIDs of the rules referenced by the entries and their hits since the last harvest; the hits
+	// are counted in SECURITY_IP_HIT_LANES lanes of m_nHitStride counters each, so that threads
+	// sharing the table do not write to the same cache lines
+	std::vector< QUuid > m_vRuleIDs;
+	QAtomicInt*     m_pHits;
+	size_t          m_nHitStride;
+
+public:
+	/**
+	 * @brief IPLookupTable constructs an empty table.
+	 *
+	 * @param nGeneration      The rule generation the table is compiled for.
+	 * @param bDenyPolicy      The deny policy of the Manager.
+	 * @param bDenyPrivateIPs  Whether private IPs are denied.
+	 * @param bLogIPCheckHits  Whether IP checks are logged.
+	 */
+	IPLookupTable( int nGeneration, bool bDenyPolicy, bool bDenyPrivateIPs,
+				   bool bLogIPCheckHits );
+
+	/**
+	 * @brief IPLookupTable creates a deep copy of a table without its hit counts.
+	 *
+	 * @param oOther  The table to copy.
+	 */
+	IPLookupTable( const IPLookupTable& oOther );
+
+	~IPLookupTable();
+
+	/**
+	 * @brief addRange adds an IP range rule to the table. Call finalize() afterwards.
+	 * <br><b>Locking: / + REQUIRES R on the rule</b>
+	 */
+	void            addRange( const IPRangeRule* const pRule );
+
+	/**
+	 * @brief addAddress adds a single IP rule to the table. Call finalize() afterwards.
+	 * <br><b>Locking: / + REQUIRES R on the rule</b>
+	 */
+	void            addAddress( const IPRule* const pRule );
+
+	/**
+	 * @brief addPrivateRange adds a private IP range to the table. Call finalize() afterwards.
+	 * <br><b>Locking: / + REQUIRES R on the rule</b>
+	 */
+	void            addPrivateRange( const IPRangeRule* const pRule );
+
+#if SECURITY_ENABLE_GEOIP
+	/**
+	 * @brief addCountry adds a country rule to the table. Call finalize() afterwards.
+	 * <br><b>Locking: / + REQUIRES R on the rule</b>
+	 */
+	void            addCountry( const CountryRule* const pRule );
+#endif // SECURITY_ENABLE_GEOIP
+
+	/**
+	 * @brief finalize sorts the entries and allocates the hit counters.
+	 * <br><b>Locking: /</b>
+	 */
+	void            finalize();
+
+	/**
+	 * @brief generation allows to access the rule generation the table has been compiled for.
+	 * <br><b>Locking: /</b>
+	 *
+	 * @return the rule generation
+	 */
+	int             generation() const;
+
+	/**
+	 * @brief denyPolicy allows to access the deny policy at compilation time.
+	 * <br><b>Locking: /</b>
+	 *
+	 * @return the deny policy
+	 */
+	bool            denyPolicy() const;
+
+	/**
+	 * @brief lookup checks an address against the table and counts the hit of the matching rule.
+	 * <br><b>Locking: /</b> (atomic ops)
+	 *
+	 * @param oAddress  The address.
+	 * @param tNow      The current time in seconds since 1.1.1970 UTC.
+	 * @param nLane     The hit counter lane of the calling thread.
+	 * @return the result of the lookup
+	 */
+	LookupResult::Result lookup( const EndPoint& oAddress, quint32 tNow, uint nLane = 0 ) const;
+
+	/**
+	 * @brief harvest moves the hits counted since the last harvest to vHits.
+	 * <br><b>Locking: /</b> (atomic ops)
+	 *
+	 * @param vHits  The hits are appended to this vector.
+	 */
+	void            harvest( HitVector& vHits );
+
+private:
+	quint32         addRule( const Rule* const pRule );
+	void            countHit( const Entry& oEntry, uint nLane ) const;
+
+	static IPKey    toKey( const QHostAddress& oAddress );
+	static Entry    makeEntry( const IPKey& oStart, const IPKey& oEnd, quint32 tExpire );
+	static const Entry* find( const EntryVector& vEntries, const IPKey& oKey );
+
+	IPLookupTable&  operator=( const IPLookupTable& );
+};
+
+/**
+ * @brief The IPReplicaSet class keeps one copy of the current IPLookupTable per group of threads,
+ * so concurrent IP checks neither share the reader count of the Manager lock nor the cache lines of
+ * the indexes with threads of other groups. Threads are assigned to the replicas round robin on
+ * their first lookup.
+ */
+class IPReplicaSet
+{
+#ifndef QUAZAA_SETUP_UNIT_TESTS
+private:
+#else
+public:
+#endif
+	struct Replica
+	{
+		QReadWriteLock  m_oLock;
+		IPLookupTable*  m_pTable;
+
+		// keep the locks of different replicas in different cache lines
+		char            m_pPadding[64];
+	};
+
+	std::vector< Replica* > m_vReplicas;
+
+	// serializes publish() and harvest()
+	QMutex          m_oPublishLock;
+
+	// generation of the last published table
+	QAtomicInt      m_nGeneration;
+
+public:
+	IPReplicaSet();
+	~IPReplicaSet();
+
+	/**
+	 * @brief resize sets the number of replicas and drops their tables. Note that this may not be
+	 * called while other threads perform lookups.
+	 * <br><b>Locking: /</b>
+	 *
+	 * @param nReplicas  The number of replicas; <code>0</code> disables the replicas.
+	 * @param vHits      The hits counted by the dropped tables are appended to this vector.
+	 */
+	void            resize( int nReplicas, HitVector& vHits );
+
+	/**
+	 * @brief size allows to access the number of replicas.
+	 * <br><b>Locking: /</b>
+	 *
+	 * @return the number of replicas
+	 */
+	int             size() const;
+
+	/**
+	 * @brief generation allows to access the rule generation of the last published table.
+	 * <br><b>Locking: /</b>
+	 *
+	 * @return the rule generation; <code>-1</code> if no table has been published
+	 */
+	int             generation() const;
+
+	/**
+	 * @brief publish hands a copy of oTable to every replica.
+	 * <br><b>Locking: /</b> (locks m_oPublishLock and the replicas internally)
+	 *
+	 * @param oTable  The new table.
+	 * @param vHits   The hits counted by the replaced tables are appended to this vector.
+	 */
+	void            publish( const IPLookupTable& oTable, HitVector& vHits );
+
+	/**
+	 * @brief harvest collects the hits counted by the current tables.
+	 * <br><b>Locking: /</b> (locks m_oPublishLock internally)
+	 *
+	 * @param vHits  The hits are appended to this vector.
+	 */
+	void            harvest( HitVector& vHits );
+
+	/**
+	 * @brief lookup checks an address against the replica of the calling thread.
+	 * <br><b>Locking: /</b> (read locks the replica of the calling thread internally)
+	 *
+	 * @param oAddress     The address.
+	 * @param tNow         The current time in seconds since 1.1.1970 UTC.
+	 * @param nGeneration  The current rule generation. Outdated tables are not used.
+	 * @param bDenyPolicy  Set to the deny policy of the table on LookupResult::Default.
+	 * @return the result of the lookup; LookupResult::Locked if no up to date table is available
+	 */
+	LookupResult::Result lookup( const EndPoint& oAddress, quint32 tNow, int nGeneration,
+								 bool& bDenyPolicy ) const;
+
+private:
+	static int      threadIndex();
+};
+
+}
+
+#endif // IPLOOKUPTABLE_H
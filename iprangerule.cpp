@@ -26,8 +26,6 @@
 
 #include "debug_new.h"
 
-#include "securitymanager.h"
-
 using namespace Security;
 
 IPRangeRule::IPRangeRule()
@@ -42,6 +40,48 @@ Rule* IPRangeRule::getCopy() const
 
 bool IPRangeRule::parseContent( const QString& sContent )
 {
+	if ( sContent.contains( '/' ) )
+	{
+		const QPair<QHostAddress, int> oSubnet = QHostAddress::parseSubnet( sContent.trimmed() );
+		const QHostAddress& oAddress = oSubnet.first;
+		const int nPrefix = oSubnet.second;
+
+		if ( oAddress.protocol() == QAbstractSocket::IPv4Protocol && nPrefix >= 0 && nPrefix <= 32 )
+		{
+			const quint32 nMask = nPrefix ? ~( quint32 )0 << ( 32 - nPrefix ) : 0;
+			const quint32 nIP   = oAddress.toIPv4Address() & nMask;
+
+			m_oStartIP.setAddress( nIP );
+			m_oEndIP.setAddress( nIP | ~nMask );
+			updateContent();
+			return true;
+		}
+		else if ( oAddress.protocol() == QAbstractSocket::IPv6Protocol &&
+				  nPrefix >= 0 && nPrefix <= 128 )
+		{
+			Q_IPV6ADDR oStart = oAddress.toIPv6Address();
+			Q_IPV6ADDR oEnd;
+
+			for ( int i = 0; i < 16; ++i )
+			{
+				const int nBits = qBound( 0, nPrefix - 8 * i, 8 );
+				const quint8 nMask = ( quint8 )( 0xFF00 >> nBits );
+
+				oStart[i] &= nMask;
+				oEnd[i]    = oStart[i] | ( quint8 )~nMask;
+			}
+
+			m_oStartIP.setAddress( oStart );
+			m_oEndIP.setAddress( oEnd );
+			updateContent();
+			return true;
+		}
+
+		qDebug() << "[Security Error] Could not parse the following as CIDR range rule: "
+				 << sContent;
+		return false;
+	}
+
 	QStringList lAddresses = sContent.split( "-" );
 
 	EndPoint oStartAddress, oEndAddress;
@@ -51,7 +91,7 @@ bool IPRangeRule::parseContent( const QString& sContent )
 	{
 		m_oStartIP = oStartAddress;
 		m_oEndIP   = oEndAddress;
-		m_sContent = sContent;
+		updateContent();
 		return true;
 	}
 
@@ -70,6 +110,133 @@ EndPoint IPRangeRule::endIP() const
 	return m_oEndIP;
 }
 
+const QList<QUuid>& IPRangeRule::origins() const
+{
+	return m_lOrigins;
+}
+
+void IPRangeRule::setOrigins( const QList<QUuid>& lOrigins )
+{
+	m_lOrigins = lOrigins;
+}
+
+bool IPRangeRule::coalesce( const IPRangeRule* const pOther )
+{
+	Q_ASSERT( pOther->m_oStartIP >= m_oStartIP );
+
+	if ( pOther->m_nAction != m_nAction || pOther->expiryTime() != expiryTime() ||
+		 pOther->m_oStartIP.protocol() != m_oEndIP.protocol() )
+	{
+		return false;
+	}
+
+	bool bAdjacent = pOther->m_oStartIP <= m_oEndIP;
+
+	if ( !bAdjacent && m_oEndIP.protocol() == QAbstractSocket::IPv4Protocol )
+	{
+		bAdjacent = pOther->m_oStartIP.toIPv4Address() - m_oEndIP.toIPv4Address() == 1;
+	}
+	else if ( !bAdjacent && m_oEndIP.protocol() == QAbstractSocket::IPv6Protocol )
+	{
+		// calculate the address following m_oEndIP
+		Q_IPV6ADDR oNext = m_oEndIP.toIPv6Address();
+		for ( int i = 15; i >= 0; --i )
+		{
+			if ( ++oNext[i] ) // no carry
+			{
+				break;
+			}
+		}
+
+		bAdjacent = QHostAddress( oNext ) == pOther->m_oStartIP;
+	}
+
+	if ( !bAdjacent )
+	{
+		return false;
+	}
+
+	pOther->mergeInto( this );
+
+	if ( pOther->m_oEndIP > m_oEndIP )
+	{
+		m_oEndIP = pOther->m_oEndIP;
+	}
+
+	m_lOrigins.append( pOther->m_idUUID );
+	m_lOrigins.append( pOther->m_lOrigins );
+
+	updateContent();
+	return true;
+}
+
+int IPRangeRule::prefixLength() const
+{
+	if ( m_oStartIP.protocol() != m_oEndIP.protocol() )
+	{
+		return -1;
+	}
+
+	if ( m_oStartIP.protocol() == QAbstractSocket::IPv4Protocol )
+	{
+		const quint32 nStart = m_oStartIP.toIPv4Address();
+		const quint32 nHost  = nStart ^ m_oEndIP.toIPv4Address();
+
+		// The host part must consist of trailing 1 bits only, which must all be 0 in nStart.
+		if ( ( nHost & ( nHost + 1 ) ) || ( nStart & nHost ) )
+		{
+			return -1;
+		}
+
+		int nPrefix = 32;
+		for ( quint32 n = nHost; n; n >>= 1 )
+		{
+			--nPrefix;
+		}
+		return nPrefix;
+	}
+	else if ( m_oStartIP.protocol() == QAbstractSocket::IPv6Protocol )
+	{
+		const Q_IPV6ADDR oStart = m_oStartIP.toIPv6Address();
+		const Q_IPV6ADDR oEnd   = m_oEndIP.toIPv6Address();
+
+		int  nPrefix = 0;
+		bool bHost   = false;
+
+		for ( int i = 0; i < 16; ++i )
+		{
+			const quint8 nHost = oStart[i] ^ oEnd[i];
+
+			if ( bHost )
+			{
+				// all bytes following the first host byte must be entirely host bits
+				if ( nHost != 0xFF || oStart[i] )
+				{
+					return -1;
+				}
+			}
+			else if ( nHost )
+			{
+				if ( ( nHost & ( nHost + 1 ) ) || ( oStart[i] & nHost ) )
+				{
+					return -1;
+				}
+
+				for ( quint8 n = nHost; n; n >>= 1 )
+				{
+					++nPrefix;
+				}
+				nPrefix = 8 * i + 8 - nPrefix;
+				bHost   = true;
+			}
+		}
+
+		return bHost ? nPrefix : 128;
+	}
+
+	return -1;
+}
+
 /**
  * @brief merge merges pOther into this rule.
  * Note that this changes only the ranges of this rule.
@@ -86,8 +253,12 @@ IPRangeRule* IPRangeRule::merge( IPRangeRule*& pOther )
 
 	// REMOVE All other asserts in this method for Quazaa 1.0.0.0
 
-	bool bThisContainsOtherStartIP = contains( pOther->startIP() );
-	bool bThisContainsOtherEndIP   = contains( pOther->endIP() );
+	// Unlike contains(), this includes the case of pOther starting at our end IP or ending at our
+	// start IP. Otherwise, both rules would overlap by one address after merging.
+	bool bThisContainsOtherStartIP = pOther->startIP() >  m_oStartIP &&
+									 pOther->startIP() <= m_oEndIP;
+	bool bThisContainsOtherEndIP   = pOther->endIP()   >= m_oStartIP &&
+									 pOther->endIP()   <  m_oEndIP;
 
 	IPRangeRule* pReturn = NULL;
 
@@ -117,8 +288,7 @@ IPRangeRule* IPRangeRule::merge( IPRangeRule*& pOther )
 
 				// Update GUI relevant info
 				pNewRule->m_sComment += QObject::tr( " (Split by range merging)" );
-				pNewRule->m_sContent = pNewRule->m_oStartIP.toString() + "-" +
-									   pNewRule->m_oEndIP.toString();
+				pNewRule->updateContent();
 
 				// return remaining second part of this rule
 				pReturn = pNewRule;
@@ -153,12 +323,10 @@ IPRangeRule* IPRangeRule::merge( IPRangeRule*& pOther )
 	// make sure to update GUI relevant info
 	if ( pOther )
 	{
-		pOther->m_sContent = pOther->m_oStartIP.toString() + "-" +
-							 pOther->m_oEndIP.toString();
+		pOther->updateContent();
 	}
 
-	m_sContent = m_oStartIP.toString() + "-" + m_oEndIP.toString();
-	securityManager.emitUpdate( m_nGUIID );
+	updateContent();
 
 	return pReturn;
 }
@@ -201,3 +369,17 @@ void IPRangeRule::toXML( QXmlStreamWriter& oXMLdocument ) const
 
 	oXMLdocument.writeEndElement();
 }
+
+void IPRangeRule::updateContent()
+{
+	const int nPrefix = prefixLength();
+
+	if ( nPrefix >= 0 && m_oStartIP != m_oEndIP )
+	{
+		m_sContent = m_oStartIP.toString() + "/" + QString::number( nPrefix );
+	}
+	else
+	{
+		m_sContent = m_oStartIP.toString() + "-" + m_oEndIP.toString();
+	}
+}
@@ -31,7 +31,9 @@ namespace Security
 {
 
 /**
- * @brief The IPRangeRule class manages IP matching against IP ranges.
+ * @brief The IPRangeRule class manages IP matching against IP ranges. Ranges can be specified
+ * either as "start-end" or in CIDR notation ("address/prefix length", IPv4 and IPv6). Ranges that
+ * are aligned to a prefix are represented in CIDR notation within their content string.
  */
 class IPRangeRule : public Rule
 {
@@ -39,6 +41,9 @@ private:
 	EndPoint m_oStartIP;
 	EndPoint m_oEndIP;
 
+	// UUIDs of the rules that have been coalesced into this one
+	QList<QUuid> m_lOrigins;
+
 public:
 	IPRangeRule();
 
@@ -49,6 +54,40 @@ public:
 	EndPoint        startIP() const;
 	EndPoint        endIP() const;
 
+	/**
+	 * @brief prefixLength allows to determine whether the range is a prefix aligned block.
+	 *
+	 * @return the prefix length if the range consists of exactly all addresses sharing the first
+	 * n bits of its start address; <code>-1</code> otherwise
+	 */
+	int             prefixLength() const;
+
+	/**
+	 * @brief origins allows to access the UUIDs of the rules that have been coalesced into this
+	 * rule by range compaction.
+	 *
+	 * @return the origin UUIDs
+	 */
+	const QList<QUuid>& origins() const;
+
+	/**
+	 * @brief setOrigins sets the UUIDs of the rules that have been coalesced into this rule.
+	 *
+	 * @param lOrigins  The origin UUIDs.
+	 */
+	void            setOrigins( const QList<QUuid>& lOrigins );
+
+	/**
+	 * @brief coalesce extends this rule by pOther if both rules share action and expiry time and
+	 * pOther starts within or directly after this range. Hit counters are added up and the UUID of
+	 * pOther as well as its own origins are recorded as origins of this rule.
+	 *
+	 * @param pOther  A range rule starting at or after the start of this rule.
+	 * @return <code>true</code> if pOther has been coalesced into this rule;
+	 * <br><code>false</code> otherwise
+	 */
+	bool            coalesce( const IPRangeRule* const pOther );
+
 	/**
 	 * @brief merge merges pOther into this rule.
 	 *
@@ -69,6 +108,13 @@ public:
 	bool            contains( const EndPoint& oAddress ) const;
 
 	void            toXML( QXmlStreamWriter& oXMLdocument ) const;
+
+private:
+	/**
+	 * @brief updateContent sets the content string to the CIDR notation of the range if possible
+	 * and to "start-end" otherwise.
+	 */
+	void            updateContent();
 };
 
 }
@@ -0,0 +1,192 @@
+/*
+** latencyhistogram.cpp
+**
+** Copyright © Quazaa Development Team, 2014.
+** This file is part of the Quazaa Security Library (quazaa.sourceforge.net)
+**
+** The Quazaa Security Library is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** The Quazaa Security Library is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with the Quazaa Security Library; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include <cstring>
+
+#include "latencyhistogram.h"
+
+#include "debug_new.h"
+
+using namespace Security;
+
+LatencyHistogram::LatencyHistogram()
+{
+	clear();
+}
+
+void LatencyHistogram::record( quint64 nValue )
+{
+	++m_pBuckets[bucketIndex( nValue )];
+
+	if ( !m_nCount || nValue < m_nMin )
+	{
+		m_nMin = nValue;
+	}
+
+	if ( nValue > m_nMax )
+	{
+		m_nMax = nValue;
+	}
+
+	++m_nCount;
+	m_nSum += nValue;
+}
+
+void LatencyHistogram::merge( const LatencyHistogram& oOther )
+{
+	if ( !oOther.m_nCount )
+	{
+		return;
+	}
+
+	for ( int i = 0; i < SECURITY_HISTOGRAM_BUCKETS; ++i )
+	{
+		m_pBuckets[i] += oOther.m_pBuckets[i];
+	}
+
+	if ( !m_nCount || oOther.m_nMin < m_nMin )
+	{
+		m_nMin = oOther.m_nMin;
+	}
+
+	if ( oOther.m_nMax > m_nMax )
+	{
+		m_nMax = oOther.m_nMax;
+	}
+
+	m_nCount += oOther.m_nCount;
+	m_nSum   += oOther.m_nSum;
+}
+
+void LatencyHistogram::clear()
+{
+	memset( m_pBuckets, 0, sizeof( m_pBuckets ) );
+
+	m_nCount = 0;
+	m_nSum   = 0;
+	m_nMin   = 0;
+	m_nMax   = 0;
+}
+
+quint64 LatencyHistogram::count() const
+{
+	return m_nCount;
+}
+
+quint64 LatencyHistogram::min() const
+{
+	return m_nMin;
+}
+
+quint64 LatencyHistogram::max() const
+{
+	return m_nMax;
+}
+
+double LatencyHistogram::mean() const
+{
+	return m_nCount ? ( double )m_nSum / m_nCount : 0.0;
+}
+
+quint64 LatencyHistogram::percentile( double dPercentile ) const
+{
+	if ( !m_nCount )
+	{
+		return 0;
+	}
+
+	dPercentile = qBound( 0.0, dPercentile, 100.0 );
+
+	// the number of values that need to be at or below the result
+	quint64 nTarget = ( quint64 )( dPercentile / 100.0 * m_nCount + 0.5 );
+	nTarget = qBound( ( quint64 )1, nTarget, m_nCount );
+
+	quint64 nSeen = 0;
+
+	for ( int i = 0; i < SECURITY_HISTOGRAM_BUCKETS; ++i )
+	{
+		nSeen += m_pBuckets[i];
+
+		if ( nSeen >= nTarget )
+		{
+			if ( i + 1 == SECURITY_HISTOGRAM_BUCKETS )
+			{
+				return m_nMax;
+			}
+
+			return qBound( m_nMin, bucketLowerBound( i + 1 ) - 1, m_nMax );
+		}
+	}
+
+	return m_nMax;
+}
+
+quint64 LatencyHistogram::bucketCount( int nBucket ) const
+{
+	Q_ASSERT( nBucket >= 0 && nBucket < SECURITY_HISTOGRAM_BUCKETS );
+
+	return m_pBuckets[nBucket];
+}
+
+int LatencyHistogram::bucketIndex( quint64 nValue )
+{
+	if ( nValue < SECURITY_HISTOGRAM_SUB_BUCKETS )
+	{
+		return ( int )nValue;
+	}
+
+	// position of the most significant bit
+	int nMSB = 0;
+	for ( int nShift = 32; nShift; nShift /= 2 )
+	{
+		if ( nValue >> ( nMSB + nShift ) )
+		{
+			nMSB += nShift;
+		}
+	}
+
+	if ( nMSB >= SECURITY_HISTOGRAM_MAX_BITS )
+	{
+		return SECURITY_HISTOGRAM_BUCKETS - 1;
+	}
+
+	const int nShift = nMSB - SECURITY_HISTOGRAM_SUB_BUCKET_BITS;
+
+	return ( nShift + 1 ) * SECURITY_HISTOGRAM_SUB_BUCKETS +
+		   ( int )( ( nValue >> nShift ) & ( SECURITY_HISTOGRAM_SUB_BUCKETS - 1 ) );
+}
+
+quint64 LatencyHistogram::bucketLowerBound( int nBucket )
+{
+	if ( nBucket < SECURITY_HISTOGRAM_SUB_BUCKETS )
+	{
+		return ( quint64 )nBucket;
+	}
+
+	const int nShift = nBucket / SECURITY_HISTOGRAM_SUB_BUCKETS - 1;
+	const quint64 nSub = nBucket % SECURITY_HISTOGRAM_SUB_BUCKETS;
+
+	return ( SECURITY_HISTOGRAM_SUB_BUCKETS + nSub ) << nShift;
+}
@@ -0,0 +1,157 @@
+/*
+** latencyhistogram.h
+**
+** Copyright © Quazaa Development Team, 2014.
+** This file is part of the Quazaa Security Library (quazaa.sourceforge.net)
+**
+** The Quazaa Security Library is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** The Quazaa Security Library is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with the Quazaa Security Library; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#ifndef LATENCYHISTOGRAM_H
+#define LATENCYHISTOGRAM_H
+
+#include <QtGlobal>
+
+// Each power of two range is split into 2^SECURITY_HISTOGRAM_SUB_BUCKET_BITS linear buckets,
+// which limits the relative error of recorded values to about 6%.
+#define SECURITY_HISTOGRAM_SUB_BUCKET_BITS 4
+#define SECURITY_HISTOGRAM_SUB_BUCKETS ( 1 << SECURITY_HISTOGRAM_SUB_BUCKET_BITS )
+
+// values of 2^SECURITY_HISTOGRAM_MAX_BITS and above are counted in the last bucket
+#define SECURITY_HISTOGRAM_MAX_BITS 40
+
+#define SECURITY_HISTOGRAM_BUCKETS ( SECURITY_HISTOGRAM_SUB_BUCKETS + \
+	( SECURITY_HISTOGRAM_MAX_BITS - SECURITY_HISTOGRAM_SUB_BUCKET_BITS ) * \
+	SECURITY_HISTOGRAM_SUB_BUCKETS )
+
+namespace Security
+{
+
+/**
+ * @brief The LatencyHistogram class records the distribution of values (usually durations in ns)
+ * using a log-linear bucket layout as known from HDR histograms: values below
+ * SECURITY_HISTOGRAM_SUB_BUCKETS are stored exactly, larger ones with a constant relative
+ * precision. Recording a value is a constant time operation without allocations.
+ *
+ * Note: This class is not thread safe.
+ */
+class LatencyHistogram
+{
+#ifndef QUAZAA_SETUP_UNIT_TESTS
+private:
+#else
+public:
+#endif
+	quint64 m_pBuckets[SECURITY_HISTOGRAM_BUCKETS];
+
+	quint64 m_nCount;
+	quint64 m_nSum;
+	quint64 m_nMin;
+	quint64 m_nMax;
+
+public:
+	/**
+	 * @brief LatencyHistogram constructs an empty histogram.
+	 */
+	LatencyHistogram();
+
+	/**
+	 * @brief record adds a value to the histogram.
+	 *
+	 * @param nValue  The value.
+	 */
+	void        record( quint64 nValue );
+
+	/**
+	 * @brief merge adds all values recorded by another histogram to this one.
+	 *
+	 * @param oOther  The other histogram.
+	 */
+	void        merge( const LatencyHistogram& oOther );
+
+	/**
+	 * @brief clear removes all recorded values.
+	 */
+	void        clear();
+
+	/**
+	 * @brief count allows to access the number of recorded values.
+	 *
+	 * @return the number of values
+	 */
+	quint64     count() const;
+
+	/**
+	 * @brief min allows to access the smallest recorded value.
+	 *
+	 * @return the minimum; 0 if no value has been recorded
+	 */
+	quint64     min() const;
+
+	/**
+	 * @brief max allows to access the largest recorded value.
+	 *
+	 * @return the maximum; 0 if no value has been recorded
+	 */
+	quint64     max() const;
+
+	/**
+	 * @brief mean calculates the average of all recorded values.
+	 *
+	 * @return the mean; 0 if no value has been recorded
+	 */
+	double      mean() const;
+
+	/**
+	 * @brief percentile calculates the value below or at which the specified percentage of all
+	 * recorded values lie, e.g. 99.9 for the p999 latency.
+	 *
+	 * @param dPercentile  The percentile in the range [0, 100].
+	 * @return the highest value equivalent to the bucket containing the percentile
+	 */
+	quint64     percentile( double dPercentile ) const;
+
+	/**
+	 * @brief bucketCount allows to access the number of values recorded within a bucket.
+	 *
+	 * @param nBucket  The bucket in the range [0, SECURITY_HISTOGRAM_BUCKETS).
+	 * @return the number of values
+	 */
+	quint64     bucketCount( int nBucket ) const;
+
+	/**
+	 * @brief bucketIndex determines the bucket a value is counted in.
+	 *
+	 * @param nValue  The value.
+	 * @return the bucket index
+	 */
+	static int  bucketIndex( quint64 nValue );
+
+	/**
+	 * @brief bucketLowerBound determines the smallest value counted in a bucket.
+	 *
+	 * @param nBucket  The bucket index.
+	 * @return the smallest value of the bucket
+	 */
+	static quint64 bucketLowerBound( int nBucket );
+};
+
+}
+
+#endif // LATENCYHISTOGRAM_H
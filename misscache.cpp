@@ -22,6 +22,7 @@
 ** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 */
 
+#include "instrumentation.h"
 #include "misscache.h"
 #include "securitymanager.h"
 
@@ -41,18 +42,40 @@ MissCache::IPv6Addr MissCache::qipv6addrToIPv6Addr( const Q_IPV6ADDR& qip6 )
 {
 	IPv6Addr ipReturn;
 
-	ipReturn.data[0] = ( ( quint64* )&qip6 )[0];
-	ipReturn.data[1] = ( ( quint64* )&qip6 )[1];
+	ipReturn.data[0] = 0;
+	ipReturn.data[1] = 0;
+
+	// Q_IPV6ADDR is in network byte order
+	for ( int i = 0; i < 8; ++i )
+	{
+		ipReturn.data[0] = ( ipReturn.data[0] << 8 ) | qip6[i];
+		ipReturn.data[1] = ( ipReturn.data[1] << 8 ) | qip6[i + 8];
+	}
 
 	return ipReturn;
 }
 
+QHostAddress MissCache::ipv6AddrToQHostAddress( const IPv6Addr& ip6 )
+{
+	Q_IPV6ADDR qip6;
+
+	for ( int i = 0; i < 8; ++i )
+	{
+		qip6[i]     = ( quint8 )( ip6.data[0] >> ( 56 - 8 * i ) );
+		qip6[i + 8] = ( quint8 )( ip6.data[1] >> ( 56 - 8 * i ) );
+	}
+
+	return QHostAddress( qip6 );
+}
+
 MissCache::MissCache() :
 	m_tOldestIP4Entry( 0 ),
 	m_tOldestIP6Entry( 0 ),
 	m_nMaxIPsInCache( 0 ),
 	m_bUseMissCache( false ),
-	m_bExpiryRequested( false )
+	m_bExpiryRequested( false ),
+	m_nHits( 0 ),
+	m_nMisses( 0 )
 {
 }
 
@@ -101,7 +124,7 @@ void MissCache::insert( const QHostAddress& rIP, const quint32 tNow )
 
 	if ( m_bUseMissCache )
 	{
-		m_oSection.lock();
+		SECURITY_LOCK_MUTEX( m_oSection, Measurement::MissCacheLockWait );
 
 		switch ( rIP.protocol() )
 		{
@@ -143,19 +166,21 @@ void MissCache::insert( const QHostAddress& rIP, const quint32 tNow )
 	}
 }
 
-void MissCache::erase( const QHostAddress& rIP )
+bool MissCache::erase( const QHostAddress& rIP )
 {
+	bool bReturn = false;
+
 	if ( m_bUseMissCache )
 	{
 		m_oSection.lock();
 
 		if ( rIP.protocol() == QAbstractSocket::IPv4Protocol )
 		{
-			m_lsIPv4Cache.erase( qHostAddressToIP4( rIP ) );
+			bReturn = m_lsIPv4Cache.erase( qHostAddressToIP4( rIP ) );
 		}
 		else if ( rIP.protocol() == QAbstractSocket::IPv6Protocol )
 		{
-			m_lsIPv6Cache.erase( qHostAddressToIP6( rIP ) );
+			bReturn = m_lsIPv6Cache.erase( qHostAddressToIP6( rIP ) );
 		}
 		else
 		{
@@ -164,6 +189,50 @@ void MissCache::erase( const QHostAddress& rIP )
 
 		m_oSection.unlock();
 	}
+
+	return bReturn;
+}
+
+void MissCache::erase( const QHostAddress& rStart, const QHostAddress& rEnd,
+					   std::vector< QHostAddress >& vErased )
+{
+	Q_ASSERT( rStart.protocol() == rEnd.protocol() );
+
+	if ( m_bUseMissCache )
+	{
+		m_oSection.lock();
+
+		if ( rStart.protocol() == QAbstractSocket::IPv4Protocol )
+		{
+			IPv4MissCache::iterator itBegin = m_lsIPv4Cache.lower_bound( qHostAddressToIP4( rStart ) );
+			IPv4MissCache::iterator itEnd   = m_lsIPv4Cache.upper_bound( qHostAddressToIP4( rEnd ) );
+
+			for ( IPv4MissCache::iterator it = itBegin; it != itEnd; ++it )
+			{
+				vErased.push_back( QHostAddress( ( *it ).second ) );
+			}
+
+			m_lsIPv4Cache.erase( itBegin, itEnd );
+		}
+		else if ( rStart.protocol() == QAbstractSocket::IPv6Protocol )
+		{
+			IPv6MissCache::iterator itBegin = m_lsIPv6Cache.lower_bound( qHostAddressToIP6( rStart ) );
+			IPv6MissCache::iterator itEnd   = m_lsIPv6Cache.upper_bound( qHostAddressToIP6( rEnd ) );
+
+			for ( IPv6MissCache::iterator it = itBegin; it != itEnd; ++it )
+			{
+				vErased.push_back( ipv6AddrToQHostAddress( ( *it ).second ) );
+			}
+
+			m_lsIPv6Cache.erase( itBegin, itEnd );
+		}
+		else
+		{
+			qDebug() << QString( "Cannot handle protocol %1 in miss cache." ).arg( rStart.protocol() );
+		}
+
+		m_oSection.unlock();
+	}
 }
 
 void MissCache::clear()
@@ -183,7 +252,7 @@ bool MissCache::check( const QHostAddress& rIP ) const
 {
 	bool bReturn = false;
 
-	m_oSection.lock();
+	SECURITY_LOCK_MUTEX( m_oSection, Measurement::MissCacheLockWait );
 
 	switch ( rIP.protocol() )
 	{
@@ -201,24 +270,47 @@ bool MissCache::check( const QHostAddress& rIP ) const
 		qDebug() << QString( "Cannot handle protocol %1 in miss cache." ).arg( rIP.protocol() );
 	}
 
+	if ( bReturn )
+	{
+		++m_nHits;
+	}
+	else
+	{
+		++m_nMisses;
+	}
+
 	m_oSection.unlock();
 
 	return bReturn;
 }
 
-void MissCache::evaluateUsage()
+quint32 MissCache::hits() const
+{
+	QMutexLocker oLock( &m_oSection );
+	return m_nHits;
+}
+
+quint32 MissCache::misses() const
+{
+	QMutexLocker oLock( &m_oSection );
+	return m_nMisses;
+}
+
+void MissCache::resetStatistics()
+{
+	QMutexLocker oLock( &m_oSection );
+	m_nHits   = 0;
+	m_nMisses = 0;
+}
+
+void MissCache::evaluateUsage( uint nIPs, uint nRanges )
 {
 	// Note: The size of the country map is considered to be negligible here, it it will not
 	//       contain a large number of rules in 99% of the use cases.
-	//       Also, we don't need a lock here as the negative impact of an erroneous value at this
-	//       place is negligible.
-	uint nIPMap       = ( uint )securityManager.m_lmIPs.size();
-	uint nIPRanges    = ( uint )securityManager.m_vIPRanges.size();
-
 	m_oSection.lock();
 
-	// ln( nCache ) < ln ( nIPMap ) + ln ( nIPRanges )
-	m_nMaxIPsInCache = nIPMap * nIPRanges;
+	// ln( nCache ) < ln ( nIPs ) + ln ( nRanges )
+	m_nMaxIPsInCache = nIPs * nRanges;
 
 	if ( m_bUseMissCache )
 	{
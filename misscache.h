@@ -26,6 +26,7 @@
 #define MISSCACHE_H
 
 #include <set>
+#include <vector>
 #include <QMutex>
 #include <QMetaMethod>
 #include <QHostAddress>
@@ -47,6 +48,7 @@ public:
 #endif
 	typedef quint32 IPv4Addr;
 
+	// data[0] holds the first (most significant) half of the address, data[1] the second one
 	typedef struct
 	{
 		quint64 data[2];
@@ -67,10 +69,10 @@ public:
 	{
 		bool operator()( const IPv6Entry& first, const IPv6Entry& second ) const
 		{
-			// second half of IPv6 is to be expected to be more diverse than first half
-			return first.second.data[1] == second.second.data[1] ?
-					first.second.data[0] < second.second.data[0] :
-					first.second.data[1] < second.second.data[1];
+			// numerical order, so address ranges can be scanned
+			return first.second.data[0] == second.second.data[0] ?
+					first.second.data[1] < second.second.data[1] :
+					first.second.data[0] < second.second.data[0];
 		}
 	};
 
@@ -90,6 +92,10 @@ public:
 
 	bool            m_bExpiryRequested;
 
+	// lookup statistics, protected by m_oSection
+	mutable quint32 m_nHits;
+	mutable quint32 m_nMisses;
+
 	QMetaMethod     m_pfExpire;
 
 	/**
@@ -118,6 +124,14 @@ public:
 	 */
 	static IPv6Addr qipv6addrToIPv6Addr( const Q_IPV6ADDR& qip6 );
 
+	/**
+	 * @brief ipv6AddrToQHostAddress converts an IPv6Addr back to a QHostAddress.
+	 *
+	 * @param ip6   The IPv6Addr
+	 * @return A QHostAddress
+	 */
+	static QHostAddress ipv6AddrToQHostAddress( const IPv6Addr& ip6 );
+
 public:
 	/**
 	 * @brief MissCache constructs an empty MissCache.
@@ -153,8 +167,19 @@ public:
 	 * @brief erase removes a specified IP from the MissCache.
 	 *
 	 * @param rIP   The IP
+	 * @return true if the IP was part of the cache; false otherwise
 	 */
-	void erase( const QHostAddress& rIP );
+	bool erase( const QHostAddress& rIP );
+
+	/**
+	 * @brief erase removes all IPs within a specified range from the MissCache.
+	 *
+	 * @param rStart   The first IP of the range
+	 * @param rEnd     The last IP of the range
+	 * @param vErased  The removed IPs are appended to this vector.
+	 */
+	void erase( const QHostAddress& rStart, const QHostAddress& rEnd,
+				std::vector< QHostAddress >& vErased );
 
 	/**
 	 * @brief clear removes all IPs from the MissCache.
@@ -169,11 +194,34 @@ public:
 	 */
 	bool check( const QHostAddress& rIP ) const;
 
+	/**
+	 * @brief hits allows to access the number of checks that found the IP in the cache.
+	 *
+	 * @return the number of successful checks since the last call of resetStatistics()
+	 */
+	quint32 hits() const;
+
+	/**
+	 * @brief misses allows to access the number of checks that did not find the IP in the cache.
+	 *
+	 * @return the number of failed checks since the last call of resetStatistics()
+	 */
+	quint32 misses() const;
+
+	/**
+	 * @brief resetStatistics resets the hit and miss counters. Note that clear() does not touch
+	 * them, as the cache is cleared on most rule changes.
+	 */
+	void resetStatistics();
+
 	/**
 	 * @brief evaluateUsage recalculates the maximal cache size, determines whether it is logical
 	 * to use the cache or not etc.
+	 *
+	 * @param nIPs     The number of single IP rules of the Manager.
+	 * @param nRanges  The number of IP range rules of the Manager.
 	 */
-	void evaluateUsage();
+	void evaluateUsage( uint nIPs, uint nRanges );
 
 private slots:
 	/**
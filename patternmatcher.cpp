@@ -0,0 +1,218 @@
+/*
+** patternmatcher.cpp
+**
+** Copyright © Quazaa Development Team, 2014.
+** This file is part of the Quazaa Security Library (quazaa.sourceforge.net)
+**
+** The Quazaa Security Library is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** The Quazaa Security Library is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with the Quazaa Security Library; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include <algorithm>
+#include <queue>
+
+#include "patternmatcher.h"
+
+#include "debug_new.h"
+
+using namespace Security;
+
+PatternMatcher::PatternMatcher( Qt::CaseSensitivity eCaseSensitivity ) :
+	m_eCaseSensitivity( eCaseSensitivity )
+{
+	clear();
+}
+
+void PatternMatcher::clear()
+{
+	m_vStates.assign( 1, State() );
+	m_vEmpty.clear();
+	std::fill( m_pRoot, m_pRoot + 128, 0 );
+	m_bBuilt = false;
+}
+
+bool PatternMatcher::isEmpty() const
+{
+	return m_vStates.size() == 1 && m_vEmpty.empty();
+}
+
+void PatternMatcher::add( const QString& sPattern, quint32 nId )
+{
+	m_bBuilt = false;
+
+	if ( sPattern.isEmpty() )
+	{
+		m_vEmpty.push_back( nId );
+		return;
+	}
+
+	quint32 nState = 0;
+
+	for ( int i = 0; i < sPattern.size(); ++i )
+	{
+		const Edge oEdge( fold( sPattern.at( i ).unicode() ), 0 );
+
+		std::vector< Edge >& vEdges = m_vStates[nState].vEdges;
+		std::vector< Edge >::iterator it = std::lower_bound( vEdges.begin(), vEdges.end(), oEdge );
+
+		if ( it != vEdges.end() && ( *it ).first == oEdge.first )
+		{
+			nState = ( *it ).second;
+		}
+		else
+		{
+			const quint32 nNew = ( quint32 )m_vStates.size();
+			vEdges.insert( it, Edge( oEdge.first, nNew ) );
+
+			// Note: this invalidates vEdges
+			m_vStates.push_back( State() );
+			nState = nNew;
+		}
+	}
+
+	m_vStates[nState].vOutputs.push_back( nId );
+}
+
+void PatternMatcher::build()
+{
+	for ( ushort c = 0; c < 128; ++c )
+	{
+		m_pRoot[c] = child( 0, c );
+	}
+
+	// breadth first traversal, so the failure state of each state is known before its children
+	// are visited
+	std::queue< quint32 > qStates;
+
+	for ( std::vector< Edge >::const_iterator it = m_vStates[0].vEdges.begin();
+		  it != m_vStates[0].vEdges.end(); ++it )
+	{
+		m_vStates[( *it ).second].nFailure = 0;
+		m_vStates[( *it ).second].nOutput  = 0;
+		qStates.push( ( *it ).second );
+	}
+
+	while ( !qStates.empty() )
+	{
+		const quint32 nState = qStates.front();
+		qStates.pop();
+
+		for ( std::vector< Edge >::size_type i = 0; i < m_vStates[nState].vEdges.size(); ++i )
+		{
+			const Edge oEdge = m_vStates[nState].vEdges[i];
+
+			// find the longest suffix of the parent that can be extended by the edge character
+			quint32 nFailure = m_vStates[nState].nFailure;
+			quint32 nTarget  = child( nFailure, oEdge.first );
+
+			while ( !nTarget && nFailure )
+			{
+				nFailure = m_vStates[nFailure].nFailure;
+				nTarget  = child( nFailure, oEdge.first );
+			}
+
+			State& oChild  = m_vStates[oEdge.second];
+			oChild.nFailure = nTarget;
+			oChild.nOutput  = m_vStates[nTarget].vOutputs.empty() ? m_vStates[nTarget].nOutput :
+																	nTarget;
+
+			qStates.push( oEdge.second );
+		}
+	}
+
+	m_bBuilt = true;
+}
+
+void PatternMatcher::match( const QString& sText, std::vector< quint32 >& vIds ) const
+{
+	Q_ASSERT( m_bBuilt );
+
+	vIds = m_vEmpty;
+
+	if ( m_vStates.size() > 1 )
+	{
+		const QChar* const pText = sText.constData();
+		const int nSize = sText.size();
+
+		quint32 nState = 0;
+
+		for ( int i = 0; i < nSize; ++i )
+		{
+			nState = next( nState, fold( pText[i].unicode() ) );
+
+			const State& oState = m_vStates[nState];
+
+			vIds.insert( vIds.end(), oState.vOutputs.begin(), oState.vOutputs.end() );
+
+			for ( quint32 nOutput = oState.nOutput; nOutput; nOutput = m_vStates[nOutput].nOutput )
+			{
+				vIds.insert( vIds.end(), m_vStates[nOutput].vOutputs.begin(),
+							 m_vStates[nOutput].vOutputs.end() );
+			}
+		}
+	}
+
+	std::sort( vIds.begin(), vIds.end() );
+	vIds.erase( std::unique( vIds.begin(), vIds.end() ), vIds.end() );
+}
+
+ushort PatternMatcher::fold( ushort c ) const
+{
+	if ( m_eCaseSensitivity == Qt::CaseSensitive )
+	{
+		return c;
+	}
+
+	// ASCII fast path
+	if ( c < 128 )
+	{
+		return ( c >= 'A' && c <= 'Z' ) ? c + ( 'a' - 'A' ) : c;
+	}
+
+	return QChar( c ).toCaseFolded().unicode();
+}
+
+quint32 PatternMatcher::child( quint32 nState, ushort c ) const
+{
+	const std::vector< Edge >& vEdges = m_vStates[nState].vEdges;
+	const Edge oEdge( c, 0 );
+
+	std::vector< Edge >::const_iterator it = std::lower_bound( vEdges.begin(), vEdges.end(), oEdge );
+
+	return ( it != vEdges.end() && ( *it ).first == c ) ? ( *it ).second : 0;
+}
+
+quint32 PatternMatcher::next( quint32 nState, ushort c ) const
+{
+	for ( ; ; )
+	{
+		if ( !nState )
+		{
+			return c < 128 ? m_pRoot[c] : child( 0, c );
+		}
+
+		const quint32 nTarget = child( nState, c );
+
+		if ( nTarget )
+		{
+			return nTarget;
+		}
+
+		nState = m_vStates[nState].nFailure;
+	}
+}
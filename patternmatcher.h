@@ -0,0 +1,140 @@
+/*
+** patternmatcher.h
+**
+** Copyright © Quazaa Development Team, 2014.
+** This file is part of the Quazaa Security Library (quazaa.sourceforge.net)
+**
+** The Quazaa Security Library is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** The Quazaa Security Library is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with the Quazaa Security Library; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#ifndef PATTERNMATCHER_H
+#define PATTERNMATCHER_H
+
+#include <vector>
+
+#include <QString>
+
+namespace Security
+{
+
+/**
+ * @brief The PatternMatcher class finds all occurrences of a set of literal patterns within a
+ * string in a single pass (Aho-Corasick). The cost of a lookup is independent of the number of
+ * patterns. Matching can be done case insensitively, in which case both patterns and text are
+ * case folded, with a table lookup for ASCII characters and a QChar fallback for the rest.
+ */
+class PatternMatcher
+{
+#ifndef QUAZAA_SETUP_UNIT_TESTS
+private:
+#else
+public:
+#endif
+	typedef std::pair< ushort, quint32 > Edge; // (folded) character, target state
+
+	struct State
+	{
+		std::vector< Edge >     vEdges;     // sorted by character
+		std::vector< quint32 >  vOutputs;   // ids of the patterns ending in this state
+		quint32                 nFailure;   // longest proper suffix that is a prefix of a pattern
+		quint32                 nOutput;    // next state on the failure chain with outputs; 0: none
+
+		State() :
+			nFailure( 0 ),
+			nOutput( 0 )
+		{
+		}
+	};
+
+	typedef std::vector< State > StateVector;
+
+	Qt::CaseSensitivity     m_eCaseSensitivity;
+	StateVector             m_vStates;
+
+	// dense transitions of the root state for ASCII characters
+	quint32                 m_pRoot[128];
+
+	// ids of empty patterns, these match any text
+	std::vector< quint32 >  m_vEmpty;
+
+	bool                    m_bBuilt;
+
+public:
+	/**
+	 * @brief PatternMatcher constructs an empty matcher.
+	 *
+	 * @param eCaseSensitivity  Whether patterns are matched case sensitively.
+	 */
+	PatternMatcher( Qt::CaseSensitivity eCaseSensitivity = Qt::CaseInsensitive );
+
+	/**
+	 * @brief clear removes all patterns.
+	 */
+	void        clear();
+
+	/**
+	 * @brief isEmpty allows to check whether there are any patterns.
+	 *
+	 * @return <code>true</code> if no pattern has been added; <br><code>false</code> otherwise
+	 */
+	bool        isEmpty() const;
+
+	/**
+	 * @brief add adds a pattern. Call build() after adding all patterns.
+	 *
+	 * @param sPattern  The pattern.
+	 * @param nId       The id reported by match() if the pattern is found.
+	 */
+	void        add( const QString& sPattern, quint32 nId );
+
+	/**
+	 * @brief build prepares the automaton for matching.
+	 */
+	void        build();
+
+	/**
+	 * @brief match finds all patterns occurring in sText.
+	 *
+	 * @param sText  The text to search.
+	 * @param vIds   Is filled with the sorted ids of all patterns occurring in sText.
+	 */
+	void        match( const QString& sText, std::vector< quint32 >& vIds ) const;
+
+private:
+	/**
+	 * @brief fold returns the case folded representation of a character, if required.
+	 */
+	ushort      fold( ushort c ) const;
+
+	/**
+	 * @brief child returns the target of the edge of nState for c.
+	 *
+	 * @return the target state; <br>0 if there is no such edge
+	 */
+	quint32     child( quint32 nState, ushort c ) const;
+
+	/**
+	 * @brief next returns the state the automaton moves to from nState on c.
+	 */
+	quint32     next( quint32 nState, ushort c ) const;
+};
+
+}
+
+#endif // PATTERNMATCHER_H
@@ -0,0 +1,132 @@
+/*
+** querycontext.cpp
+**
+** Copyright © Quazaa Development Team, 2014.
+** This file is part of the Quazaa Security Library (quazaa.sourceforge.net)
+**
+** The Quazaa Security Library is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** The Quazaa Security Library is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with the Quazaa Security Library; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "querycontext.h"
+#include "regexprule.h"
+
+#include "debug_new.h"
+
+using namespace Security;
+
+// The keywords are kept as entered: the positional <N> elements of regular expression rules refer
+// to the token positions of the query, exactly as RegularExpressionRule::match() sees them.
+QueryContext::QueryContext( const QList<QString>& lQuery ) :
+	m_lKeywords( lQuery ),
+	m_nGeneration( -1 )
+{
+}
+
+const QList<QString>& QueryContext::keywords() const
+{
+	return m_lKeywords;
+}
+
+QByteArray QueryContext::hitKey( const QueryHit* const pHit )
+{
+	const HashSet& vHashes = pHit->m_vHashes;
+
+	QByteArray baKey;
+
+	// The hashes within a HashSet are sorted by priority, so the first one is the most reliable.
+	for ( quint8 i = 0, nSize = vHashes.size(); i < nSize; ++i )
+	{
+		if ( vHashes[i] )
+		{
+			baKey.append( ( char )i );
+			baKey.append( vHashes[i]->rawValue() );
+			break;
+		}
+	}
+
+	if ( baKey.isEmpty() )
+	{
+		baKey.append( ( char )0xFF );
+	}
+
+	// The hash length is defined by its type and the size string cannot contain a ':', so the key
+	// is unambiguous.
+	baKey.append( QByteArray::number( pHit->m_nObjectSize ) );
+	baKey.append( ':' );
+	baKey.append( pHit->m_sDescriptiveName.toUtf8() );
+
+	return baKey;
+}
+
+bool QueryContext::lookup( const QByteArray& baKey, int nGeneration, bool& bDenied )
+{
+	QMutexLocker oLock( &m_oSection );
+
+	if ( m_nGeneration != nGeneration )
+	{
+		// The rules have changed since the verdicts have been memorized.
+		m_lhVerdicts.clear();
+		m_nGeneration = nGeneration;
+		return false;
+	}
+
+	VerdictMemo::const_iterator it = m_lhVerdicts.constFind( baKey );
+
+	if ( it == m_lhVerdicts.constEnd() )
+	{
+		return false;
+	}
+
+	bDenied = it.value();
+	return true;
+}
+
+void QueryContext::memorize( const QByteArray& baKey, int nGeneration, bool bDenied )
+{
+	QMutexLocker oLock( &m_oSection );
+
+	if ( m_nGeneration == nGeneration )
+	{
+		m_lhVerdicts.insert( baKey, bDenied );
+	}
+}
+
+#if QT_VERSION >= 0x050000
+QRegularExpression QueryContext::regExp( const RegularExpressionRule* const pRule )
+#else
+QRegExp QueryContext::regExp( const RegularExpressionRule* const pRule )
+#endif
+{
+	Q_ASSERT( pRule->hasSpecialElements() );
+
+	QMutexLocker oLock( &m_oSection );
+
+	RegExpCache::iterator it = m_lhRegExps.find( pRule->contentString() );
+
+	if ( it == m_lhRegExps.end() )
+	{
+#if QT_VERSION >= 0x050000
+		it = m_lhRegExps.insert( pRule->contentString(),
+								 QRegularExpression( pRule->filter( m_lKeywords ) ) );
+#else
+		it = m_lhRegExps.insert( pRule->contentString(), QRegExp( pRule->filter( m_lKeywords ) ) );
+#endif
+	}
+
+	return it.value();
+}
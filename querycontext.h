@@ -0,0 +1,150 @@
+/*
+** querycontext.h
+**
+** Copyright © Quazaa Development Team, 2014.
+** This file is part of the Quazaa Security Library (quazaa.sourceforge.net)
+**
+** The Quazaa Security Library is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** The Quazaa Security Library is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with the Quazaa Security Library; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#ifndef QUERYCONTEXT_H
+#define QUERYCONTEXT_H
+
+#include <vector>
+
+#include <QHash>
+#include <QMutex>
+
+#if QT_VERSION >= 0x050000
+#  include <QRegularExpression>
+#else
+#  include <QRegExp>
+#endif
+
+#include "externals.h"
+
+namespace Security
+{
+
+class RegularExpressionRule;
+
+/**
+ * @brief QueryHitVector represents the hits of a search result packet.
+ */
+typedef std::vector< const QueryHit* > QueryHitVector;
+
+/**
+ * @brief The QueryContext class holds the search dependent data required to filter the hits of a
+ * search. It is to be created once per search and handed to Manager::isDenied() for every hit or
+ * result packet returned by that search.
+ */
+class QueryContext
+{
+	friend class Manager;
+
+private:
+#if QT_VERSION >= 0x050000
+	typedef QHash< QString, QRegularExpression > RegExpCache;
+#else
+	typedef QHash< QString, QRegExp > RegExpCache;
+#endif
+	typedef QHash< QByteArray, bool > VerdictMemo;
+
+	mutable QMutex  m_oSection;
+
+	// search keywords exactly as they have been entered (including empty tokens)
+	QList<QString>  m_lKeywords;
+
+	// rule regular expressions instantiated for this query, by rule content
+	RegExpCache     m_lhRegExps;
+
+	// verdicts of hits already checked for this search, by file identity
+	VerdictMemo     m_lhVerdicts;
+
+	// the rule generation the verdicts in m_lhVerdicts are valid for
+	int             m_nGeneration;
+
+public:
+	/**
+	 * @brief QueryContext constructs the context for a search.
+	 *
+	 * @param lQuery  A list of all search keywords in the same order they have been entered in
+	 * the edit box of the GUI.
+	 */
+	QueryContext( const QList<QString>& lQuery );
+
+	/**
+	 * @brief keywords allows to access the search keywords.
+	 * <br><b>Locking: /</b>
+	 *
+	 * @return the search keywords as handed to the constructor; empty tokens are preserved so
+	 * that positional elements of regular expression rules match the legacy QList<QString> path
+	 */
+	const QList<QString>& keywords() const;
+
+	/**
+	 * @brief hitKey generates a key identifying the file of a QueryHit: its highest priority hash
+	 * (if any), its size and its name.
+	 * <br><b>Locking: /</b>
+	 *
+	 * @param pHit  The QueryHit.
+	 * @return a key that is equal for all hits describing the same file
+	 */
+	static QByteArray hitKey( const QueryHit* const pHit );
+
+private:
+	/**
+	 * @brief lookup retrieves a memorized verdict.
+	 * <br><b>Locking: /</b> (locks m_oSection internally)
+	 *
+	 * @param baKey        The file key as returned by hitKey().
+	 * @param nGeneration  The current rule generation of the Manager. Verdicts memorized for other
+	 * generations are discarded.
+	 * @param bDenied      Set to the memorized verdict if one could be found.
+	 * @return <code>true</code> if a verdict was found; <br><code>false</code> otherwise
+	 */
+	bool            lookup( const QByteArray& baKey, int nGeneration, bool& bDenied );
+
+	/**
+	 * @brief memorize stores the verdict for a file.
+	 * <br><b>Locking: /</b> (locks m_oSection internally)
+	 *
+	 * @param baKey        The file key as returned by hitKey().
+	 * @param nGeneration  The rule generation the verdict has been determined with.
+	 * @param bDenied      The verdict.
+	 */
+	void            memorize( const QByteArray& baKey, int nGeneration, bool bDenied );
+
+	/**
+	 * @brief regExp returns the regular expression of a rule with special elements instantiated
+	 * for the keywords of this context. The expression is only compiled on first request.
+	 * <br><b>Locking: /</b> (locks m_oSection internally)
+	 *
+	 * @param pRule  The RegularExpressionRule.
+	 * @return the instantiated regular expression
+	 */
+#if QT_VERSION >= 0x050000
+	QRegularExpression regExp( const RegularExpressionRule* const pRule );
+#else
+	QRegExp            regExp( const RegularExpressionRule* const pRule );
+#endif
+};
+
+}
+
+#endif // QUERYCONTEXT_H
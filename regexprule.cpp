@@ -93,39 +93,7 @@ bool RegularExpressionRule::match( const QList<QString>& lQuery, const QString&
 
 	if ( m_bSpecialElements )
 	{
-		// Build a regular expression filter from the search query words.
-		// Returns an empty string if not applied or if the filter was invalid.
-		//
-		// Substitutes:
-		// <_> - inserts all query keywords;
-		// <0>..<9> - inserts query keyword number 0..9;
-		// <> - inserts next query keyword.
-		//
-		// For example regular expression:
-		//	.*(<2><1>)|(<_>).*
-		// for "music mp3" query will be converted to:
-		//	.*(mp3\s*music\s*)|(music\s*mp3\s*).*
-		//
-		// Note: \s* - matches any number of white-space symbols (including zero).
-
-		QString sFilter, sBaseFilter = m_sContent;
-
-		int pos = sBaseFilter.indexOf( '<' );
-		Q_ASSERT( pos != -1 );
-
-		quint8 nArg = 0;
-
-		// replace all relevant occurrences of <*something*
-		while ( pos != -1 )
-		{
-			sFilter += sBaseFilter.left( pos );
-			sBaseFilter.remove( 0, pos );
-			bool bSuccess = replace( sBaseFilter, lQuery, nArg );
-
-			pos = sBaseFilter.indexOf( '<', bSuccess ? 0 : 1 );
-		}
-		// add whats left of the base filter string to the newly generated filter
-		sFilter += sBaseFilter;
+		const QString sFilter = filter( lQuery );
 
 #if QT_VERSION >= 0x050000
 		QRegularExpression oRegExpFilter = QRegularExpression( sFilter );
@@ -145,6 +113,51 @@ bool RegularExpressionRule::match( const QList<QString>& lQuery, const QString&
 	}
 }
 
+bool RegularExpressionRule::hasSpecialElements() const
+{
+	return m_bSpecialElements;
+}
+
+QString RegularExpressionRule::filter( const QList<QString>& lQuery ) const
+{
+	Q_ASSERT( m_bSpecialElements );
+
+	// Build a regular expression filter from the search query words.
+	//
+	// Substitutes:
+	// <_> - inserts all query keywords;
+	// <0>..<9> - inserts query keyword number 0..9;
+	// <> - inserts next query keyword.
+	//
+	// For example regular expression:
+	//	.*(<2><1>)|(<_>).*
+	// for "music mp3" query will be converted to:
+	//	.*(mp3\s*music\s*)|(music\s*mp3\s*).*
+	//
+	// Note: \s* - matches any number of white-space symbols (including zero).
+
+	QString sFilter, sBaseFilter = m_sContent;
+
+	int pos = sBaseFilter.indexOf( '<' );
+	Q_ASSERT( pos != -1 );
+
+	quint8 nArg = 0;
+
+	// replace all relevant occurrences of <*something*
+	while ( pos != -1 )
+	{
+		sFilter += sBaseFilter.left( pos );
+		sBaseFilter.remove( 0, pos );
+		bool bSuccess = replace( sBaseFilter, lQuery, nArg );
+
+		pos = sBaseFilter.indexOf( '<', bSuccess ? 0 : 1 );
+	}
+	// add whats left of the base filter string to the newly generated filter
+	sFilter += sBaseFilter;
+
+	return sFilter;
+}
+
 void RegularExpressionRule::toXML( QXmlStreamWriter& oXMLdocument ) const
 {
 	Q_ASSERT( m_nType == RuleType::RegularExpression );
@@ -71,6 +71,25 @@ public:
 	bool        match( const QList<QString>& lQuery, const QString& sContent ) const;
 	void        toXML( QXmlStreamWriter& oXMLdocument ) const;
 
+	/**
+	 * @brief hasSpecialElements allows to know whether the regular expression of this rule needs
+	 * to be instantiated with the query keywords before matching.
+	 *
+	 * @return <code>true</code> if the rule contains special elements;
+	 * <br><code>false</code> otherwise
+	 */
+	bool        hasSpecialElements() const;
+
+	/**
+	 * @brief filter builds the regular expression filter string for a given query by replacing
+	 * the special elements of the rule with the query keywords.
+	 *
+	 * @param lQuery  A list of all search keywords in the same order they have been entered in
+	 * the edit box of the GUI.
+	 * @return the instantiated filter string
+	 */
+	QString     filter( const QList<QString>& lQuery ) const;
+
 private:
 	static bool replace( QString& sReplace, const QList<QString>& lQuery, quint8& nCurrent );
 };
@@ -22,11 +22,118 @@
 ** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 */
 
+#include <algorithm>
+
+#include <QRunnable>
+#include <QSemaphore>
+
 #include "sanitychecker.h"
+#include "securitymanager.h"
 
 using namespace Security;
 
-SanityChecker::SanityChecker() :
+namespace Security
+{
+/**
+ * @brief The SanityCheckTask class checks a part of a bulk request against the loaded new rules.
+ * The verdicts are written to a char vector as std::vector<bool> cannot be written to by multiple
+ * threads at once.
+ */
+class SanityCheckTask : public QRunnable
+{
+private:
+	size_t              m_nBegin;
+	size_t              m_nEnd;
+	std::vector<char>&  m_vDenied;
+	QSemaphore*         m_pDone;
+
+public:
+	SanityCheckTask( size_t nBegin, size_t nEnd, std::vector<char>& vDenied ) :
+		m_nBegin( nBegin ),
+		m_nEnd( nEnd ),
+		m_vDenied( vDenied ),
+		m_pDone( NULL )
+	{
+		setAutoDelete( false );
+	}
+
+	virtual ~SanityCheckTask()
+	{
+	}
+
+	void setDoneSemaphore( QSemaphore* pDone )
+	{
+		m_pDone = pDone;
+	}
+
+	void run()
+	{
+		for ( size_t i = m_nBegin; i < m_nEnd; ++i )
+		{
+			m_vDenied[i] = check( i );
+		}
+
+		if ( m_pDone )
+		{
+			m_pDone->release();
+		}
+	}
+
+protected:
+	virtual bool check( size_t nItem ) = 0;
+};
+
+class AddressCheckTask : public SanityCheckTask
+{
+private:
+	SanityChecker&          m_oChecker;
+	const EndPointVector&   m_vAddresses;
+
+public:
+	AddressCheckTask( SanityChecker& oChecker, const EndPointVector& vAddresses,
+					  size_t nBegin, size_t nEnd, std::vector<char>& vDenied ) :
+		SanityCheckTask( nBegin, nEnd, vDenied ),
+		m_oChecker( oChecker ),
+		m_vAddresses( vAddresses )
+	{
+	}
+
+protected:
+	bool check( size_t nItem )
+	{
+		return m_oChecker.isNewlyDenied( m_vAddresses[nItem] );
+	}
+};
+
+class HitCheckTask : public SanityCheckTask
+{
+private:
+	SanityChecker&          m_oChecker;
+	const QueryHitVector&   m_vHits;
+	const QList<QString>&   m_lQuery;
+
+public:
+	HitCheckTask( SanityChecker& oChecker, const QueryHitVector& vHits,
+				  const QList<QString>& lQuery, size_t nBegin, size_t nEnd,
+				  std::vector<char>& vDenied ) :
+		SanityCheckTask( nBegin, nEnd, vDenied ),
+		m_oChecker( oChecker ),
+		m_vHits( vHits ),
+		m_lQuery( lQuery )
+	{
+	}
+
+protected:
+	bool check( size_t nItem )
+	{
+		return m_oChecker.isNewlyDenied( m_vHits[nItem], m_lQuery );
+	}
+};
+}
+
+SanityChecker::SanityChecker( Manager& oManager ) :
+	m_oManager( oManager ),
+	m_pQueueHead( NULL ),
 	m_bNewRulesLoaded( false ),
 	m_nPendingOperations( 0 ),
 	m_bVerboose( false )
@@ -48,18 +155,22 @@ bool SanityChecker::isNewlyDenied( const EndPoint& oAddress )
 	// This should only be called if new rules have been loaded previously.
 	Q_ASSERT( m_bNewRulesLoaded );
 
-	RuleVectorPos n = 0;
-	const RuleVectorPos nMax = m_vLoadedRules.size();
+	Q_ASSERT( m_vLoadedRules.size() );
 
-	Q_ASSERT( nMax );
+	// Only rules that might match need to be tested. The candidates are returned in batch order, so
+	// the first matching rule still decides.
+	BatchIndex::PositionVector vCandidates;
+	m_oBatchIndex.candidates( oAddress, vCandidates );
 
 	Rule* const * const pRules = &m_vLoadedRules[0];
 
-	while ( n < nMax )
+	for ( size_t i = 0, nMax = vCandidates.size(); i < nMax; ++i )
 	{
+		const RuleVectorPos n = vCandidates[i];
+
 		if ( pRules[n]->match( oAddress ) )
 		{
-			pRules[n]->count( common::getTNowUTC() );
+			pRules[n]->count( m_oManager.m_pEnvironment->now() );
 
 			if ( pRules[n]->m_nAction == RuleAction::Deny )
 			{
@@ -70,8 +181,6 @@ bool SanityChecker::isNewlyDenied( const EndPoint& oAddress )
 				return false;
 			}
 		}
-
-		++n;
 	}
 
 	return false;
@@ -87,18 +196,20 @@ bool SanityChecker::isNewlyDenied( const QueryHit* const pHit, const QList<QStri
 	// This should only be called if new rules have been loaded previously.
 	Q_ASSERT( m_bNewRulesLoaded );
 
-	RuleVectorPos n = 0;
-	const RuleVectorPos nMax = m_vLoadedRules.size();
+	Q_ASSERT( m_vLoadedRules.size() );
 
-	Q_ASSERT( nMax );
+	BatchIndex::PositionVector vCandidates;
+	m_oBatchIndex.candidates( pHit, vCandidates );
 
 	Rule* const * const pRules = &m_vLoadedRules[0];
 
-	while ( n < nMax )
+	for ( size_t i = 0, nMax = vCandidates.size(); i < nMax; ++i )
 	{
+		const RuleVectorPos n = vCandidates[i];
+
 		if ( pRules[n]->match( pHit ) || pRules[n]->match( lQuery, pHit->m_sDescriptiveName ) )
 		{
-			pRules[n]->count( common::getTNowUTC() );
+			pRules[n]->count( m_oManager.m_pEnvironment->now() );
 
 			if ( pRules[n]->m_nAction == RuleAction::Deny )
 			{
@@ -109,18 +220,136 @@ bool SanityChecker::isNewlyDenied( const QueryHit* const pHit, const QList<QStri
 				return false;
 			}
 		}
-
-		++n;
 	}
 
 	return false;
 }
 
+void SanityChecker::push( const std::vector< QUuid >& vRules )
+{
+	if ( vRules.empty() )
+	{
+		return;
+	}
+
+	QueueNode* pNode = new QueueNode;
+	pNode->vRules = vRules;
+
+	enqueue( pNode );
+}
+
+void SanityChecker::pushBan( const QHostAddress& oAddress )
+{
+	QueueNode* pNode = new QueueNode;
+	pNode->vBans.push_back( oAddress );
+
+	enqueue( pNode );
+}
+
+void SanityChecker::pushNetworkBan( const QHostAddress& oNetwork )
+{
+	QueueNode* pNode = new QueueNode;
+	pNode->vNetworkBans.push_back( oNetwork );
+
+	enqueue( pNode );
+}
+
+void SanityChecker::pushAffected( const std::vector< QHostAddress >& vAddresses )
+{
+	if ( vAddresses.empty() )
+	{
+		return;
+	}
+
+	m_oQueueLock.lock();
+
+	for ( size_t i = 0; i < vAddresses.size(); ++i )
+	{
+		m_vPendingAddresses.push_back( EndPoint( vAddresses[i] ) );
+	}
+
+	m_oQueueLock.unlock();
+}
+
+const EndPointVector& SanityChecker::affectedAddresses() const
+{
+	return m_vAffectedAddresses;
+}
+
+EndPointVector SanityChecker::newlyDenied( const EndPointVector& vAddresses )
+{
+	EndPointVector vReturn;
+
+	if ( vAddresses.empty() )
+	{
+		return vReturn;
+	}
+
+	const size_t nItems = vAddresses.size();
+	const size_t nChunk = chunkSize( nItems );
+
+	std::vector<char> vDenied( nItems, 0 );
+	std::vector< SanityCheckTask* > vTasks;
+
+	for ( size_t nBegin = 0; nBegin < nItems; nBegin += nChunk )
+	{
+		vTasks.push_back( new AddressCheckTask( *this, vAddresses, nBegin,
+												qMin( nBegin + nChunk, nItems ), vDenied ) );
+	}
+
+	runTasks( vTasks );
+
+	for ( size_t i = 0; i < nItems; ++i )
+	{
+		if ( vDenied[i] )
+		{
+			vReturn.push_back( vAddresses[i] );
+		}
+	}
+
+	return vReturn;
+}
+
+QueryHitVector SanityChecker::newlyDenied( const QueryHitVector& vHits,
+										   const QList<QString>& lQuery )
+{
+	QueryHitVector vReturn;
+
+	if ( vHits.empty() )
+	{
+		return vReturn;
+	}
+
+	const size_t nItems = vHits.size();
+	const size_t nChunk = chunkSize( nItems );
+
+	std::vector<char> vDenied( nItems, 0 );
+	std::vector< SanityCheckTask* > vTasks;
+
+	for ( size_t nBegin = 0; nBegin < nItems; nBegin += nChunk )
+	{
+		vTasks.push_back( new HitCheckTask( *this, vHits, lQuery, nBegin,
+											qMin( nBegin + nChunk, nItems ), vDenied ) );
+	}
+
+	runTasks( vTasks );
+
+	for ( size_t i = 0; i < nItems; ++i )
+	{
+		if ( vDenied[i] )
+		{
+			vReturn.push_back( vHits[i] );
+		}
+	}
+
+	return vReturn;
+}
+
 void SanityChecker::sanityCheck()
 {
 	if ( m_bVerboose )
 	{
-		postLogMessage( LogSeverity::Debug, tr( "Initializing Sanity. " ), true );
+		m_oManager.m_pEnvironment->log( LogSeverity::Debug, tr( "Initializing Sanity. " ), true );
 	}
 
 	if ( m_oRWLock.tryLockForWrite( 200 ) )
@@ -130,43 +359,42 @@ void SanityChecker::sanityCheck()
 
 		bool bEmit = false;
 
-		m_oQueueLock.lock();
 		// If there are new rules to deal with.
-		if ( m_lqNewRules.size() )
+		if ( queueHead() )
 		{
 			if ( !m_bNewRulesLoaded )
 			{
-				loadBatch();
-
-				// Count how many "OK"s we need to get back.
-				m_nPendingOperations = receivers( SIGNAL( beginSanityCheck() ) );
-
-				// if there is anyone listening, start the sanity check
-				if ( m_nPendingOperations )
+				// Nothing to do if all queued rules have been removed in the meantime.
+				if ( loadBatch() )
 				{
+					// Count how many "OK"s we need to get back.
+					m_nPendingOperations = receivers( SIGNAL( beginSanityCheck() ) );
+
+					// if there is anyone listening, start the sanity check
+					if ( m_nPendingOperations )
+					{
 #ifdef _DEBUG
-					// Failsafe mechanism in case there are massive problems somewhere else.
-					m_idForceEoSC = signalQueue.push( this, "forceEndOfSanityCheck", 120 );
+						// Failsafe mechanism in case there are massive problems somewhere else.
+						m_idForceEoSC = signalQueue.push( this, "forceEndOfSanityCheck", 120 );
 #endif
-					bEmit = true;
-				}
-				else
-				{
-					clearBatch();
+						bEmit = true;
+					}
+					else
+					{
+						clearBatch();
+					}
 				}
 			}
 			else // other sanity check still in progress
 			{
 				// try again later
 				if ( m_bVerboose )
-					postLogMessage( LogSeverity::Debug,
-									tr( "Other check still running. Trying again in 5 sec." ),
-									true );
+					m_oManager.m_pEnvironment->log( LogSeverity::Debug,
+					        tr( "Other check still running. Trying again in 5 sec." ), true );
 				signalQueue.push( this, "sanityCheck", 5 );
 			}
 		}
 
-		m_oQueueLock.unlock();
 		m_oRWLock.unlock();
 
 		if ( bEmit )
@@ -179,9 +407,8 @@ void SanityChecker::sanityCheck()
 	{
 		// try again later
 		if ( m_bVerboose )
-			postLogMessage( LogSeverity::Debug,
-							tr( "Failed to obtain lock. Trying again in 5 sec." ),
-							true );
+			m_oManager.m_pEnvironment->log( LogSeverity::Debug,
+			        tr( "Failed to obtain lock. Trying again in 5 sec." ), true );
 		else
 		{
 			qDebug() << "[Security] Failed to obtain Sanity check lock. Trying again in 5 sec.";
@@ -200,15 +427,17 @@ void SanityChecker::sanityCheckPerformed()
 	if ( --m_nPendingOperations )
 	{
 		if ( m_bVerboose )
-			postLogMessage( LogSeverity::Debug, tr( "A component finished with sanity checking. " )
-							+ tr( "Still waiting for %s other components to finish."
-								).arg( m_nPendingOperations ), true );
+			m_oManager.m_pEnvironment->log( LogSeverity::Debug,
+			        tr( "A component finished with sanity checking. " )
+			        + tr( "Still waiting for %s other components to finish."
+			            ).arg( m_nPendingOperations ), true );
 	}
 	else
 	{
 		if ( m_bVerboose )
-			postLogMessage( LogSeverity::Debug, tr( "Sanity Check finished successfully. " ) +
-							tr( "Starting cleanup now." ), true );
+			m_oManager.m_pEnvironment->log( LogSeverity::Debug,
+			        tr( "Sanity Check finished successfully. " ) +
+			        tr( "Starting cleanup now." ), true );
 
 		clearBatch();
 	}
@@ -226,7 +455,7 @@ void SanityChecker::forceEndOfSanityCheck()
 		QString sTmp = QObject::tr( "Sanity check aborted. Most probable reason: It took some " ) +
 					   QObject::tr( "component longer than 2min to call sanityCheckPerformed() " ) +
 					   QObject::tr( "after having recieved the signal performSanityCheck()." );
-		postLogMessage( LogSeverity::Error, sTmp, true );
+		m_oManager.m_pEnvironment->log( LogSeverity::Error, sTmp, true );
 		Q_ASSERT( false );
 	}
 
@@ -238,29 +467,135 @@ void SanityChecker::forceEndOfSanityCheck()
 }
 #endif //_DEBUG
 
-void SanityChecker::loadBatch()
+void SanityChecker::enqueue( QueueNode* pNode )
+{
+	QueueNode* pHead;
+
+	do
+	{
+		pHead = queueHead();
+		pNode->pNext = pHead;
+	}
+	while ( !m_pQueueHead.testAndSetRelease( pHead, pNode ) );
+}
+
+SanityChecker::QueueNode* SanityChecker::takeQueue()
+{
+	// As nodes are never removed individually, there is no ABA problem here.
+	QueueNode* pNode = m_pQueueHead.fetchAndStoreAcquire( NULL );
+
+	// The stack is in reverse insertion order.
+	QueueNode* pReturn = NULL;
+
+	while ( pNode )
+	{
+		QueueNode* pNext = pNode->pNext;
+		pNode->pNext = pReturn;
+		pReturn = pNode;
+		pNode = pNext;
+	}
+
+	return pReturn;
+}
+
+bool SanityChecker::loadBatch()
 {
 	Q_ASSERT( !m_bNewRulesLoaded );
 	Q_ASSERT( m_vLoadedRules.empty() );
 
+	QueueNode* pNode = takeQueue();
+
 	// there should be at least 1 new rule
-	Q_ASSERT( m_lqNewRules.size() );
+	Q_ASSERT( pNode );
 
-	Rule* pRule = NULL;
+	// Copy the rules once for the entire batch. The copies are required as the Manager might
+	// modify or remove its rules while the sanity check is running.
+	m_oManager.m_oRWLock.lockForRead();
 
-	while ( m_lqNewRules.size() )
+	const Manager::RuleVectorPos nRules = m_oManager.m_vRules.size();
+	const quint32 tNow = m_oManager.m_pEnvironment->now();
+
+	while ( pNode )
 	{
-		pRule = m_lqNewRules.front();
-		m_lqNewRules.pop();
+		for ( size_t i = 0; i < pNode->vRules.size(); ++i )
+		{
+			const Manager::RuleVectorPos nPos = m_oManager.find( pNode->vRules[i] );
+
+			if ( nPos != nRules )
+			{
+				Rule* pRule = m_oManager.m_vRules[nPos]->getCopy();
+
+				Q_ASSERT( pRule->type() && pRule->type() < RuleType::NoOfTypes );
+
+				m_vLoadedRules.push_back( pRule );
+			}
+		}
+
+		// Automatic bans are not stored as rules, so temporary ones are created for the check.
+		for ( size_t i = 0; i < pNode->vBans.size(); ++i )
+		{
+			if ( m_oManager.m_oAutoBans.contains( pNode->vBans[i], tNow ) )
+			{
+				IPRule* pRule = new IPRule();
 
-		Q_ASSERT( pRule->type() && pRule->type() < RuleType::NoOfTypes );
+				if ( pRule->parseContent( pNode->vBans[i].toString() ) )
+				{
+					pRule->m_bAutomatic = true;
+					m_vLoadedRules.push_back( pRule );
+				}
+				else
+				{
+					delete pRule;
+				}
+			}
+		}
+
+		for ( size_t i = 0; i < pNode->vNetworkBans.size(); ++i )
+		{
+			if ( m_oManager.m_oNetworkBans.contains( pNode->vNetworkBans[i], tNow ) )
+			{
+				IPRangeRule* pRule = new IPRangeRule();
 
-		m_vLoadedRules.push_back( pRule );
+				if ( pRule->parseContent( FloodDetector::prefix( pNode->vNetworkBans[i] ) ) )
+				{
+					pRule->m_bAutomatic = true;
+					m_vLoadedRules.push_back( pRule );
+				}
+				else
+				{
+					delete pRule;
+				}
+			}
+		}
 
-		pRule = NULL;
+		QueueNode* pNext = pNode->pNext;
+		delete pNode;
+		pNode = pNext;
 	}
 
+	m_oManager.m_oRWLock.unlock();
+
+	m_oQueueLock.lock();
+	m_vAffectedAddresses.swap( m_vPendingAddresses );
+	m_vPendingAddresses.clear();
+	m_oQueueLock.unlock();
+
+	if ( m_vLoadedRules.empty() )
+	{
+		m_vAffectedAddresses.clear();
+		return false;
+	}
+
+	m_oBatchIndex.build( m_vLoadedRules );
+
+	std::sort( m_vAffectedAddresses.begin(), m_vAffectedAddresses.end() );
+	m_vAffectedAddresses.erase( std::unique( m_vAffectedAddresses.begin(),
+											 m_vAffectedAddresses.end() ),
+								m_vAffectedAddresses.end() );
+
 	m_bNewRulesLoaded = true;
+
+	return true;
 }
 
 void SanityChecker::clearBatch( bool bShutDown )
@@ -281,6 +616,8 @@ void SanityChecker::clearBatch( bool bShutDown )
 	}
 
 	m_vLoadedRules.clear();
+	m_oBatchIndex.clear();
+	m_vAffectedAddresses.clear();
 
 #ifdef _DEBUG // use failsafe to abort sanity check only in debug version
 
@@ -307,12 +644,50 @@ void SanityChecker::clear()
 		clearBatch( true );
 	}
 
-	while ( m_lqNewRules.size() )
+	QueueNode* pNode = takeQueue();
+
+	while ( pNode )
 	{
-		delete m_lqNewRules.front();
-		m_lqNewRules.pop();
+		QueueNode* pNext = pNode->pNext;
+		delete pNode;
+		pNode = pNext;
 	}
 
+	m_vPendingAddresses.clear();
+
 	m_oQueueLock.unlock();
 	m_oRWLock.unlock();
 }
+
+size_t SanityChecker::chunkSize( size_t nItems ) const
+{
+	// one task per worker thread plus one for the calling thread
+	const size_t nThreads = ( size_t )qMax( m_oWorkers.maxThreadCount(), 0 ) + 1;
+
+	return qMax( ( size_t )SECURITY_SANITY_CHECK_CHUNK_SIZE, ( nItems + nThreads - 1 ) / nThreads );
+}
+
+void SanityChecker::runTasks( std::vector< SanityCheckTask* >& vTasks )
+{
+	Q_ASSERT( !vTasks.empty() );
+
+	QSemaphore oDone;
+
+	for ( size_t i = 1; i < vTasks.size(); ++i )
+	{
+		vTasks[i]->setDoneSemaphore( &oDone );
+		m_oWorkers.start( vTasks[i] );
+	}
+
+	// don't leave the calling thread idle
+	vTasks[0]->run();
+
+	oDone.acquire( ( int )vTasks.size() - 1 );
+
+	for ( size_t i = 0; i < vTasks.size(); ++i )
+	{
+		delete vTasks[i];
+	}
+
+	vTasks.clear();
+}
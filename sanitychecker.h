@@ -25,18 +25,29 @@
 #ifndef SANITYCHECKER_H
 #define SANITYCHECKER_H
 
+#include <QAtomicPointer>
 #include <QObject>
 #include <QReadWriteLock>
+#include <QThreadPool>
 
 #include <vector>
-#include <queue>
 
+#include "batchindex.h"
 #include "externals.h"
+#include "querycontext.h"
 #include "securerule.h"
 
 namespace Security
 {
 
+class Manager;
+class SanityCheckTask;
+
+/**
+ * @brief EndPointVector represents a set of IPs to be checked at once.
+ */
+typedef std::vector< EndPoint > EndPointVector;
+
 /**
  * @brief The SanityCecker class manages coordinating the rechecking of the entire application in
  * the case of rule additions.
@@ -49,11 +60,26 @@ private:
 	typedef std::vector< Rule*  > RuleVector;
 	typedef RuleVector::size_type RuleVectorPos;
 
-	// a queue for new rules to wait in
-	typedef std::queue< Rule* > NewRulesQueue;
+	/**
+	 * @brief QueueNode holds the IDs of one or more rules or automatic bans waiting for a sanity
+	 * check. The rules themselves are only copied from the Manager once their batch is loaded.
+	 */
+	struct QueueNode
+	{
+		QueueNode*           pNext;
+		std::vector< QUuid > vRules;
+		std::vector< QHostAddress > vBans;
+		std::vector< QHostAddress > vNetworkBans;
+	};
+
+	Manager&               m_oManager;
 
 	mutable QReadWriteLock m_oRWLock;
-	mutable QMutex         m_oQueueLock;
+	mutable QMutex         m_oQueueLock;     // protects m_vPendingAddresses
+
+	// Lock-free queue for new rules to wait in. Producers push single nodes onto this stack; the
+	// sanity check takes the whole stack at once and restores the insertion order.
+	QAtomicPointer< QueueNode > m_pQueueHead;
 
 #ifdef _DEBUG // use failsafe to abort sanity check only in debug version
 	QUuid           m_idForceEoSC;        // The signalQueue ID (force end of sanity check)
@@ -61,7 +87,14 @@ private:
 
 	// Used to manage newly added rules during sanity check
 	RuleVector      m_vLoadedRules;
-	NewRulesQueue   m_lqNewRules;
+
+	// allows to look up the loaded rules that might match an IP or a hit
+	BatchIndex      m_oBatchIndex;
+
+	// Recently seen IPs affected by new deny rules, waiting for the next batch and belonging to
+	// the loaded batch respectively.
+	EndPointVector  m_vPendingAddresses;
+	EndPointVector  m_vAffectedAddresses;
 
 	// true if new rules for sanity check have been loaded.
 	bool            m_bNewRulesLoaded;
@@ -72,20 +105,60 @@ private:
 
 	bool            m_bVerboose;
 
+	// worker threads for the bulk checks
+	QThreadPool     m_oWorkers;
+
 public:
 	/**
 	 * @brief SanityCecker constructs an empty SanityCecker.
+	 *
+	 * @param oManager  The Manager the queued rules are copied from.
 	 */
-	SanityChecker();
+	SanityChecker( Manager& oManager );
 	~SanityChecker();
 
 	/**
 	 * @brief push adds a new rule to the queue for sanity checking.
-	 * <br><b>Locking: QUEUE + REQUIRES R on the rule</b>
+	 * <br><b>Locking: / + REQUIRES R on the rule</b>
 	 *
 	 * @param pRule : the rule.
 	 */
-	inline void     push( Rule* pRule );
+	inline void     push( const Rule* const pRule );
+
+	/**
+	 * @brief push adds a batch of new rules to the queue for sanity checking as a single entry.
+	 * <br><b>Locking: /</b>
+	 *
+	 * @param vRules : the IDs of the rules.
+	 */
+	void            push( const std::vector< QUuid >& vRules );
+
+	/**
+	 * @brief pushBan adds a new automatic IP ban to the queue for sanity checking. It is checked
+	 * like an automatic IP rule.
+	 * <br><b>Locking: /</b>
+	 *
+	 * @param oAddress : the banned IP.
+	 */
+	void            pushBan( const QHostAddress& oAddress );
+
+	/**
+	 * @brief pushNetworkBan adds a new automatic network ban to the queue for sanity checking. It
+	 * is checked like an automatic IP range rule.
+	 * <br><b>Locking: /</b>
+	 *
+	 * @param oNetwork : the network as returned by FloodDetector::network().
+	 */
+	void            pushNetworkBan( const QHostAddress& oNetwork );
+
+	/**
+	 * @brief pushAffected registers recently seen IPs that are affected by new deny rules. They
+	 * will be made available via affectedAddresses() during the next sanity check.
+	 * <br><b>Locking: QUEUE</b>
+	 *
+	 * @param vAddresses  The IPs.
+	 */
+	void            pushAffected( const std::vector< QHostAddress >& vAddresses );
 
 	/**
 	 * @brief lockForWrite allocates a lock for reading.
@@ -118,6 +191,40 @@ public:
 	 */
 	bool            isNewlyDenied( const QueryHit* const pHit, const QList<QString>& lQuery );
 
+	/**
+	 * @brief newlyDenied checks a set of IPs against the list of loaded new security rules. Large
+	 * sets are split up and checked in parallel, so this should be preferred over calling
+	 * isNewlyDenied() for every IP.
+	 * <br><b>Locking: REQUIRES R</b>
+	 *
+	 * @param vAddresses  The IPs to be checked
+	 * @return the newly banned IPs in the order they have been handed to this method
+	 */
+	EndPointVector  newlyDenied( const EndPointVector& vAddresses );
+
+	/**
+	 * @brief newlyDenied checks a set of hits against the list of loaded new security rules. Large
+	 * sets are split up and checked in parallel, so this should be preferred over calling
+	 * isNewlyDenied() for every hit.
+	 * <br><b>Locking: REQUIRES R</b>
+	 *
+	 * @param vHits   The QueryHits
+	 * @param lQuery  The query string
+	 * @return the newly banned hits in the order they have been handed to this method
+	 */
+	QueryHitVector  newlyDenied( const QueryHitVector& vHits, const QList<QString>& lQuery );
+
+	/**
+	 * @brief affectedAddresses allows to access the recently seen IPs that are known to be within
+	 * a new deny rule of the loaded batch. Modules can check these first (e.g. by handing them to
+	 * newlyDenied()) instead of rescanning all their peers. Note that the list only covers IPs the
+	 * library has been asked about recently; it is not a replacement for a full scan.
+	 * <br><b>Locking: REQUIRES R</b>
+	 *
+	 * @return the sorted affected IPs without duplicates
+	 */
+	const EndPointVector& affectedAddresses() const;
+
 signals:
 	/**
 	 * @brief beginSanityCheck informs all other application components about a sanity check.
@@ -136,7 +243,7 @@ signals:
 public slots:
 	/**
 	 * @brief sanityCheck triggers a system wide sanity check.
-	 * <br><b>Locking: QUEUE + RW</b>
+	 * <br><b>Locking: RW + QUEUE + R on the Manager</b>
 	 *
 	 * The sanity check is delayed by 5s, if a write lock couldn't be aquired after 200ms.<br>
 	 * The sanity check is aborted if it takes longer than 2min to finish. (debug version only)
@@ -164,11 +271,39 @@ public slots:
 #endif
 
 private:
+	/**
+	 * @brief enqueue pushes a node onto the queue.
+	 * <br><b>Locking: /</b>
+	 *
+	 * @param pNode  The node. The queue takes ownership.
+	 */
+	void            enqueue( QueueNode* pNode );
+
+	/**
+	 * @brief queueHead allows to access the most recently queued node.
+	 * <br><b>Locking: /</b>
+	 *
+	 * @return the head of the queue; <code>NULL</code> if the queue is empty
+	 */
+	inline QueueNode* queueHead() const;
+
+	/**
+	 * @brief takeQueue removes all nodes from the queue.
+	 * <br><b>Locking: /</b>
+	 *
+	 * @return the nodes in the order they have been queued
+	 */
+	QueueNode*      takeQueue();
+
 	/**
 	 * @brief loadBatch loads a batch of waiting rules into the container used for sanity checking.
-	 * <br><b>Locking: REQUIRES QUEUE + REQUIRES RW</b>
+	 * Rules that have been removed from the Manager in the meantime are skipped.
+	 * <br><b>Locking: REQUIRES RW + QUEUE + R on the Manager</b>
+	 *
+	 * @return <code>true</code> if at least one rule has been loaded;
+	 * <br><code>false</code> otherwise
 	 */
-	void            loadBatch();
+	bool            loadBatch();
 
 	/**
 	 * @brief clearBatch unloads the new rules from sanity check containers.
@@ -181,13 +316,41 @@ private:
 	 * <br><b>Locking: REQUIRES RW</b>
 	 */
 	void            clear();
+
+	/**
+	 * @brief chunkSize calculates how many items should be checked by a single task.
+	 * <br><b>Locking: /</b>
+	 *
+	 * @param nItems  The total number of items to be checked.
+	 * @return the number of items per task
+	 */
+	size_t          chunkSize( size_t nItems ) const;
+
+	/**
+	 * @brief runTasks runs a set of bulk check tasks and returns once all of them have finished.
+	 * The first task is run by the calling thread. Takes ownership of the tasks.
+	 * <br><b>Locking: REQUIRES R</b>
+	 *
+	 * @param vTasks  The tasks.
+	 */
+	void            runTasks( std::vector< SanityCheckTask* >& vTasks );
 };
 
-void SanityChecker::push( Rule* pRule )
+void SanityChecker::push( const Rule* const pRule )
 {
-	m_oQueueLock.lock();
-	m_lqNewRules.push( pRule->getCopy() );
-	m_oQueueLock.unlock();
+	QueueNode* pNode = new QueueNode;
+	pNode->vRules.push_back( pRule->m_idUUID );
+
+	enqueue( pNode );
+}
+
+SanityChecker::QueueNode* SanityChecker::queueHead() const
+{
+#if QT_VERSION >= 0x050000
+	return m_pQueueHead.load();
+#else
+	return m_pQueueHead;
+#endif
 }
 
 void SanityChecker::lockForRead()
@@ -32,8 +32,6 @@
 #include "regexprule.h"
 #include "useragentrule.h"
 
-#include "securitymanager.h"
-
 #if QT_VERSION >= 0x050000
 #  include <QRegularExpression>
 #else
@@ -60,6 +58,8 @@ Rule::Rule() :
 	m_nAction = RuleAction::Deny;
 	m_idUUID  = QUuid::createUuid();
 
+	m_bAutomatic = false;
+
 	m_nGUIID  = m_oIDProvider.aquire();
 }
 
@@ -189,8 +189,6 @@ void Rule::mergeInto( Rule* pDestination ) const
 
 	pDestination->m_nToday.fetchAndAddRelaxed( m_nToday.load() );
 	pDestination->m_nTotal.fetchAndAddRelaxed( m_nTotal.load() );
-
-	securityManager.emitUpdate( pDestination->m_nGUIID );
 }
 
 void Rule::count( quint32 tNow, uint nCount )
@@ -247,7 +245,7 @@ bool Rule::match( const QList<QString>&, const QString& ) const
 	return false;
 }
 
-Rule* Rule::load( QDataStream& fsFile, int nVersion )
+Rule* Rule::load( QDataStream& fsFile, int nVersion, const quint32 tNow )
 {
 	Rule* pRule = NULL;
 
@@ -274,7 +272,7 @@ Rule* Rule::load( QDataStream& fsFile, int nVersion )
 	}
 	else
 	{
-		tLastHit = common::getTNowUTC();
+		tLastHit = tNow;
 	}
 
 	fsFile >> nTotal;
@@ -295,6 +293,14 @@ Rule* Rule::load( QDataStream& fsFile, int nVersion )
 
 	case RuleType::IPAddressRange:
 		pRule = new IPRangeRule();
+
+		if ( nVersion > 2 )
+		{
+			// added in version 3
+			QList<QUuid> lOrigins;
+			fsFile >> lOrigins;
+			( ( IPRangeRule* )pRule )->setOrigins( lOrigins );
+		}
 		break;
 
 #if SECURITY_ENABLE_GEOIP
@@ -357,7 +363,11 @@ void Rule::save( const Rule* const pRule, QDataStream& oStream )
 	oStream << pRule->m_bAutomatic;
 	oStream << pRule->contentString();
 
-	if ( pRule->m_nType == RuleType::UserAgent )
+	if ( pRule->m_nType == RuleType::IPAddressRange )
+	{
+		oStream << ( ( IPRangeRule* )pRule )->origins();
+	}
+	else if ( pRule->m_nType == RuleType::UserAgent )
 	{
 		oStream << ( ( UserAgentRule* )pRule )->isRegExp();
 	}
@@ -432,7 +442,14 @@ Rule* Rule::fromXML( QXmlStreamReader& oXMLdocument, float nVersion )
 		}
 		else
 		{
-			pRule = new IPRule();
+			if ( sAddress.contains( '/' ) ) // CIDR notation
+			{
+				pRule = new IPRangeRule();
+			}
+			else
+			{
+				pRule = new IPRule();
+			}
 
 			if ( !pRule->parseContent( sAddress ) )
 			{
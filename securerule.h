@@ -314,9 +314,10 @@ public:
 	 *
 	 * @param fsFile    The filesteam to read the Rule from.
 	 * @param nVersion  The data file version.
+	 * @param tNow      The current time; used as last hit time for files not storing it.
 	 * @return the new Rule that has been read from the data stream
 	 */
-	static Rule*    load( QDataStream& fsFile, const int nVersion );
+	static Rule*    load( QDataStream& fsFile, const int nVersion, const quint32 tNow );
 
 	/**
 	 * @brief save writes the specified rule to the specified file.
@@ -29,34 +29,62 @@ INCLUDEPATH += $$PWD
 
 # Headers
 HEADERS += \
+		$$PWD/autobanstore.h \
+		$$PWD/batchindex.h \
+		$$PWD/clientblacklist.h \
 		$$PWD/clientversion.h \
 		$$PWD/contentrule.h \
 		$$PWD/countryrule.h \
+		$$PWD/decisiontrace.h \
+		$$PWD/digesttable.h \
+		$$PWD/eventlog.h \
 		$$PWD/externals.h \
+		$$PWD/flooddetector.h \
+		$$PWD/hashlist.h \
 		$$PWD/hashrule.h \
+		$$PWD/instrumentation.h \
+		$$PWD/iplookuptable.h \
 		$$PWD/iprangerule.h \
 		$$PWD/iprule.h \
+		$$PWD/latencyhistogram.h \
 		$$PWD/misscache.h \
+		$$PWD/patternmatcher.h \
+		$$PWD/querycontext.h \
 		$$PWD/regexprule.h \
 		$$PWD/sanitychecker.h \
 		$$PWD/securerule.h \
 		$$PWD/securitymanager.h \
 		$$PWD/useragent.h \
-		$$PWD/useragentrule.h
+		$$PWD/useragentrule.h \
+		$$PWD/verdictcache.h
 
 # Sources
 SOURCES += \
+		$$PWD/autobanstore.cpp \
+		$$PWD/batchindex.cpp \
+		$$PWD/clientblacklist.cpp \
 		$$PWD/clientversion.cpp \
 		$$PWD/contentrule.cpp \
 		$$PWD/countryrule.cpp \
+		$$PWD/decisiontrace.cpp \
+		$$PWD/digesttable.cpp \
+		$$PWD/eventlog.cpp \
 		$$PWD/externals.cpp \
+		$$PWD/flooddetector.cpp \
+		$$PWD/hashlist.cpp \
 		$$PWD/hashrule.cpp \
+		$$PWD/instrumentation.cpp \
+		$$PWD/iplookuptable.cpp \
 		$$PWD/iprangerule.cpp \
 		$$PWD/iprule.cpp \
+		$$PWD/latencyhistogram.cpp \
 		$$PWD/misscache.cpp \
+		$$PWD/patternmatcher.cpp \
+		$$PWD/querycontext.cpp \
 		$$PWD/regexprule.cpp \
 		$$PWD/sanitychecker.cpp \
 		$$PWD/securerule.cpp \
 		$$PWD/securitymanager.cpp \
 		$$PWD/useragent.cpp \
-		$$PWD/useragentrule.cpp
+		$$PWD/useragentrule.cpp \
+		$$PWD/verdictcache.cpp
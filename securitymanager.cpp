@@ -22,6 +22,9 @@
 ** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 */
 
+#include <algorithm>
+#include <map>
+
 #include <QDir>
 #include <QDateTime>
 #include <QMetaType>
@@ -30,7 +33,6 @@
 #include <QXmlStreamReader>
 #include <QXmlStreamWriter>
 
-#include "useragent.h"
 #include "securitymanager.h"
 
 #include "debug_new.h"
@@ -40,23 +42,82 @@ const QString Security::Manager::sXMLNameSpace = "http://www.shareaza.com/schema
 Security::Manager securityManager;
 using namespace Security;
 
-Manager::Manager() :
+namespace Security
+{
+/**
+ * @brief RangeMap holds the range index by start IP while Manager::insertRanges() replays
+ * insertRange() for a batch of new ranges. Ranges starting at the same IP are kept in insertion
+ * order, as with insertRangeHelper().
+ */
+typedef std::multimap< EndPoint, IPRangeRule* > RangeMap;
+
+/**
+ * @brief rekeyRange updates the position of a range in a RangeMap after merge() has changed its
+ * start IP. As merge() only moves the start IP within the gap to the next range, the order of the
+ * ranges is not affected.
+ *
+ * @param lmRanges  The map.
+ * @param it        The entry of the range; points to the new entry afterwards.
+ */
+static void rekeyRange( RangeMap& lmRanges, RangeMap::iterator& it )
+{
+	IPRangeRule* pRange = ( *it ).second;
+
+	if ( ( *it ).first != pRange->startIP() )
+	{
+		RangeMap::iterator itNext = it;
+		++itNext;
+
+		lmRanges.erase( it );
+		it = lmRanges.insert( itNext, std::make_pair( pRange->startIP(), pRange ) );
+	}
+}
+
+static bool ruleUUIDLess( const Rule* const pA, const Rule* const pB )
+{
+	return pA->m_idUUID < pB->m_idUUID;
+}
+}
+
+Manager::Manager( Environment* pEnvironment ) :
+    m_oSanity( *this ),
+    m_pEnvironment( pEnvironment ? pEnvironment : Environment::global() ),
     m_bEnableCountries( false ),
+    m_bAgentMatcherDirty( 0 ),
+    m_oLog( m_pEnvironment ),
+    m_bAutoBansChanged( false ),
+    m_pClientBlacklist( new ClientBlacklist() ),
     m_bLogIPCheckHits( false ),
     m_tRuleExpiryInterval( 0 ),
     m_bUnsaved( false ),
     m_bShutDown( false ),
     m_bExpiryRequested( false ),
     m_bDenyPrivateIPs( false ),
-    m_bDenyPolicy( false )
+    m_nRuleGeneration( 0 ),
+    m_bDenyPolicy( false ),
+    m_pCommitTimer( NULL ),
+    m_bCommitPending( 0 ),
+    m_bCommitSave( 0 ),
+    m_nCommitDelay( SECURITY_COMMIT_DELAY ),
+    m_nCommitRequests( 0 ),
+    m_nCommits( 0 )
 {
 	// QApplication hasn't been started when the global definition creates this object, so
 	// no qt specific calls (for example connect() or emit signal) may be used over here.
 	// See initialize() for that kind of initializations.
+
+	HitVector vHits;
+	m_oReplicas.resize( SECURITY_IP_REPLICAS, vHits );
 }
 
 Manager::~Manager()
 {
+	qDeleteAll( m_vHashLists );
+}
+
+Environment* Manager::environment() const
+{
+	return m_pEnvironment;
 }
 
 Manager::RuleVectorPos Manager::count() const
@@ -69,6 +130,123 @@ bool Manager::denyPolicy() const
 	return m_bDenyPolicy;
 }
 
+const VerdictCache& Manager::verdictCache() const
+{
+	return m_oVerdictCache;
+}
+
+const MissCache& Manager::missCache() const
+{
+	return m_oMissCache;
+}
+
+AutoBanStatistics Manager::autoBanStatistics() const
+{
+	return m_oAutoBans.statistics();
+}
+
+void Manager::setAutoBanMemory( quint32 nBytes )
+{
+	const quint32 nEvicted = m_oAutoBans.setMemory( nBytes );
+
+	if ( nEvicted )
+	{
+		recordAutoBanChange();
+		requestChangeNotification();
+
+		m_pEnvironment->log( LogSeverity::Debug,
+		                     tr( "%1 automatic bans evicted to fit into %2 bytes."
+		                       ).arg( nEvicted ).arg( nBytes ), true );
+	}
+}
+
+const FloodDetector& Manager::floodDetector() const
+{
+	return m_oFloodDetector;
+}
+
+void Manager::setFloodThreshold( FloodEvent::Type eType, FloodScope::Scope eScope,
+                                 quint32 nEvents, RuleTime::Time nBanLength )
+{
+	m_oFloodDetector.setThreshold( eType, eScope, nEvents, nBanLength );
+}
+
+void Manager::setFloodWindow( quint32 nSeconds )
+{
+	m_oFloodDetector.setWindow( nSeconds );
+}
+
+bool Manager::recordEvent( const QHostAddress& oAddress, FloodEvent::Type eType )
+{
+	const quint32 tNow = m_pEnvironment->now();
+	const FloodScope::Scope eScope = m_oFloodDetector.record( oAddress, eType, tNow );
+
+	switch ( eScope )
+	{
+	case FloodScope::Address:
+		// reported for every event above the threshold; only ban again once the ban has ended
+		if ( m_oAutoBans.contains( oAddress, tNow ) )
+		{
+			return false;
+		}
+
+		ban( oAddress, m_oFloodDetector.banLength( eType, eScope ), false, tr( "Flood Ban" ),
+		     true );
+		m_oLog.post( LogEvent::FloodBan, oAddress );
+		return true;
+
+	case FloodScope::Prefix:
+	{
+		if ( m_oNetworkBans.contains( FloodDetector::network( oAddress ), tNow ) )
+		{
+			return false;
+		}
+
+		const QPair<QHostAddress, int> oNetwork =
+		        QHostAddress::parseSubnet( FloodDetector::prefix( oAddress ) );
+
+		banNetwork( oAddress, m_oFloodDetector.banLength( eType, eScope ) );
+		m_oLog.post( LogEvent::FloodBan, oNetwork.first, ( quint32 )oNetwork.second );
+		return true;
+	}
+
+	default:
+		return false;
+	}
+}
+
+#if SECURITY_ENABLE_DECISION_TRACE
+bool Manager::startTrace( const QString& sPath )
+{
+	return m_oTrace.start( sPath );
+}
+
+void Manager::stopTrace()
+{
+	m_oTrace.stop();
+}
+#endif // SECURITY_ENABLE_DECISION_TRACE
+
+quint32 Manager::commitDelay() const
+{
+	return ( quint32 )m_nCommitDelay.load();
+}
+
+void Manager::setCommitDelay( quint32 nDelay )
+{
+	m_nCommitDelay.store( ( int )nDelay );
+}
+
+quint32 Manager::commitRequests() const
+{
+	return ( quint32 )m_nCommitRequests.load();
+}
+
+quint32 Manager::mergedCommitRequests() const
+{
+	return ( quint32 )( m_nCommitRequests.load() - m_nCommits.load() );
+}
+
 void Manager::setDenyPolicy( bool bDenyPolicy )
 {
 	m_oRWLock.lockForWrite();
@@ -76,10 +254,18 @@ void Manager::setDenyPolicy( bool bDenyPolicy )
 	{
 		m_bDenyPolicy = bDenyPolicy;
 		m_bUnsaved    = true;
+
+		// invalidate the replicas
+		m_nRuleGeneration.ref();
 	}
 	m_oRWLock.unlock();
 }
 
+int Manager::replicaCount() const
+{
+	return m_oReplicas.size();
+}
+
 bool Manager::check( const Rule* const pRule ) const
 {
 	m_oRWLock.lockForRead();
@@ -90,6 +276,11 @@ bool Manager::check( const Rule* const pRule ) const
 }
 
 bool Manager::add( Rule* pRule , bool bDoSanityCheck )
+{
+	return addInternal( pRule, bDoSanityCheck, NULL );
+}
+
+bool Manager::addInternal( Rule* pRule, bool bDoSanityCheck, ImportBatch* pBatch )
 {
 	if ( !pRule )
 	{
@@ -106,6 +297,45 @@ bool Manager::add( Rule* pRule , bool bDoSanityCheck )
 	          nAction >= 0 && nAction < RuleAction::NoOfActions );
 	Q_ASSERT( !pRule->m_idUUID.isNull() );
 
+	// Automatic bans are absorbed by the automatic ban store. As for merged rules, the caller
+	// must not access the deleted rule, which is signalled by returning false.
+	if ( nType == RuleType::IPAddress && pRule->m_bAutomatic && nAction == RuleAction::Deny )
+	{
+		const bool bNewBan = banAutomatic( ( IPRule* )pRule );
+		delete pRule;
+
+		if ( bNewBan && bDoSanityCheck )
+		{
+			writeLock.unlock();
+			requestCommit( false );
+		}
+
+		return false;
+	}
+
+	// The same goes for network flood bans, which must not split the manual ranges.
+	if ( nType == RuleType::IPAddressRange && pRule->m_bAutomatic && nAction == RuleAction::Deny &&
+	     pRule->contentString() == FloodDetector::prefix( ( ( IPRangeRule* )pRule )->startIP() ) )
+	{
+		const bool bNewBan = banNetworkAutomatic( ( IPRangeRule* )pRule );
+		delete pRule;
+
+		if ( bNewBan && bDoSanityCheck )
+		{
+			writeLock.unlock();
+			requestCommit( false );
+		}
+
+		return false;
+	}
+
+	if ( pBatch && nType == RuleType::IPAddressRange )
+	{
+		// merged into the range index together with the other new ranges by endImport()
+		pBatch->vRanges.push_back( ( IPRangeRule* )pRule );
+		return true;
+	}
+
 	const RuleVectorPos nExRule = find( pRule->m_idUUID );
 	if ( nExRule != m_vRules.size() )
 	{
@@ -143,7 +373,7 @@ bool Manager::add( Rule* pRule , bool bDoSanityCheck )
 
 		if ( it != m_lmIPs.end() ) // there is a conflicting rule in our map
 		{
-			pRule->mergeInto( ( *it ).second );
+			mergeRule( pRule, ( *it ).second );
 
 			delete pRule;
 			pRule = NULL;
@@ -173,7 +403,7 @@ bool Manager::add( Rule* pRule , bool bDoSanityCheck )
 
 		if ( it != m_lmCountries.end() ) // there is a conflicting rule in our map
 		{
-			pRule->mergeInto( ( *it ).second );
+			mergeRule( pRule, ( *it ).second );
 
 			delete pRule;
 			pRule = NULL;
@@ -193,11 +423,11 @@ bool Manager::add( Rule* pRule , bool bDoSanityCheck )
 	case RuleType::Hash:
 	{
 		const HashSet& vHashes = ( ( HashRule* )pRule )->getHashes();
-		RuleVectorPos nPos = find( vHashes );
+		HashRule* pExisting = findHashMatch( vHashes );
 
-		if ( nPos != m_vRules.size() )
+		if ( pExisting )
 		{
-			pRule->mergeInto( m_vRules[nPos] );
+			mergeRule( pRule, pExisting );
 
 			// there is no point on adding a rule for the same content twice,
 			// as that content is already blocked.
@@ -207,13 +437,17 @@ bool Manager::add( Rule* pRule , bool bDoSanityCheck )
 		else
 		{
 			// If there isn't a rule for this content or there is a rule for
-			// similar but not 100% identical content, add hashes to map.
+			// similar but not 100% identical content, add hashes to the tables.
 			for ( quint8 i = 0, nSize = vHashes.size(); i < nSize; ++i )
 			{
 				if ( vHashes[i] )
 				{
-					uint nKey = qHash( vHashes[i]->rawValue() );
-					m_lmmHashes.insert( HashPair( nKey, ( HashRule* )pRule ) );
+					if ( i >= m_vHashTables.size() )
+					{
+						m_vHashTables.resize( nSize );
+					}
+
+					m_vHashTables[i].insert( vHashes[i]->rawValue(), ( HashRule* )pRule );
 				}
 			}
 
@@ -233,7 +467,7 @@ bool Manager::add( Rule* pRule , bool bDoSanityCheck )
 			{
 				if ( pRegExpRules[i]->contentString() == pRule->contentString() )
 				{
-					pRule->mergeInto( pRegExpRules[i] );
+					mergeRule( pRule, pRegExpRules[i] );
 
 					delete pRule;
 					pRule = NULL;
@@ -263,7 +497,7 @@ bool Manager::add( Rule* pRule , bool bDoSanityCheck )
 				if ( pContentRules[i]->contentString() ==  pRule->contentString() &&
 				     pContentRules[i]->getAll()           == ( ( ContentRule* )pRule )->getAll() )
 				{
-					pRule->mergeInto( pContentRules[i] );
+					mergeRule( pRule, pContentRules[i] );
 
 					delete pRule;
 					pRule = NULL;
@@ -292,7 +526,7 @@ bool Manager::add( Rule* pRule , bool bDoSanityCheck )
 			{
 				if ( pUserAgentRules[i]->contentString() ==  pRule->contentString() )
 				{
-					pRule->mergeInto( pUserAgentRules[i] );
+					mergeRule( pRule, pUserAgentRules[i] );
 
 					delete pRule;
 					pRule = NULL;
@@ -304,6 +538,7 @@ bool Manager::add( Rule* pRule , bool bDoSanityCheck )
 		if ( pRule )
 		{
 			m_vUserAgents.push_back( ( UserAgentRule* )pRule );
+			m_bAgentMatcherDirty.store( 1 );
 		}
 	}
 	break;
@@ -319,26 +554,48 @@ bool Manager::add( Rule* pRule , bool bDoSanityCheck )
 	// a rule has been added and we might require saving
 	m_bUnsaved = true;
 
+	// invalidate verdicts cached outside of the manager
+	m_nRuleGeneration.ref();
+
 	if ( pRule )
 	{
 		if ( bNewAddress )
 		{
+			// IPs in the miss cache have been seen recently and were not denied. Those within a new
+			// deny rule are the ones most likely to need attention during the sanity check.
+			std::vector< QHostAddress > vCached;
+
 			if ( nType == RuleType::IPAddress )
 			{
-				m_oMissCache.erase( ( ( IPRule* )pRule )->IP() );
+				const QHostAddress& oIP = ( ( IPRule* )pRule )->IP();
+
+				if ( m_oMissCache.erase( oIP ) )
+				{
+					vCached.push_back( oIP );
+				}
+			}
+			else if ( nType == RuleType::IPAddressRange )
+			{
+				m_oMissCache.erase( ( ( IPRangeRule* )pRule )->startIP(),
+									( ( IPRangeRule* )pRule )->endIP(), vCached );
 			}
 			else
 			{
 				m_oMissCache.clear();
 			}
 
-			m_oMissCache.evaluateUsage();
+			m_oMissCache.evaluateUsage( ( uint )m_lmIPs.size(), ( uint )m_vIPRanges.size() );
+
+			if ( pRule->m_nAction == RuleAction::Deny )
+			{
+				m_oSanity.pushAffected( vCached );
+			}
 
-			m_oSanity.push( pRule );
+			queueForSanityCheck( pRule, pBatch );
 		}
 		else if ( bNewHit )
 		{
-			m_oSanity.push( pRule );
+			queueForSanityCheck( pRule, pBatch );
 		}
 
 		// add rule to vector containing all rules sorted by GUID
@@ -347,7 +604,7 @@ bool Manager::add( Rule* pRule , bool bDoSanityCheck )
 		bool bSave = !pRule->m_bAutomatic;
 
 		// Inform SecurityTableModel about new rule.
-		emit ruleAdded( pRule );
+		recordAddition( pRule );
 
 		if ( bDoSanityCheck )
 		{
@@ -356,18 +613,12 @@ bool Manager::add( Rule* pRule , bool bDoSanityCheck )
 
 			// In case we are currently loading rules from file,
 			// this is done uppon completion of the entire process.
-			m_oSanity.sanityCheck();
-
-			if ( bSave )
-			{
-				save();
-			}
+			requestCommit( bSave );
 		}
 	}
 	else
 	{
-		postLogMessage( LogSeverity::Security,
-		                tr( "A new security rule has been merged into an existing one." ) );
+		m_oLog.post( LogEvent::RuleMerged );
 	}
 
 	// REMOVE for beta 1
@@ -407,12 +658,23 @@ void Manager::remove( const Rule* const pRule )
 	remove( nPos );
 
 	m_oRWLock.unlock();
+
+	requestChangeNotification();
 }
 
 void Manager::clear()
 {
 	m_oRWLock.lockForWrite();
 
+	// The GUI is informed by cleared(), so pending notifications are obsolete. This also makes sure
+	// no pointers to the deleted rules are emitted.
+	m_oChangeLock.lock();
+	m_vAddedRules.clear();
+	m_vRemovedRules.clear();
+	m_lsUpdatedRules.clear();
+	m_bAutoBansChanged = false;
+	m_oChangeLock.unlock();
+
 	qDeleteAll( m_vRules );
 	m_vRules.clear();
 
@@ -420,19 +682,25 @@ void Manager::clear()
 	{
 		m_lmIPs.clear();
 		m_vIPRanges.clear();
+		m_oAutoBans.clear();
+		m_oNetworkBans.clear();
 #if SECURITY_ENABLE_GEOIP
 		m_lmCountries.clear();
 #endif // SECURITY_ENABLE_GEOIP
-		m_lmmHashes.clear();
+		m_vHashTables.clear();
 		m_vRegularExpressions.clear();
 		m_vContents.clear();
 		m_vUserAgents.clear();
+		m_bAgentMatcherDirty.store( 1 );
 
 		m_oMissCache.clear();
 
 		// saving might be required :)
 		m_bUnsaved = true;
 
+		// invalidate verdicts cached outside of the manager
+		m_nRuleGeneration.ref();
+
 		m_oRWLock.unlock();
 
 		emit cleared();
@@ -448,6 +716,36 @@ void Manager::clear()
 	}
 }
 
+bool Manager::addHashList( const QString& sPath )
+{
+	HashList* pList = new HashList();
+
+	if ( !pList->open( sPath ) )
+	{
+		delete pList;
+		return false;
+	}
+
+	m_pEnvironment->log( LogSeverity::Debug, tr( "Loaded %0 hashes from hash list: " ).arg(
+	                         pList->count() ) + sPath, true );
+
+	m_oRWLock.lockForWrite();
+	m_vHashLists.push_back( pList );
+	m_nRuleGeneration.ref();
+	m_oRWLock.unlock();
+
+	return true;
+}
+
+void Manager::clearHashLists()
+{
+	m_oRWLock.lockForWrite();
+	qDeleteAll( m_vHashLists );
+	m_vHashLists.clear();
+	m_nRuleGeneration.ref();
+	m_oRWLock.unlock();
+}
+
 void Manager::ban( const QHostAddress& oAddress, RuleTime::Time nBanLength,
                    bool bMessage, const QString& sComment, bool bAutomatic
 #if SECURITY_LOG_BAN_SOURCES
@@ -468,7 +766,7 @@ void Manager::ban( const QHostAddress& oAddress, RuleTime::Time nBanLength,
 	qDebug() << "[Security] Manager::ban() invoked by: " << sSender.toLocal8Bit().data();
 #endif // SECURITY_LOG_BAN_SOURCES
 
-	const quint32 tNow = common::getTNowUTC();
+	const quint32 tNow = m_pEnvironment->now();
 	IPRule* pIPRule = new IPRule();
 
 	if ( !pIPRule->parseContent( oAddress.toString() ) )
@@ -537,21 +835,48 @@ void Manager::ban( const QHostAddress& oAddress, RuleTime::Time nBanLength,
 		pIPRule->m_sComment = sComment;
 	}
 
-	Rule* pRule = pIPRule;
+	const quint32 tExpire = pIPRule->expiryTime();
+	bool bBanned;
+
+	if ( bAutomatic )
+	{
+		// Automatic bans go to the automatic ban store, the rule itself is not kept.
+		pIPRule->count( tNow );
+
+		m_oRWLock.lockForWrite();
+		const bool bNewBan = banAutomatic( pIPRule );
+		m_oRWLock.unlock();
+
+		delete pIPRule;
+
+		if ( bNewBan )
+		{
+			requestCommit( false );
+		}
 
-	// This also merges any existing rules in case the same IP is added twice.
-	if ( add( pRule ) )
+		bBanned = true;
+	}
+	else
 	{
-		pRule->count( tNow );
+		// This also merges any existing rules in case the same IP is added twice.
+		Rule* pRule = pIPRule;
+		bBanned = add( pRule );
 
+		if ( bBanned )
+		{
+			pRule->count( tNow );
+		}
+	}
+
+	if ( bBanned )
+	{
 		if ( bMessage )
 		{
 			if ( sUntil.isEmpty() )
-				sUntil = tr( "until " ) +
-				         QDateTime::fromTime_t( pIPRule->expiryTime() ).toString();
+				sUntil = tr( "until " ) + QDateTime::fromTime_t( tExpire ).toString();
 
-			postLogMessage( LogSeverity::Security,
-			                tr( "Banned %1 %2." ).arg( oAddress.toString(), sUntil ) );
+			m_pEnvironment->log( LogSeverity::Security,
+			                     tr( "Banned %1 %2." ).arg( oAddress.toString(), sUntil ) );
 		}
 	}
 	else
@@ -560,12 +885,82 @@ void Manager::ban( const QHostAddress& oAddress, RuleTime::Time nBanLength,
 	}
 }
 
+bool Manager::unban( const QHostAddress& oAddress )
+{
+	// The replicas and the verdict caches do not contain automatic bans, so there is nothing to
+	// invalidate.
+	const bool bAddress = m_oAutoBans.remove( oAddress );
+	const bool bNetwork = m_oNetworkBans.remove( oAddress );
+
+	if ( !bAddress && !bNetwork )
+	{
+		return false;
+	}
+
+	recordAutoBanChange();
+	requestChangeNotification();
+
+	m_oRWLock.lockForWrite();
+	m_bUnsaved = true;
+	m_oRWLock.unlock();
+
+	return true;
+}
+
+void Manager::autoBans( AutoBanVector& vBans ) const
+{
+	m_oAutoBans.bans( vBans );
+}
+
+void Manager::networkBans( AutoBanVector& vBans ) const
+{
+	m_oNetworkBans.bans( vBans );
+}
+
+void Manager::banNetwork( const QHostAddress& oAddress, RuleTime::Time nBanLength )
+{
+	const QString sNetwork = FloodDetector::prefix( oAddress );
+	IPRangeRule oRule;
+
+	if ( !oRule.parseContent( sNetwork ) )
+	{
+		m_pEnvironment->log( LogSeverity::Error,
+		                     tr( "Unable to ban invalid network: %1" ).arg( sNetwork ) );
+		return;
+	}
+
+	const quint32 tNow = m_pEnvironment->now();
+
+	switch ( nBanLength )
+	{
+	case RuleTime::Session:
+	case RuleTime::Forever:
+		oRule.setExpiryTime( nBanLength );
+		break;
+
+	default:
+		oRule.setExpiryTime( tNow + nBanLength );
+	}
+
+	oRule.m_bAutomatic = true;
+	oRule.count( tNow );
+
+	m_oRWLock.lockForWrite();
+	const bool bNewBan = banNetworkAutomatic( &oRule );
+	m_oRWLock.unlock();
+
+	if ( bNewBan )
+	{
+		requestCommit( false );
+	}
+}
+
 void Manager::ban( const QueryHit* const pHit, RuleTime::Time nBanLength, quint8 nMaxHashes,
                    const QString& sComment )
 {
 	if ( !pHit || !pHit->isValid() || pHit->m_vHashes.empty() )
 	{
-		postLogMessage( LogSeverity::Security, tr( "Error: Could not ban invalid file." ) );
+		m_pEnvironment->log( LogSeverity::Security, tr( "Error: Could not ban invalid file." ) );
 		return;
 	}
 
@@ -575,12 +970,12 @@ void Manager::ban( const QueryHit* const pHit, RuleTime::Time nBanLength, quint8
 
 	if ( bAlreadyBlocked )
 	{
-		postLogMessage( LogSeverity::Security,
-		                tr( "Error: Could not ban already banned file." ) );
+		m_pEnvironment->log( LogSeverity::Security,
+		                     tr( "Error: Could not ban already banned file." ) );
 	}
 	else
 	{
-		const quint32 tNow = common::getTNowUTC();
+		const quint32 tNow = m_pEnvironment->now();
 		HashRule* pRule = new HashRule();
 
 		pRule->setExpiryTime( tNow + nBanLength );
@@ -649,8 +1044,8 @@ void Manager::ban( const QueryHit* const pHit, RuleTime::Time nBanLength, quint8
 			pRule->count( tNow );
 		}
 
-		postLogMessage( LogSeverity::Security,
-		                tr( "Banned file: " ) + pHit->m_sDescriptiveName );
+		m_pEnvironment->log( LogSeverity::Security,
+		                     tr( "Banned file: " ) + pHit->m_sDescriptiveName );
 	}
 }
 
@@ -661,9 +1056,55 @@ bool Manager::isDenied( const EndPoint& oAddress )
 		return false;
 	}
 
-	QReadLocker readLock( &m_oRWLock );
+	const bool bDenied = isAddressDenied( oAddress );
+	SECURITY_TRACE_ADDRESS( m_oTrace, oAddress, bDenied );
+
+	return bDenied;
+}
+
+bool Manager::isAddressDenied( const EndPoint& oAddress )
+{
+	SECURITY_MEASURE_LATENCY( Measurement::IPCheck );
+
+	// If enabled, check the replica of the calling thread, which does not require the lock.
+	if ( m_oReplicas.size() )
+	{
+		bool bDenyPolicy;
+		const LookupResult::Result eResult = m_oReplicas.lookup( oAddress, m_pEnvironment->now(),
+		                                                         m_nRuleGeneration.load(),
+		                                                         bDenyPolicy );
+		if ( eResult != LookupResult::Locked )
+		{
+			SECURITY_COUNT_STAGE( Stage::Replica );
+
+			switch ( eResult )
+			{
+			case LookupResult::Private:
+				m_oLog.post( LogEvent::PrivateIPDenied, oAddress );
+				return true;
+
+			case LookupResult::Deny:
+				return true;
+
+			case LookupResult::Accept:
+				return false;
+
+			default:
+				// automatic bans are not part of the replicas
+				if ( isAutoBanned( oAddress, m_pEnvironment->now() ) )
+				{
+					SECURITY_COUNT_STAGE( Stage::AutoBan );
+					return true;
+				}
+
+				return bDenyPolicy;
+			}
+		}
+	}
+
+	SECURITY_READ_LOCKER( readLock, &m_oRWLock, Measurement::ManagerLockWait );
 
-	const quint32 tNow = common::getTNowUTC();
+	const quint32 tNow = m_pEnvironment->now();
 
 	// First, check the miss cache if the IP is not included in the list of rules.
 	// If the address is in cache, it is a miss and no further lookup is needed.
@@ -671,20 +1112,17 @@ bool Manager::isDenied( const EndPoint& oAddress )
 	{
 		if ( m_bLogIPCheckHits )
 		{
-			postLogMessage( LogSeverity::Security,
-			                tr( "Skipped repeat IP security check for %1 (%2 IPs cached)."
-			                  ).arg( oAddress.toString(),
-			                         QString::number( m_oMissCache.size() ) ) );
+			m_oLog.post( LogEvent::RepeatIPCheck, oAddress, m_oMissCache.size() );
 		}
 
+		SECURITY_COUNT_STAGE( Stage::MissCacheHit );
+
 		return m_bDenyPolicy;
 	}
 
 	if ( m_bLogIPCheckHits )
 	{
-		postLogMessage( LogSeverity::Security,
-		                tr( "Called first-time IP security check for %1."
-		                  ).arg( oAddress.toString() ) );
+		m_oLog.post( LogEvent::FirstIPCheck, oAddress );
 	}
 
 	// Second, if quazaa local/private blocking is turned on, check if the IP is local/private
@@ -692,8 +1130,9 @@ bool Manager::isDenied( const EndPoint& oAddress )
 	{
 		if ( isPrivate( oAddress ) )
 		{
-			postLogMessage( LogSeverity::Security,
-			                tr( "Local/Private IP denied: %1" ).arg( oAddress.toString() ) );
+			SECURITY_COUNT_STAGE( Stage::PrivateIP );
+
+			m_oLog.post( LogEvent::PrivateIPDenied, oAddress );
 			return true;
 		}
 	}
@@ -716,6 +1155,7 @@ bool Manager::isDenied( const EndPoint& oAddress )
 			else if ( pCountryRule->match( oAddress ) )
 			{
 				hit( pCountryRule );
+				SECURITY_COUNT_STAGE( Stage::Country );
 
 				if ( pCountryRule->m_nAction == RuleAction::Deny )
 				{
@@ -745,6 +1185,7 @@ bool Manager::isDenied( const EndPoint& oAddress )
 			else
 			{
 				hit( pRangeRule );
+				SECURITY_COUNT_STAGE( Stage::IPRange );
 
 				if ( pRangeRule->m_nAction == RuleAction::Deny )
 				{
@@ -780,6 +1221,7 @@ bool Manager::isDenied( const EndPoint& oAddress )
 				}
 
 				hit( pIPRule );
+				SECURITY_COUNT_STAGE( Stage::SingleIP );
 
 				if ( pIPRule->m_nAction == RuleAction::Deny )
 				{
@@ -793,6 +1235,13 @@ bool Manager::isDenied( const EndPoint& oAddress )
 		}
 	}
 
+	// Sixth, check the automatic bans of the address and of its network.
+	if ( isAutoBanned( oAddress, tNow ) )
+	{
+		SECURITY_COUNT_STAGE( Stage::AutoBan );
+		return true;
+	}
+
 	// If the IP is not within the rules (and we're using the cache),
 	// add the IP to the miss cache.
 	m_oMissCache.insert( oAddress, tNow );
@@ -803,272 +1252,216 @@ bool Manager::isDenied( const EndPoint& oAddress )
 
 bool Manager::isDenied( const QueryHit* const pHit, const QList<QString>& lQuery )
 {
+	SECURITY_MEASURE_LATENCY( Measurement::HitCheck );
+
 	bool bReturn;
+	const quint32 tNow = m_pEnvironment->now();
 
-	m_oRWLock.lockForRead();
-	bReturn = isDenied( pHit ) ||                           // test hashes, file size and extension
-	          isDenied( lQuery, pHit->m_sDescriptiveName ); // test regex
+	SECURITY_LOCK_FOR_READ( m_oRWLock, Measurement::ManagerLockWait );
+	bReturn = isDenied( pHit, tNow ) ||                           // test hashes, size and extension
+	          isDenied( lQuery, pHit->m_sDescriptiveName, tNow ); // test regex
+	m_oRWLock.unlock();
+
+	SECURITY_TRACE_HIT( m_oTrace, pHit, lQuery, bReturn );
+
+	return bReturn;
+}
+
+bool Manager::isDenied( QueryContext& oContext, const QueryHit* const pHit )
+{
+	SECURITY_MEASURE_LATENCY( Measurement::HitCheck );
+
+	bool bReturn;
+	const quint32 tNow = m_pEnvironment->now();
+
+	SECURITY_LOCK_FOR_READ( m_oRWLock, Measurement::ManagerLockWait );
+	bReturn = isDeniedInternal( oContext, pHit, tNow );
 	m_oRWLock.unlock();
 
+	SECURITY_TRACE_HIT( m_oTrace, pHit, oContext.keywords(), bReturn );
+
 	return bReturn;
 }
 
-bool Manager::isClientBad( const QString& sUserAgent ) const
+quint32 Manager::isDenied( QueryContext& oContext, const QueryHitVector& vHits,
+						   std::vector<bool>& vDenied )
 {
-	// No user agent - assume bad - They allowed to connect but no searches were performed
-	if ( sUserAgent.isEmpty() )
+	const quint32 nSize = ( quint32 )vHits.size();
+	quint32 nDenied = 0;
+
+	vDenied.assign( nSize, false );
+
+	if ( !nSize )
 	{
-		return true;
+		return 0;
 	}
 
-	UserAgent oUserAgent( sUserAgent );
+	const quint32 tNow = m_pEnvironment->now();
 
-	static const UserAgent oShareaza( "Shareaza" );
-	if ( oUserAgent == oShareaza )
+	SECURITY_LOCK_FOR_READ( m_oRWLock, Measurement::ManagerLockWait );
+	for ( quint32 n = 0; n < nSize; ++n )
 	{
-		static const UserAgent oShareaza2520( "Shareaza 2.5.2.0" );
-		static const UserAgent oShareaza3000( "Shareaza 3.0.0.0" );
+		SECURITY_MEASURE_LATENCY( Measurement::HitCheck );
 
-		// old and bad versions
-		if ( oUserAgent <= oShareaza2520 )
+		if ( isDeniedInternal( oContext, vHits[n], tNow ) )
 		{
-			return true;
-		}
-
-		// fake versions
-		if ( oUserAgent >= oShareaza3000 )
-		{
-			return true;
-		}
-	}
-
-	if ( sUserAgent.startsWith( "Shareaza Pro", Qt::CaseInsensitive ) )
-	{
-		return true;
-	}
-	else
-	{
-		return false;
-	}
-
-	QString sSubStr;
-
-	// Dianlei: Shareaza rip-off
-	// add only based on alpha code, need verification for others
-	if ( sUserAgent.startsWith( "Dianlei", Qt::CaseInsensitive ) )
-	{
-		sSubStr = sUserAgent.mid( 7 );
-		if ( sSubStr.startsWith( " 1." ) )
-		{
-			return true;
-		}
-		if ( sSubStr.startsWith( " 0." ) )
-		{
-			return true;
-		}
-
-		return false;
-	}
-
-	// BearShare
-	if ( sUserAgent.startsWith( "BearShare", Qt::CaseInsensitive ) )
-	{
-		sSubStr = sUserAgent.mid( 9 );
-		if ( sSubStr.startsWith( " Lite"  ) )
-		{
-			return true;
-		}
-		if ( sSubStr.startsWith( " Pro"   ) )
-		{
-			return true;
-		}
-		if ( sSubStr.startsWith( " MP3"   ) )
-		{
-			return true;    // GPL breaker
-		}
-		if ( sSubStr.startsWith( " Music" ) )
-		{
-			return true;    // GPL breaker
-		}
-		if ( sSubStr.startsWith( " 6."    ) )
-		{
-			return true;    // iMesh
+			vDenied[n] = true;
+			++nDenied;
 		}
-
-		return false;
-	}
-
-	// Fastload.TV
-	if ( sUserAgent.startsWith( "Fastload.TV",            Qt::CaseInsensitive ) )
-	{
-		return true;
 	}
+	m_oRWLock.unlock();
 
-	// Fildelarprogram
-	if ( sUserAgent.startsWith( "Fildelarprogram",        Qt::CaseInsensitive ) )
+#if SECURITY_ENABLE_DECISION_TRACE
+	for ( quint32 n = 0; n < nSize; ++n )
 	{
-		return true;
+		SECURITY_TRACE_HIT( m_oTrace, vHits[n], oContext.keywords(), vDenied[n] );
 	}
+#endif // SECURITY_ENABLE_DECISION_TRACE
 
-	// Gnutella Turbo (Look into this client some more)
-	if ( sUserAgent.startsWith( "Gnutella Turbo",         Qt::CaseInsensitive ) )
-	{
-		return true;
-	}
+	return nDenied;
+}
 
-	// Identified Shareaza Leecher Mod
-	if ( sUserAgent.startsWith( "eMule mod (4)",          Qt::CaseInsensitive ) )
+bool Manager::isClientBad( const QString& sUserAgent ) const
+{
+	// No user agent - assume bad - They allowed to connect but no searches were performed
+	if ( sUserAgent.isEmpty() )
 	{
 		return true;
 	}
 
-	// iMesh
-	if ( sUserAgent.startsWith( "iMesh",                  Qt::CaseInsensitive ) )
-	{
-		return true;
-	}
+	// There are only a few hundred different user agents in the wild, so most handshakes can be
+	// answered by a single lookup.
+	QMutexLocker oLock( &m_oClientSection );
 
-	// Mastermax File Sharing
-	if ( sUserAgent.startsWith( "Mastermax File Sharing", Qt::CaseInsensitive ) )
+	QHash<QString, bool>::const_iterator it = m_lhClientVerdicts.constFind( sUserAgent );
+	if ( it != m_lhClientVerdicts.constEnd() )
 	{
-		return true;
+		return it.value();
 	}
 
-	// Trilix
-	if ( sUserAgent.startsWith( "Trilix",                 Qt::CaseInsensitive ) )
-	{
-		return true;
-	}
+	const QSharedPointer<const ClientBlacklist> pBlacklist = m_pClientBlacklist;
 
-	// Wru (bad GuncDNA based client)
-	if ( sUserAgent.startsWith( "Wru",                    Qt::CaseInsensitive ) )
-	{
-		return true;
-	}
+	oLock.unlock();
 
-	// GPL breakers- Clients violating the GPL
-	// See http://www.gnu.org/copyleft/gpl.html
-	// Some other breakers outside the list
+	const bool bBad = pBlacklist->isClientBad( sUserAgent );
 
-	if ( sUserAgent.startsWith( "C -3.0.1",               Qt::CaseInsensitive ) )
-	{
-		return true;
-	}
+	oLock.relock();
 
-	// outdated rip-off
-	if ( sUserAgent.startsWith( "eTomi",                  Qt::CaseInsensitive ) )
+	// don't cache verdicts of a blacklist that has been replaced in the meantime
+	if ( m_pClientBlacklist == pBlacklist )
 	{
-		return true;
-	}
+		if ( m_lhClientVerdicts.size() >= SECURITY_MAX_CACHED_AGENTS )
+		{
+			// Something is flooding us with random user agents. Start over.
+			m_lhClientVerdicts.clear();
+		}
 
-	// Shareaza rip-off / GPL violator
-	if ( sUserAgent.startsWith( "FreeTorrentViewer",      Qt::CaseInsensitive ) )
-	{
-		return true;
+		m_lhClientVerdicts.insert( sUserAgent, bBad );
 	}
 
-	// Is it bad?
-	if ( sUserAgent.startsWith( "K-Lite",                 Qt::CaseInsensitive ) )
-	{
-		return true;
-	}
+	return bBad;
+}
 
-	// Leechers, do not allow to connect
-	if ( sUserAgent.startsWith( "mxie",                   Qt::CaseInsensitive ) )
-	{
-		return true;
-	}
+bool Manager::loadClientBlacklist( const QString& sPath )
+{
+	ClientBlacklist* pBlacklist = new ClientBlacklist();
 
-	// ShareZilla (bad Shareaza clone)
-	if ( sUserAgent.startsWith( "ShareZilla",             Qt::CaseInsensitive ) )
+	if ( !pBlacklist->load( sPath, m_pEnvironment ) )
 	{
-		return true;
+		delete pBlacklist;
+		return false;
 	}
 
-	// Shareaza rip-off / GPL violator
-	if ( sUserAgent.startsWith( "P2P Rocket",             Qt::CaseInsensitive ) )
-	{
-		return true;
-	}
+	const QSharedPointer<const ClientBlacklist> pNew( pBlacklist );
 
-	// Rip-off with bad tweaks
-	if ( sUserAgent.startsWith( "SlingerX",               Qt::CaseInsensitive ) )
-	{
-		return true;
-	}
+	m_oRWLock.lockForWrite();
+	m_oClientSection.lock();
 
-	// Not clear why it's bad
-	if ( sUserAgent.startsWith( "vagaa",                  Qt::CaseInsensitive ) )
-	{
-		return true;
-	}
+	// Keep the old blacklist alive until both locks have been released.
+	const QSharedPointer<const ClientBlacklist> pOld = m_pClientBlacklist;
+	m_pClientBlacklist = pNew;
+	m_lhClientVerdicts.clear();
 
-	if ( sUserAgent.startsWith( "WinMX",                  Qt::CaseInsensitive ) )
-	{
-		return true;
-	}
+	m_oClientSection.unlock();
+	m_oRWLock.unlock();
 
-	// Unknown- Assume OK
-	return false;
+	return true;
 }
 
 // Test new releases, and remove block if/when they are fixed.
 bool Manager::isAgentDenied( const QString& sUserAgent )
 {
+	SECURITY_MEASURE_LATENCY( Measurement::AgentCheck );
+
+	bool bReturn;
+
 	// The remote computer didn't send a "User-Agent", or it sent whitespace
 	// We don't like those.
 	if ( sUserAgent.isEmpty() )
 	{
-		return true;
+		bReturn = true;
 	}
-
-	// foxy - leecher client. (Tested, does not upload)
-	// having something like Authentication which is not defined on specification
-	if ( sUserAgent.startsWith( "foxy", Qt::CaseInsensitive ) )
+	else
 	{
-		return true;
-	}
+		// The rules have changed since the last call, so the matcher needs to be rebuilt.
+		if ( m_bAgentMatcherDirty.load() )
+		{
+			m_oRWLock.lockForWrite();
+			if ( m_bAgentMatcherDirty.load() )
+			{
+				rebuildAgentMatcher();
+			}
+			m_oRWLock.unlock();
+		}
 
-	// i2hub - leecher client. (Tested, does not upload)
-	if ( sUserAgent.startsWith( "i2hub 2.0", Qt::CaseInsensitive ) )
-	{
-		return true;
+		// Check against leecher clients etc., then by content filter. The read lock also
+		// protects the blacklist pointer, so no further synchronization is required.
+		SECURITY_LOCK_FOR_READ( m_oRWLock, Measurement::ManagerLockWait );
+		bReturn = m_pClientBlacklist->isAgentDenied( sUserAgent ) ||
+		          isAgentDeniedInternal( sUserAgent );
+		m_oRWLock.unlock();
 	}
 
-	// Check by content filter
-	m_oRWLock.lockForRead();
-	bool bReturn = isAgentDeniedInternal( sUserAgent );
-	m_oRWLock.unlock();
+	SECURITY_TRACE_AGENT( m_oTrace, sUserAgent, bReturn );
 
 	return bReturn;
 }
 
 bool Manager::isVendorBlocked( const QString& sVendor ) const
 {
-	// foxy - leecher client. (Tested, does not upload)
-	// having something like Authentication which is not defined on specification
-	if ( sVendor.startsWith( "foxy", Qt::CaseInsensitive ) )
-	{
-		return true;
-	}
+	SECURITY_LOCK_FOR_READ( m_oRWLock, Measurement::ManagerLockWait );
+	const bool bBlocked = m_pClientBlacklist->isVendorBlocked( sVendor );
+	m_oRWLock.unlock();
 
-	// Allow it
-	return false;
+	return bBlocked;
 }
 
 void Manager::registerMetaTypes()
 {
 	static int foo = qRegisterMetaType< ID >( "ID" );
 	static int bar = qRegisterMetaType< SharedRulePtr >( "SharedRulePtr" );
+	static int baz = qRegisterMetaType< RuleBatch >( "RuleBatch" );
+	static int qux = qRegisterMetaType< SharedRuleBatch >( "SharedRuleBatch" );
+	static int quux = qRegisterMetaType< IDSet >( "IDSet" );
 
 	Q_UNUSED( foo );
 	Q_UNUSED( bar );
+	Q_UNUSED( baz );
+	Q_UNUSED( qux );
+	Q_UNUSED( quux );
 }
 
-bool Manager::start()
+bool Manager::start( int nReplicas )
 {
 	registerMetaTypes();
 
+	if ( nReplicas != m_oReplicas.size() )
+	{
+		HitVector vHits;
+		m_oReplicas.resize( nReplicas, vHits );
+		applyHits( vHits );
+	}
+
 	const QMetaObject* pMetaObject = metaObject();
 	int nMethodIndex    = pMetaObject->indexOfMethod( "expire()" );
 	m_pfExpire          = pMetaObject->method( nMethodIndex );
@@ -1077,21 +1470,51 @@ bool Manager::start()
 	Q_ASSERT( m_pfExpire.isValid() );
 #endif // _DEBUG
 
+	nMethodIndex         = pMetaObject->indexOfMethod( "startCommitTimer()" );
+	m_pfStartCommitTimer = pMetaObject->method( nMethodIndex );
+
+#ifdef _DEBUG
+	Q_ASSERT( m_pfStartCommitTimer.isValid() );
+#endif // _DEBUG
+
+	m_pCommitTimer = new QTimer( this );
+	m_pCommitTimer->setSingleShot( true );
+	connect( m_pCommitTimer, &QTimer::timeout, this, &Manager::commit );
+
 	// initialize MissCache QMetaMethod(s)
 	m_oMissCache.start();
 
+	m_oLog.start();
+
 	connect( &m_oSanity, &SanityChecker::hit, this, &Manager::updateHitCount, Qt::UniqueConnection );
 
-	connect( &securitySettings, &SecuritySettings::settingsUpdate,
+	connect( &m_pEnvironment->settings(), &SecuritySettings::settingsUpdate,
 	         this, &Manager::settingsChanged );
 
 	// Make sure to initialize the external settings module.
-	securitySettings.start();
+	m_pEnvironment->start();
+
+	// Settings not bound to the settings manager are not pulled by the environment.
+	settingsChanged();
 
 	loadPrivates();
+	loadHashLists();
+
+	// replace the built-in client blacklist if the user provides one
+	const QString sBlacklist = m_pEnvironment->dataPath() + "clientblacklist.txt";
+	if ( QFile::exists( sBlacklist ) )
+	{
+		loadClientBlacklist( sBlacklist );
+	}
 
 	bool bReturn = load(); // Load security rules from HDD.
 
+	if ( m_oReplicas.size() )
+	{
+		signalQueue.push( this, "updateReplicas", SECURITY_REPLICA_UPDATE_INTERVAL, true );
+		updateReplicas();
+	}
+
 	emit startUpFinished();
 	return bReturn;
 }
@@ -1100,18 +1523,36 @@ void Manager::stop()
 {
 	signalQueue.pop( this );    // Remove all cleanup intervall timers from the queue.
 
-	disconnect( &securitySettings, &SecuritySettings::settingsUpdate,
+	disconnect( &m_pEnvironment->settings(), &SecuritySettings::settingsUpdate,
 	            this, &Manager::settingsChanged );
 
-	securitySettings.stop();
+	m_pEnvironment->stop();
+
+	// No need for a pending sanity check on shutdown. The rules are saved below anyway.
+	delete m_pCommitTimer;
+	m_pCommitTimer = NULL;
+	m_bCommitPending.store( 0 );
+	m_bCommitSave.store( 0 );
 
-	save( true ); // Save security rules to disk.
-	clear();      // Release memory and free containers.
+#if SECURITY_ENABLE_DECISION_TRACE
+	m_oTrace.stop();
+#endif // SECURITY_ENABLE_DECISION_TRACE
+
+	m_oLog.stop();    // Write the remaining log events and summaries.
+
+	// Make sure the hits counted by the replicas are saved.
+	HitVector vHits;
+	m_oReplicas.harvest( vHits );
+	applyHits( vHits );
+
+	save( true );     // Save security rules to disk.
+	clear();          // Release memory and free containers.
+	clearHashLists(); // Unmap hash list files.
 }
 
 bool Manager::load()
 {
-	QString sPath = dataPath();
+	QString sPath = m_pEnvironment->dataPath();
 
 	if ( load( sPath + "security.dat" ) )
 	{
@@ -1119,10 +1560,10 @@ bool Manager::load()
 	}
 	else
 	{
-		postLogMessage( LogSeverity::Warning,
-		                tr( "Failed loading security rules from primary file:\n" )
-		                + sPath + "security.dat\n"
-		                + tr( "Switching to backup file instead." ) );
+		m_pEnvironment->log( LogSeverity::Warning,
+		                     tr( "Failed loading security rules from primary file:\n" )
+		                     + sPath + "security.dat\n"
+		                     + tr( "Switching to backup file instead." ) );
 
 		// try backup file if primary file failed for some reason
 		if ( load( sPath + "security_backup.dat" ) )
@@ -1130,10 +1571,10 @@ bool Manager::load()
 			return true;
 		}
 
-		postLogMessage( LogSeverity::Warning,
-		                tr( "Failed loading security rules from backup file:\n" )
-		                + sPath + "security_backup.dat\n"
-		                + tr( "Loading default rules now." ) );
+		m_pEnvironment->log( LogSeverity::Warning,
+		                     tr( "Failed loading security rules from backup file:\n" )
+		                     + sPath + "security_backup.dat\n"
+		                     + tr( "Loading default rules now." ) );
 
 		// fall back to default file if neither primary nor backup file exists
 		sPath = QDir::toNativeSeparators( QString( "%1/DefaultSecurity.dat"
@@ -1150,7 +1591,7 @@ void Manager::save( bool bForceSaving ) const
 		return;		// Saving not required ATM.
 	}
 
-	const QString sPath = dataPath();
+	const QString sPath = m_pEnvironment->dataPath();
 
 	m_oRWLock.lockForRead();
 	m_bUnsaved   = false;
@@ -1158,7 +1599,7 @@ void Manager::save( bool bForceSaving ) const
 	                                        this, &Security::Manager::writeToFile );
 	m_oRWLock.unlock();
 
-	postLogMessage( LogSeverity::Debug, tr( "%0 rules saved." ).arg( nCount ) );
+	m_pEnvironment->log( LogSeverity::Debug, tr( "%0 rules saved." ).arg( nCount ) );
 #else
 	Q_UNUSED( bForceSaving );
 	return;
@@ -1173,9 +1614,15 @@ quint32 Manager::writeToFile( const void* const pManager, QFile& oFile )
 	Manager* pSManager = ( Manager* )pManager;
 	const RuleVectorPos nCount = pSManager->m_vRules.size();
 
+	AutoBanVector vBans, vNetworkBans;
+	pSManager->m_oAutoBans.bans( vBans );
+	pSManager->m_oNetworkBans.bans( vNetworkBans );
+
+	const quint32 nTotal = ( quint32 )( nCount + vBans.size() + vNetworkBans.size() );
+
 	oStream << nVersion;
 	oStream << pSManager->m_bDenyPolicy;
-	oStream << ( quint32 )nCount;
+	oStream << nTotal;
 
 	if ( nCount )
 	{
@@ -1186,7 +1633,37 @@ quint32 Manager::writeToFile( const void* const pManager, QFile& oFile )
 		}
 	}
 
-	return ( quint32 )nCount;
+	// Automatic bans are stored as automatic IP rules, add() moves them back to the store.
+	for ( AutoBanVector::size_type n = 0; n < vBans.size(); ++n )
+	{
+		IPRule oRule;
+		oRule.parseContent( vBans[n].oAddress.toString() );
+		oRule.m_nAction    = RuleAction::Deny;
+		oRule.m_bAutomatic = true;
+		oRule.m_sComment   = tr( "Auto Ban" );
+		oRule.setExpiryTime( vBans[n].tExpire );
+		oRule.count( vBans[n].tLastHit, 0 );
+		oRule.loadTotalCount( vBans[n].nTotal );
+
+		Rule::save( &oRule, oStream );
+	}
+
+	// Network bans are stored as automatic IP range rules covering the flood detection network.
+	for ( AutoBanVector::size_type n = 0; n < vNetworkBans.size(); ++n )
+	{
+		IPRangeRule oRule;
+		oRule.parseContent( FloodDetector::prefix( vNetworkBans[n].oAddress ) );
+		oRule.m_nAction    = RuleAction::Deny;
+		oRule.m_bAutomatic = true;
+		oRule.m_sComment   = tr( "Flood Ban" );
+		oRule.setExpiryTime( vNetworkBans[n].tExpire );
+		oRule.count( vNetworkBans[n].tLastHit, 0 );
+		oRule.loadTotalCount( vNetworkBans[n].nTotal );
+
+		Rule::save( &oRule, oStream );
+	}
+
+	return nTotal;
 }
 
 bool Manager::import( const QString& sPath )
@@ -1205,6 +1682,8 @@ bool Manager::fromP2P( const QString& sPath )
 
 	emit updateLoadMax( file.size() );
 
+	ImportBatch oBatch;
+
 	quint8 nGuiThrottle = 0;
 	uint   nCount       = 0;
 
@@ -1223,7 +1702,11 @@ bool Manager::fromP2P( const QString& sPath )
 
 			QStringList lAddresses = sContent.split( "-" );
 
-			if ( lAddresses.at( 0 ) == lAddresses.at( 1 ) )
+			if ( sContent.contains( '/' ) ) // CIDR notation
+			{
+				pRule = new IPRangeRule();
+			}
+			else if ( lAddresses.size() < 2 || lAddresses.at( 0 ) == lAddresses.at( 1 ) )
 			{
 				sContent = lAddresses.at( 0 );
 				pRule = new IPRule();
@@ -1243,7 +1726,7 @@ bool Manager::fromP2P( const QString& sPath )
 			pRule->setExpiryTime( RuleTime::Forever );
 			pRule->m_bAutomatic = false;
 
-			nCount += add( pRule, false );
+			nCount += addInternal( pRule, false, &oBatch );
 		}
 
 		++nGuiThrottle;
@@ -1255,8 +1738,11 @@ bool Manager::fromP2P( const QString& sPath )
 		}
 	}
 
-	m_oSanity.sanityCheck();
-	save();
+	compactRanges( &oBatch );
+
+	endImport( oBatch );
+
+	requestCommit( true );
 
 	return nCount;
 }
@@ -1277,13 +1763,14 @@ bool Manager::fromXML( const QString& sPath )
 	     !xmlDocument.readNextStartElement() || // read first element
 	     xmlDocument.name().toString().compare( "security", Qt::CaseInsensitive ) )
 	{
-		postLogMessage( LogSeverity::Error,
-		                tr( "Could not import rules. File is not a valid security XML file." ) );
+		m_pEnvironment->log( LogSeverity::Error,
+		                     tr( "Could not import rules. "
+		                         "File is not a valid security XML file." ) );
 		return false;
 	}
 
-	postLogMessage( LogSeverity::Information,
-	                tr( "Importing security rules from file: " ) + sPath );
+	m_pEnvironment->log( LogSeverity::Information,
+	                     tr( "Importing security rules from file: " ) + sPath );
 
 	float nVersion;
 
@@ -1298,18 +1785,20 @@ bool Manager::fromXML( const QString& sPath )
 		nVersion = sVersion.toFloat( &bOK );
 		if ( !bOK )
 		{
-			postLogMessage( LogSeverity::Error,
-			                tr( "Failed to read the Security XML version number from file." ) );
+			m_pEnvironment->log( LogSeverity::Error,
+			                     tr( "Failed to read the Security XML version number from file." ) );
 			nVersion = 1.0;
 		}
 	}
 
-	const quint32 tNow = common::getTNowUTC();
+	const quint32 tNow = m_pEnvironment->now();
 
 	Rule* pRule = NULL;
 	uint nRuleCount = 0;
 	quint8 nActivityCounter = 0;
 
+	ImportBatch oBatch;
+
 	// For all rules do:
 	while ( !xmlDocument.atEnd() )
 	{
@@ -1331,7 +1820,7 @@ bool Manager::fromXML( const QString& sPath )
 			{
 				if ( !pRule->isExpired( tNow ) )
 				{
-					nRuleCount += add( pRule, false );
+					nRuleCount += addInternal( pRule, false, &oBatch );
 				}
 				else
 				{
@@ -1341,15 +1830,15 @@ bool Manager::fromXML( const QString& sPath )
 			}
 			else
 			{
-				postLogMessage( LogSeverity::Error,
-				                tr( "Failed to read a Security Rule from XML." ) );
+				m_pEnvironment->log( LogSeverity::Error,
+				                     tr( "Failed to read a Security Rule from XML." ) );
 			}
 		}
 		else
 		{
-			postLogMessage( LogSeverity::Error,
-			                tr( "Unrecognized entry in XML file with name: " ) +
-			                xmlDocument.name().toString() );
+			m_pEnvironment->log( LogSeverity::Error,
+			                     tr( "Unrecognized entry in XML file with name: " ) +
+			                     xmlDocument.name().toString() );
 		}
 
 		if ( !nActivityCounter )
@@ -1362,11 +1851,14 @@ bool Manager::fromXML( const QString& sPath )
 	// report 100% complete
 	emit updateLoadProgress( oFile.size() );
 
-	m_oSanity.sanityCheck();
-	save();
+	compactRanges( &oBatch );
+
+	endImport( oBatch );
+
+	requestCommit( true );
 
-	postLogMessage( LogSeverity::Information,
-	                QString::number( nRuleCount ) + tr( " Rules imported." ) );
+	m_pEnvironment->log( LogSeverity::Information,
+	                     QString::number( nRuleCount ) + tr( " Rules imported." ) );
 
 	return nRuleCount;
 }
@@ -1427,32 +1919,66 @@ bool Manager::toXML( const QString& sPath , const IDSet& lsIDs ) const
 
 void Manager::emitUpdate( ID nID )
 {
-	emit ruleUpdated( nID );
+	recordUpdate( nID );
+	requestChangeNotification();
 }
 
-quint32 Manager::requestRuleInfo()
+quint32 Manager::ruleCount( int& nGeneration ) const
 {
-	m_oRWLock.lockForRead();
+	QReadLocker oLock( &m_oRWLock );
 
-	const quint32 nSize = ( quint32 )m_vRules.size();
+	nGeneration = m_nRuleGeneration.load();
+	return ( quint32 )m_vRules.size();
+}
 
-	if ( nSize )
+bool Manager::rules( quint32 nFirst, quint32 nCount, SharedRuleBatch& vRules,
+					 int& nGeneration ) const
+{
+	vRules.clear();
+
+	QReadLocker oLock( &m_oRWLock );
+
+	const int nCurrent = m_nRuleGeneration.load();
+	const bool bUnchanged = nCurrent == nGeneration;
+	nGeneration = nCurrent;
+
+	const RuleVectorPos nSize = m_vRules.size();
+	const RuleVectorPos nEnd  = qMin<RuleVectorPos>( nSize, ( RuleVectorPos )nFirst + nCount );
+
+	if ( nFirst < nEnd )
 	{
-		Rule* const * const pRules = &m_vRules[0];
-		for ( quint32 n = 0; n < nSize ; ++n )
+		vRules.reserve( nEnd - nFirst );
+
+		for ( RuleVectorPos n = nFirst; n < nEnd; ++n )
 		{
-			emit ruleInfo( pRules[n] );
+			vRules.push_back( SharedRulePtr( m_vRules[n]->getCopy() ) );
 		}
 	}
 
+	return bUnchanged;
+}
+
+quint32 Manager::requestRuleInfo()
+{
+	// Emit the signals after releasing the lock, so that directly connected receivers may call
+	// back into the Manager and writers are not blocked by the receivers.
+	m_oRWLock.lockForRead();
+	const RuleVector vRules( m_vRules );
 	m_oRWLock.unlock();
 
+	const quint32 nSize = ( quint32 )vRules.size();
+
+	for ( quint32 n = 0; n < nSize; ++n )
+	{
+		emit ruleInfo( vRules[n] );
+	}
+
 	return nSize;
 }
 
 void Manager::expire()
 {
-	postLogMessage( LogSeverity::Debug, QString( "Expiring old rules now!" ), true );
+	m_pEnvironment->log( LogSeverity::Debug, QString( "Expiring old rules now!" ), true );
 
 	m_oRWLock.lockForWrite();
 
@@ -1461,7 +1987,7 @@ void Manager::expire()
 
 	if ( nSize )
 	{
-		const quint32 tNow = common::getTNowUTC();
+		const quint32 tNow = m_pEnvironment->now();
 
 		const Rule* const * const pRules = &m_vRules[0];
 		RuleVectorPos n = nSize;
@@ -1480,6 +2006,16 @@ void Manager::expire()
 
 	m_bExpiryRequested = false;
 
+	const quint32 nBans = m_oAutoBans.expire( m_pEnvironment->now() ) +
+	                      m_oNetworkBans.expire( m_pEnvironment->now() );
+	if ( nBans )
+	{
+		m_bUnsaved = true;
+
+		recordAutoBanChange();
+		requestChangeNotification();
+	}
+
 	// REMOVE for beta 1
 #ifdef _DEBUG
 	for ( RuleVectorPos i = 0; i < m_vRules.size(); ++i )
@@ -1499,16 +2035,22 @@ void Manager::expire()
 
 	m_oRWLock.unlock();
 
-	postLogMessage( LogSeverity::Debug, QString::number( nCount ) + " Rules expired.", true );
+	if ( nCount )
+	{
+		requestChangeNotification();
+	}
+
+	m_pEnvironment->log( LogSeverity::Debug, QString::number( nCount ) + " Rules and " +
+	                     QString::number( nBans ) + " automatic bans expired.", true );
 }
 
 void Manager::settingsChanged()
 {
 	m_oRWLock.lockForWrite();
 
-	if ( m_tRuleExpiryInterval != securitySettings.ruleExpiryInterval() )
+	if ( m_tRuleExpiryInterval != m_pEnvironment->settings().ruleExpiryInterval() )
 	{
-		m_tRuleExpiryInterval = securitySettings.ruleExpiryInterval();
+		m_tRuleExpiryInterval = m_pEnvironment->settings().ruleExpiryInterval();
 		if ( m_tRuleExpiryInterval )
 		{
 			if ( m_idRuleExpiry.isNull() )
@@ -1528,12 +2070,111 @@ void Manager::settingsChanged()
 		}
 	}
 
-	m_bLogIPCheckHits = securitySettings.logIPCheckHits();
-	m_bDenyPrivateIPs = securitySettings.ignorePrivateIPs();
+	const bool bLogIPCheckHits = m_pEnvironment->settings().logIPCheckHits();
+	const bool bDenyPrivateIPs = m_pEnvironment->settings().ignorePrivateIPs();
+
+	if ( m_bLogIPCheckHits != bLogIPCheckHits || m_bDenyPrivateIPs != bDenyPrivateIPs )
+	{
+		m_bLogIPCheckHits = bLogIPCheckHits;
+		m_bDenyPrivateIPs = bDenyPrivateIPs;
+
+		// invalidate the replicas
+		m_nRuleGeneration.ref();
+	}
 
 	m_oRWLock.unlock();
 }
 
+void Manager::startCommitTimer()
+{
+	if ( m_pCommitTimer && !m_pCommitTimer->isActive() )
+	{
+		m_pCommitTimer->start( ( int )commitDelay() );
+	}
+}
+
+void Manager::commit()
+{
+	// Requests arriving from now on need a new commit.
+	m_bCommitPending.store( 0 );
+	const bool bSave = m_bCommitSave.fetchAndStoreOrdered( 0 );
+
+	m_nCommits.ref();
+
+	m_oSanity.sanityCheck();
+
+	updateReplicas();
+
+	if ( bSave )
+	{
+		save();
+	}
+
+	emitChanges();
+}
+
+void Manager::emitChanges()
+{
+	RuleBatch       vAdded;
+	SharedRuleBatch vRemoved;
+	IDSet           lsUpdated;
+
+	m_oChangeLock.lock();
+	vAdded.swap( m_vAddedRules );
+	vRemoved.swap( m_vRemovedRules );
+	lsUpdated.swap( m_lsUpdatedRules );
+	const bool bAutoBansChanged = m_bAutoBansChanged;
+	m_bAutoBansChanged = false;
+	m_oChangeLock.unlock();
+
+	// Rules added and removed within the same window are reported in both batches. This is safe,
+	// as the removed rules are only deleted once the receivers have dropped their references.
+	if ( !vAdded.empty() )
+	{
+		emit rulesAdded( vAdded );
+
+		// per rule signals for receivers that have not been ported to the batches
+		if ( receivers( SIGNAL( ruleAdded( Rule* ) ) ) )
+		{
+			for ( RuleBatch::const_iterator it = vAdded.begin(); it != vAdded.end(); ++it )
+			{
+				emit ruleAdded( *it );
+			}
+		}
+	}
+
+	if ( !vRemoved.empty() )
+	{
+		emit rulesRemoved( vRemoved );
+
+		if ( receivers( SIGNAL( ruleRemoved( SharedRulePtr ) ) ) )
+		{
+			for ( SharedRuleBatch::const_iterator it = vRemoved.begin(); it != vRemoved.end(); ++it )
+			{
+				emit ruleRemoved( *it );
+			}
+		}
+	}
+
+	if ( !lsUpdated.empty() )
+	{
+		emit rulesUpdated( lsUpdated );
+
+		if ( receivers( SIGNAL( ruleUpdated( ID ) ) ) )
+		{
+			for ( IDSet::const_iterator it = lsUpdated.begin(); it != lsUpdated.end(); ++it )
+			{
+				emit ruleUpdated( *it );
+			}
+		}
+	}
+
+	if ( bAutoBansChanged )
+	{
+		emit autoBansChanged();
+	}
+}
+
 void Manager::shutDown()
 {
 	m_oRWLock.lockForWrite();
@@ -1548,34 +2189,158 @@ void Manager::updateHitCount( QUuid ruleID, uint nCount )
 
 	if ( nPos != m_vRules.size() )
 	{
-		m_vRules[nPos]->count( common::getTNowUTC(), nCount );
-		emit ruleUpdated( m_vRules[nPos]->m_nGUIID );
+		m_vRules[nPos]->count( m_pEnvironment->now(), nCount );
+		recordUpdate( m_vRules[nPos]->m_nGUIID );
 	}
 
 	m_oRWLock.unlock();
+
+	requestChangeNotification();
 }
 
 void Manager::hit( Rule* pRule )
 {
-	pRule->count( common::getTNowUTC() );
-	emit ruleUpdated( pRule->m_nGUIID );
+	pRule->count( m_pEnvironment->now() );
+
+	recordUpdate( pRule->m_nGUIID );
+	requestChangeNotification();
 }
 
-void Manager::loadPrivates()
+void Manager::updateReplicas()
 {
-	m_oRWLock.lockForWrite();
+	if ( !m_oReplicas.size() )
+	{
+		return;
+	}
 
-	clearPrivates();
+	IPLookupTable* pTable = NULL;
 
-	m_vPrivateRanges.reserve( 12 );
+	m_oRWLock.lockForRead();
 
-	std::vector<QString> vRanges;
-	vRanges.reserve( 12 );
+	const int nGeneration = m_nRuleGeneration.load();
 
-	vRanges.push_back( QString(      "0.0.0.0-0.255.255.255"   ) );
-	vRanges.push_back( QString(     "10.0.0.0-10.255.255.255"  ) );
-	vRanges.push_back( QString(   "100.64.0.0-100.127.255.255" ) );
-	vRanges.push_back( QString(    "127.0.0.0-127.255.255.255" ) );
+	if ( m_oReplicas.generation() != nGeneration )
+	{
+		pTable = new IPLookupTable( nGeneration, m_bDenyPolicy, m_bDenyPrivateIPs,
+		                            m_bLogIPCheckHits );
+
+		for ( IPRangeVectorPos i = 0; i < m_vIPRanges.size(); ++i )
+		{
+			pTable->addRange( m_vIPRanges[i] );
+		}
+
+		for ( IPMap::const_iterator it = m_lmIPs.begin(); it != m_lmIPs.end(); ++it )
+		{
+			pTable->addAddress( ( *it ).second );
+		}
+
+		for ( IPRangeVectorPos i = 0; i < m_vPrivateRanges.size(); ++i )
+		{
+			pTable->addPrivateRange( m_vPrivateRanges[i] );
+		}
+
+#if SECURITY_ENABLE_GEOIP
+		for ( CountryMap::const_iterator it = m_lmCountries.begin();
+		      it != m_lmCountries.end(); ++it )
+		{
+			pTable->addCountry( ( *it ).second );
+		}
+#endif // SECURITY_ENABLE_GEOIP
+
+		pTable->finalize();
+	}
+
+	m_oRWLock.unlock();
+
+	HitVector vHits;
+
+	// The table does not reference the rules, so copying it to the replicas requires no lock.
+	if ( pTable )
+	{
+		m_oReplicas.publish( *pTable, vHits );
+		delete pTable;
+	}
+
+	m_oReplicas.harvest( vHits );
+	applyHits( vHits );
+}
+
+void Manager::applyHits( const HitVector& vHits )
+{
+	if ( vHits.empty() )
+	{
+		return;
+	}
+
+	const quint32 tNow = m_pEnvironment->now();
+
+	// The hit counters are atomic, so read access is sufficient.
+	m_oRWLock.lockForRead();
+
+	for ( size_t i = 0; i < vHits.size(); ++i )
+	{
+		const RuleVectorPos nPos = find( vHits[i].first );
+
+		if ( nPos != m_vRules.size() )
+		{
+			m_vRules[nPos]->count( tNow, vHits[i].second );
+			recordUpdate( m_vRules[nPos]->m_nGUIID );
+		}
+	}
+
+	m_oRWLock.unlock();
+
+	requestChangeNotification();
+}
+
+void Manager::recordAddition( Rule* pRule )
+{
+	QMutexLocker oLock( &m_oChangeLock );
+	m_vAddedRules.push_back( pRule );
+}
+
+void Manager::recordRemoval( const SharedRulePtr& pRule )
+{
+	QMutexLocker oLock( &m_oChangeLock );
+	m_vRemovedRules.push_back( pRule );
+}
+
+void Manager::recordUpdate( ID nID )
+{
+	QMutexLocker oLock( &m_oChangeLock );
+	m_lsUpdatedRules.insert( nID );
+}
+
+void Manager::recordAutoBanChange()
+{
+	QMutexLocker oLock( &m_oChangeLock );
+	m_bAutoBansChanged = true;
+}
+
+void Manager::requestChangeNotification()
+{
+	// Without the timer (before start()), the changes are emitted with the next commit.
+	if ( m_pCommitTimer && m_bCommitPending.testAndSetOrdered( 0, 1 ) )
+	{
+		m_pfStartCommitTimer.invoke( this, Qt::QueuedConnection );
+	}
+}
+
+void Manager::loadPrivates()
+{
+	m_oRWLock.lockForWrite();
+
+	clearPrivates();
+
+	m_vPrivateRanges.reserve( 12 );
+
+	std::vector<QString> vRanges;
+	vRanges.reserve( 12 );
+
+	vRanges.push_back( QString(      "0.0.0.0-0.255.255.255"   ) );
+	vRanges.push_back( QString(     "10.0.0.0-10.255.255.255"  ) );
+	vRanges.push_back( QString(   "100.64.0.0-100.127.255.255" ) );
+	vRanges.push_back( QString(    "127.0.0.0-127.255.255.255" ) );
 	vRanges.push_back( QString(  "169.254.0.0-169.254.255.255" ) );
 	vRanges.push_back( QString(   "172.16.0.0-172.31.255.255"  ) );
 	vRanges.push_back( QString(    "192.0.0.0-192.0.2.255"     ) );
@@ -1599,6 +2364,23 @@ void Manager::loadPrivates()
 	m_oRWLock.unlock();
 }
 
+void Manager::loadHashLists()
+{
+	QDir oDir( m_pEnvironment->dataPath() + "hashlists" );
+
+	const QStringList lFiles = oDir.entryList( QStringList() << "*.qhl", QDir::Files,
+											   QDir::Name );
+
+	for ( int i = 0; i < lFiles.size(); ++i )
+	{
+		if ( !addHashList( oDir.absoluteFilePath( lFiles.at( i ) ) ) )
+		{
+			m_pEnvironment->log( LogSeverity::Warning,
+			                     tr( "Failed to load hash list: " ) + lFiles.at( i ) );
+		}
+	}
+}
+
 void Manager::clearPrivates()
 {
 	const IPRangeVectorPos nSize =  m_vPrivateRanges.size();
@@ -1615,6 +2397,154 @@ void Manager::clearPrivates()
 	m_vPrivateRanges.clear();
 }
 
+void Manager::requestCommit( bool bSave )
+{
+	m_nCommitRequests.ref();
+
+	if ( bSave )
+	{
+		m_bCommitSave.store( 1 );
+	}
+
+	// Perform the commit right away if coalescing is disabled or not available (yet).
+	if ( !m_pCommitTimer || !commitDelay() )
+	{
+		m_bCommitPending.store( 1 );
+		commit();
+		return;
+	}
+
+	// Only the first request within a window schedules the commit. The window is not extended by
+	// subsequent requests, so a commit happens at most commitDelay() ms after a change.
+	if ( m_bCommitPending.testAndSetOrdered( 0, 1 ) )
+	{
+		m_pfStartCommitTimer.invoke( this, Qt::QueuedConnection );
+	}
+}
+
+void Manager::queueForSanityCheck( const Rule* const pRule, ImportBatch* pBatch )
+{
+	if ( pBatch )
+	{
+		pBatch->vRules.push_back( pRule->m_idUUID );
+	}
+	else
+	{
+		m_oSanity.push( pRule );
+	}
+}
+
+bool Manager::banAutomatic( const IPRule* const pRule )
+{
+	const QHostAddress& oIP = pRule->IP();
+
+	AutoBan oBan;
+	oBan.oAddress = oIP;
+	oBan.tExpire  = pRule->expiryTime();
+	oBan.tLastHit = pRule->lastHit();
+	oBan.nTotal   = pRule->totalCount();
+
+	QHostAddress oEvicted;
+	const bool bNew = m_oAutoBans.insert( oBan, m_pEnvironment->now(), oEvicted );
+
+	if ( !oEvicted.isNull() )
+	{
+		m_oLog.post( LogEvent::AutoBanEvicted, oEvicted );
+	}
+
+	m_bUnsaved = true;
+
+	if ( bNew || !oEvicted.isNull() )
+	{
+		recordAutoBanChange();
+		requestChangeNotification();
+	}
+
+	if ( bNew )
+	{
+		// Same as for new IP rules, see add(). The generation is not increased, as neither the
+		// replicas nor the verdict caches contain automatic bans.
+		std::vector< QHostAddress > vCached;
+
+		if ( m_oMissCache.erase( oIP ) )
+		{
+			vCached.push_back( oIP );
+		}
+
+		m_oSanity.pushAffected( vCached );
+		m_oSanity.pushBan( oIP );
+	}
+
+	return bNew;
+}
+
+bool Manager::banNetworkAutomatic( const IPRangeRule* const pRule )
+{
+	const QHostAddress oNetwork = pRule->startIP();
+
+	AutoBan oBan;
+	oBan.oAddress = oNetwork;
+	oBan.tExpire  = pRule->expiryTime();
+	oBan.tLastHit = pRule->lastHit();
+	oBan.nTotal   = pRule->totalCount();
+
+	QHostAddress oEvicted;
+	const bool bNew = m_oNetworkBans.insert( oBan, m_pEnvironment->now(), oEvicted );
+
+	if ( !oEvicted.isNull() )
+	{
+		m_oLog.post( LogEvent::AutoBanEvicted, oEvicted );
+	}
+
+	m_bUnsaved = true;
+
+	if ( bNew || !oEvicted.isNull() )
+	{
+		recordAutoBanChange();
+		requestChangeNotification();
+	}
+
+	if ( bNew )
+	{
+		// see banAutomatic()
+		std::vector< QHostAddress > vCached;
+		m_oMissCache.erase( pRule->startIP(), pRule->endIP(), vCached );
+
+		m_oSanity.pushAffected( vCached );
+		m_oSanity.pushNetworkBan( oNetwork );
+	}
+
+	return bNew;
+}
+
+bool Manager::isAutoBanned( const QHostAddress& oAddress, quint32 tNow )
+{
+	if ( m_oAutoBans.isBanned( oAddress, tNow ) )
+	{
+		return true;
+	}
+
+	// skips computing the network while there are no network bans
+	return m_oNetworkBans.size() &&
+	       m_oNetworkBans.isBanned( FloodDetector::network( oAddress ), tNow );
+}
+
+void Manager::endImport( ImportBatch& oBatch )
+{
+	std::vector< QUuid > vRules;
+
+	m_oRWLock.lockForWrite();
+	insertRanges( oBatch.vRanges, &oBatch );
+	vRules.swap( oBatch.vRules );
+	m_oRWLock.unlock();
+
+	// compactRanges() queues the rules it extends, which may have been imported themselves
+	std::sort( vRules.begin(), vRules.end() );
+	vRules.erase( std::unique( vRules.begin(), vRules.end() ), vRules.end() );
+
+	m_oSanity.push( vRules );
+}
+
 bool Manager::load( const QString& sPath )
 {
 	QFile oFile( sPath );
@@ -1625,6 +2555,7 @@ bool Manager::load( const QString& sPath )
 	}
 
 	Rule* pRule = NULL;
+	ImportBatch oBatch;
 
 	try
 	{
@@ -1641,7 +2572,7 @@ bool Manager::load( const QString& sPath )
 		quint32 nCount;
 		fsFile >> nCount;
 
-		const quint32 tNow = common::getTNowUTC();
+		const quint32 tNow = m_pEnvironment->now();
 
 		m_oRWLock.lockForWrite();
 		m_bDenyPolicy = bDenyPolicy;
@@ -1653,10 +2584,11 @@ bool Manager::load( const QString& sPath )
 		{
 			while ( nCount > 0 )
 			{
-				pRule = Rule::load( fsFile, nVersion );
+				pRule = Rule::load( fsFile, nVersion, tNow );
 
 				if ( !pRule )
 				{
+					endImport( oBatch );
 					return false;
 				}
 
@@ -1666,7 +2598,7 @@ bool Manager::load( const QString& sPath )
 				}
 				else
 				{
-					nSuccessCount += add( pRule, false );
+					nSuccessCount += addInternal( pRule, false, &oBatch );
 				}
 
 				pRule = NULL;
@@ -1674,9 +2606,11 @@ bool Manager::load( const QString& sPath )
 			}
 		}
 
-		postLogMessage( LogSeverity::Information,
-		                tr( "Loaded %0 security rules from file: %1"
-		                    ).arg( QString::number( nSuccessCount ), sPath ) );
+		m_pEnvironment->log( LogSeverity::Information,
+		                     tr( "Loaded %0 security rules from file: %1"
+		                         ).arg( QString::number( nSuccessCount ), sPath ) );
+
+		endImport( oBatch );
 
 		// perform sanity check after loading.
 		m_oSanity.sanityCheck();
@@ -1690,6 +2624,7 @@ bool Manager::load( const QString& sPath )
 			delete pRule;
 		}
 
+		endImport( oBatch );
 		clear();
 
 		return false;
@@ -1772,52 +2707,298 @@ void Manager::insertRange( IPRangeRule*& pNew )
 		if ( m_vIPRanges[nPos]->startIP() < pNew->startIP() ||
 		     m_vIPRanges[nPos]->endIP()   > pNew->endIP() )
 		{
-			// merge pNewRange into m_vIPRanges[nPos]
-			pSecondHalf = m_vIPRanges[nPos++]->merge( pNew );
+			// merge pNewRange into m_vIPRanges[nPos]
+			pSecondHalf = m_vIPRanges[nPos]->merge( pNew );
+			emitUpdate( m_vIPRanges[nPos++]->m_nGUIID );
+		}
+
+		if ( pNew ) // if it hasn't been set to NULL/merged completely into the existing rule
+		{
+			// remove all rules contained completely within pNewRange
+			IPRangeVectorPos nSize;
+			while ( nPos < ( nSize = m_vIPRanges.size() ) && m_vIPRanges[nPos]->endIP() <= pNew->endIP() )
+			{
+				m_oLog.post( LogEvent::OverlappedRangeRemoved,
+				             m_vIPRanges[nPos]->startIP(), m_vIPRanges[nPos]->endIP() );
+
+				const RuleVectorPos nUUIDPos = find( m_vIPRanges[nPos]->m_idUUID );
+#ifdef _DEBUG
+				Q_ASSERT( nUUIDPos != m_vRules.size() );
+				Q_ASSERT( m_vRules[nUUIDPos]->m_idUUID == m_vIPRanges[nPos]->m_idUUID );
+#endif
+				// this moves a new rule to position nPos, so we don't need to do sth like ++nPos
+				remove( nUUIDPos );
+
+				// REMOVE for beta 1
+				Q_ASSERT( nSize != m_vIPRanges.size() );
+			}
+
+			// merge pNewRange into eventually overlapped rule
+			if ( nPos < m_vIPRanges.size() && m_vIPRanges[nPos]->startIP() <= pNew->endIP() )
+			{
+				m_vIPRanges[nPos]->merge( pNew );
+				emitUpdate( m_vIPRanges[nPos]->m_nGUIID );
+			}
+		}
+	}
+
+	if ( pSecondHalf )
+	{
+		// no need for sanity checking and most of the other stuff dealt with in add()
+		insertRangeHelper( pSecondHalf );
+		insert( pSecondHalf );
+		recordAddition( pSecondHalf );
+	}
+
+	if ( pNew )
+	{
+		insertRangeHelper( pNew );
+	}
+}
+
+void Manager::insertRanges( std::vector< IPRangeRule* >& vNew, ImportBatch* pBatch )
+{
+	if ( vNew.empty() )
+	{
+		return;
+	}
+
+	// We do not allow 2 rules by the same UUID. As in add(), the rule added last prevails.
+	std::vector< IPRangeRule* > vByUUID( vNew );
+	std::stable_sort( vByUUID.begin(), vByUUID.end(), ruleUUIDLess );
+
+	std::unordered_set< const Rule* > lsDuplicates;
+	for ( size_t n = 1; n < vByUUID.size(); ++n )
+	{
+		if ( vByUUID[n - 1]->m_idUUID == vByUUID[n]->m_idUUID )
+		{
+			lsDuplicates.insert( vByUUID[n - 1] );
+		}
+	}
+
+	size_t nNew = 0;
+	for ( size_t n = 0; n < vNew.size(); ++n )
+	{
+		if ( lsDuplicates.count( vNew[n] ) )
+		{
+			delete vNew[n];
+			continue;
+		}
+
+		const RuleVectorPos nExRule = find( vNew[n]->m_idUUID );
+		if ( nExRule != m_vRules.size() )
+		{
+			remove( nExRule );
+		}
+
+		vNew[nNew++] = vNew[n];
+	}
+	vNew.resize( nNew );
+
+	// Replay insertRange() for every new range in the order of arrival, so later ranges take
+	// precedence over the ones they overlap exactly as with sequential add() calls. The index is
+	// held in a map for the duration of the batch, which makes every step logarithmic instead of
+	// linear in the size of the index.
+	RangeMap lmRanges;
+	for ( size_t n = 0; n < m_vIPRanges.size(); ++n )
+	{
+		lmRanges.insert( lmRanges.end(), std::make_pair( m_vIPRanges[n]->startIP(),
+		                                                 m_vIPRanges[n] ) );
+	}
+
+	std::vector< Rule* >              vAdded;   // rules to be added to the rules vector
+	std::unordered_set< const Rule* > lsNew;    // new ranges not yet merged or removed
+	std::unordered_set< const Rule* > lsRemoved;
+
+	for ( size_t n = 0; n < vNew.size(); ++n )
+	{
+		IPRangeRule* pNew        = vNew[n];
+		IPRangeRule* pSecondHalf = NULL;
+
+		// the range insertRange() starts merging at (see findRangeForMerging())
+		RangeMap::iterator it = lmRanges.upper_bound( pNew->startIP() );
+		if ( it != lmRanges.begin() )
+		{
+			--it;
+		}
+
+		if ( it != lmRanges.end() )
+		{
+			IPRangeRule* pRange = ( *it ).second;
+
+			// if something will remain of pRange after the merging, merge
+			if ( pRange->startIP() < pNew->startIP() || pRange->endIP() > pNew->endIP() )
+			{
+				pSecondHalf = pRange->merge( pNew );
+				recordUpdate( pRange->m_nGUIID );
+
+				rekeyRange( lmRanges, it );
+				++it;
+			}
+
+			if ( pNew ) // if it hasn't been merged completely into the existing rule
+			{
+				// remove all rules contained completely within pNew
+				while ( it != lmRanges.end() && ( *it ).second->endIP() <= pNew->endIP() )
+				{
+					IPRangeRule* pCovered = ( *it ).second;
+
+					m_oLog.post( LogEvent::OverlappedRangeRemoved,
+					             pCovered->startIP(), pCovered->endIP() );
+					lsRemoved.insert( pCovered );
+
+					RangeMap::iterator itCovered = it++;
+					lmRanges.erase( itCovered );
+				}
+
+				// merge pNew into eventually overlapped rule
+				if ( it != lmRanges.end() && ( *it ).second->startIP() <= pNew->endIP() )
+				{
+					( *it ).second->merge( pNew );
+					recordUpdate( ( *it ).second->m_nGUIID );
+
+					rekeyRange( lmRanges, it );
+				}
+			}
+		}
+
+		if ( pSecondHalf )
+		{
+			lmRanges.insert( std::make_pair( pSecondHalf->startIP(), pSecondHalf ) );
+			vAdded.push_back( pSecondHalf );
+		}
+
+		if ( pNew )
+		{
+			lmRanges.insert( std::make_pair( pNew->startIP(), pNew ) );
+			lsNew.insert( pNew );
+		}
+		else
+		{
+			m_oLog.post( LogEvent::RuleMerged );
+		}
+	}
+
+	m_vIPRanges.clear();
+	m_vIPRanges.reserve( lmRanges.size() );
+
+	for ( RangeMap::const_iterator it = lmRanges.begin(); it != lmRanges.end(); ++it )
+	{
+		m_vIPRanges.push_back( ( *it ).second );
+	}
+
+	// Rules that have been added and removed again during the sweep have never been visible, so
+	// they can be deleted right away.
+	std::unordered_set< const Rule* > lsTransient;
+	for ( std::unordered_set< const Rule* >::const_iterator it = lsRemoved.begin();
+		  it != lsRemoved.end(); ++it )
+	{
+		if ( lsNew.count( *it ) )
+		{
+			lsTransient.insert( *it );
+			lsNew.erase( *it );
+		}
+	}
+
+	// vAdded contains the split off parts only so far
+	for ( size_t n = 0; n < vAdded.size(); ++n )
+	{
+		if ( lsRemoved.count( vAdded[n] ) )
+		{
+			lsTransient.insert( vAdded[n] );
+		}
+	}
+
+	std::vector< QHostAddress > vCached;
+
+	for ( size_t n = 0; n < m_vIPRanges.size(); ++n )
+	{
+		IPRangeRule* pRange = m_vIPRanges[n];
+
+		if ( lsNew.count( pRange ) )
+		{
+			std::vector< QHostAddress > vRangeCached;
+			m_oMissCache.erase( pRange->startIP(), pRange->endIP(), vRangeCached );
+
+			if ( pRange->m_nAction == RuleAction::Deny )
+			{
+				vCached.insert( vCached.end(), vRangeCached.begin(), vRangeCached.end() );
+			}
+
+			queueForSanityCheck( pRange, pBatch );
+			vAdded.push_back( pRange );
+		}
+	}
+
+	// Remove the covered rules from the rules vector and add the new ones in a single pass.
+	size_t nAdded = 0;
+	for ( size_t n = 0; n < vAdded.size(); ++n )
+	{
+		if ( lsTransient.count( vAdded[n] ) )
+		{
+			delete vAdded[n];
 		}
-
-		if ( pNew ) // if it hasn't been set to NULL/merged completely into the existing rule
+		else
 		{
-			// remove all rules contained completely within pNewRange
-			IPRangeVectorPos nSize;
-			while ( nPos < ( nSize = m_vIPRanges.size() ) && m_vIPRanges[nPos]->endIP() <= pNew->endIP() )
-			{
-				postLogMessage( LogSeverity::Security,
-				                tr( "Merging IP range rules. Removing overlapped IP range %1."
-				                  ).arg( m_vIPRanges[nPos]->contentString() ) );
+			vAdded[nAdded++] = vAdded[n];
+		}
+	}
+	vAdded.resize( nAdded );
 
-				const RuleVectorPos nUUIDPos = find( m_vIPRanges[nPos]->m_idUUID );
-#ifdef _DEBUG
-				Q_ASSERT( nUUIDPos != m_vRules.size() );
-				Q_ASSERT( m_vRules[nUUIDPos]->m_idUUID == m_vIPRanges[nPos]->m_idUUID );
-#endif
-				// this moves a new rule to position nPos, so we don't need to do sth like ++nPos
-				remove( nUUIDPos );
+	std::sort( vAdded.begin(), vAdded.end(), ruleUUIDLess );
 
-				// REMOVE for beta 1
-				Q_ASSERT( nSize != m_vIPRanges.size() );
-			}
+	std::vector< Rule* > vRules;
+	vRules.reserve( m_vRules.size() + vAdded.size() );
 
-			// merge pNewRange into eventually overlapped rule
-			if ( nPos < m_vIPRanges.size() && m_vIPRanges[nPos]->startIP() <= pNew->endIP() )
-			{
-				m_vIPRanges[nPos]->merge( pNew );
-			}
+	std::vector< Rule* >::const_iterator itAdded = vAdded.begin();
+	for ( RuleVectorPos n = 0; n < m_vRules.size(); ++n )
+	{
+		Rule* pRule = m_vRules[n];
+
+		while ( itAdded != vAdded.end() && ( *itAdded )->m_idUUID < pRule->m_idUUID )
+		{
+			vRules.push_back( *itAdded++ );
 		}
-	}
 
-	if ( pSecondHalf )
+		if ( lsRemoved.count( pRule ) )
+		{
+			recordRemoval( SharedRulePtr( pRule ) );
+		}
+		else
+		{
+			vRules.push_back( pRule );
+		}
+	}
+	for ( ; itAdded != vAdded.end(); ++itAdded )
 	{
-		// no need for sanity checking and most of the other stuff dealt with in add()
-		insertRangeHelper( pSecondHalf );
-		insert( pSecondHalf );
-		emit ruleAdded( pSecondHalf );
+		vRules.push_back( *itAdded );
 	}
 
-	if ( pNew )
+	m_vRules.swap( vRules );
+
+	for ( size_t n = 0; n < vAdded.size(); ++n )
 	{
-		insertRangeHelper( pNew );
+		recordAddition( vAdded[n] );
 	}
+
+	m_oMissCache.evaluateUsage( ( uint )m_lmIPs.size(), ( uint )m_vIPRanges.size() );
+	m_oSanity.pushAffected( vCached );
+
+	// rules have been added and we might require saving
+	m_bUnsaved = true;
+
+	// invalidate verdicts cached outside of the manager
+	m_nRuleGeneration.ref();
+
+	vNew.clear();
+
+	requestChangeNotification();
+}
+
+void Manager::mergeRule( const Rule* const pRule, Rule* pDestination )
+{
+	pRule->mergeInto( pDestination );
+	emitUpdate( pDestination->m_nGUIID );
 }
 
 void Manager::insertRangeHelper( IPRangeRule* pNewRange )
@@ -1868,6 +3049,116 @@ void Manager::eraseRange( const IPRangeVectorPos nPos )
 #endif
 }
 
+uint Manager::compactRanges()
+{
+	return compactRanges( NULL );
+}
+
+uint Manager::compactRanges( ImportBatch* pBatch )
+{
+	m_oRWLock.lockForWrite();
+
+	// ranges of a running import must be part of the index before it can be compacted
+	if ( pBatch )
+	{
+		insertRanges( pBatch->vRanges, pBatch );
+	}
+
+	const uint nBefore   = ( uint )m_vIPRanges.size();
+	const uint nAbsorbed = compactRangesInternal( pBatch );
+
+	m_oRWLock.unlock();
+
+	if ( nAbsorbed )
+	{
+		requestChangeNotification();
+	}
+
+	m_pEnvironment->log( LogSeverity::Information,
+	                     tr( "Compacted IP range rules: %1 ranges before, %2 after."
+	                         ).arg( nBefore ).arg( nBefore - nAbsorbed ) );
+
+	return nAbsorbed;
+}
+
+uint Manager::compactRangesInternal( ImportBatch* pBatch )
+{
+	const IPRangeVectorPos nSize = m_vIPRanges.size();
+
+	if ( nSize < 2 )
+	{
+		return 0;
+	}
+
+	std::unordered_set< const Rule* > lsAbsorbed;
+
+	IPRangeRule** pArray = &m_vIPRanges[0]; // access internal array
+	IPRangeVectorPos nLast = 0;
+	bool bExtended = false;
+
+	// The ranges are sorted by start IP, so a single sweep suffices to find all coalescable rules.
+	for ( IPRangeVectorPos n = 1; n < nSize; ++n )
+	{
+		if ( pArray[nLast]->coalesce( pArray[n] ) )
+		{
+			lsAbsorbed.insert( pArray[n] );
+
+			if ( !bExtended )
+			{
+				recordUpdate( pArray[nLast]->m_nGUIID );
+
+				// The remaining rule needs to be sanity checked together with the new ones.
+				// Duplicates are removed by endImport().
+				if ( pBatch )
+				{
+					pBatch->vRules.push_back( pArray[nLast]->m_idUUID );
+				}
+
+				bExtended = true;
+			}
+		}
+		else
+		{
+			pArray[++nLast] = pArray[n];
+			bExtended = false;
+		}
+	}
+
+	if ( lsAbsorbed.empty() )
+	{
+		return 0;
+	}
+
+	m_vIPRanges.resize( nLast + 1 );
+
+	// Remove the absorbed rules from the list of all rules in one pass, keeping the UUID order.
+	Rule** pRules = &m_vRules[0]; // access internal array
+	const RuleVectorPos nRules = m_vRules.size();
+	RuleVectorPos nKept = 0;
+
+	for ( RuleVectorPos n = 0; n < nRules; ++n )
+	{
+		if ( lsAbsorbed.count( pRules[n] ) )
+		{
+			recordRemoval( SharedRulePtr( pRules[n] ) );
+		}
+		else
+		{
+			pRules[nKept++] = pRules[n];
+		}
+	}
+
+	m_vRules.resize( nKept );
+
+	// rules have been removed, so we might want to save...
+	m_bUnsaved = true;
+
+	// invalidate verdicts cached outside of the manager
+	m_nRuleGeneration.ref();
+
+	return ( uint )lsAbsorbed.size();
+}
+
 Manager::RuleVectorPos Manager::findInternal( const QUuid& idUUID, const Rule* const * const pRules,
                                               const RuleVectorPos nSize ) const
 {
@@ -1978,45 +3269,36 @@ Manager::RuleVectorPos Manager::find( const QUuid& idUUID ) const
 	}
 }
 
-Manager::RuleVectorPos Manager::find( const HashSet& vHashes ) const
+HashRule* Manager::findHashMatch( const HashSet& vHashes ) const
 {
 	// We are not searching for any hash. :)
 	if ( vHashes.empty() )
 	{
-		return m_vRules.size();
+		return NULL;
 	}
 
-	std::pair<HashIterator, HashIterator> oBounds;
+	const quint8 nTables = ( quint8 )qMin( ( size_t )vHashes.size(), m_vHashTables.size() );
 
 	// For each hash that has been given to the function:
-	for ( quint8 i = 0, nSize = vHashes.size(); i < nSize; ++i )
+	for ( quint8 i = 0; i < nTables; ++i )
 	{
 		if ( vHashes[i] )
 		{
-			// 1. Check whether a corresponding rule can be found in our lookup container.
-			oBounds = m_lmmHashes.equal_range( qHash( vHashes[i]->rawValue() ) );
+			// Look up the full digest in the table of its algorithm. The table takes care of
+			// multiple rules sharing a digest (e.g. because of collisions of weaker hashes).
+			HashRule* pRule = m_vHashTables[i].match( vHashes[i]->rawValue(), vHashes );
 
-			HashIterator it = oBounds.first;
-
-			// 2. Iterate threw all rules that include the current hash
-			// (this is important for weaker hashes to deal correctly with hash collisions)
-			while ( it != oBounds.second )
+			if ( pRule )
 			{
-				if ( ( *it ).second->match( vHashes ) )
-				{
-					RuleVectorPos nPos = find( ( *it ).second->m_idUUID );
 #ifdef _DEBUG
-					Q_ASSERT( nPos != m_vRules.size() );
-					Q_ASSERT( m_vRules[nPos]->m_idUUID == ( *it ).second->m_idUUID );
+				Q_ASSERT( find( pRule->m_idUUID ) != m_vRules.size() );
 #endif
-					return nPos;
-				}
-				++it;
+				return pRule;
 			}
 		}
 	}
 
-	return m_vRules.size();
+	return NULL;
 }
 
 void Manager::expireLater()
@@ -2092,24 +3374,11 @@ void Manager::remove( const RuleVectorPos nVectorPos )
 		HashRule* pHashRule = ( HashRule* )pRule;
 		const HashSet& vHashes = pHashRule->getHashes();
 
-		HashRuleMap::iterator it;
-		std::pair<HashRuleMap::iterator, HashRuleMap::iterator> oBounds;
 		for ( quint8 i = 0, nSize = vHashes.size(); i < nSize; ++i )
 		{
-			if ( vHashes[i] )
+			if ( vHashes[i] && i < m_vHashTables.size() )
 			{
-				oBounds = m_lmmHashes.equal_range( qHash( vHashes[i]->rawValue() ) );
-				it = oBounds.first;
-
-				while ( it != oBounds.second )
-				{
-					if ( ( *it ).second->m_idUUID == pHashRule->m_idUUID )
-					{
-						m_lmmHashes.erase( it );
-						break;
-					}
-					++it;
-				}
+				m_vHashTables[i].remove( vHashes[i]->rawValue(), pHashRule );
 			}
 		}
 	}
@@ -2192,6 +3461,7 @@ void Manager::remove( const RuleVectorPos nVectorPos )
 			memmove( pArray + nPos, pArray + nPos + 1, ( nMax - nPos ) * sizeof( Rule* ) );
 
 			m_vUserAgents.pop_back();       // remove last element
+			m_bAgentMatcherDirty.store( 1 );
 		}
 	}
 	break;
@@ -2208,6 +3478,9 @@ void Manager::remove( const RuleVectorPos nVectorPos )
 	// a rule has been removed, so we might want to save...
 	m_bUnsaved = true;
 
+	// invalidate verdicts cached outside of the manager
+	m_nRuleGeneration.ref();
+
 	// Remove rule entry from list of all rules
 	erase( nVectorPos );
 
@@ -2228,8 +3501,7 @@ void Manager::remove( const RuleVectorPos nVectorPos )
 	}
 #endif
 
-	SharedRulePtr pReturn = SharedRulePtr( pRule );
-	emit ruleRemoved( pReturn );
+	recordRemoval( SharedRulePtr( pRule ) );
 }
 
 bool Manager::isAgentDeniedInternal( const QString& sUserAgent )
@@ -2244,15 +3516,74 @@ bool Manager::isAgentDeniedInternal( const QString& sUserAgent )
 	if ( nSize )
 	{
 		UserAgentRule* const * const pArray = &m_vUserAgents[0];
-		const quint32 tNow = common::getTNowUTC();
+		const quint32 tNow = m_pEnvironment->now();
+
+		// Fall back to checking all rules if the matcher is outdated.
+		if ( m_bAgentMatcherDirty.load() )
+		{
+			for ( UserAgentVectorPos n = 0; n < nSize; ++n )
+			{
+				if ( !pArray[n]->isExpired( tNow ) )
+				{
+					if ( pArray[n]->match( sUserAgent ) )
+					{
+						hit( pArray[n] );
+						SECURITY_COUNT_STAGE( Stage::UserAgent );
+
+						if ( pArray[n]->m_nAction == RuleAction::Deny )
+						{
+							return true;
+						}
+						else if ( pArray[n]->m_nAction == RuleAction::Accept )
+						{
+							return false;
+						}
+					}
+				}
+				else
+				{
+					expireLater();
+				}
+			}
+
+			return false;
+		}
 
-		for ( UserAgentVectorPos n = 0; n < nSize; ++n )
+		// positions of the literal rules occurring in sUserAgent
+		std::vector< quint32 > vLiterals;
+		m_oAgentMatcher.match( sUserAgent, vLiterals );
+
+		const std::vector< quint32 >::size_type nLiterals = vLiterals.size();
+		const UserAgentVectorPos                nRegExps  = m_vAgentRegExps.size();
+
+		std::vector< quint32 >::size_type nLiteral = 0;
+		UserAgentVectorPos                nRegExp  = 0;
+
+		// Visit the matching literal rules and the regexp rules in rule order, so the first
+		// matching rule still decides.
+		while ( nLiteral < nLiterals || nRegExp < nRegExps )
 		{
+			UserAgentVectorPos n;
+			bool bMatch;
+
+			if ( nRegExp == nRegExps ||
+				 ( nLiteral < nLiterals && vLiterals[nLiteral] < m_vAgentRegExps[nRegExp] ) )
+			{
+				n      = vLiterals[nLiteral++];
+				bMatch = true;
+			}
+			else
+			{
+				n      = m_vAgentRegExps[nRegExp++];
+				bMatch = false;
+			}
+
 			if ( !pArray[n]->isExpired( tNow ) )
 			{
-				if ( pArray[n]->match( sUserAgent ) )
+				if ( bMatch || pArray[n]->match( sUserAgent ) )
 				{
 					hit( pArray[n] );
+					SECURITY_COUNT_STAGE( Stage::UserAgent );
 
 					if ( pArray[n]->m_nAction == RuleAction::Deny )
 					{
@@ -2274,38 +3605,89 @@ bool Manager::isAgentDeniedInternal( const QString& sUserAgent )
 	return false;
 }
 
-bool Manager::isDenied( const QueryHit* const pHit )
+void Manager::rebuildAgentMatcher()
+{
+	m_oAgentMatcher.clear();
+	m_vAgentRegExps.clear();
+
+	for ( UserAgentVectorPos n = 0, nSize = m_vUserAgents.size(); n < nSize; ++n )
+	{
+		if ( m_vUserAgents[n]->isRegExp() )
+		{
+			m_vAgentRegExps.push_back( n );
+		}
+		else
+		{
+			m_oAgentMatcher.add( m_vUserAgents[n]->contentString(), ( quint32 )n );
+		}
+	}
+
+	m_oAgentMatcher.build();
+	m_bAgentMatcherDirty.store( 0 );
+}
+
+bool Manager::isDenied( const QueryHit* const pHit, const quint32 tNow )
 {
 	if ( !pHit )
 	{
 		return false;
 	}
 
+	return isDenied( pHit, QueryContext::hitKey( pHit ), tNow );
+}
+
+bool Manager::isDenied( const QueryHit* const pHit, const QByteArray& baKey, const quint32 tNow )
+{
+	const int nGeneration = m_nRuleGeneration.load();
+
+	bool bDenied;
+
+	// The same file is usually returned by many hosts, so there is no need to evaluate the rules
+	// more than once per generation. Note that rule hits are not counted for cached verdicts.
+	// Verdicts based on a rule with an expiry time are only reused until that rule expires.
+	if ( m_oVerdictCache.lookup( baKey, nGeneration, tNow, bDenied ) )
+	{
+		return bDenied;
+	}
+
+	quint32 tExpire;
+	bDenied = isDeniedUncached( pHit, tNow, tExpire );
+
+	m_oVerdictCache.insert( baKey, nGeneration, tExpire, bDenied );
+
+	return bDenied;
+}
+
+bool Manager::isDeniedUncached( const QueryHit* const pHit, const quint32 tNow,
+                                quint32& tExpire )
+{
 	const HashSet& vHashes = pHit->m_vHashes;
 
-	const quint32 tNow = common::getTNowUTC();
+	tExpire = RuleTime::Forever;
 
 	// Search for a rule matching these hashes
-	RuleVectorPos nPos = find( vHashes );
+	HashRule* pHashRule = findHashMatch( vHashes );
+
+	// Note: user defined hash rules take precedence over hash lists.
 
 	// If this rule matches the file, return the specified action.
-	if ( nPos != m_vRules.size() )
+	if ( pHashRule )
 	{
-		HashRule* pHashRule = ( HashRule* )m_vRules[nPos];
+		// Note: findHashMatch() already verified the rule to match vHashes.
 		if ( !pHashRule->isExpired( tNow ) )
 		{
-			if ( pHashRule->match( vHashes ) )
-			{
-				hit( pHashRule );
+			hit( pHashRule );
+			SECURITY_COUNT_STAGE( Stage::Hash );
 
-				if ( pHashRule->m_nAction == RuleAction::Deny )
-				{
-					return true;
-				}
-				else if ( pHashRule->m_nAction == RuleAction::Accept )
-				{
-					return false;
-				}
+			if ( pHashRule->m_nAction == RuleAction::Deny )
+			{
+				tExpire = pHashRule->expiryTime();
+				return true;
+			}
+			else if ( pHashRule->m_nAction == RuleAction::Accept )
+			{
+				tExpire = pHashRule->expiryTime();
+				return false;
 			}
 		}
 		else
@@ -2314,6 +3696,15 @@ bool Manager::isDenied( const QueryHit* const pHit )
 		}
 	}
 
+	for ( HashListVector::const_iterator it = m_vHashLists.begin(); it != m_vHashLists.end(); ++it )
+	{
+		if ( ( *it )->contains( vHashes ) )
+		{
+			SECURITY_COUNT_STAGE( Stage::HashList );
+			return ( *it )->action() == RuleAction::Deny;
+		}
+	}
+
 	const ContentVectorPos nSize = m_vContents.size();
 
 	if ( nSize )
@@ -2327,13 +3718,16 @@ bool Manager::isDenied( const QueryHit* const pHit )
 				if ( pArray[n]->match( pHit ) )
 				{
 					hit( pArray[n] );
+					SECURITY_COUNT_STAGE( Stage::Content );
 
 					if ( pArray[n]->m_nAction == RuleAction::Deny )
 					{
+						tExpire = pArray[n]->expiryTime();
 						return true;
 					}
 					else if ( pArray[n]->m_nAction == RuleAction::Accept )
 					{
+						tExpire = pArray[n]->expiryTime();
 						return false;
 					}
 				}
@@ -2348,7 +3742,8 @@ bool Manager::isDenied( const QueryHit* const pHit )
 	return false;
 }
 
-bool Manager::isDenied( const QList<QString>& lQuery, const QString& sContent )
+bool Manager::isDenied( const QList<QString>& lQuery, const QString& sContent,
+						const quint32 tNow )
 {
 	// if this happens, fix caller :D
 	Q_ASSERT( !lQuery.isEmpty() );
@@ -2362,7 +3757,6 @@ bool Manager::isDenied( const QList<QString>& lQuery, const QString& sContent )
 
 	if ( nSize )
 	{
-		const quint32 tNow = common::getTNowUTC();
 		RegularExpressionRule* const * const pArray = &m_vRegularExpressions[0];
 
 		for ( RegExpVectorPos n = 0; n < nSize; ++n )
@@ -2372,6 +3766,7 @@ bool Manager::isDenied( const QList<QString>& lQuery, const QString& sContent )
 				if ( pArray[n]->match( lQuery, sContent ) )
 				{
 					hit( pArray[n] );
+					SECURITY_COUNT_STAGE( Stage::RegularExpression );
 
 					if ( pArray[n]->m_nAction == RuleAction::Deny )
 					{
@@ -2393,6 +3788,94 @@ bool Manager::isDenied( const QList<QString>& lQuery, const QString& sContent )
 	return false;
 }
 
+bool Manager::isDenied( QueryContext& oContext, const QString& sContent, const quint32 tNow )
+{
+	const QList<QString>& lQuery = oContext.keywords();
+
+	if ( lQuery.isEmpty() || sContent.isEmpty() )
+	{
+		return false;
+	}
+
+	const RegExpVectorPos nSize = m_vRegularExpressions.size();
+
+	if ( nSize )
+	{
+		RegularExpressionRule* const * const pArray = &m_vRegularExpressions[0];
+
+		for ( RegExpVectorPos n = 0; n < nSize; ++n )
+		{
+			if ( !pArray[n]->isExpired( tNow ) )
+			{
+				bool bMatch;
+
+				if ( pArray[n]->hasSpecialElements() )
+				{
+					// use the filter already instantiated for the keywords of this search
+#if QT_VERSION >= 0x050000
+					bMatch = oContext.regExp( pArray[n] ).match( sContent ).hasMatch();
+#else
+					bMatch = oContext.regExp( pArray[n] ).exactMatch( sContent );
+#endif
+				}
+				else
+				{
+					bMatch = pArray[n]->match( lQuery, sContent );
+				}
+
+				if ( bMatch )
+				{
+					hit( pArray[n] );
+					SECURITY_COUNT_STAGE( Stage::RegularExpression );
+
+					if ( pArray[n]->m_nAction == RuleAction::Deny )
+					{
+						return true;
+					}
+					else if ( pArray[n]->m_nAction == RuleAction::Accept )
+					{
+						return false;
+					}
+				}
+			}
+			else
+			{
+				expireLater();
+			}
+		}
+	}
+
+	return false;
+}
+
+bool Manager::isDeniedInternal( QueryContext& oContext, const QueryHit* const pHit,
+								const quint32 tNow )
+{
+	if ( !pHit )
+	{
+		return false;
+	}
+
+	const int nGeneration = m_nRuleGeneration.load();
+	const QByteArray baKey = QueryContext::hitKey( pHit );
+
+	bool bDenied;
+
+	// Hits describing the same file are frequently returned by multiple hosts. Note that rule hits
+	// are only counted for the first occurrence of a file within a search.
+	if ( oContext.lookup( baKey, nGeneration, bDenied ) )
+	{
+		return bDenied;
+	}
+
+	bDenied = isDenied( pHit, baKey, tNow ) ||                      // test hashes, size and extension
+	          isDenied( oContext, pHit->m_sDescriptiveName, tNow ); // test regex
+
+	oContext.memorize( baKey, nGeneration, bDenied );
+
+	return bDenied;
+}
+
 bool Manager::isPrivate( const EndPoint& oAddress )
 {
 #if SECURITY_DISABLE_IS_PRIVATE_OLD
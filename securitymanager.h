@@ -25,13 +25,19 @@
 #ifndef SECURITYMANAGER_H
 #define SECURITYMANAGER_H
 
-#include <map>
 #include <unordered_map>
 #include <unordered_set>
 
 #include <QFile>
+#include <QTimer>
 
 #include "externals.h"
+#include "autobanstore.h"
+#include "decisiontrace.h"
+#include "eventlog.h"
+#include "flooddetector.h"
+#include "instrumentation.h"
+#include "iplookuptable.h"
 
 #include "securerule.h"
 
@@ -43,15 +49,22 @@
 #include "regexprule.h"
 #include "useragentrule.h"
 
+#include "digesttable.h"
+#include "hashlist.h"
+#include "clientblacklist.h"
 #include "misscache.h"
+#include "patternmatcher.h"
+#include "querycontext.h"
 #include "sanitychecker.h"
+#include "verdictcache.h"
 
 // Increment this if there have been made changes to the way of storing security rules.
-#define SECURITY_CODE_VERSION 2
+#define SECURITY_CODE_VERSION 3
 // History:
 // 0 - Initial implementation
 // 1 - Some changes to the way the rule time is stored and other minor adjustments.
 // 2 - Added last hit time to rules
+// 3 - Added origin UUIDs to IP range rules
 
 #define SECURITY_XML_VERSION "2.0"
 // History:
@@ -72,6 +85,16 @@ typedef QSharedPointer<Rule> SharedRulePtr;
  */
 typedef std::unordered_set<ID> IDSet;
 
+/**
+ * @brief RuleBatch represents the rules added to the Manager since the last change notification.
+ */
+typedef std::vector<Rule*> RuleBatch;
+
+/**
+ * @brief SharedRuleBatch represents removed rules or copies of rules.
+ */
+typedef std::vector<SharedRulePtr> SharedRuleBatch;
+
 /**
  * @brief The Manager class manages the security rules and allows checking content against them.
  */
@@ -79,7 +102,7 @@ class Manager : public QObject
 {
 	Q_OBJECT
 
-	friend class MissCache;
+	friend class SanityChecker;
 
 	/* ========================================================================================== */
 	/* ====================================== Definitions  ====================================== */
@@ -107,11 +130,28 @@ private:
 	typedef UserAgentVector::size_type UserAgentVectorPos;
 	typedef   ContentVector::size_type   ContentVectorPos;
 
-	typedef std::pair< uint, HashRule*          > HashPair;
-	// Note: Using a multimap eliminates eventual problems of hash
-	// collisions caused by weaker hashes like MD5 for example.
-	typedef std::multimap< uint, HashRule*      > HashRuleMap;
-	typedef HashRuleMap::const_iterator HashIterator;
+	// one table per hash algorithm, indexed by HashSet slot
+	typedef std::vector< DigestTable > DigestTableVector;
+
+	typedef std::vector< HashList* > HashListVector;
+
+#ifndef QUAZAA_SETUP_UNIT_TESTS
+private:
+#else
+public:
+#endif
+	/**
+	 * @brief The ImportBatch struct collects the rules added by a single bulk import. It is owned
+	 * by the importing call, so rules added by other threads in the meantime are not affected.
+	 */
+	struct ImportBatch
+	{
+		// IDs of the imported rules, handed to the sanity checker as one batch
+		std::vector< QUuid >        vRules;
+
+		// imported IP ranges, merged into the range index as one batch
+		std::vector< IPRangeRule* > vRanges;
+	};
 
 	/* ========================================================================================== */
 	/* ======================================= Attributes ======================================= */
@@ -125,6 +165,9 @@ private:
 #else
 public:
 #endif
+	// settings, clock, log and data path
+	Environment*    m_pEnvironment;
+
 	// contains all rules
 	RuleVector      m_vRules;
 
@@ -144,7 +187,10 @@ public:
 #endif // SECURITY_ENABLE_GEOIP
 
 	// hash rules
-	HashRuleMap     m_lmmHashes;
+	DigestTableVector m_vHashTables;
+
+	// compiled hash lists, checked after the hash rules
+	HashListVector  m_vHashLists;
 
 	// all other content rules
 	ContentVector   m_vContents;
@@ -155,9 +201,51 @@ public:
 	// User agent rules
 	UserAgentVector m_vUserAgents;
 
+	// literal user agent rules by position in m_vUserAgents and positions of the regexp rules
+	PatternMatcher  m_oAgentMatcher;
+	std::vector< UserAgentVectorPos > m_vAgentRegExps;
+	QAtomicInt      m_bAgentMatcherDirty;   // set if m_oAgentMatcher needs to be rebuilt
+
 	// Miss cache
 	MissCache       m_oMissCache;
 
+	// automatic IP bans, kept apart from the rules within a fixed amount of memory
+	AutoBanStore    m_oAutoBans;
+
+	// automatic flood bans of networks, keyed by FloodDetector::network(); checked after the rules
+	AutoBanStore    m_oNetworkBans;
+
+	// event counters by address and network triggering automatic bans
+	FloodDetector   m_oFloodDetector;
+
+	// query independent verdicts of recently checked files
+	VerdictCache    m_oVerdictCache;
+
+	// rate limited log for events that might occur in large numbers
+	EventLog        m_oLog;
+
+	// per thread group copies of the IP indexes
+	IPReplicaSet    m_oReplicas;
+
+	// changes collected for the next batched change notification, protected by m_oChangeLock
+	QMutex          m_oChangeLock;
+	RuleBatch       m_vAddedRules;
+	SharedRuleBatch m_vRemovedRules;
+	IDSet           m_lsUpdatedRules;
+	bool            m_bAutoBansChanged;
+
+#if SECURITY_ENABLE_DECISION_TRACE
+	// records all checks while a trace is running
+	DecisionTrace   m_oTrace;
+#endif // SECURITY_ENABLE_DECISION_TRACE
+
+	// client/agent/vendor blacklist and isClientBad() verdicts by user agent string
+	// The blacklist pointer is only replaced while holding both m_oRWLock (RW) and
+	// m_oClientSection, so holding either of them is sufficient to read it.
+	mutable QMutex          m_oClientSection;
+	mutable QHash<QString, bool> m_lhClientVerdicts;
+	QSharedPointer<const ClientBlacklist> m_pClientBlacklist;
+
 	// Security manager settings
 	bool            m_bLogIPCheckHits;          // Post log message on IsDenied( QHostAdress ) call
 	quint64         m_tRuleExpiryInterval;      // Check the security manager for expired hosts
@@ -172,6 +260,12 @@ public:
 	bool            m_bExpiryRequested;
 	bool            m_bDenyPrivateIPs;
 
+	/**
+	 * @brief m_nRuleGeneration is incremented each time the rule set changes. This allows caches
+	 * outside of the Manager to detect whether their content is still valid.
+	 */
+	QAtomicInt      m_nRuleGeneration;
+
 	/**
 	 * @brief m_bDenyPolicy specifies the default deny policy for IP checking.
 	 * <br><b>Values:</b>
@@ -182,6 +276,15 @@ public:
 
 	QMetaMethod     m_pfExpire;
 
+	// Coalescing of the sanity checks and saves requested by bursts of rule changes
+	QTimer*         m_pCommitTimer;
+	QMetaMethod     m_pfStartCommitTimer;
+	QAtomicInt      m_bCommitPending;     // set while a commit is scheduled
+	QAtomicInt      m_bCommitSave;        // set if the scheduled commit needs to save the rules
+	QAtomicInt      m_nCommitDelay;       // the collection window in ms
+	QAtomicInt      m_nCommitRequests;
+	QAtomicInt      m_nCommits;
+
 	/**
 	 * @brief sXMLNameSpace contains the namespace specification for Sheareza securiy XML files,
 	 * as used by Quazaa to export security rules to XML.
@@ -195,11 +298,25 @@ public:
 	/**
 	 * @brief Manager constructs an empty security manager. Note that you should call start() before
 	 * actually using it.
+	 *
+	 * Several independent instances may coexist as long as each of them is handed an environment
+	 * with its own data path.
 	 * @see start()
+	 *
+	 * @param pEnvironment  The settings, clock, log and data path to use. If <code>NULL</code>, the
+	 * application wide default environment is used. The Manager does not take ownership.
 	 */
-	Manager();
+	Manager( Environment* pEnvironment = NULL );
 	~Manager();
 
+	/**
+	 * @brief environment allows to access the environment of this Manager.
+	 * <br><b>Locking: /</b>
+	 *
+	 * @return the environment
+	 */
+	Environment*    environment() const;
+
 	/* ========================================================================================== */
 	/* ======================================= Operations ======================================= */
 	/* ========================================================================================== */
@@ -219,6 +336,140 @@ public:
 	 */
 	bool            denyPolicy() const;
 
+	/**
+	 * @brief verdictCache allows to access the statistics of the QueryHit verdict cache.
+	 * <br><b>Locking: /</b>
+	 *
+	 * @return the verdict cache
+	 */
+	const VerdictCache& verdictCache() const;
+
+	/**
+	 * @brief missCache allows to access the statistics of the IP miss cache.
+	 * <br><b>Locking: /</b>
+	 *
+	 * @return the miss cache
+	 */
+	const MissCache& missCache() const;
+
+	/**
+	 * @brief autoBanStatistics allows to access the size and the eviction metrics of the automatic
+	 * ban store.
+	 * <br><b>Locking: /</b>
+	 *
+	 * @return the statistics
+	 */
+	AutoBanStatistics autoBanStatistics() const;
+
+	/**
+	 * @brief setAutoBanMemory limits the memory used for automatic IP bans. Once the limit is
+	 * reached, each new automatic ban evicts an expired one or one that has not been hit recently.
+	 * Shrinking the store evicts the least recently hit bans right away.
+	 * <br><b>Locking: /</b>
+	 *
+	 * @param nBytes  The limit in bytes; defaults to SECURITY_AUTOBAN_MEMORY.
+	 */
+	void            setAutoBanMemory( quint32 nBytes );
+
+	/**
+	 * @brief floodDetector allows to access the thresholds and statistics of the flood detector.
+	 * <br><b>Locking: /</b>
+	 *
+	 * @return the flood detector
+	 */
+	const FloodDetector& floodDetector() const;
+
+	/**
+	 * @brief setFloodThreshold configures when addresses or networks reporting events via
+	 * recordEvent() are banned automatically. All thresholds are disabled by default.
+	 * <br><b>Locking: /</b>
+	 *
+	 * @param eType       The event type.
+	 * @param eScope      Whether the events are counted by address or by network.
+	 * @param nEvents     The number of events within the window to ban at; <code>0</code>
+	 * disables the threshold.
+	 * @param nBanLength  The ban length.
+	 */
+	void            setFloodThreshold( FloodEvent::Type eType, FloodScope::Scope eScope,
+									   quint32 nEvents, RuleTime::Time nBanLength );
+
+	/**
+	 * @brief setFloodWindow sets the length of the sliding window events are counted in.
+	 * <br><b>Locking: /</b>
+	 *
+	 * Note: This may not be called while other threads record events.
+	 *
+	 * @param nSeconds  The window length in seconds; defaults to SECURITY_FLOOD_WINDOW.
+	 */
+	void            setFloodWindow( quint32 nSeconds );
+
+	/**
+	 * @brief recordEvent counts an event caused by a remote host, e.g. a connection attempt. Once
+	 * the host or its network exceeds the threshold set for the event type, it is banned
+	 * automatically via the automatic ban stores. Hosts and networks that keep exceeding the
+	 * threshold once their ban has ended are banned again. Counting requires constant memory and
+	 * no lock.
+	 * <br><b>Locking: /</b> (RW if a ban is added)
+	 *
+	 * @param oAddress  The address of the remote host.
+	 * @param eType     The event type.
+	 * @return <code>true</code> if the event has caused a ban; <br><code>false</code> otherwise
+	 */
+	bool            recordEvent( const QHostAddress& oAddress, FloodEvent::Type eType );
+
+#if SECURITY_ENABLE_DECISION_TRACE
+	/**
+	 * @brief startTrace starts recording all address, QueryHit and user agent checks including
+	 * their verdicts to a file. See DecisionTrace for the format.
+	 * <br><b>Locking: /</b>
+	 *
+	 * @param sPath  The trace file; overwritten if it exists.
+	 * @return <code>true</code> if the recording has been started; <br><code>false</code> otherwise
+	 */
+	bool            startTrace( const QString& sPath );
+
+	/**
+	 * @brief stopTrace stops a running recording.
+	 * <br><b>Locking: /</b>
+	 */
+	void            stopTrace();
+#endif // SECURITY_ENABLE_DECISION_TRACE
+
+	/**
+	 * @brief commitDelay allows to access the time rule changes are collected before the
+	 * resulting sanity check and save are performed.
+	 * <br><b>Locking: /</b>
+	 *
+	 * @return the collection window in ms
+	 */
+	quint32         commitDelay() const;
+
+	/**
+	 * @brief setCommitDelay sets the time rule changes are collected before the resulting sanity
+	 * check and save are performed. 0 disables coalescing.
+	 * <br><b>Locking: /</b>
+	 *
+	 * @param nDelay  The collection window in ms.
+	 */
+	void            setCommitDelay( quint32 nDelay );
+
+	/**
+	 * @brief commitRequests allows to access the number of sanity check/save requests since start.
+	 * <br><b>Locking: /</b>
+	 *
+	 * @return the number of requests
+	 */
+	quint32         commitRequests() const;
+
+	/**
+	 * @brief mergedCommitRequests allows to access the number of sanity check/save requests that
+	 * have been merged into another request instead of being performed on their own.
+	 * <br><b>Locking: /</b>
+	 *
+	 * @return the number of merged requests
+	 */
+	quint32         mergedCommitRequests() const;
+
 	/**
 	 * @brief setDenyPolicy sets the deny policy to a given value.
 	 * <br><b>Locking: RW</b>
@@ -228,6 +479,14 @@ public:
 	 */
 	void            setDenyPolicy( bool bDenyPolicy );
 
+	/**
+	 * @brief replicaCount allows to access the number of replicas of the IP lookup indexes.
+	 * <br><b>Locking: /</b>
+	 *
+	 * @return the number of replicas; <code>0</code> if disabled
+	 */
+	int             replicaCount() const;
+
 	/**
 	 * @brief check allows to see whether a Rule with the same UUID exists within the Manager.
 	 * <br><b>Locking: R</b>
@@ -242,11 +501,15 @@ public:
 	 * @brief add inserts a Rule into the security database.
 	 * <br><b>Locking: RW</b>
 	 *
-	 * Note: This takes ownership of the Rule, so don't delete it after adding.
+	 * Note: This always takes ownership of the Rule, so don't delete it after adding. Rules that
+	 * are merged into an existing rule are deleted right away, as are automatic IP deny rules and
+	 * automatic IP range deny rules covering exactly one flood detection network, which are moved
+	 * to the automatic ban stores. In both cases false is returned and pRule must not be accessed
+	 * anymore.
 	 *
-	 * @param pRule  The Rule to be added. Will be set to NULL if redundant.
-	 * @return <code>true</code> if the Rule has been added;
-	 * <br><code>false</code> otherwise
+	 * @param pRule  The Rule to be added.
+	 * @return <code>true</code> if the Rule has been added and remains valid;
+	 * <br><code>false</code> if it has been deleted
 	 */
 	bool            add( Rule* pRule, bool bDoSanityCheck = true );
 
@@ -268,7 +531,26 @@ public:
 	void            clear();
 
 	/**
-	 * @brief ban bans a given IP for a specified amount of time.
+	 * @brief addHashList maps a compiled hash list (see HashList::compile()) and starts checking
+	 * query hits against it.
+	 * <br><b>Locking: RW</b>
+	 *
+	 * @param sPath  The location of the compiled hash list.
+	 * @return <code>true</code> if the list could be opened; <br><code>false</code> otherwise
+	 */
+	bool            addHashList( const QString& sPath );
+
+	/**
+	 * @brief clearHashLists stops checking query hits against compiled hash lists and unmaps them.
+	 * <br><b>Locking: RW</b>
+	 */
+	void            clearHashLists();
+
+	/**
+	 * @brief ban bans a given IP for a specified amount of time. Automatic bans are not added to
+	 * the rules, but to a store of fixed size (see setAutoBanMemory()), so they do not appear
+	 * among the rules (see autoBans() and autoBansChanged() instead) and may be evicted before
+	 * their expiry during ban floods.
 	 * <br><b>Locking: R + RW</b> (call to add())
 	 *
 	 * @param oAddress    The IP to ban.
@@ -286,6 +568,36 @@ public:
 #endif
 						);
 
+	/**
+	 * @brief unban lifts the automatic ban of an IP or, if oAddress is the first address of a
+	 * network banned by the flood detection, the ban of that network. Rules are not affected; use
+	 * remove() for those.
+	 * <br><b>Locking: RW</b>
+	 *
+	 * @param oAddress  The IP.
+	 * @return <code>true</code> if there was an automatic ban for oAddress;
+	 * <br><code>false</code> otherwise
+	 */
+	bool            unban( const QHostAddress& oAddress );
+
+	/**
+	 * @brief autoBans allows to access a copy of all automatic IP bans, e.g. to display them in
+	 * the GUI. Expired bans may be included until the next call of expire().
+	 * <br><b>Locking: /</b>
+	 *
+	 * @param vBans  The bans are appended to this vector.
+	 */
+	void            autoBans( AutoBanVector& vBans ) const;
+
+	/**
+	 * @brief networkBans allows to access a copy of all network bans of the flood detection. The
+	 * address of each ban is the first address of the network, see FloodDetector::prefix().
+	 * <br><b>Locking: /</b>
+	 *
+	 * @param vBans  The bans are appended to this vector.
+	 */
+	void            networkBans( AutoBanVector& vBans ) const;
+
 	/**
 	 * @brief ban bans a given file for a specified amount of time.
 	 * <br><b>Locking: R + RW</b> (during call to add())
@@ -321,8 +633,36 @@ public:
 	bool            isDenied( const QueryHit* const pHit, const QList<QString>& lQuery );
 
 	/**
-	 * @brief isClientBad checks for bad user agents.
-	 * <br><b>Locking: /</b>
+	 * @brief isDenied checks a hit against the security database, making use of the prepared
+	 * search data and the verdicts memorized within the context of its search.
+	 * <br><b>Locking: R</b>
+	 *
+	 * Note: This does not verify the hit IP to avoid redundant checking.
+	 *
+	 * @param oContext  The context of the search the hit has been returned for.
+	 * @param pHit      The QueryHit to check.
+	 * @return <code>true</code> if the QueryHit is denied; <br><code>false</code> otherwise.
+	 */
+	bool            isDenied( QueryContext& oContext, const QueryHit* const pHit );
+
+	/**
+	 * @brief isDenied checks all hits of a result packet against the security database, aquiring
+	 * the lock only once for the entire packet.
+	 * <br><b>Locking: R</b>
+	 *
+	 * Note: This does not verify the hit IPs to avoid redundant checking.
+	 *
+	 * @param oContext  The context of the search the hits have been returned for.
+	 * @param vHits     The hits to check.
+	 * @param vDenied   Is filled with the verdicts for the hits in vHits, in the same order.
+	 * @return the number of denied hits
+	 */
+	quint32         isDenied( QueryContext& oContext, const QueryHitVector& vHits,
+							  std::vector<bool>& vDenied );
+
+	/**
+	 * @brief isClientBad checks for bad user agents. The verdicts are cached by user agent string.
+	 * <br><b>Locking: /</b> (locks m_oClientSection internally)
 	 *
 	 * Note: We don't actually ban these clients, but we don't accept them as a leaf. They are
 	 * allowed to upload, though.
@@ -345,13 +685,24 @@ public:
 
 	/**
 	 * @brief isVendorBlocked checks for blocked vendors.
-	 * <br><b>Locking: /</b>
+	 * <br><b>Locking: R</b>
 	 *
 	 * @param sVendor  The vendor code.
 	 * @return <code>true</code> for blocked vendors; <br><code>false</code> otherwise.
 	 */
 	bool            isVendorBlocked( const QString& sVendor ) const;
 
+	/**
+	 * @brief loadClientBlacklist replaces the built-in client, agent and vendor blacklists used by
+	 * isClientBad(), isAgentDenied() and isVendorBlocked() with the content of a data file. See
+	 * ClientBlacklist for the file format.
+	 * <br><b>Locking: RW</b>
+	 *
+	 * @param sPath  The location of the data file.
+	 * @return <code>true</code> if the file could be read; <br><code>false</code> otherwise
+	 */
+	bool            loadClientBlacklist( const QString& sPath );
+
 	/**
 	 * @brief registerMetaTypes registers the necessary meta types for using the signals
 	 * and slots of the Security Manager.
@@ -365,10 +716,20 @@ public:
 	 *
 	 * Initializes signal/slot connections, pulls settings and sets up cleanup interval counters.
 	 *
+	 * With replicas of the IP lookup indexes, isDenied( EndPoint ) answers most checks from the
+	 * replica of the calling thread without locking the Manager. Replicas are updated after each
+	 * commit and every SECURITY_REPLICA_UPDATE_INTERVAL ms; checks fall back to the Manager while
+	 * the replica of the calling thread is outdated. Note that addresses checked against a replica
+	 * are not added to the miss cache. As lookups access the replicas without any lock, their
+	 * number can only be set here, and start() must not be called while other threads check
+	 * addresses.
+	 *
+	 * @param nReplicas  The number of replicas, e.g. one per core or NUMA node;
+	 * <code>0</code> disables the replicas.
 	 * @return <code>true</code> if loading the Security Rules from disk was successful;
 	 * <br><code>false</code> otherwise.
 	 */
-	bool            start();
+	bool            start( int nReplicas = SECURITY_IP_REPLICAS );
 
 	/**
 	 * @brief stop prepares the security manager for destruction.
@@ -439,6 +800,17 @@ public:
 	 */
 	bool            fromXML( const QString& sPath );
 
+	/**
+	 * @brief compactRanges coalesces adjacent and overlapping IP range rules sharing the same
+	 * action and expiry time into single rules within a single sweep over the range index. The
+	 * UUIDs of the absorbed rules are kept by the remaining rules as origins, see
+	 * IPRangeRule::origins(). This is done automatically after importing rule files.
+	 * <br><b>Locking: RW</b>
+	 *
+	 * @return the number of range rules that have been absorbed
+	 */
+	uint            compactRanges();
+
 	/**
 	 * @brief toXML exports all rules to a Shareaza style Security XML file.
 	 * <br><b>Locking: R</b>
@@ -458,6 +830,31 @@ public:
 	 */
 	void            emitUpdate( ID nID );
 
+	/**
+	 * @brief ruleCount allows a model to determine the number of rows of the rule table.
+	 * <br><b>Locking: R</b>
+	 *
+	 * @param nGeneration  Set to the current rule generation; pass it to rules() to detect changes
+	 * between two requests.
+	 * @return the number of rules
+	 */
+	quint32         ruleCount( int& nGeneration ) const;
+
+	/**
+	 * @brief rules allows a model to fetch a page of the rule table on demand. The rules are
+	 * returned as copies, so they can be used without holding any lock.
+	 * <br><b>Locking: R</b>
+	 *
+	 * @param nFirst       The position of the first rule of the page.
+	 * @param nCount       The maximum number of rules to return.
+	 * @param vRules       Receives copies of the rules; cleared first.
+	 * @param nGeneration  Set to the current rule generation.
+	 * @return <code>true</code> if nGeneration was unchanged, i.e. the page is consistent with the
+	 * previously fetched ones; <br><code>false</code> if the rule set has changed in the meantime
+	 */
+	bool            rules( quint32 nFirst, quint32 nCount, SharedRuleBatch& vRules,
+						   int& nGeneration ) const;
+
 	/* ========================================================================================== */
 	/* ======================================== Signals  ======================================== */
 	/* ========================================================================================== */
@@ -467,14 +864,36 @@ signals:
 	 */
 	void            startUpFinished();
 
+	/**
+	 * @brief rulesAdded informs about all rules added since the last commit. It is emitted once per
+	 * commit, before rulesRemoved().
+	 * @param vRules  The newly added rules.
+	 */
+	void            rulesAdded( RuleBatch vRules );
+
+	/**
+	 * @brief rulesRemoved informs about all rules removed since the last commit. The rules are
+	 * deleted once the last reference to them has been dropped.
+	 * @param vRules  The removed rules.
+	 */
+	void            rulesRemoved( SharedRuleBatch vRules );
+
+	/**
+	 * @brief rulesUpdated informs about all rules updated (e.g. hit) since the last commit.
+	 * @param lsIDs  The GUI IDs of the updated rules.
+	 */
+	void            rulesUpdated( IDSet lsIDs );
+
 	/**
 	 * @brief ruleAdded informs about a new Rule having been added.
+	 * Note: This is only emitted if connected; it is emitted along with rulesAdded().
 	 * @param pRule  The newly added Rule.
 	 */
 	void            ruleAdded( Rule* pRule );
 
 	/**
 	 * @brief ruleRemoved informs about a Rule having been removed.
+	 * Note: This is only emitted if connected; it is emitted along with rulesRemoved().
 	 * @param pRule  The newly removed Rule.
 	 */
 	void            ruleRemoved( SharedRulePtr pRule );
@@ -488,10 +907,19 @@ signals:
 
 	/**
 	 * @brief ruleUpdated informs about a Rule having been updated.
+	 * Note: This is only emitted if connected; it is emitted along with rulesUpdated().
 	 * @param nID  The GUI ID of the updated Rule.
 	 */
 	void            ruleUpdated( ID nID );
 
+	/**
+	 * @brief autoBansChanged informs about automatic IP or network bans having been added, lifted,
+	 * expired or evicted since the last commit. As automatic bans are not rules, they are not
+	 * reported by rulesAdded() and rulesRemoved(); receivers can read the current bans via
+	 * autoBans() and networkBans() instead.
+	 */
+	void            autoBansChanged();
+
 	/**
 	 * @brief cleared informs about the Manager having been cleared.
 	 */
@@ -515,10 +943,11 @@ signals:
 public slots:
 	/**
 	 * @brief requestRuleInfo allows to request ruleInfo signals for all rules.
-	 * <br><b>Locking: R</b>
+	 * <br><b>Locking: R</b> (released before the signals are emitted)
 	 *
 	 * Remember using queued connections when connceting to the ruleInfo signal, else you risk
-	 * recieving the signals before this method returns.
+	 * recieving the signals before this method returns. For large rule sets, prefer fetching the
+	 * rules on demand using ruleCount() and rules().
 	 * @see ruleInfo()
 	 * @return the number of rule info signals for the caller to expect
 	 */
@@ -555,6 +984,33 @@ private slots:
 	 */
 	void            updateHitCount( QUuid ruleID, uint nCount );
 
+	/**
+	 * @brief startCommitTimer starts the collection window of a scheduled commit.
+	 * <br><b>Locking: /</b>
+	 */
+	void            startCommitTimer();
+
+	/**
+	 * @brief commit performs the sanity check and save for all changes collected since the commit
+	 * has been scheduled.
+	 * <br><b>Locking: RW</b>
+	 */
+	void            commit();
+
+	/**
+	 * @brief emitChanges emits the batched change notifications for all changes collected since
+	 * the last call.
+	 * <br><b>Locking: /</b>
+	 */
+	void            emitChanges();
+
+	/**
+	 * @brief updateReplicas publishes a new IP lookup table to the replicas if the rules have
+	 * changed since the last update and collects the hits counted by the replicas.
+	 * <br><b>Locking: R</b>
+	 */
+	void            updateReplicas();
+
 	/* ========================================================================================== */
 	/* ======================================== Privates ======================================== */
 	/* ========================================================================================== */
@@ -564,7 +1020,40 @@ private:
 public:
 #endif
 	/**
-	 * @brief hit increases the rule counters by 1 and emits an updating signal to the GUI.
+	 * @brief recordAddition, recordRemoval and recordUpdate collect a change for the next batched
+	 * change notification.
+	 * <br><b>Locking: /</b>
+	 */
+	void            recordAddition( Rule* pRule );
+	void            recordRemoval( const SharedRulePtr& pRule );
+	void            recordUpdate( ID nID );
+
+	/**
+	 * @brief recordAutoBanChange collects a change of the automatic ban stores for the next
+	 * batched change notification.
+	 * <br><b>Locking: /</b>
+	 */
+	void            recordAutoBanChange();
+
+	/**
+	 * @brief applyHits adds hits counted outside of the Manager (e.g. by the replicas) to the
+	 * respective rules. Hits of rules that have been removed in the meantime are dropped.
+	 * <br><b>Locking: R</b>
+	 *
+	 * @param vHits  The hit counts by rule UUID.
+	 */
+	void            applyHits( const HitVector& vHits );
+
+	/**
+	 * @brief requestChangeNotification makes sure the collected changes are emitted within the
+	 * commit window, even if no commit has been requested. Unlike requestCommit(), this never
+	 * commits synchronously, so it may be called while holding m_oRWLock.
+	 * <br><b>Locking: /</b>
+	 */
+	void            requestChangeNotification();
+
+	/**
+	 * @brief hit increases the rule counters by 1 and records an update for the GUI.
 	 * <br><b>Locking: /</b>
 	 *
 	 * @param pRule  The Rule that has been hit.
@@ -583,6 +1072,96 @@ public:
 	 */
 	void            clearPrivates();
 
+	/**
+	 * @brief addInternal does the work for add().
+	 * <br><b>Locking: RW</b>
+	 *
+	 * @param pRule           The Rule to be added.
+	 * @param bDoSanityCheck  Whether to request a commit after adding the rule.
+	 * @param pBatch          The bulk import the rule is part of; NULL outside of imports. New IP
+	 * ranges of an import are collected in the batch and only become effective in endImport().
+	 * @return <code>true</code> if the Rule has been added;
+	 * <br><code>false</code> otherwise
+	 */
+	bool            addInternal( Rule* pRule, bool bDoSanityCheck, ImportBatch* pBatch );
+
+	/**
+	 * @brief queueForSanityCheck queues a new rule for the next sanity check. During bulk imports,
+	 * the rule is collected and queued together with the rest of the import later on.
+	 * <br><b>Locking: REQUIRES RW</b>
+	 *
+	 * @param pRule   The new rule.
+	 * @param pBatch  The bulk import the rule is part of; NULL outside of imports.
+	 */
+	void            queueForSanityCheck( const Rule* const pRule, ImportBatch* pBatch );
+
+	/**
+	 * @brief banAutomatic moves an automatic IP deny rule to the automatic ban store.
+	 * <br><b>Locking: REQUIRES RW</b>
+	 *
+	 * @param pRule  The rule. It is not taken over.
+	 * @return <code>true</code> if the IP has not been banned before;
+	 * <br><code>false</code> otherwise
+	 */
+	bool            banAutomatic( const IPRule* const pRule );
+
+	/**
+	 * @brief banNetworkAutomatic moves an automatic IP range deny rule covering exactly one flood
+	 * detection network to the network ban store. The ranges of the manual rules are not touched,
+	 * so accept rules within the network keep taking precedence.
+	 * <br><b>Locking: REQUIRES RW</b>
+	 *
+	 * @param pRule  The rule. It is not taken over.
+	 * @return <code>true</code> if the network has not been banned before;
+	 * <br><code>false</code> otherwise
+	 */
+	bool            banNetworkAutomatic( const IPRangeRule* const pRule );
+
+	/**
+	 * @brief banNetwork bans the flood detection network of an address.
+	 * <br><b>Locking: RW</b>
+	 *
+	 * @param oAddress    An address within the network.
+	 * @param nBanLength  The ban length.
+	 */
+	void            banNetwork( const QHostAddress& oAddress, RuleTime::Time nBanLength );
+
+	/**
+	 * @brief isAutoBanned checks the automatic bans of an address and of its network and counts
+	 * the hit.
+	 * <br><b>Locking: /</b>
+	 *
+	 * @param oAddress  The address.
+	 * @param tNow      The current time.
+	 * @return <code>true</code> if the address is banned; <br><code>false</code> otherwise
+	 */
+	bool            isAutoBanned( const QHostAddress& oAddress, quint32 tNow );
+
+	/**
+	 * @brief endImport merges the IP ranges collected by an import into the range index and queues
+	 * the rules collected for the sanity check as a single batch.
+	 * <br><b>Locking: RW</b>
+	 *
+	 * @param oBatch  The batch filled by addInternal(). It is empty afterwards.
+	 */
+	void            endImport( ImportBatch& oBatch );
+
+	/**
+	 * @brief requestCommit schedules a sanity check and optionally a save of the rules. Requests
+	 * arriving within the collection window are merged into a single commit.
+	 * <br><b>Locking: RW (if coalescing is disabled)</b>
+	 *
+	 * @param bSave  Set this to true if the rules need to be saved.
+	 */
+	void            requestCommit( bool bSave );
+
+	/**
+	 * @brief loadHashLists maps all compiled hash lists found in the hashlists subfolder of the
+	 * data path.
+	 * <br><b>Locking: RW</b>
+	 */
+	void            loadHashLists();
+
 	/**
 	 * @brief load retrieves the rules from HDD and adds them to the Manager.
 	 * <br><b>Locking: RW</b>
@@ -619,6 +1198,27 @@ public:
 	 */
 	void            insertRange( IPRangeRule*& pNew );
 
+	/**
+	 * @brief insertRanges merges a batch of new IP range rules into the range index and rebuilds
+	 * the rules vector in a single pass. The result is the same as if the ranges had been added one
+	 * by one in the order of the vector using insertRange(), so ranges of the batch overlapping
+	 * each other are resolved in favour of the one added later.
+	 * <br><b>Locking: REQUIRES RW</b>
+	 *
+	 * @param vNew    The new ranges. The Manager takes ownership, the vector is cleared.
+	 * @param pBatch  The bulk import the ranges are part of; NULL outside of imports.
+	 */
+	void            insertRanges( std::vector< IPRangeRule* >& vNew, ImportBatch* pBatch );
+
+	/**
+	 * @brief mergeRule merges pRule into pDestination and reports the update of pDestination.
+	 * <br><b>Locking: REQUIRES RW</b>
+	 *
+	 * @param pRule         The Rule to merge.
+	 * @param pDestination  The Rule pRule is merged into.
+	 */
+	void            mergeRule( const Rule* const pRule, Rule* pDestination );
+
 	/**
 	 * @brief insertRangeHelper inserts an IPRangeRule at the correct place into the vector.
 	 * <br><b>Locking: REQUIRES RW</b>
@@ -637,6 +1237,26 @@ public:
 	 */
 	void            eraseRange( const IPRangeVectorPos nPos );
 
+	/**
+	 * @brief compactRanges coalesces the IP range rules at the end of an import. The ranges
+	 * collected by the import are merged into the range index beforehand.
+	 * <br><b>Locking: RW</b>
+	 *
+	 * @param pBatch  The running import; NULL to compact the range index only.
+	 * @return the number of range rules that have been absorbed
+	 */
+	uint            compactRanges( ImportBatch* pBatch );
+
+	/**
+	 * @brief compactRangesInternal does the work for compactRanges().
+	 * <br><b>Locking: REQUIRES RW</b>
+	 *
+	 * @param pBatch  The running import; NULL outside of imports. Extended rules are queued for
+	 * the sanity check together with the imported ones.
+	 * @return the number of range rules that have been absorbed
+	 */
+	uint            compactRangesInternal( ImportBatch* pBatch );
+
 	/**
 	 * @brief findInternal Allows to determine the theoretical position of the rule with idUUID
 	 * within pRules.
@@ -666,16 +1286,16 @@ public:
 	RuleVectorPos   find( const QUuid& idUUID ) const;
 
 	/**
-	 * @brief find allows to determine the RuleVectorPos of the Rule matching vHashes.
+	 * @brief findHashMatch allows to find the HashRule matching vHashes.
 	 * <br><b>Locking: REQUIRES R</b>
 	 *
 	 * Note: This returns the first rule found. There might be others, however.
 	 *
 	 * @param vHashes  The HashSet of hashes to look for.
-	 * @return the RuleVectorPos of the HashRule;
-	 * <br><code>m_vRules.size()</code> if no HashRule by the specified HashSet could be found.
+	 * @return the HashRule; <br><code>NULL</code> if no HashRule by the specified HashSet could be
+	 * found.
 	 */
-	RuleVectorPos   find( const HashSet& vHashes ) const;
+	HashRule*       findHashMatch( const HashSet& vHashes ) const;
 
 	/**
 	 * @brief expireLater invokes delayed rule expiry on return to the main loop.
@@ -706,15 +1326,59 @@ public:
 	 */
 	bool            isAgentDeniedInternal( const QString& sUserAgent );
 
+	/**
+	 * @brief isAddressDenied performs the address check of isDenied( const EndPoint& ).
+	 * <br><b>Locking: R</b>
+	 *
+	 * @param oAddress  The address.
+	 * @return <code>true</code> if the address is denied; <br><code>false</code> otherwise
+	 */
+	bool            isAddressDenied( const EndPoint& oAddress );
+
+	/**
+	 * @brief rebuildAgentMatcher compiles the literal user agent rules into m_oAgentMatcher.
+	 * <br><b>Locking: REQUIRES RW</b>
+	 */
+	void            rebuildAgentMatcher();
+
 	/**
 	 * @brief isDenied checks a QueryHit against hash and content rules.
 	 * <br><b>Locking: REQUIRES R</b>
 	 *
 	 * @param pHit  The QueryHit to be checked.
+	 * @param tNow  The current time in seconds since 1.1.1970 UTC.
+	 * @return <code>true</code> if the hit is denied;
+	 * <br><code>false</code> otherwise
+	 */
+	bool            isDenied( const QueryHit* const pHit, const quint32 tNow );
+
+	/**
+	 * @brief isDenied checks a QueryHit against hash and content rules, making use of the verdict
+	 * cache.
+	 * <br><b>Locking: REQUIRES R</b>
+	 *
+	 * @param pHit   The QueryHit to be checked.
+	 * @param baKey  The key of pHit as returned by QueryContext::hitKey().
+	 * @param tNow   The current time in seconds since 1.1.1970 UTC.
 	 * @return <code>true</code> if the hit is denied;
 	 * <br><code>false</code> otherwise
 	 */
-	bool            isDenied( const QueryHit* const pHit );
+	bool            isDenied( const QueryHit* const pHit, const QByteArray& baKey,
+							  const quint32 tNow );
+
+	/**
+	 * @brief isDeniedUncached checks a QueryHit against hash and content rules.
+	 * <br><b>Locking: REQUIRES R</b>
+	 *
+	 * @param pHit     The QueryHit to be checked. May not be NULL.
+	 * @param tNow     The current time in seconds since 1.1.1970 UTC.
+	 * @param tExpire  Set to the expiry time of the rule the verdict is based on;
+	 * RuleTime::Forever if no rule with an expiry time decided.
+	 * @return <code>true</code> if the hit is denied;
+	 * <br><code>false</code> otherwise
+	 */
+	bool            isDeniedUncached( const QueryHit* const pHit, const quint32 tNow,
+									  quint32& tExpire );
 
 	/**
 	 * @brief isDenied checks a QueryHit name against the list of regular expression rules.
@@ -723,10 +1387,39 @@ public:
 	 * @param lQuery    A list of all search keywords in the same order they have been entered in
 	 * the edit box of the GUI.
 	 * @param sContent  The content string/file name to be checked.
+	 * @param tNow      The current time in seconds since 1.1.1970 UTC.
+	 * @return <code>true</code> if the hit is denied;
+	 * <br><code>false</code> otherwise
+	 */
+	bool            isDenied( const QList<QString>& lQuery, const QString& sContent,
+							  const quint32 tNow );
+
+	/**
+	 * @brief isDenied checks a QueryHit name against the list of regular expression rules using
+	 * the regular expressions already instantiated for the search of oContext.
+	 * <br><b>Locking: REQUIRES R</b>
+	 *
+	 * @param oContext  The context of the search.
+	 * @param sContent  The content string/file name to be checked.
+	 * @param tNow      The current time in seconds since 1.1.1970 UTC.
+	 * @return <code>true</code> if the hit is denied;
+	 * <br><code>false</code> otherwise
+	 */
+	bool            isDenied( QueryContext& oContext, const QString& sContent, const quint32 tNow );
+
+	/**
+	 * @brief isDeniedInternal checks a QueryHit against all hit related rules, making use of the
+	 * verdict memo of oContext.
+	 * <br><b>Locking: REQUIRES R</b>
+	 *
+	 * @param oContext  The context of the search.
+	 * @param pHit      The QueryHit to be checked.
+	 * @param tNow      The current time in seconds since 1.1.1970 UTC.
 	 * @return <code>true</code> if the hit is denied;
 	 * <br><code>false</code> otherwise
 	 */
-	bool            isDenied( const QList<QString>& lQuery, const QString& sContent );
+	bool            isDeniedInternal( QueryContext& oContext, const QueryHit* const pHit,
+									  const quint32 tNow );
 
 	/**
 	 * @brief isPrivate checks whether a given IP is located within one of the IP ranges designated
@@ -0,0 +1,299 @@
+/*
+** securitytest.cpp
+**
+** Copyright © Quazaa Development Team, 2014.
+** This file is part of the Quazaa Security Library (quazaa.sourceforge.net)
+**
+** The Quazaa Security Library is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** The Quazaa Security Library is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with the Quazaa Security Library; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include "securitytest.h"
+
+#include "debug_new.h"
+
+using namespace Security;
+
+// number of randomized rounds comparing batch range insertion with sequential insertion
+#define TEST_DIFF_ROUNDS 100
+
+// number of distinct addresses banned automatically during the ban flood
+#define TEST_FLOOD_BANS  200000
+
+// memory available to the automatic bans during the ban flood
+#define TEST_FLOOD_MEMORY ( 64 * 1024 )
+
+// number of events reported by distinct addresses to the flood detector
+#define TEST_FLOOD_EVENTS 200000
+
+void SecurityTest::queryContextTokens()
+{
+	// Positional special elements refer to the query tokens as entered. A QueryContext must see
+	// the same token positions as the legacy QList<QString> overload, including empty tokens.
+	Manager oManager;
+
+	RegularExpressionRule* pRule = new RegularExpressionRule();
+	QVERIFY( pRule->parseContent( "<2>\\.ogg" ) );
+	oManager.add( pRule, false );
+
+	const QList<QString> lQuery = QList<QString>() << "music" << "" << "jazz" << " ";
+	QueryContext oContext( lQuery );
+
+	const char* const pNames[] = { "jazz.ogg", "music.ogg", "jazz.mp3", ".ogg" };
+
+	for ( int i = 0; i < 4; ++i )
+	{
+		QueryHit* pHit = new QueryHit();
+		pHit->m_sDescriptiveName = pNames[i];
+		pHit->m_nObjectSize      = 1024 + i;
+
+		const bool bLegacy = oManager.isDenied( pHit, lQuery );
+		QCOMPARE( oManager.isDenied( oContext, pHit ), bLegacy );
+
+		// only the hit named after the token at position 2 is denied
+		QCOMPARE( bLegacy, i == 0 );
+
+		delete pHit;
+	}
+
+	oManager.clear();
+}
+
+void SecurityTest::insertRanges()
+{
+	// A range added later takes precedence over the ranges it overlaps, also within an import.
+	{
+		Manager oManager;
+
+		const char* const pRanges[] = { "10.0.0.50-10.0.0.60", "10.0.0.0/24" };
+		const RuleAction::Action pActions[] = { RuleAction::Accept, RuleAction::Deny };
+
+		Manager::ImportBatch oImport;
+		for ( int i = 0; i < 2; ++i )
+		{
+			IPRangeRule* pRule = new IPRangeRule();
+			QVERIFY( pRule->parseContent( pRanges[i] ) );
+			pRule->m_nAction = pActions[i];
+			oManager.addInternal( pRule, false, &oImport );
+		}
+		oManager.endImport( oImport );
+
+		QCOMPARE( oManager.m_vIPRanges.size(), ( size_t )1 );
+		QCOMPARE( oManager.m_vIPRanges[0]->contentString(), QString( "10.0.0.0/24" ) );
+		QCOMPARE( oManager.m_vIPRanges[0]->m_nAction, RuleAction::Deny );
+		QCOMPARE( oManager.m_vRules.size(), ( Manager::RuleVectorPos )1 );
+
+		oManager.clear();
+	}
+
+	// Differential check: Merging a batch of ranges must produce the same range index as adding
+	// them one by one in the same order.
+	for ( int nRound = 0; nRound < TEST_DIFF_ROUNDS; ++nRound )
+	{
+		RuleGenerator oGenerator( 100 + nRound );
+
+		Manager oSequential;
+		Manager oBatch;
+
+		for ( int i = 0; i < 200; ++i )
+		{
+			IPRangeRule* pRule = oGenerator.denseRangeRule();
+			oSequential.add( pRule->getCopy(), false );
+			oBatch.add( pRule, false );
+		}
+
+		std::vector<IPRangeRule*> vNew;
+		for ( int i = 0; i < 200; ++i )
+		{
+			vNew.push_back( oGenerator.denseRangeRule() );
+		}
+
+		Manager::ImportBatch oImport;
+		for ( size_t i = 0; i < vNew.size(); ++i )
+		{
+			oBatch.addInternal( vNew[i]->getCopy(), false, &oImport );
+		}
+		oBatch.endImport( oImport );
+
+		for ( size_t i = 0; i < vNew.size(); ++i )
+		{
+			oSequential.add( vNew[i], false );
+		}
+
+		const std::vector<IPRangeRule*>& vExpected = oSequential.m_vIPRanges;
+		const std::vector<IPRangeRule*>& vActual   = oBatch.m_vIPRanges;
+
+		QCOMPARE( vActual.size(), vExpected.size() );
+		QCOMPARE( oBatch.m_vRules.size(), oSequential.m_vRules.size() );
+
+		for ( size_t i = 0; i < vExpected.size(); ++i )
+		{
+			QCOMPARE( vActual[i]->startIP().toString(), vExpected[i]->startIP().toString() );
+			QCOMPARE( vActual[i]->endIP().toString(),   vExpected[i]->endIP().toString() );
+			QCOMPARE( vActual[i]->m_nAction,            vExpected[i]->m_nAction );
+			QCOMPARE( vActual[i]->expiryTime(),         vExpected[i]->expiryTime() );
+			QCOMPARE( vActual[i]->totalCount(),         vExpected[i]->totalCount() );
+			QCOMPARE( vActual[i]->m_sComment,           vExpected[i]->m_sComment );
+
+			// the rules vector must stay sorted by UUID
+			QVERIFY( oBatch.find( vActual[i]->m_idUUID ) != oBatch.m_vRules.size() );
+		}
+
+		oSequential.clear();
+		oBatch.clear();
+	}
+}
+
+void SecurityTest::banFlood()
+{
+	// Floods the automatic ban store with distinct addresses. The store must evict instead of
+	// growing, keep the bans that are still being hit and leave the manual rules untouched.
+	Manager oManager;
+	QSignalSpy oChanged( &oManager, SIGNAL( autoBansChanged() ) );
+
+	oManager.setAutoBanMemory( TEST_FLOOD_MEMORY );
+
+	RuleGenerator oGenerator( 4 );
+
+	IPRule* pManual = oGenerator.ipRule( false, RuleAction::Accept );
+	const QHostAddress oManualIP = pManual->IP();
+	oManager.add( pManual, false );
+
+	const QHostAddress oActive( "82.165.12.34" );
+	oManager.ban( oActive, RuleTime::Day, false );
+
+	const AutoBanStatistics oBefore = oManager.autoBanStatistics();
+
+	oManager.ban( oManualIP, RuleTime::Day, false );
+
+	for ( int i = 0; i < TEST_FLOOD_BANS; ++i )
+	{
+		oManager.ban( oGenerator.ipv4( false ), RuleTime::Day, false );
+
+		if ( !( i & 63 ) )
+		{
+			oManager.isDenied( EndPoint( oActive ) );
+		}
+	}
+
+	const AutoBanStatistics oAfter = oManager.autoBanStatistics();
+
+	QVERIFY( oAfter.nSize <= oAfter.nCapacity );
+	QVERIFY( oAfter.nMemory <= TEST_FLOOD_MEMORY );
+	QVERIFY( oAfter.nEvictions > oBefore.nEvictions );
+	QCOMPARE( oBefore.nSize + ( oAfter.nInsertions - oBefore.nInsertions ),
+			  oAfter.nSize + ( oAfter.nEvictions - oBefore.nEvictions ) +
+			  ( oAfter.nExpirations - oBefore.nExpirations ) );
+
+	// the regularly hit ban survives the flood
+	QVERIFY( oManager.m_oAutoBans.contains( oActive, common::getTNowUTC() ) );
+
+	// automatic bans of the same address do not modify the manual rule
+	QCOMPARE( oManager.m_vRules.size(), ( Manager::RuleVectorPos )1 );
+	QCOMPARE( oManager.m_lmIPs.size(), ( size_t )1 );
+	QCOMPARE( ( *oManager.m_lmIPs.begin() ).second->m_nAction, RuleAction::Accept );
+	QVERIFY( !( *oManager.m_lmIPs.begin() ).second->m_bAutomatic );
+
+	AutoBanVector vBans;
+	oManager.autoBans( vBans );
+	QCOMPARE( ( quint32 )vBans.size(), oAfter.nSize );
+
+	// the bans do not appear among the rules, so they are reported separately
+	QVERIFY( !oChanged.isEmpty() );
+	oChanged.clear();
+
+	// single bans can be lifted
+	QVERIFY( oManager.unban( oActive ) );
+	QVERIFY( !oManager.m_oAutoBans.contains( oActive, common::getTNowUTC() ) );
+	QVERIFY( !oManager.unban( oActive ) );
+	QCOMPARE( oManager.autoBanStatistics().nSize, oAfter.nSize - 1 );
+
+	// without a commit timer, the change is emitted with the next commit
+	QVERIFY( QMetaObject::invokeMethod( &oManager, "emitChanges" ) );
+	QCOMPARE( oChanged.count(), 1 );
+
+	oManager.clear();
+}
+
+void SecurityTest::floodDetector()
+{
+	// Events of many distinct addresses must not cause any bans by themselves, while a flooding
+	// address and a flooding network are banned once they reach their thresholds.
+	Manager oManager;
+	oManager.setFloodThreshold( FloodEvent::Connection, FloodScope::Address, 50, RuleTime::Day );
+	oManager.setFloodThreshold( FloodEvent::Connection, FloodScope::Prefix, 200, RuleTime::Day );
+
+	RuleGenerator oGenerator( 5 );
+	const QHostAddress oFlooder( "82.165.12.34" );
+
+	quint32 nBans = 0;
+	bool bFlooderBanned = false;
+
+	for ( int i = 0; i < TEST_FLOOD_EVENTS; ++i )
+	{
+		nBans += oManager.recordEvent( oGenerator.ipv4( false ), FloodEvent::Connection );
+
+		if ( !( i & 2047 ) )
+		{
+			bFlooderBanned |= oManager.recordEvent( oFlooder, FloodEvent::Connection );
+		}
+	}
+
+	QCOMPARE( nBans, ( quint32 )0 );
+	QVERIFY( bFlooderBanned );
+	QVERIFY( oManager.m_oAutoBans.contains( oFlooder, common::getTNowUTC() ) );
+	QVERIFY( oManager.m_vIPRanges.empty() );
+
+	// a manual accept range within the network must neither be split nor overridden by its ban
+	IPRangeRule* pManual = new IPRangeRule();
+	QVERIFY( pManual->parseContent( "82.166.7.64/26" ) );
+	pManual->m_nAction = RuleAction::Accept;
+	oManager.add( pManual, false );
+
+	// every address of the network reports a single event
+	const QHostAddress oNetwork( "82.166.7.0" );
+	const quint32 nNetwork = oNetwork.toIPv4Address();
+
+	for ( quint32 i = 0; i < 256; ++i )
+	{
+		oManager.recordEvent( QHostAddress( nNetwork + i ), FloodEvent::Connection );
+	}
+
+	QVERIFY( oManager.m_oNetworkBans.contains( oNetwork, common::getTNowUTC() ) );
+	QCOMPARE( oManager.m_vIPRanges.size(), ( size_t )1 );
+	QCOMPARE( oManager.m_vIPRanges[0]->contentString(), QString( "82.166.7.64/26" ) );
+	QCOMPARE( oManager.m_vIPRanges[0]->m_nAction, RuleAction::Accept );
+
+	QVERIFY( oManager.isDenied( EndPoint( QHostAddress( nNetwork + 200 ) ) ) );
+	QVERIFY( !oManager.isDenied( EndPoint( QHostAddress( nNetwork + 100 ) ) ) );
+
+	AutoBanVector vBans;
+	oManager.networkBans( vBans );
+	QCOMPARE( vBans.size(), ( size_t )1 );
+	QCOMPARE( vBans[0].oAddress, oNetwork );
+
+	// a network still flooding once its ban has been lifted is banned again, but only once
+	QVERIFY( oManager.unban( oNetwork ) );
+	QVERIFY( oManager.recordEvent( QHostAddress( nNetwork + 1 ), FloodEvent::Connection ) );
+	QVERIFY( !oManager.recordEvent( QHostAddress( nNetwork + 2 ), FloodEvent::Connection ) );
+	QVERIFY( oManager.m_oNetworkBans.contains( oNetwork, common::getTNowUTC() ) );
+
+	oManager.clear();
+}
+
+QTEST_GUILESS_MAIN( Security::SecurityTest )
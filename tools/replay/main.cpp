@@ -0,0 +1,351 @@
+/*
+** main.cpp
+**
+** Copyright © Quazaa Development Team, 2014.
+** This file is part of the Quazaa Security Library (quazaa.sourceforge.net)
+**
+** The Quazaa Security Library is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** The Quazaa Security Library is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with the Quazaa Security Library; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include <vector>
+
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+#include <QTextStream>
+
+#include "securitymanager.h"
+
+#include "debug_new.h"
+
+using namespace Security;
+
+/**
+ * @brief The Configuration struct describes a rule set and the engine settings to replay with.
+ */
+struct Configuration
+{
+	QString sRules;
+	int     nDenyPolicy;  // -1: as stored in the rule set
+	int     nDenyPrivate; // -1: default (off)
+};
+
+/**
+ * @brief The Instance struct holds an independent Manager for one configuration. Its data is kept
+ * in a temporary directory, so replaying never touches the rules of the application.
+ */
+struct Instance
+{
+	QTemporaryDir    oDataPath;
+	SecuritySettings oSettings;
+	Environment      oEnvironment;
+	Manager          oManager;
+
+	Instance() :
+		oEnvironment( &oSettings, oDataPath.path() + "/" ),
+		oManager( &oEnvironment )
+	{
+	}
+};
+
+/**
+ * @brief The Statistics struct holds the results of a replay.
+ */
+struct Statistics
+{
+	double              dSeconds;
+	quint64             pChecks[TraceEvent::NoOfTypes];
+	quint64             pDenied[TraceEvent::NoOfTypes];
+	quint32             nMissCacheHits;
+	quint32             nMissCacheMisses;
+	quint32             nVerdictCacheHits;
+	quint32             nVerdictCacheMisses;
+	std::vector<char>   vVerdicts;
+};
+
+static const char* const pTypeNames[TraceEvent::NoOfTypes] = { "address", "hit", "agent" };
+
+static QString describe( const TraceRecord& oRecord )
+{
+	switch ( oRecord.m_eType )
+	{
+	case TraceEvent::Address:
+		return QString( "address %1" ).arg( oRecord.m_oAddress.toString() );
+
+	case TraceEvent::Hit:
+		return QString( "hit \"%1\" (%2 bytes) for \"%3\""
+					  ).arg( oRecord.m_pHit->m_sDescriptiveName,
+							 QString::number( oRecord.m_pHit->m_nObjectSize ),
+							 QStringList( oRecord.m_lQuery ).join( " " ) );
+
+	default:
+		return QString( "agent \"%1\"" ).arg( oRecord.m_sAgent );
+	}
+}
+
+static bool replay( Manager& oManager, const std::vector<TraceRecord>& vRecords,
+					const Configuration& oConfig, Statistics& oStats )
+{
+	if ( !oManager.load( oConfig.sRules ) )
+	{
+		QTextStream( stderr ) << "Could not load rule set " << oConfig.sRules << "\n";
+		return false;
+	}
+
+	if ( oConfig.nDenyPolicy >= 0 )
+	{
+		oManager.setDenyPolicy( oConfig.nDenyPolicy );
+	}
+	if ( oConfig.nDenyPrivate >= 0 )
+	{
+		oManager.environment()->settings().setValues( false, oConfig.nDenyPrivate, 0 );
+	}
+
+	// start with empty caches, so hit rates are comparable between configurations
+	oManager.m_oMissCache.clear();
+	oManager.m_oMissCache.resetStatistics();
+	oManager.m_oVerdictCache.clear();
+
+	for ( int i = 0; i < TraceEvent::NoOfTypes; ++i )
+	{
+		oStats.pChecks[i] = 0;
+		oStats.pDenied[i] = 0;
+	}
+	oStats.vVerdicts.resize( vRecords.size() );
+
+	QElapsedTimer oTimer;
+	oTimer.start();
+
+	for ( size_t i = 0; i < vRecords.size(); ++i )
+	{
+		const TraceRecord& oRecord = vRecords[i];
+		bool bDenied;
+
+		switch ( oRecord.m_eType )
+		{
+		case TraceEvent::Address:
+			bDenied = oManager.isDenied( oRecord.m_oAddress );
+			break;
+
+		case TraceEvent::Hit:
+			bDenied = oManager.isDenied( oRecord.m_pHit.data(), oRecord.m_lQuery );
+			break;
+
+		default:
+			bDenied = oManager.isAgentDenied( oRecord.m_sAgent );
+		}
+
+		oStats.vVerdicts[i] = bDenied;
+		++oStats.pChecks[oRecord.m_eType];
+		oStats.pDenied[oRecord.m_eType] += bDenied;
+	}
+
+	oStats.dSeconds = oTimer.nsecsElapsed() / 1e9;
+
+	oStats.nMissCacheHits      = oManager.missCache().hits();
+	oStats.nMissCacheMisses    = oManager.missCache().misses();
+	oStats.nVerdictCacheHits   = oManager.verdictCache().hits();
+	oStats.nVerdictCacheMisses = oManager.verdictCache().misses();
+
+	return true;
+}
+
+static double ratio( quint64 nPart, quint64 nTotal )
+{
+	return nTotal ? 100.0 * nPart / nTotal : 0.0;
+}
+
+static void report( QTextStream& oOut, const QString& sName, const Statistics& oStats )
+{
+	quint64 nTotal = 0;
+	for ( int i = 0; i < TraceEvent::NoOfTypes; ++i )
+	{
+		nTotal += oStats.pChecks[i];
+	}
+
+	oOut << sName << ": " << nTotal << " checks in " << oStats.dSeconds << " s ("
+		 << ( quint64 )( oStats.dSeconds > 0 ? nTotal / oStats.dSeconds : 0 ) << " checks/s)\n";
+
+	for ( int i = 0; i < TraceEvent::NoOfTypes; ++i )
+	{
+		oOut << "  " << pTypeNames[i] << ": " << oStats.pChecks[i] << " checks, "
+			 << oStats.pDenied[i] << " denied\n";
+	}
+
+	oOut << "  miss cache hit rate: "
+		 << ratio( oStats.nMissCacheHits, oStats.nMissCacheHits + oStats.nMissCacheMisses )
+		 << " %\n  verdict cache hit rate: "
+		 << ratio( oStats.nVerdictCacheHits,
+				   oStats.nVerdictCacheHits + oStats.nVerdictCacheMisses ) << " %\n";
+}
+
+static void compare( QTextStream& oOut, const QString& sName,
+					 const std::vector<TraceRecord>& vRecords, const std::vector<char>& vFirst,
+					 const std::vector<char>& vSecond, int nShow )
+{
+	quint64 pDiffs[TraceEvent::NoOfTypes] = { 0, 0, 0 };
+	quint64 nDiffs = 0;
+
+	oOut << sName << ":\n";
+
+	for ( size_t i = 0; i < vRecords.size(); ++i )
+	{
+		if ( vFirst[i] != vSecond[i] )
+		{
+			++pDiffs[vRecords[i].m_eType];
+
+			if ( nDiffs++ < ( quint64 )nShow )
+			{
+				oOut << "  #" << i << " " << describe( vRecords[i] ) << ": "
+					 << ( vFirst[i] ? "denied" : "allowed" ) << " -> "
+					 << ( vSecond[i] ? "denied" : "allowed" ) << "\n";
+			}
+		}
+	}
+
+	oOut << "  " << nDiffs << " differences (";
+	for ( int i = 0; i < TraceEvent::NoOfTypes; ++i )
+	{
+		oOut << ( i ? ", " : "" ) << pTypeNames[i] << ": " << pDiffs[i];
+	}
+	oOut << ")\n";
+}
+
+int main( int argc, char* argv[] )
+{
+	QCoreApplication oApp( argc, argv );
+
+	QCommandLineParser oParser;
+	oParser.setApplicationDescription( "Replays a decision trace against one or two rule sets." );
+	oParser.addHelpOption();
+	oParser.addPositionalArgument( "trace", "The decision trace to replay." );
+	oParser.addPositionalArgument( "rules", "The rule set (security.dat) to replay against." );
+
+	QCommandLineOption oCompare( "compare", "Replay against this rule set as well and report "
+								 "the differing verdicts.", "rules" );
+	QCommandLineOption oDenyPolicy( "deny-policy", "Override the deny policy (0 or 1).", "0|1" );
+	QCommandLineOption oDenyPrivate( "deny-private", "Override private IP denial (0 or 1).",
+									 "0|1" );
+	QCommandLineOption oCompareDenyPolicy( "compare-deny-policy", "Deny policy of the compared "
+										   "configuration (0 or 1).", "0|1" );
+	QCommandLineOption oCompareDenyPrivate( "compare-deny-private", "Private IP denial of the "
+											"compared configuration (0 or 1).", "0|1" );
+	QCommandLineOption oShow( "show", "Number of differing verdicts to list.", "n", "10" );
+
+	oParser.addOption( oCompare );
+	oParser.addOption( oDenyPolicy );
+	oParser.addOption( oDenyPrivate );
+	oParser.addOption( oCompareDenyPolicy );
+	oParser.addOption( oCompareDenyPrivate );
+	oParser.addOption( oShow );
+	oParser.process( oApp );
+
+	const QStringList lArguments = oParser.positionalArguments();
+	if ( lArguments.size() != 2 )
+	{
+		oParser.showHelp( 1 );
+	}
+
+	QTextStream oOut( stdout );
+
+	DecisionTraceReader oReader;
+	if ( !oReader.open( lArguments.at( 0 ) ) )
+	{
+		QTextStream( stderr ) << "Could not open trace " << lArguments.at( 0 ) << "\n";
+		return 1;
+	}
+
+	// Read the entire trace first, so the replay measures the Manager and not the disk.
+	std::vector<TraceRecord> vRecords;
+	std::vector<char>        vRecorded;
+	TraceRecord oRecord;
+
+	while ( oReader.next( oRecord ) )
+	{
+		vRecords.push_back( oRecord );
+		vRecorded.push_back( oRecord.m_bDenied );
+		oRecord.m_pHit.clear();
+	}
+
+	oOut << "Trace: " << vRecords.size() << " records over "
+		 << ( vRecords.empty() ? 0 : vRecords.back().m_tOffset / 1000 ) << " s\n\n";
+
+	Configuration oFirst;
+	oFirst.sRules       = lArguments.at( 1 );
+	oFirst.nDenyPolicy  = oParser.isSet( oDenyPolicy ) ?
+							  oParser.value( oDenyPolicy ).toInt() : -1;
+	oFirst.nDenyPrivate = oParser.isSet( oDenyPrivate ) ?
+							  oParser.value( oDenyPrivate ).toInt() : -1;
+
+	const bool bCompare = oParser.isSet( oCompare ) || oParser.isSet( oCompareDenyPolicy ) ||
+						  oParser.isSet( oCompareDenyPrivate );
+
+	Configuration oSecond = oFirst;
+	if ( oParser.isSet( oCompare ) )
+	{
+		oSecond.sRules = oParser.value( oCompare );
+	}
+	if ( oParser.isSet( oCompareDenyPolicy ) )
+	{
+		oSecond.nDenyPolicy = oParser.value( oCompareDenyPolicy ).toInt();
+	}
+	if ( oParser.isSet( oCompareDenyPrivate ) )
+	{
+		oSecond.nDenyPrivate = oParser.value( oCompareDenyPrivate ).toInt();
+	}
+
+	const int nShow = oParser.value( oShow ).toInt();
+
+	Instance oInstanceA;
+	oInstanceA.oManager.start();
+
+	Statistics oFirstStats;
+	const bool bReplayed = replay( oInstanceA.oManager, vRecords, oFirst, oFirstStats );
+	oInstanceA.oManager.stop();
+
+	if ( !bReplayed )
+	{
+		return 1;
+	}
+
+	report( oOut, "Configuration A", oFirstStats );
+	compare( oOut, "Recorded -> A", vRecords, vRecorded, oFirstStats.vVerdicts, nShow );
+
+	if ( bCompare )
+	{
+		Instance oInstanceB;
+		oInstanceB.oManager.start();
+
+		Statistics oSecondStats;
+		const bool bReplayed = replay( oInstanceB.oManager, vRecords, oSecond, oSecondStats );
+		oInstanceB.oManager.stop();
+
+		if ( !bReplayed )
+		{
+			return 1;
+		}
+
+		oOut << "\n";
+		report( oOut, "Configuration B", oSecondStats );
+		compare( oOut, "A -> B", vRecords, oFirstStats.vVerdicts, oSecondStats.vVerdicts, nShow );
+	}
+
+	return 0;
+}
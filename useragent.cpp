@@ -22,61 +22,40 @@
 ** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 */
 
-#include <QDebug>
-#include <QRegularExpression>
-
 #include "useragent.h"
 
 UserAgent::UserAgent( const QString& sUserAgent ) :
-	m_sUserAgent( sUserAgent.trimmed() )
+	m_sUserAgent( sUserAgent.trimmed() ),
+	m_eStyle( Style::Unknown )
 {
-	// TODO: improve parsing to reduce the number of regular expression usages
-
-	qDebug() << "UserAgent: " << sUserAgent.toLocal8Bit().data();
-
-	const QString d = "([0-9]|[1-9][0-9]|1[0-9][0-9]|2[0-4][0-9]|25[0-5])";  // matches range 0-255
-	const QString sDefaultVersion = d + "\\." + d + "\\." + d + "\\." + d;   // matches d.d.d.d
-	const QString sAgent = ".*\\s" + sDefaultVersion;
-	const QString sAgentLibrary = sAgent + "\\s\\(" + sAgent + "\\)";
-	const QString sSimple = d + "\\." + d;
-	const QString sEMuleVersion  = sSimple + "[a-z]";
-
-	if ( QRegularExpression( "\\A" + sAgentLibrary + "\\z" ).match( sUserAgent ).hasMatch() )
+	const QString& sAgent = m_sUserAgent;
+
+	// GnucDNA style: client name + d.d.d.d + " (" + library name + d.d.d.d + ")"
+	const int nPos = sAgent.lastIndexOf( '(' );
+	if ( nPos > 0 && sAgent.endsWith( ')' ) && sAgent.at( nPos - 1 ).isSpace() &&
+		 split( sAgent.left( nPos - 1 ), Style::QuazaaDefault, true,
+				m_sClientName, m_oClientVersion ) &&
+		 split( sAgent.mid( nPos + 1, sAgent.size() - nPos - 2 ), Style::QuazaaDefault, true,
+				m_sLibraryName, m_oLibraryVersion ) )
 	{
 		m_eStyle = Style::GnucDNA;
-
-		qDebug() << "Seems to be GnucDNA style.";
-
-		int nPos      = sUserAgent.lastIndexOf( '(' );
-		parse( sUserAgent.left( nPos ),
-			   Style::QuazaaDefault, m_sClientName,  m_oClientVersion  );
-
-		parse( sUserAgent.mid( nPos + 1, sUserAgent.size() - nPos - 2 ),
-			   Style::QuazaaDefault, m_sLibraryName, m_oLibraryVersion );
 	}
-	else if ( QRegularExpression( "\\A" + sAgent ).match( sUserAgent ).hasMatch() )
+	else if ( split( sAgent, Style::QuazaaDefault, false, m_sClientName, m_oClientVersion ) )
 	{
 		m_eStyle = Style::QuazaaDefault;
-		qDebug() << "Seems to be Default style.";
-		parse( sUserAgent, Style::QuazaaDefault, m_sClientName,  m_oClientVersion  );
 	}
-	else if ( QRegularExpression( "\\A.*\\s" + sEMuleVersion ).match( sUserAgent ).hasMatch() )
+	else if ( split( sAgent, Style::eMule,         false, m_sClientName, m_oClientVersion ) )
 	{
 		m_eStyle = Style::eMule;
-		qDebug() << "Seems to be eMule style.";
-		parse( sUserAgent, Style::eMule, m_sClientName,  m_oClientVersion  );
 	}
-	else if ( QRegularExpression( "\\A.*\\s" + sSimple ).match( sUserAgent ).hasMatch() )
+	else if ( split( sAgent, Style::Simple,        false, m_sClientName, m_oClientVersion ) )
 	{
 		m_eStyle = Style::Simple;
-		qDebug() << "Seems to be Simple style.";
-		parse( sUserAgent, Style::Simple, m_sClientName,  m_oClientVersion  );
 	}
 	else
 	{
-		m_eStyle = Style::Unknown;
-		qDebug() << "Unknown style.";
-		m_sClientName = sUserAgent.trimmed();
+		m_sClientName    = sAgent;
+		m_oClientVersion = ClientVersion();
 	}
 }
 
@@ -115,42 +94,7 @@ bool UserAgent::operator!=(const UserAgent& other)
 void UserAgent::parse( const QString& sWhat, const UserAgent::Style eHow,
 					   QString& sNameDest, ClientVersion& rClientDest )
 {
-	const QString d = "([0-9]|[1-9][0-9]|1[0-9][0-9]|2[0-4][0-9]|25[0-5])";  // matches range 0-255
-	const QString sDefaultVersion = d + "\\." + d + "\\." + d + "\\." + d;   // matches d.d.d.d
-
-	const QString sSimple = d + "\\." + d;
-	const QString sEMuleVersion  = sSimple + "[a-z]";
-
-	switch ( eHow )
-	{
-	case Style::QuazaaDefault:
-	{
-		int nPos    = sWhat.lastIndexOf( QRegularExpression( sDefaultVersion ) );
-		sNameDest   = sWhat.left( nPos ).trimmed();
-		rClientDest = ClientVersion( sWhat.mid( nPos ), ClientVersion::Style::QuazaaDefault );
-		break;
-	}
-
-	case Style::eMule:
-	{
-		int nPos    = sWhat.lastIndexOf( QRegularExpression( sEMuleVersion ) );
-		sNameDest   = sWhat.left( nPos ).trimmed();
-		rClientDest = ClientVersion( sWhat.mid( nPos ), ClientVersion::Style::eMule );
-		break;
-	}
-
-	case Style::Simple:
-	{
-		int nPos    = sWhat.lastIndexOf( QRegularExpression( sSimple ) );
-		sNameDest   = sWhat.left( nPos ).trimmed();
-		rClientDest = ClientVersion( sWhat.mid( nPos ), ClientVersion::Style::Simple );
-		break;
-	}
-
-	default:
-		// do nothing
-		break;
-	}
+	split( sWhat, eHow, false, sNameDest, rClientDest );
 }
 
 QString UserAgent::userAgentString() const
@@ -177,3 +121,58 @@ ClientVersion UserAgent::libraryVersion() const
 {
 	return m_oLibraryVersion;
 }
+
+bool UserAgent::split( const QString& sWhat, const UserAgent::Style eHow, bool bAnchored,
+					   QString& sNameDest, ClientVersion& rClientDest )
+{
+	ClientVersion::Style eVersionStyle;
+
+	switch ( eHow )
+	{
+	case Style::QuazaaDefault:
+		eVersionStyle = ClientVersion::Style::QuazaaDefault;
+		break;
+
+	case Style::eMule:
+		eVersionStyle = ClientVersion::Style::eMule;
+		break;
+
+	case Style::Simple:
+		eVersionStyle = ClientVersion::Style::Simple;
+		break;
+
+	default:
+		return false;
+	}
+
+	const int nSize = sWhat.size();
+	quint32 nVersion;
+
+	// Walk backwards over the string and try each whitespace as version separator. Versions are
+	// short and start with a digit, so this touches every character only a bounded number of times.
+	for ( int nPos = nSize - 2; nPos >= 0; --nPos )
+	{
+		if ( !sWhat.at( nPos ).isSpace() )
+		{
+			continue;
+		}
+
+		const ushort c = sWhat.at( nPos + 1 ).unicode();
+		if ( c < '0' || c > '9' )
+		{
+			continue;
+		}
+
+		const int nEnd = ClientVersion::scan( sWhat, nPos + 1, eVersionStyle, nVersion );
+
+		if ( nEnd != -1 && ( !bAnchored || nEnd == nSize ) )
+		{
+			sNameDest   = sWhat.left( nPos ).trimmed();
+			rClientDest = ClientVersion( eVersionStyle, nVersion,
+										 sWhat.mid( nPos + 1, nEnd - nPos - 1 ) );
+			return true;
+		}
+	}
+
+	return false;
+}
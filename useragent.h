@@ -72,6 +72,22 @@ public:
 	ClientVersion clientVersion() const;
 	QString libraryName() const;
 	ClientVersion libraryVersion() const;
+
+private:
+	/**
+	 * @brief split separates a client name from the version following it. The version must be
+	 * preceded by a whitespace. If there are multiple candidates, the last one is used.
+	 *
+	 * @param sWhat        The string to split.
+	 * @param eHow         The expected style of the version.
+	 * @param bAnchored    If <code>true</code>, the version must end at the end of sWhat.
+	 * @param sNameDest    Set to the client name on success.
+	 * @param rClientDest  Set to the client version on success.
+	 * @return <code>true</code> if a version of the requested style could be found;
+	 * <br><code>false</code> otherwise
+	 */
+	static bool split( const QString& sWhat, const Style eHow, bool bAnchored,
+					   QString& sNameDest, ClientVersion& rClientDest );
 };
 
 #endif // USERAGENT_H
@@ -0,0 +1,165 @@
+/*
+** verdictcache.cpp
+**
+** Copyright © Quazaa Development Team, 2014.
+** This file is part of the Quazaa Security Library (quazaa.sourceforge.net)
+**
+** The Quazaa Security Library is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** The Quazaa Security Library is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with the Quazaa Security Library; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#include "verdictcache.h"
+#include "securerule.h"
+
+#include "debug_new.h"
+
+using namespace Security;
+
+VerdictCache::Stripe::Stripe() :
+	m_nUsed( 0 ),
+	m_nHand( 0 )
+{
+	m_lhIndex.reserve( SECURITY_VERDICT_CACHE_STRIPE_SIZE );
+}
+
+VerdictCache::VerdictCache() :
+	m_nHits( 0 ),
+	m_nMisses( 0 )
+{
+}
+
+bool VerdictCache::lookup( const QByteArray& baKey, int nGeneration, quint32 tNow,
+						   bool& bDenied )
+{
+	Stripe& oStripe = stripe( baKey );
+
+	oStripe.m_oSection.lock();
+
+	VerdictIndex::const_iterator it = oStripe.m_lhIndex.find( baKey );
+
+	if ( it != oStripe.m_lhIndex.end() )
+	{
+		Verdict& oVerdict = oStripe.m_pVerdicts[it.value()];
+
+		// Outdated verdicts are left in place: the caller is going to overwrite them anyway.
+		if ( oVerdict.nGeneration == nGeneration &&
+			 ( oVerdict.tExpire <= RuleTime::Session || oVerdict.tExpire >= tNow ) )
+		{
+			oVerdict.bReferenced = true;
+			bDenied = oVerdict.bDenied;
+			oStripe.m_oSection.unlock();
+
+			m_nHits.ref();
+			return true;
+		}
+	}
+
+	oStripe.m_oSection.unlock();
+
+	m_nMisses.ref();
+	return false;
+}
+
+void VerdictCache::insert( const QByteArray& baKey, int nGeneration, quint32 tExpire,
+						   bool bDenied )
+{
+	Stripe& oStripe = stripe( baKey );
+
+	QMutexLocker oLock( &oStripe.m_oSection );
+
+	VerdictIndex::const_iterator it = oStripe.m_lhIndex.find( baKey );
+	int nSlot;
+
+	if ( it != oStripe.m_lhIndex.end() )
+	{
+		nSlot = it.value();
+	}
+	else if ( oStripe.m_nUsed < SECURITY_VERDICT_CACHE_STRIPE_SIZE )
+	{
+		nSlot = oStripe.m_nUsed++;
+		oStripe.m_lhIndex.insert( baKey, nSlot );
+	}
+	else
+	{
+		// CLOCK: give referenced verdicts a second chance, evict the first one that is either
+		// unreferenced or has been determined for an older rule generation.
+		while ( oStripe.m_pVerdicts[oStripe.m_nHand].bReferenced &&
+				oStripe.m_pVerdicts[oStripe.m_nHand].nGeneration == nGeneration )
+		{
+			oStripe.m_pVerdicts[oStripe.m_nHand].bReferenced = false;
+			oStripe.m_nHand = ( oStripe.m_nHand + 1 ) % SECURITY_VERDICT_CACHE_STRIPE_SIZE;
+		}
+
+		nSlot = oStripe.m_nHand;
+		oStripe.m_nHand = ( oStripe.m_nHand + 1 ) % SECURITY_VERDICT_CACHE_STRIPE_SIZE;
+
+		oStripe.m_lhIndex.remove( oStripe.m_pVerdicts[nSlot].baKey );
+		oStripe.m_lhIndex.insert( baKey, nSlot );
+	}
+
+	Verdict& oVerdict = oStripe.m_pVerdicts[nSlot];
+	oVerdict.baKey       = baKey;
+	oVerdict.nGeneration = nGeneration;
+	oVerdict.tExpire     = tExpire;
+	oVerdict.bDenied     = bDenied;
+	oVerdict.bReferenced = false;
+}
+
+void VerdictCache::clear()
+{
+	for ( int i = 0; i < SECURITY_VERDICT_CACHE_STRIPES; ++i )
+	{
+		Stripe& oStripe = m_pStripes[i];
+		QMutexLocker oLock( &oStripe.m_oSection );
+
+		for ( int n = 0; n < oStripe.m_nUsed; ++n )
+		{
+			oStripe.m_pVerdicts[n].baKey.clear();
+		}
+
+		oStripe.m_lhIndex.clear();
+		oStripe.m_nUsed = 0;
+		oStripe.m_nHand = 0;
+	}
+
+	m_nHits.store( 0 );
+	m_nMisses.store( 0 );
+}
+
+quint32 VerdictCache::hits() const
+{
+	return m_nHits.load();
+}
+
+quint32 VerdictCache::misses() const
+{
+	return m_nMisses.load();
+}
+
+double VerdictCache::hitRate() const
+{
+	const quint32 nHits  = hits();
+	const quint32 nTotal = nHits + misses();
+
+	return nTotal ? ( double )nHits / nTotal : 0.0;
+}
+
+VerdictCache::Stripe& VerdictCache::stripe( const QByteArray& baKey )
+{
+	return m_pStripes[qHash( baKey ) % SECURITY_VERDICT_CACHE_STRIPES];
+}
@@ -0,0 +1,159 @@
+/*
+** verdictcache.h
+**
+** Copyright © Quazaa Development Team, 2014.
+** This file is part of the Quazaa Security Library (quazaa.sourceforge.net)
+**
+** The Quazaa Security Library is free software; this file may be used under the terms of the GNU
+** General Public License version 3.0 or later as published by the Free Software
+** Foundation and appearing in the file LICENSE.GPL included in the
+** packaging of this file.
+**
+** The Quazaa Security Library is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+**
+** Please review the following information to ensure the GNU General Public
+** License version 3.0 requirements will be met:
+** http://www.gnu.org/copyleft/gpl.html.
+**
+** You should have received a copy of the GNU General Public License version
+** 3.0 along with the Quazaa Security Library; if not, write to the Free Software Foundation,
+** Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+
+#ifndef VERDICTCACHE_H
+#define VERDICTCACHE_H
+
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QHash>
+#include <QMutex>
+
+// number of independently locked parts of the verdict cache
+#define SECURITY_VERDICT_CACHE_STRIPES 16
+
+// maximum number of verdicts stored per stripe
+#define SECURITY_VERDICT_CACHE_STRIPE_SIZE 256
+
+namespace Security
+{
+
+/**
+ * @brief The VerdictCache class stores the query independent verdicts (hash, hash list and content
+ * rules) of recently checked files, so the same file returned by many hosts is evaluated only once
+ * per rule set generation. Access is distributed over several independently locked stripes to keep
+ * contention between search threads low.
+ *
+ * Each stripe holds a fixed number of slots that are recycled in CLOCK order: lookups mark a slot
+ * as referenced and the clock hand evicts the first unreferenced (or outdated) verdict it passes.
+ */
+class VerdictCache
+{
+#ifndef QUAZAA_SETUP_UNIT_TESTS
+private:
+#else
+public:
+#endif
+	struct Verdict
+	{
+		QByteArray  baKey;
+		int         nGeneration;
+		quint32     tExpire;        // expiry time of the deciding rule; Forever if none
+		bool        bDenied;
+		bool        bReferenced;    // CLOCK reference bit
+	};
+
+	typedef QHash< QByteArray, int > VerdictIndex;
+
+	struct Stripe
+	{
+		QMutex          m_oSection;
+		VerdictIndex    m_lhIndex;      // slot by key
+		Verdict         m_pVerdicts[SECURITY_VERDICT_CACHE_STRIPE_SIZE];
+		int             m_nUsed;
+		int             m_nHand;        // CLOCK hand
+
+		Stripe();
+	};
+
+	Stripe          m_pStripes[SECURITY_VERDICT_CACHE_STRIPES];
+
+	QAtomicInt      m_nHits;
+	QAtomicInt      m_nMisses;
+
+public:
+	/**
+	 * @brief VerdictCache constructs an empty cache.
+	 */
+	VerdictCache();
+
+	/**
+	 * @brief lookup retrieves a cached verdict.
+	 * <br><b>Locking: /</b> (locks the stripe of baKey internally)
+	 *
+	 * @param baKey        The file key as returned by QueryContext::hitKey().
+	 * @param nGeneration  The current rule generation of the Manager.
+	 * @param tNow         The current time in sec since 1970-01-01 UTC.
+	 * @param bDenied      Set to the cached verdict if one could be found.
+	 * @return <code>true</code> if a verdict valid for nGeneration whose deciding rule has not
+	 * expired yet was found; <br><code>false</code> otherwise
+	 */
+	bool            lookup( const QByteArray& baKey, int nGeneration, quint32 tNow,
+							bool& bDenied );
+
+	/**
+	 * @brief insert caches a verdict. If the stripe responsible for baKey is full, the clock hand
+	 * evicts the first verdict that has not been looked up since it last passed.
+	 * <br><b>Locking: /</b> (locks the stripe of baKey internally)
+	 *
+	 * @param baKey        The file key as returned by QueryContext::hitKey().
+	 * @param nGeneration  The rule generation the verdict has been determined with.
+	 * @param tExpire      The expiry time of the rule the verdict is based on; RuleTime::Forever
+	 * if the verdict does not depend on a rule with an expiry time.
+	 * @param bDenied      The verdict.
+	 */
+	void            insert( const QByteArray& baKey, int nGeneration, quint32 tExpire,
+							bool bDenied );
+
+	/**
+	 * @brief clear removes all verdicts and resets the statistics.
+	 * <br><b>Locking: /</b> (locks the stripes one by one internally)
+	 */
+	void            clear();
+
+	/**
+	 * @brief hits allows to access the number of successful lookups.
+	 * <br><b>Locking: /</b>
+	 *
+	 * @return the number of lookups that returned a verdict
+	 */
+	quint32         hits() const;
+
+	/**
+	 * @brief misses allows to access the number of failed lookups.
+	 * <br><b>Locking: /</b>
+	 *
+	 * @return the number of lookups that did not return a verdict
+	 */
+	quint32         misses() const;
+
+	/**
+	 * @brief hitRate allows to access the ratio of successful lookups.
+	 * <br><b>Locking: /</b>
+	 *
+	 * @return hits() / ( hits() + misses() ); 0 if there have not been any lookups yet
+	 */
+	double          hitRate() const;
+
+private:
+	/**
+	 * @brief stripe returns the stripe responsible for a key.
+	 */
+	Stripe&         stripe( const QByteArray& baKey );
+};
+
+}
+
+#endif // VERDICTCACHE_H